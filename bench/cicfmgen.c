@@ -0,0 +1,235 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*  Generate a reproducible CSV file shaped like the CIC flow meter data: the
+    88 columns of cicfm_rbaspec, a label mix close to the CIC-DDoS2019 one,
+    and float columns with integers, decimals, zeros, Infinity, NaN and empty
+    cells.
+
+    cicfmgen [-s <seed>] [-d <percent>] <rows> <output CSV>
+
+    -d repeats a previous row for about <percent> of the rows, to exercise
+    duplicate elimination. The same seed always gives the same file. */
+
+#include <time.h>
+#include <unistd.h>
+
+#include <rba.h>
+#include <cicfm.h>
+
+/*  label weights in 1/1000 */
+static const uint32_t label_weights[CICFM_LABEL_COUNT] = {  50,     /* BENIGN */
+                                                            100,    /* DrDoS_DNS */
+                                                            80,     /* DrDoS_MSSQL */
+                                                            20,     /* DrDoS_NTP */
+                                                            50,     /* DrDoS_SSDP */
+                                                            30,     /* Syn */
+                                                            10,     /* UDP-lag */
+                                                            1,      /* WebDDoS */
+                                                            40,     /* DrDoS_LDAP */
+                                                            80,     /* DrDoS_NetBIOS */
+                                                            100,    /* DrDoS_SNMP */
+                                                            60,     /* DrDoS_UDP */
+                                                            379 };  /* TFTP */
+
+#define MAXLINE (8192)
+
+static uint64_t
+next_random (uint64_t *state)
+{
+    /*  splitmix64 */
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int
+float_cell (uint64_t    *state,
+            char        *cell,
+            size_t      len)
+{
+    uint64_t r = next_random (state);
+    uint32_t kind = (uint32_t)(r % 100);
+
+    r >>= 8;
+    if (kind < 35) {
+        return snprintf (cell, len, "0");
+    } else if (kind < 65) {
+        return snprintf (cell, len, "%u", (unsigned)(r % 1000000));
+    } else if (kind < 96) {
+        return snprintf (cell, len, "%u.%03u", (unsigned)(r % 100000), (unsigned)((r >> 20) % 1000));
+    } else if (kind < 98) {
+        return snprintf (cell, len, "Infinity");
+    } else if (kind < 99) {
+        return snprintf (cell, len, "NaN");
+    } else {
+        cell[0] = '\0';
+        return 0;
+    }
+}
+
+static uint32_t
+pick_label (uint64_t *state)
+{
+    uint32_t l, r = (uint32_t)(next_random (state) % 1000);
+
+    for (l = 0; (l < CICFM_LABEL_COUNT - 1) && (r >= label_weights[l]); l++) {
+        r -= label_weights[l];
+    }
+
+    return l;
+}
+
+static size_t
+gen_line (  uint64_t    *state,
+            uint64_t    row,
+            int64_t     *usec,
+            char        *line)
+{
+    size_t len = 0;
+    uint32_t c;
+    uint32_t src = 1 + (uint32_t)(next_random (state) % 254);
+    uint32_t sport = 1024 + (uint32_t)(next_random (state) % 64511);
+    uint32_t dport = (uint32_t)(next_random (state) % 1024);
+    uint32_t proto = (uint32_t[]){ 0, 6, 17 }[next_random (state) % 3];
+    time_t secs;
+    struct tm tm;
+    rba_type_t *type;
+    const char *name;
+
+    *usec += (int64_t)(next_random (state) % 200000);
+    secs = (time_t)(*usec / 1000000);
+    gmtime_r (&secs, &tm);
+
+    for (c = 0; c < cicfm_cols; c++) {
+        type = cicfm_rbaspec[c].type;
+        name = cicfm_rbaspec[c].name;
+        if (0 != c) {
+            line[len++] = ',';
+        }
+        if (0 == strcmp (name, "Unnamed: 0")) {
+            len += snprintf (line + len, MAXLINE - len, "%llu", (unsigned long long)row);
+        } else if (0 == strcmp (name, "Flow ID")) {
+            len += snprintf (line + len, MAXLINE - len, "172.16.0.%u-192.168.50.1-%u-%u-%u", (unsigned)src, (unsigned)sport, (unsigned)dport, (unsigned)proto);
+        } else if (0 == strcmp (name, "Source IP")) {
+            len += snprintf (line + len, MAXLINE - len, "172.16.0.%u", (unsigned)src);
+        } else if (0 == strcmp (name, "Destination IP")) {
+            len += snprintf (line + len, MAXLINE - len, "192.168.50.1");
+        } else if (0 == strcmp (name, "Source Port")) {
+            len += snprintf (line + len, MAXLINE - len, "%u", (unsigned)sport);
+        } else if (0 == strcmp (name, "Destination Port")) {
+            len += snprintf (line + len, MAXLINE - len, "%u", (unsigned)dport);
+        } else if (0 == strcmp (name, "Protocol")) {
+            len += snprintf (line + len, MAXLINE - len, "%u", (unsigned)proto);
+        } else if (&rba_type_timestamp == type) {
+            len += strftime (line + len, MAXLINE - len, "%Y-%m-%d %H:%M:%S", &tm);
+            len += snprintf (line + len, MAXLINE - len, ".%06u", (unsigned)(*usec % 1000000));
+        } else if (&rba_type_cicfm_label == type) {
+            len += snprintf (line + len, MAXLINE - len, "%s", cicfm_labels[pick_label (state)]);
+        } else if (&rba_type_float == type) {
+            len += float_cell (state, line + len, MAXLINE - len);
+        } else {
+            line[len++] = '0';
+        }
+    }
+    line[len++] = '\n';
+
+    return len;
+}
+
+int main (int argc, char **argv)
+{
+    int ret = 0;
+
+    uint64_t seed = 1, dups = 0, rows, row, state;
+    int64_t usec;
+    uint32_t c;
+    char *line, *prev;
+    size_t len, prevlen;
+    FILE *filep;
+    int opt;
+
+    while ((0 == ret) && (-1 != (opt = getopt (argc, argv, "s:d:")))) {
+        switch (opt) {
+            case 's':
+                ret = strtouint64 (optarg, &seed);
+                break;
+            case 'd':
+                ret = strtouint64 (optarg, &dups);
+                break;
+            default:
+                ret = -1;
+                break;
+        }
+    }
+
+    if ((0 != ret) || (argc - optind != 2) || (0 != strtouint64 (argv[optind], &rows))) {
+        fprintf (stderr, "%s [-s <seed>] [-d <percent>] <rows> <output CSV>\n", argv[0]);
+        return -1;
+    }
+
+    filep = fopen (argv[optind + 1], "w");
+    line = (char*)malloc (MAXLINE);
+    prev = (char*)malloc (MAXLINE);
+    if ((NULL == filep) || (NULL == line) || (NULL == prev)) {
+        RBA_ERR("Failed to open %s\n", argv[optind + 1]);
+        return -1;
+    }
+
+    for (c = 0; c < cicfm_cols; c++) {
+        fprintf (filep, "%s%s", (0 != c) ? ", " : "", cicfm_rbaspec[c].name);
+    }
+    fprintf (filep, "\n");
+
+    state = seed;
+    usec = INT64_C(1543658400000000); /* 2018-12-01 10:00:00 */
+    prevlen = 0;
+    for (row = 0; (row < rows) && (0 == ret); row++) {
+        if ((0 != prevlen) && ((next_random (&state) % 100) < dups)) {
+            ret = (1 == fwrite (prev, prevlen, 1, filep)) ? 0 : -1;
+        } else {
+            len = gen_line (&state, row, &usec, line);
+            ret = (1 == fwrite (line, len, 1, filep)) ? 0 : -1;
+            memcpy (prev, line, len);
+            prevlen = len;
+        }
+    }
+
+    if ((0 != fclose (filep)) || (0 != ret)) {
+        RBA_ERR("Failed to write %s\n", argv[optind + 1]);
+        ret = -1;
+    }
+    free (line);
+    free (prev);
+
+    return ret;
+}
@@ -0,0 +1,464 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*  Microbenchmarks of the conversion stages and an end-to-end throughput
+    sweep, printing one JSON object per result line on stdout.
+
+    rbabench [-r <rounds>] micro <workdir> <CSV>
+    rbabench [-p <partitions>] [-x <repetitions>] sweep <workdir> <CSV1> [<CSV2> ...]
+
+    micro times the tokenizer, strtodouble, strtouint64 against
+    rba_parse_decimal_u64, the label lookup, the partition picker and buffer
+    flushes on the records of <CSV>. sweep converts each CSV for every
+    combination of the comma separated partition and repetition counts
+    (default 1,4,16,64 and 1,2,4). Output files are written to <workdir>,
+    which is created and removed again. Progress messages of the library are
+    dropped so that stdout only carries results. */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <rba.h>
+#include <cicfm.h>
+
+#define MAXLINES (200000)
+#define MAXLIST (32)
+
+static FILE *results;
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static void
+report (const char  *bench,
+        const char  *params,
+        uint64_t    items,
+        double      seconds)
+{
+    fprintf (results, "{\"bench\":\"%s\",%s%s\"items\":%llu,\"seconds\":%.6f,\"items_per_sec\":%.1f,\"ns_per_item\":%.2f}\n",
+            bench, params, ('\0' != params[0]) ? "," : "",
+            (unsigned long long)items, seconds,
+            (double)items / seconds, 1e9 * seconds / (double)items);
+    fflush (results);
+}
+
+static int
+remove_entry (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove (path);
+}
+
+static void
+remove_tree (const char *path)
+{
+    nftw (path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int
+parse_list (const char  *list,
+            uint64_t    *values,
+            uint32_t    *count_p)
+{
+    int ret = 0;
+
+    char *copy, *iterator, *tok;
+
+    *count_p = 0;
+    copy = strdup (list);
+    if (NULL == copy) {
+        return -1;
+    }
+    for_each_csvtoken(copy, iterator, tok) {
+        if ((0 != ret) || (*count_p == MAXLIST) ||
+                (0 != strtouint64 (tok, &(values[*count_p]))) || (0 == values[*count_p])) {
+            ret = -1;
+        } else {
+            (*count_p)++;
+        }
+    }
+    free (copy);
+
+    return ret;
+}
+
+/*  read up to MAXLINES records of a CSV file into one buffer */
+static int
+load_lines (const char  *filename,
+            char        **text_p,
+            char        ***lines_p,
+            uint64_t    *count_p)
+{
+    int ret;
+
+    FILE *filep;
+    struct stat st;
+    char *text, **lines;
+    uint64_t count = 0;
+    size_t len, i;
+
+    filep = fopen (filename, "rb");
+    if ((NULL == filep) || (0 != fstat (fileno (filep), &st))) {
+        RBA_ERR("Failed to open %s\n", filename);
+        return -1;
+    }
+
+    text = (char*)malloc ((size_t)st.st_size + 1);
+    lines = (char**)malloc (MAXLINES * sizeof(char*));
+    if ((NULL == text) || (NULL == lines) ||
+            ((size_t)st.st_size != fread (text, 1, (size_t)st.st_size, filep))) {
+        RBA_ERR("Failed to read %s\n", filename);
+        ret = -1;
+    } else {
+        len = (size_t)st.st_size;
+        text[len] = '\0';
+        /*  skip the header, split the records */
+        for (i = 0; (i < len) && ('\n' != text[i]); i++);
+        for (i++; (i < len) && (count < MAXLINES); ) {
+            lines[count++] = text + i;
+            for (; (i < len) && ('\n' != text[i]); i++);
+            text[i++] = '\0';
+        }
+        ret = (0 == count) ? -1 : 0;
+    }
+    fclose (filep);
+
+    *text_p = text;
+    *lines_p = lines;
+    *count_p = count;
+
+    return ret;
+}
+
+static int
+bench_micro (   const char  *workdir,
+                const char  *csvname,
+                uint64_t    rounds)
+{
+    int ret;
+
+    char *text, **lines, *scratch, *iterator, *token;
+    char params[256], path[4096];
+    uint64_t count, r, i, items, p, c;
+    uint32_t col, class, labelcol = 0;
+    double start, elapsed, value;
+    const char **floats, **labels, **ints;
+    uint64_t nfloats = 0, nints = 0, u64;
+    size_t maxlen = 0;
+    volatile double sink = 0;
+    rba_spec_entry_t pickspec[1] = { { "Unnamed: 0", &rba_type_ignore } };
+    char pickline[] = "0";
+    rba_data_t data;
+    rba_buf_t buf;
+    static const uint64_t partitions[] = { 4, 64, 1024 };
+    uint32_t flags;
+
+    ret = load_lines (csvname, &text, &lines, &count);
+    if (0 != ret) {
+        return ret;
+    }
+    for (i = 0; i < count; i++) {
+        maxlen = (strlen (lines[i]) > maxlen) ? strlen (lines[i]) : maxlen;
+    }
+    for (labelcol = 0; (labelcol < cicfm_cols) && (&rba_type_cicfm_label != cicfm_rbaspec[labelcol].type); labelcol++);
+
+    /*  tokenizer, on a copy of each line since strsep modifies it */
+    scratch = (char*)malloc (maxlen + 1);
+    floats = (const char**)malloc (count * cicfm_cols * sizeof(char*));
+    labels = (const char**)malloc (count * sizeof(char*));
+    ints = (const char**)malloc (count * cicfm_cols * sizeof(char*));
+    if ((NULL == scratch) || (NULL == floats) || (NULL == labels) || (NULL == ints)) {
+        return -1;
+    }
+    for (r = 0, items = 0, elapsed = 0; r < rounds; r++) {
+        start = now ();
+        for (i = 0; i < count; i++) {
+            strcpy (scratch, lines[i]);
+            for_each_csvtoken(scratch, iterator, token) {
+                token = rba_strtrim (token);
+                items++;
+            }
+        }
+        elapsed += now () - start;
+    }
+    report ("tokenize", "", items, elapsed);
+
+    /*  collect the non-empty float fields and the label fields, tokenizing
+        in place */
+    for (i = 0; i < count; i++) {
+        col = 0;
+        for_each_csvtoken(lines[i], iterator, token) {
+            token = rba_strtrim (token);
+            if ((col < cicfm_cols) && (&rba_type_float == cicfm_rbaspec[col].type) && ('\0' != token[0])) {
+                floats[nfloats++] = token;
+                if (strspn (token, "0123456789") == strlen (token)) {
+                    ints[nints++] = token;
+                }
+            } else if (col == labelcol) {
+                labels[i] = token;
+            }
+            col++;
+        }
+    }
+
+    for (r = 0, elapsed = 0; r < rounds; r++) {
+        start = now ();
+        for (i = 0; i < nfloats; i++) {
+            if (0 == strtodouble (floats[i], &value)) {
+                sink += value;
+            }
+        }
+        elapsed += now () - start;
+    }
+    report ("strtodouble", "", rounds * nfloats, elapsed);
+
+    /*  the fields holding plain integers, through the old and new parser */
+    for (r = 0, elapsed = 0; r < rounds; r++) {
+        start = now ();
+        for (i = 0; i < nints; i++) {
+            if (0 == strtouint64 (ints[i], &u64)) {
+                sink += (double)u64;
+            }
+        }
+        elapsed += now () - start;
+    }
+    report ("strtouint64", "", rounds * nints, elapsed);
+
+    for (r = 0, elapsed = 0; r < rounds; r++) {
+        start = now ();
+        for (i = 0; i < nints; i++) {
+            if (0 == rba_parse_decimal_u64 (ints[i], UINT64_MAX, &u64)) {
+                sink += (double)u64;
+            }
+        }
+        elapsed += now () - start;
+    }
+    report ("parse_decimal", "", rounds * nints, elapsed);
+
+    for (r = 0, elapsed = 0; r < rounds; r++) {
+        start = now ();
+        for (i = 0; i < count; i++) {
+            rba_type_cicfm_classify (&rba_type_cicfm_label, labels[i], &class);
+            sink += class;
+        }
+        elapsed += now () - start;
+    }
+    report ("label_lookup", "", rounds * count, elapsed);
+
+    /*  the partition picker, through a data set with a single ignored
+        column so that parsing a record is little more than picking its
+        partitions */
+    for (p = 0; (p < sizeof(partitions) / sizeof(partitions[0])) && (0 == ret); p++) {
+        for (flags = 0; (flags <= RBA_DATA_STREAM) && (0 == ret); flags += RBA_DATA_STREAM) {
+            snprintf (path, sizeof(path), "%s/pick", workdir);
+            ret = rba_data_alloc (&data, pickspec, 1, path, (uint32_t)partitions[p], 1, rounds * count, flags, NULL);
+            if (0 == ret) {
+                start = now ();
+                for (i = 0; (i < rounds * count) && (0 == ret); i++) {
+                    ret = rba_data_parse_line (&data, pickline);
+                }
+                elapsed = now () - start;
+                rba_data_free (&data);
+                snprintf (params, sizeof(params), "\"partitions\":%llu,\"stream\":%s", (unsigned long long)partitions[p], (0 != flags) ? "true" : "false");
+                report ("pick_partitions", params, rounds * count, elapsed);
+            }
+            remove_tree (path);
+        }
+    }
+
+    /*  flushing full buffers of floats, plain and packed */
+    for (flags = 0; (flags <= RBA_DATA_PACKED) && (0 == ret); flags += RBA_DATA_PACKED) {
+        snprintf (path, sizeof(path), "%s/flush.bin", workdir);
+        ret = rba_buf_alloc (&rba_type_float, path, flags, &buf);
+        if (0 == ret) {
+            for (i = 0; i < buf.len; i++) {
+                ((float*)buf.arr)[i] = (float)(i % 1000) * 0.5f;
+            }
+            c = 16 * rounds;
+            start = now ();
+            for (i = 0; (i < c) && (0 == ret); i++) {
+                buf.idx = buf.len;
+                ret = rba_buf_simple_flush (&buf);
+            }
+            elapsed = now () - start;
+            rba_buf_simple_free (&rba_type_float, &buf);
+            snprintf (params, sizeof(params), "\"packed\":%s,\"bytes\":%llu", (0 != flags) ? "true" : "false", (unsigned long long)(c * RBA_BUF_DEFAULTLEN * sizeof(float)));
+            report ("flush", params, c * RBA_BUF_DEFAULTLEN, elapsed);
+        }
+        remove (path);
+    }
+
+    free (scratch);
+    free (floats);
+    free (ints);
+    free (labels);
+    free (lines);
+    free (text);
+
+    return ret;
+}
+
+static int
+bench_sweep (   const char      *workdir,
+                const char      **csvnames,
+                int             csvcount,
+                const uint64_t  *partitions,
+                uint32_t        npartitions,
+                const uint64_t  *repetitions,
+                uint32_t        nrepetitions)
+{
+    int ret = 0;
+
+    char params[1024], path[4096];
+    struct stat st;
+    rba_data_t data;
+    uint64_t records;
+    uint32_t p, r;
+    int csv_idx;
+    double start, elapsed;
+
+    snprintf (path, sizeof(path), "%s/sweep", workdir);
+    for (csv_idx = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+        if (0 != stat (csvnames[csv_idx], &st)) {
+            RBA_ERR("Failed to stat %s\n", csvnames[csv_idx]);
+            ret = -1;
+        }
+        for (p = 0; (p < npartitions) && (0 == ret); p++) {
+            for (r = 0; (r < nrepetitions) && (0 == ret); r++) {
+                start = now ();
+                ret = rba_checkhdr_countrecords (cicfm_rbaspec, cicfm_cols, csvnames[csv_idx], &records);
+                if (0 == ret) {
+                    ret = rba_data_alloc (&data, cicfm_rbaspec, cicfm_cols, path,
+                                            (uint32_t)partitions[p], (uint32_t)repetitions[r],
+                                            records, 0, NULL);
+                }
+                if (0 == ret) {
+                    ret = rba_data_parse_csvs (&data, &(csvnames[csv_idx]), 1);
+                    if (0 != rba_data_free (&data)) {
+                        ret = -1;
+                    }
+                }
+                elapsed = now () - start;
+                remove_tree (path);
+
+                if (0 == ret) {
+                    snprintf (params, sizeof(params),
+                            "\"csv\":\"%s\",\"bytes\":%llu,\"partitions\":%llu,\"repetitions\":%llu,\"mb_per_sec\":%.2f",
+                            csvnames[csv_idx], (unsigned long long)st.st_size,
+                            (unsigned long long)partitions[p], (unsigned long long)repetitions[r],
+                            (double)st.st_size / elapsed / 1e6);
+                    report ("convert", params, records, elapsed);
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+int main (int argc, char **argv)
+{
+    int ret = 0;
+
+    uint64_t rounds = 8;
+    uint64_t partitions[MAXLIST] = { 1, 4, 16, 64 };
+    uint64_t repetitions[MAXLIST] = { 1, 2, 4 };
+    uint32_t npartitions = 4, nrepetitions = 3;
+    const char *workdir;
+    int opt;
+
+    while ((0 == ret) && (-1 != (opt = getopt (argc, argv, "+r:p:x:")))) {
+        switch (opt) {
+            case 'r':
+                ret = strtouint64 (optarg, &rounds);
+                break;
+            case 'p':
+                ret = parse_list (optarg, partitions, &npartitions);
+                break;
+            case 'x':
+                ret = parse_list (optarg, repetitions, &nrepetitions);
+                break;
+            default:
+                ret = -1;
+                break;
+        }
+    }
+
+    if ((0 != ret) || (argc - optind < 3) || (0 == rounds) ||
+            ((0 != strcmp (argv[optind], "micro")) && (0 != strcmp (argv[optind], "sweep")))) {
+        fprintf (stderr, "%s [-r <rounds>] micro <workdir> <CSV>\n"
+                         "%s [-p <partitions>] [-x <repetitions>] sweep <workdir> <CSV1> [<CSV2> ...]\n",
+                         argv[0], argv[0]);
+        return -1;
+    }
+
+    /*  results go to the original stdout, library progress messages nowhere */
+    results = fdopen (dup (STDOUT_FILENO), "w");
+    if ((NULL == results) || (NULL == freopen ("/dev/null", "w", stdout))) {
+        return -1;
+    }
+
+    workdir = argv[optind + 1];
+    if (0 != mkdir (workdir, 0777)) {
+        RBA_ERR("Failed to create work directory %s\n", workdir);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    if (0 == strcmp (argv[optind], "micro")) {
+        ret = bench_micro (workdir, argv[optind + 2], rounds);
+    } else {
+        ret = bench_sweep ( workdir,
+                            (const char**)(argv + optind + 2),
+                            argc - optind - 2,
+                            partitions,
+                            npartitions,
+                            repetitions,
+                            nrepetitions);
+    }
+
+    remove_tree (workdir);
+    fclose (results);
+
+    return ret;
+}
@@ -0,0 +1,190 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*  Measure rows/sec of rba_gather for random sorted minibatches of a range of
+    sizes, with both gather methods and batch layouts.
+
+    rbagather <dirpath> <partition> [<columns> [<rounds>]]
+
+    The column types are taken from the file headers, so any RBA data set can
+    be used. <columns> limits the batch to the first stored columns. */
+
+#include <time.h>
+#include <unistd.h>
+
+#include <rba.h>
+
+#define MAXCOLS (4096)
+
+static const size_t batchsizes[] = { 1, 16, 64, 256, 1024, 4096, 16384 };
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static uint64_t
+next_random (uint64_t *state)
+{
+    /*  splitmix64 */
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int
+cmp_u64 (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/*  build a spec with one type per column file, taken from its header */
+static uint32_t
+probe_columns ( const char          *dirpath,
+                uint32_t            partition,
+                rba_spec_entry_t    *spec,
+                rba_type_t          *types)
+{
+    char filename[4096];
+    rba_header_t hdr;
+    FILE *filep;
+    uint32_t c;
+
+    for (c = 0; c < MAXCOLS; c++) {
+        snprintf (filename, sizeof(filename), "%s/p%08X/c%08X.bin", dirpath, partition, c);
+        filep = fopen (filename, "rb");
+        if (NULL == filep) {
+            break;
+        }
+        memset (&(types[c]), 0, sizeof(rba_type_t));
+        types[c].specname = "column";
+        if ((1 == fread (&hdr, sizeof(hdr), 1, filep)) && (RBA_HEADER_MAGIC == hdr.rba_header_magic)) {
+            types[c].magic = hdr.rba_type_magic;
+            types[c].size = hdr.typesize;
+        }
+        spec[c].name = "column";
+        spec[c].type = &(types[c]);
+        fclose (filep);
+    }
+
+    return c;
+}
+
+int main(int argc, const char **argv)
+{
+    static rba_spec_entry_t spec[MAXCOLS];
+    static rba_type_t types[MAXCOLS];
+    static uint32_t cols[MAXCOLS];
+
+    rba_reader_t reader;
+    rba_gather_t gather;
+    uint64_t partition, maxcols, rounds, records, state;
+    uint64_t *indices;
+    void *batch;
+    uint32_t speccols, ncols, c;
+    size_t b, i, r;
+    int method, layout;
+    double start, elapsed;
+
+    if ((argc < 3) ||
+            (0 != strtouint64 (argv[2], &partition)) ||
+            ((argc > 3) && (0 != strtouint64 (argv[3], &maxcols))) ||
+            ((argc > 4) && (0 != strtouint64 (argv[4], &rounds)))) {
+        fprintf (stderr, "%s <dirpath> <partition> [<columns> [<rounds>]]\n", argv[0]);
+        return -1;
+    }
+    maxcols = (argc > 3) ? maxcols : MAXCOLS;
+    rounds = (argc > 4) ? rounds : 64;
+
+    speccols = probe_columns (argv[1], (uint32_t)partition, spec, types);
+    for (c = 0, ncols = 0; (c < speccols) && (ncols < maxcols); c++) {
+        if (types[c].size > 0) {
+            cols[ncols++] = c;
+        }
+    }
+    if ((0 == ncols) ||
+            (0 != rba_open (&reader, spec, speccols, argv[1], (uint32_t)partition, RBA_ADVICE_RANDOM))) {
+        fprintf (stderr, "ERROR: no columns found in partition %llu of %s\n",
+                (unsigned long long)partition, argv[1]);
+        return -1;
+    }
+
+    printf ("%10s %8s %8s %14s\n", "batch", "method", "layout", "rows/sec");
+    for (b = 0; b < sizeof(batchsizes) / sizeof(batchsizes[0]); b++) {
+        for (method = RBA_GATHER_MMAP; method <= RBA_GATHER_PREADV; method++) {
+            for (layout = RBA_GATHER_ROWMAJOR; layout <= RBA_GATHER_COLMAJOR; layout++) {
+
+                if (0 != rba_gather_init (&gather, &reader, cols, ncols, batchsizes[b], layout, method)) {
+                    return -1;
+                }
+                records = gather.records;
+                indices = (uint64_t*)malloc (batchsizes[b] * sizeof(uint64_t));
+                batch = malloc (batchsizes[b] * gather.rowsize);
+                if ((0 == records) || (NULL == indices) || (NULL == batch)) {
+                    fprintf (stderr, "ERROR: nothing to gather\n");
+                    return -1;
+                }
+
+                state = 1;
+                elapsed = 0;
+                for (r = 0; r < rounds; r++) {
+                    for (i = 0; i < batchsizes[b]; i++) {
+                        indices[i] = next_random (&state) % records;
+                    }
+                    qsort (indices, batchsizes[b], sizeof(uint64_t), cmp_u64);
+
+                    start = now ();
+                    if (0 != rba_gather (&gather, indices, batch)) {
+                        return -1;
+                    }
+                    elapsed += now () - start;
+                }
+
+                printf ("%10zu %8s %8s %14.0f\n", batchsizes[b],
+                        (RBA_GATHER_MMAP == method) ? "mmap" : "preadv",
+                        (RBA_GATHER_ROWMAJOR == layout) ? "row" : "column",
+                        (double)(rounds * batchsizes[b]) / elapsed);
+
+                free (batch);
+                free (indices);
+                rba_gather_free (&gather);
+            }
+        }
+    }
+
+    return rba_close (&reader);
+}
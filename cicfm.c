@@ -0,0 +1,228 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <rba.h>
+#include <cicfm.h>
+
+const char  *cicfm_labels[CICFM_LABEL_COUNT] = {"BENIGN",
+                                                "DrDoS_DNS",
+                                                "DrDoS_MSSQL",
+                                                "DrDoS_NTP",
+                                                "DrDoS_SSDP",
+                                                "Syn",
+                                                "UDP-lag",
+                                                "WebDDoS",
+                                                "DrDoS_LDAP",
+                                                "DrDoS_NetBIOS",
+                                                "DrDoS_SNMP",
+                                                "DrDoS_UDP",
+                                                "TFTP"  };
+
+int
+rba_type_cicfm_classify (   rba_type_t  *type,
+                            const char  *string,
+                            uint32_t    *class_p)
+{
+    int ret;
+    uint32_t id;
+
+    (void)type;
+
+    for (id = 0; \
+        (id < CICFM_LABEL_COUNT) && (0 != strcmp(string, cicfm_labels[id]));
+            id++);
+
+    if (CICFM_LABEL_COUNT == id) {
+        RBA_ERR("Unknown label for CICFM record: %s\n", string);
+        ret = -1;
+    } else {
+        *class_p = id;
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  labels are filtered by their class, "Label == BENIGN" */
+int
+rba_type_cicfm_value (  rba_type_t          *type,
+                        const char          *string,
+                        uint32_t            flags,
+                        rba_zone_value_t    *value_p)
+{
+    int ret;
+    uint32_t id;
+
+    (void)flags;
+
+    ret = rba_type_cicfm_classify (type, string, &id);
+    if (0 == ret) {
+        value_p->u = id;
+    }
+
+    return ret;
+}
+
+int
+rba_type_cicfm_parse (  rba_data_t  *data,
+                        uint32_t    col,
+                        const char  *string)
+{
+    int ret;
+    uint32_t id;
+
+    ret = rba_type_cicfm_classify (data->spec[col].type, string, &id);
+    if (0 == ret) {
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+            
+            ((int8_t*)(bufs[p].arr))[bufs[p].idx] = (int8_t)id;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+rba_type_t rba_type_cicfm_label =    {  .specname   = "cicfm_label",
+                                        .magic      = 0x4142524d46434943,
+                                        .size       = sizeof(uint8_t),
+                                        .initbuf    = rba_buf_alloc,
+                                        .freebuf    = rba_buf_simple_free,
+                                        .parse      = rba_type_cicfm_parse,
+                                        .classify   = rba_type_cicfm_classify,
+                                        .classes    = CICFM_LABEL_COUNT,
+                                        .zone       = RBA_ZONE_UINT,
+                                        .value      = rba_type_cicfm_value};
+
+uint32_t         cicfm_cols = 88;
+rba_spec_entry_t cicfm_rbaspec[] =  {   {"Unnamed: 0",                  &rba_type_ignore },
+                                        {"Flow ID",                     &rba_type_ignore },
+                                        {"Source IP",                   &rba_type_ipv4 },
+                                        {"Source Port",                 &rba_type_float },
+                                        {"Destination IP",              &rba_type_ipv4 },
+                                        {"Destination Port",            &rba_type_float },
+                                        {"Protocol",                    &rba_type_float },
+                                        {"Timestamp",                   &rba_type_timestamp },
+                                        {"Flow Duration",               &rba_type_float },
+                                        {"Total Fwd Packets",           &rba_type_float },
+                                        {"Total Backward Packets",      &rba_type_float },
+                                        {"Total Length of Fwd Packets", &rba_type_float },
+                                        {"Total Length of Bwd Packets", &rba_type_float },
+                                        {"Fwd Packet Length Max",       &rba_type_float },
+                                        {"Fwd Packet Length Min",       &rba_type_float },
+                                        {"Fwd Packet Length Mean",      &rba_type_float },
+                                        {"Fwd Packet Length Std",       &rba_type_float },
+                                        {"Bwd Packet Length Max",       &rba_type_float },
+                                        {"Bwd Packet Length Min",       &rba_type_float },
+                                        {"Bwd Packet Length Mean",      &rba_type_float },
+                                        {"Bwd Packet Length Std",       &rba_type_float },
+                                        {"Flow Bytes/s",                &rba_type_float },
+                                        {"Flow Packets/s",              &rba_type_float },
+                                        {"Flow IAT Mean",               &rba_type_float },
+                                        {"Flow IAT Std",                &rba_type_float },
+                                        {"Flow IAT Max",                &rba_type_float },
+                                        {"Flow IAT Min",                &rba_type_float },
+                                        {"Fwd IAT Total",               &rba_type_float },
+                                        {"Fwd IAT Mean",                &rba_type_float },
+                                        {"Fwd IAT Std",                 &rba_type_float },
+                                        {"Fwd IAT Max",                 &rba_type_float },
+                                        {"Fwd IAT Min",                 &rba_type_float },
+                                        {"Bwd IAT Total",               &rba_type_float },
+                                        {"Bwd IAT Mean",                &rba_type_float },
+                                        {"Bwd IAT Std",                 &rba_type_float },
+                                        {"Bwd IAT Max",                 &rba_type_float },
+                                        {"Bwd IAT Min",                 &rba_type_float },
+                                        {"Fwd PSH Flags",               &rba_type_float },
+                                        {"Bwd PSH Flags",               &rba_type_float },
+                                        {"Fwd URG Flags",               &rba_type_float },
+                                        {"Bwd URG Flags",               &rba_type_float },
+                                        {"Fwd Header Length",           &rba_type_float },
+                                        {"Bwd Header Length",           &rba_type_float },
+                                        {"Fwd Packets/s",               &rba_type_float },
+                                        {"Bwd Packets/s",               &rba_type_float },
+                                        {"Min Packet Length",           &rba_type_float },
+                                        {"Max Packet Length",           &rba_type_float },
+                                        {"Packet Length Mean",          &rba_type_float },
+                                        {"Packet Length Std",           &rba_type_float },
+                                        {"Packet Length Variance",      &rba_type_float },
+                                        {"FIN Flag Count",              &rba_type_float },
+                                        {"SYN Flag Count",              &rba_type_float },
+                                        {"RST Flag Count",              &rba_type_float },
+                                        {"PSH Flag Count",              &rba_type_float },
+                                        {"ACK Flag Count",              &rba_type_float },
+                                        {"URG Flag Count",              &rba_type_float },
+                                        {"CWE Flag Count",              &rba_type_float },
+                                        {"ECE Flag Count",              &rba_type_float },
+                                        {"Down/Up Ratio",               &rba_type_float },
+                                        {"Average Packet Size",         &rba_type_float },
+                                        {"Avg Fwd Segment Size",        &rba_type_float },
+                                        {"Avg Bwd Segment Size",        &rba_type_float },
+                                        {"Fwd Header Length.1",         &rba_type_float },
+                                        {"Fwd Avg Bytes/Bulk",          &rba_type_float },
+                                        {"Fwd Avg Packets/Bulk",        &rba_type_float },
+                                        {"Fwd Avg Bulk Rate",           &rba_type_float },
+                                        {"Bwd Avg Bytes/Bulk",          &rba_type_float },
+                                        {"Bwd Avg Packets/Bulk",        &rba_type_float },
+                                        {"Bwd Avg Bulk Rate",           &rba_type_float },
+                                        {"Subflow Fwd Packets",         &rba_type_float },
+                                        {"Subflow Fwd Bytes",           &rba_type_float },
+                                        {"Subflow Bwd Packets",         &rba_type_float },
+                                        {"Subflow Bwd Bytes",           &rba_type_float },
+                                        {"Init_Win_bytes_forward",      &rba_type_float },
+                                        {"Init_Win_bytes_backward",     &rba_type_float },
+                                        {"act_data_pkt_fwd",            &rba_type_float },
+                                        {"min_seg_size_forward",        &rba_type_float },
+                                        {"Active Mean",                 &rba_type_float },
+                                        {"Active Std",                  &rba_type_float },
+                                        {"Active Max",                  &rba_type_float },
+                                        {"Active Min",                  &rba_type_float },
+                                        {"Idle Mean",                   &rba_type_float },
+                                        {"Idle Std",                    &rba_type_float },
+                                        {"Idle Max",                    &rba_type_float },
+                                        {"Idle Min",                    &rba_type_float },
+                                        {"SimillarHTTP",                &rba_type_ignore },
+                                        {"Inbound",                     &rba_type_float },
+                                        {"Label",                       &rba_type_cicfm_label },
+                                    };
@@ -0,0 +1,63 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __CICFM_H__
+#define __CICFM_H__
+
+#include <rba.h>
+
+/*  The CIC flow meter data set: the labels, the label column type and the
+    spec of the 88 CSV columns. */
+#define CICFM_LABEL_COUNT (13)
+
+extern const char *cicfm_labels[CICFM_LABEL_COUNT];
+
+extern int
+rba_type_cicfm_classify (   rba_type_t  *type,
+                            const char  *string,
+                            uint32_t    *class_p);
+
+extern int
+rba_type_cicfm_value (  rba_type_t          *type,
+                        const char          *string,
+                        uint32_t            flags,
+                        rba_zone_value_t    *value_p);
+
+extern int
+rba_type_cicfm_parse (  rba_data_t  *data,
+                        uint32_t    col,
+                        const char  *string);
+
+extern rba_type_t rba_type_cicfm_label;
+
+extern uint32_t         cicfm_cols;
+extern rba_spec_entry_t cicfm_rbaspec[];
+
+#endif /* #ifndef __CICFM_H__ */
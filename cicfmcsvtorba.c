@@ -1,162 +1,482 @@
 
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include <rba.h>
+#include <cicfm.h>
 
-#define CICFM_LABEL_COUNT (13)
-const char  *cicfm_labels[CICFM_LABEL_COUNT] = {"BENIGN",
-                                                "DrDoS_DNS",
-                                                "DrDoS_MSSQL",
-                                                "DrDoS_NTP",
-                                                "DrDoS_SSDP",
-                                                "Syn",
-                                                "UDP-lag",
-                                                "WebDDoS",
-                                                "DrDoS_LDAP",
-                                                "DrDoS_NetBIOS",
-                                                "DrDoS_SNMP",
-                                                "DrDoS_UDP",
-                                                "TFTP"  };
-
-int
-rba_type_cicfm_parse (  rba_data_t  *data,
-                        uint32_t    col,
-                        const char  *string)
+/*  check the headers and count the records of all CSV files, consulting the
+    record count cache first if one is given */
+static int
+count_csvs (const char  **csvlist,
+            int         csvcount,
+            const char  *cachename,
+            uint32_t    threads,
+            uint64_t    *total_p)
+{
+    int ret = 0;
+
+    int csv_idx, miss_idx, misscount;
+    uint64_t *file_reccounts, *missreccounts;
+    const char **misslist;
+    int *cache_hits;
+
+    rba_cache_t cache;
+
+    memset (&cache, 0, sizeof(cache));
+    if (NULL != cachename) {
+        ret = rba_cache_load (  &cache,
+                                cachename,
+                                cicfm_rbaspec,
+                                cicfm_cols);
+        if (0 != ret) {
+            fprintf (stderr, "ERROR: failed to load record count cache %s\n", cachename);
+        }
+    }
+
+    file_reccounts = (uint64_t*)calloc (csvcount, sizeof(uint64_t));
+    misslist = (const char**)calloc (csvcount, sizeof(const char*));
+    cache_hits = (int*)calloc (csvcount, sizeof(int));
+    if ((0 == ret) &&
+        ((NULL == file_reccounts) || (NULL == misslist) || (NULL == cache_hits))) {
+        fprintf (stderr, "ERROR: failed to allocate record count arrays\n");
+        ret = -1;
+    }
+
+    /*  only the files missing from the cache are counted */
+    for (csv_idx = 0, misscount = 0;
+            ((csv_idx < csvcount) && (0 == ret));
+                csv_idx++) {
+        if (NULL != cachename) {
+            ret = rba_cache_lookup (&cache,
+                                    csvlist[csv_idx],
+                                    &(file_reccounts[csv_idx]),
+                                    &(cache_hits[csv_idx]));
+        }
+        if ((0 == ret) && !cache_hits[csv_idx]) {
+            misslist[misscount++] = csvlist[csv_idx];
+        }
+    }
+
+    if ((0 == ret) && (misscount > 0)) {
+        missreccounts = (uint64_t*)calloc (misscount, sizeof(uint64_t));
+        if (NULL == missreccounts) {
+            fprintf (stderr, "ERROR: failed to allocate record count arrays\n");
+            ret = -1;
+        } else {
+            ret = rba_checkhdr_countrecords_parallel (  cicfm_rbaspec,
+                                                        cicfm_cols,
+                                                        misslist,
+                                                        misscount,
+                                                        threads,
+                                                        missreccounts);
+            for (csv_idx = 0, miss_idx = 0;
+                    ((csv_idx < csvcount) && (0 == ret));
+                        csv_idx++) {
+                if (!cache_hits[csv_idx]) {
+                    file_reccounts[csv_idx] = missreccounts[miss_idx++];
+                    if (NULL != cachename) {
+                        ret = rba_cache_update (&cache,
+                                                csvlist[csv_idx],
+                                                file_reccounts[csv_idx]);
+                    }
+                }
+            }
+            free (missreccounts);
+        }
+    }
+
+    for (csv_idx = 0, *total_p=0; 
+            ((csv_idx < csvcount) && (0 == ret));
+                csv_idx++) {
+        printf("    %s is valid and contains %lu records%s\n",
+                csvlist[csv_idx],
+                file_reccounts[csv_idx],
+                cache_hits[csv_idx] ? " (cached)" : "");
+        *total_p += file_reccounts[csv_idx];
+    }
+
+    free (file_reccounts);
+    free (misslist);
+    free (cache_hits);
+
+    if (NULL != cachename) {
+        if ((0 == ret) && (0 != rba_cache_save (&cache))) {
+            fprintf (stderr, "ERROR: failed to save record count cache %s\n", cachename);
+            ret = -1;
+        }
+        rba_cache_free (&cache);
+    }
+
+    return ret;
+}
+
+/*  check the headers and count the records of all CSV files that pass the
+    filter. The fields have to be parsed, so the record count cache, which
+    holds line counts, is not used. */
+static int
+count_filtered (const char          **csvlist,
+                int                 csvcount,
+                const rba_filter_t  *filter,
+                uint64_t            *total_p)
+{
+    int ret = 0;
+
+    int csv_idx;
+    uint64_t reccount;
+
+    for (csv_idx = 0, *total_p = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+        ret = rba_filter_count (filter, csvlist[csv_idx], &reccount);
+        if (0 != ret) {
+            fprintf (stderr, "ERROR: failed to filter %s\n", csvlist[csv_idx]);
+        } else {
+            printf("    %s is valid and contains %lu records passing the filter\n",
+                    csvlist[csv_idx],
+                    reccount);
+            *total_p += reccount;
+        }
+    }
+
+    return ret;
+}
+
+/*  Set up classification by the label column. Unless streaming, the records
+    of each label are counted, which also checks the headers and gives the
+    total record count. With dedup, only distinct records are counted, and
+    with a filter only the records it keeps. */
+static int
+count_labels (  const char          **csvlist,
+                int                 csvcount,
+                uint32_t            flags,
+                rba_dedup_t         *dedup,
+                const rba_filter_t  *filter,
+                rba_strata_t        *strata,
+                uint64_t            *total_p)
 {
     int ret;
-    uint8_t id;
 
-    for (id = 0; \
-        (id < CICFM_LABEL_COUNT) && (0 != strcmp(string, cicfm_labels[id]));
-            id++);
+    int csv_idx;
+    uint32_t c, l;
+
+    for (c = 0; (c < cicfm_cols) && (&rba_type_cicfm_label != cicfm_rbaspec[c].type); c++);
+
+    strata->col = c;
+    strata->classes = rba_type_cicfm_label.classes;
+    strata->samples = NULL;
+    *total_p = 0;
 
-    if (CICFM_LABEL_COUNT == id) {
-        RBA_ERR("Unknown label for CICFM record: %s\n", string);
+    if (flags & RBA_DATA_STREAM) {
+        ret = 0;
+    } else {
+        strata->samples = (uint64_t*)calloc (strata->classes, sizeof(uint64_t));
+        if (NULL == strata->samples) {
+            ret = -1;
+        } else if (NULL != dedup) {
+            ret = rba_dedup_scan (  dedup,
+                                    cicfm_rbaspec,
+                                    cicfm_cols,
+                                    csvlist,
+                                    csvcount,
+                                    strata->col,
+                                    strata->samples,
+                                    filter,
+                                    total_p);
+        } else {
+            for (csv_idx = 0, ret = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+                ret = rba_checkhdr_countclasses (   cicfm_rbaspec,
+                                                    cicfm_cols,
+                                                    strata->col,
+                                                    csvlist[csv_idx],
+                                                    filter,
+                                                    strata->samples);
+                if (0 != ret) {
+                    fprintf (stderr, "ERROR: failed to count labels of %s\n", csvlist[csv_idx]);
+                }
+            }
+            for (l = 0; (l < strata->classes) && (0 == ret); l++) {
+                *total_p += strata->samples[l];
+            }
+        }
+        for (l = 0; (l < strata->classes) && (0 == ret); l++) {
+            printf("    %-24s %lu\n", cicfm_labels[l], strata->samples[l]);
+        }
+    }
+
+    return ret;
+}
+
+/*  turn a comma separated list of output layouts into RBA_DATA_ flags */
+static int
+parse_layouts ( const char  *layouts,
+                uint32_t    *flags_p)
+{
+    int ret;
+
+    char *list, *iterator, *tok;
+    int columns = 0;
+    uint32_t flags = 0;
+
+    list = strdup (layouts);
+    if (NULL == list) {
         ret = -1;
     } else {
-        uint32_t    r, p;
-        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+        ret = 0;
+        for_each_csvtoken(list, iterator, tok) {
+            if (0 == strcmp (tok, "columns")) {
+                columns = 1;
+            } else if (0 == strcmp (tok, "rows")) {
+                flags |= RBA_DATA_ROWS;
+            } else if (0 == strcmp (tok, "pax")) {
+                flags |= RBA_DATA_PAX;
+            } else {
+                fprintf (stderr, "ERROR: unknown layout \"%s\"\n", tok);
+                ret = -1;
+            }
+        }
+        free (list);
+    }
+
+    if ((0 == ret) && !columns) {
+        if (0 == flags) {
+            fprintf (stderr, "ERROR: no output layout given\n");
+            ret = -1;
+        }
+        flags |= RBA_DATA_NOCOLS;
+    }
 
-        for (r=0, ret=0; \
-                (r < data->repetitions) && (0 == ret) ;
-                    r++) {
+    if (0 == ret) {
+        *flags_p = flags;
+    }
 
-            p = data->partidxbuf[r];
-            
-            ((int8_t*)(bufs[p].arr))[bufs[p].idx] = id;
-            bufs[p].idx++;
-            if (bufs[p].idx == bufs[p].len) {
+    return ret;
+}
 
-                ret = rba_buf_simple_flush (&(bufs[p]));
-                if (0 != ret) {
-                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+/*  Parse a comma separated list of <label>=<value> pairs into the per-label
+    sampling rates, or into the per-label repetitions when rates is NULL.
+    Labels that are not listed keep their value. */
+static int
+parse_label_values (const char  *list,
+                    double      *rates,
+                    uint32_t    *reps)
+{
+    int ret;
+
+    char *copy, *iterator, *tok, *value, *end;
+    uint32_t l;
+    uint64_t rep;
+    double rate;
+
+    copy = strdup (list);
+    if (NULL == copy) {
+        ret = -1;
+    } else {
+        ret = 0;
+        for_each_csvtoken(copy, iterator, tok) {
+            if (0 != ret) {
+                continue;
+            }
+            value = strchr (tok, '=');
+            if (NULL == value) {
+                fprintf (stderr, "ERROR: expected <label>=<value>, got \"%s\"\n", tok);
+                ret = -1;
+            } else {
+                *value++ = '\0';
+                ret = rba_type_cicfm_classify (&rba_type_cicfm_label, tok, &l);
+            }
+            if ((0 == ret) && (NULL != rates)) {
+                rate = strtod (value, &end);
+                if ((end == value) || ('\0' != *end) || !(rate >= 0.0) || (rate > 1.0)) {
+                    fprintf (stderr, "ERROR: sampling rate of %s must be between 0 and 1\n", tok);
                     ret = -1;
+                } else {
+                    rates[l] = rate;
+                }
+            } else if (0 == ret) {
+                ret = strtouint64 (value, &rep);
+                if ((0 != ret) || (rep > UINT32_MAX)) {
+                    fprintf (stderr, "ERROR: failed to parse repetitions of %s\n", tok);
+                    ret = -1;
+                } else {
+                    reps[l] = (uint32_t)rep;
                 }
             }
         }
+        free (copy);
+    }
+
+    return ret;
+}
+
+/*  Parse <shard>/<shards>[/<seed>] */
+static int
+parse_shard (   const char  *arg,
+                uint64_t    *shard_p,
+                uint64_t    *shards_p,
+                uint64_t    *seed_p)
+{
+    int ret;
+
+    char *copy, *shards, *seed;
+
+    copy = strdup (arg);
+    if (NULL == copy) {
+        return -1;
+    }
+
+    shards = strchr (copy, '/');
+    if (NULL == shards) {
+        ret = -1;
+    } else {
+        *shards++ = '\0';
+        seed = strchr (shards, '/');
+        if (NULL != seed) {
+            *seed++ = '\0';
+        }
+        ret = strtouint64 (copy, shard_p);
+        if (0 == ret) {
+            ret = strtouint64 (shards, shards_p);
+        }
+        if ((0 == ret) && (NULL != seed)) {
+            ret = strtouint64 (seed, seed_p);
+        }
+        if ((0 == ret) && ((*shard_p >= *shards_p) || (*shards_p > UINT32_MAX))) {
+            ret = -1;
+        }
     }
+    if (0 != ret) {
+        fprintf (stderr, "ERROR: expected <shard>/<shards>[/<seed>] with <shard> below <shards>, got \"%s\"\n", arg);
+    }
+    free (copy);
 
     return ret;
 }
 
-rba_type_t rba_type_cicfm_label =    {  .specname   = "cicfm_label",
-                                        .magic      = 0x4142524d46434943,
-                                        .size       = sizeof(uint8_t),
-                                        .initbuf    = rba_buf_alloc,
-                                        .freebuf    = rba_buf_simple_free,
-                                        .parse      = rba_type_cicfm_parse};
-
-uint32_t         cicfm_cols = 88;
-rba_spec_entry_t cicfm_rbaspec[] =  {   {"Unnamed: 0",                  &rba_type_ignore },
-                                        {"Flow ID",                     &rba_type_ignore },
-                                        {"Source IP",                   &rba_type_ignore },
-                                        {"Source Port",                 &rba_type_float },
-                                        {"Destination IP",              &rba_type_ignore },
-                                        {"Destination Port",            &rba_type_float },
-                                        {"Protocol",                    &rba_type_float },
-                                        {"Timestamp",                   &rba_type_ignore },
-                                        {"Flow Duration",               &rba_type_float },
-                                        {"Total Fwd Packets",           &rba_type_float },
-                                        {"Total Backward Packets",      &rba_type_float },
-                                        {"Total Length of Fwd Packets", &rba_type_float },
-                                        {"Total Length of Bwd Packets", &rba_type_float },
-                                        {"Fwd Packet Length Max",       &rba_type_float },
-                                        {"Fwd Packet Length Min",       &rba_type_float },
-                                        {"Fwd Packet Length Mean",      &rba_type_float },
-                                        {"Fwd Packet Length Std",       &rba_type_float },
-                                        {"Bwd Packet Length Max",       &rba_type_float },
-                                        {"Bwd Packet Length Min",       &rba_type_float },
-                                        {"Bwd Packet Length Mean",      &rba_type_float },
-                                        {"Bwd Packet Length Std",       &rba_type_float },
-                                        {"Flow Bytes/s",                &rba_type_float },
-                                        {"Flow Packets/s",              &rba_type_float },
-                                        {"Flow IAT Mean",               &rba_type_float },
-                                        {"Flow IAT Std",                &rba_type_float },
-                                        {"Flow IAT Max",                &rba_type_float },
-                                        {"Flow IAT Min",                &rba_type_float },
-                                        {"Fwd IAT Total",               &rba_type_float },
-                                        {"Fwd IAT Mean",                &rba_type_float },
-                                        {"Fwd IAT Std",                 &rba_type_float },
-                                        {"Fwd IAT Max",                 &rba_type_float },
-                                        {"Fwd IAT Min",                 &rba_type_float },
-                                        {"Bwd IAT Total",               &rba_type_float },
-                                        {"Bwd IAT Mean",                &rba_type_float },
-                                        {"Bwd IAT Std",                 &rba_type_float },
-                                        {"Bwd IAT Max",                 &rba_type_float },
-                                        {"Bwd IAT Min",                 &rba_type_float },
-                                        {"Fwd PSH Flags",               &rba_type_float },
-                                        {"Bwd PSH Flags",               &rba_type_float },
-                                        {"Fwd URG Flags",               &rba_type_float },
-                                        {"Bwd URG Flags",               &rba_type_float },
-                                        {"Fwd Header Length",           &rba_type_float },
-                                        {"Bwd Header Length",           &rba_type_float },
-                                        {"Fwd Packets/s",               &rba_type_float },
-                                        {"Bwd Packets/s",               &rba_type_float },
-                                        {"Min Packet Length",           &rba_type_float },
-                                        {"Max Packet Length",           &rba_type_float },
-                                        {"Packet Length Mean",          &rba_type_float },
-                                        {"Packet Length Std",           &rba_type_float },
-                                        {"Packet Length Variance",      &rba_type_float },
-                                        {"FIN Flag Count",              &rba_type_float },
-                                        {"SYN Flag Count",              &rba_type_float },
-                                        {"RST Flag Count",              &rba_type_float },
-                                        {"PSH Flag Count",              &rba_type_float },
-                                        {"ACK Flag Count",              &rba_type_float },
-                                        {"URG Flag Count",              &rba_type_float },
-                                        {"CWE Flag Count",              &rba_type_float },
-                                        {"ECE Flag Count",              &rba_type_float },
-                                        {"Down/Up Ratio",               &rba_type_float },
-                                        {"Average Packet Size",         &rba_type_float },
-                                        {"Avg Fwd Segment Size",        &rba_type_float },
-                                        {"Avg Bwd Segment Size",        &rba_type_float },
-                                        {"Fwd Header Length.1",         &rba_type_float },
-                                        {"Fwd Avg Bytes/Bulk",          &rba_type_float },
-                                        {"Fwd Avg Packets/Bulk",        &rba_type_float },
-                                        {"Fwd Avg Bulk Rate",           &rba_type_float },
-                                        {"Bwd Avg Bytes/Bulk",          &rba_type_float },
-                                        {"Bwd Avg Packets/Bulk",        &rba_type_float },
-                                        {"Bwd Avg Bulk Rate",           &rba_type_float },
-                                        {"Subflow Fwd Packets",         &rba_type_float },
-                                        {"Subflow Fwd Bytes",           &rba_type_float },
-                                        {"Subflow Bwd Packets",         &rba_type_float },
-                                        {"Subflow Bwd Bytes",           &rba_type_float },
-                                        {"Init_Win_bytes_forward",      &rba_type_float },
-                                        {"Init_Win_bytes_backward",     &rba_type_float },
-                                        {"act_data_pkt_fwd",            &rba_type_float },
-                                        {"min_seg_size_forward",        &rba_type_float },
-                                        {"Active Mean",                 &rba_type_float },
-                                        {"Active Std",                  &rba_type_float },
-                                        {"Active Max",                  &rba_type_float },
-                                        {"Active Min",                  &rba_type_float },
-                                        {"Idle Mean",                   &rba_type_float },
-                                        {"Idle Std",                    &rba_type_float },
-                                        {"Idle Max",                    &rba_type_float },
-                                        {"Idle Min",                    &rba_type_float },
-                                        {"SimillarHTTP",                &rba_type_ignore },
-                                        {"Inbound",                     &rba_type_float },
-                                        {"Label",                       &rba_type_cicfm_label },
-                                    };
+/*  The data set of shard shard below dirpath, <dirpath>/s%08X */
+static char*
+shard_dirpath ( const char  *dirpath,
+                uint64_t    shard)
+{
+    char *sharddir;
+    size_t len = strlen (dirpath) + sizeof("/s00000000");
+
+    if ((0 != mkdir (dirpath, 0777)) && (EEXIST != errno)) {
+        fprintf (stderr, "ERROR: failed to create directory %s\n", dirpath);
+        return NULL;
+    }
+    sharddir = (char*)malloc (len);
+    if (NULL != sharddir) {
+        snprintf (sharddir, len, "%s/s%08X", dirpath, (unsigned)shard);
+    }
+
+    return sharddir;
+}
+
+/*  Merge the data sets of the shards below dirpath into dirpath, sorting
+    the partitions by timestamp and indexing their labels afterwards if
+    asked to */
+static int
+merge_shards (  const char  *dirpath,
+                uint64_t    shards,
+                uint64_t    partitions,
+                int         timesort,
+                uint32_t    timecol,
+                int         labelindex,
+                uint32_t    labelcol)
+{
+    int ret = 0;
+
+    char **srcdirs;
+    uint64_t s;
+    uint32_t p;
+
+    srcdirs = (char**)calloc (shards, sizeof(char*));
+    if (NULL == srcdirs) {
+        ret = -1;
+    }
+    for (s = 0; (s < shards) && (0 == ret); s++) {
+        srcdirs[s] = shard_dirpath (dirpath, s);
+        ret = (NULL == srcdirs[s]) ? -1 : 0;
+    }
+
+    if (0 == ret) {
+        ret = rba_merge_dataset (dirpath, (const char**)srcdirs, (uint32_t)shards, (uint32_t)partitions);
+        if (0 != ret) {
+            fprintf (stderr, "ERROR: failed to merge the shards in %s\n", dirpath);
+        }
+    }
+
+    for (p = 0; (p < partitions) && (0 == ret) && timesort; p++) {
+        printf("    Sorting partition %u by timestamp\n", (unsigned)p);
+        ret = rba_sort_partition (  cicfm_rbaspec,
+                                    cicfm_cols,
+                                    dirpath,
+                                    p,
+                                    timecol);
+    }
+    for (p = 0; (p < partitions) && (0 == ret) && labelindex; p++) {
+        ret = rba_labels_build (cicfm_rbaspec, cicfm_cols, dirpath, p, labelcol);
+    }
+
+    for (s = 0; (NULL != srcdirs) && (s < shards); s++) {
+        free (srcdirs[s]);
+    }
+    free (srcdirs);
+
+    return ret;
+}
 
 const char*
-usagestring = "%s <partitions> <repetition> <dirpath> <CSV1> [<CSV2> ...]\n";
+usagestring = "%s [-a] [-s] [-S] [-k <rates>] [-x <reps>] [-d] [-m <MiB>] [-P] [-T <seconds>] [-R] [-O] [-z] [-K] [-l <layouts>] [-c <cache>] [-j <threads>] [-J <report>] [-C] [-v <secs>] [-w <secs>] [-r] [-N <i>/<n>[/<seed>]] [-M <n>] [-L] [-Z] [-F <filter>] [-I] <partitions> <repetition> <dirpath> <CSV1> [<CSV2> ...]\n"
+              "    -a          append the CSVs to the existing RBA data set in <dirpath>\n"
+              "    -s          stream the CSVs without counting records first, needed\n"
+              "                for stdin (\"-\") and gzip/zstd compressed CSVs\n"
+              "    -S          stratify by label, every partition gets the same share\n"
+              "                of each label\n"
+              "    -k <list>   comma separated <label>=<fraction> sampling rates, keep\n"
+              "                only that fraction of the records of each listed label\n"
+              "    -x <list>   comma separated <label>=<n> repetitions, write each\n"
+              "                record of a listed label to <n> partitions\n"
+              "    -d          drop rows whose stored fields duplicate an earlier row\n"
+              "    -m <MiB>    memory for the -d hash table (default: 256), rows spill\n"
+              "                to temporary files when it fills up\n"
+              "    -P          store the /24 prefixes of the IP addresses instead of\n"
+              "                the addresses\n"
+              "    -T <secs>   partition by timestamp, in buckets of <secs> seconds\n"
+              "                dealt round robin over the partitions\n"
+              "    -R          partition by time ranges holding about the same number\n"
+              "                of records each\n"
+              "    -O          sort each partition by timestamp\n"
+              "    -z          write packed column files, compressing each flushed\n"
+              "                chunk and indexing the chunks at the end of the file\n"
+              "    -K          write a CRC32C checksum file next to every output file\n"
+              "    -l <list>   comma separated output layouts: columns (default),\n"
+              "                rows, pax\n"
+              "    -c <cache>  reuse header checks and record counts of unchanged CSVs\n"
+              "                from the <cache> file and update it\n"
+              "    -j <n>      count records with <n> threads (default: online CPUs)\n"
+              "    -J <file>   write counters and the time spent in each stage of the\n"
+              "                conversion to <file> as JSON\n"
+              "    -C          also time the parsing of each column for -J\n"
+              "    -v <secs>   print progress and the time left every <secs> seconds\n"
+              "    -w <secs>   write a checkpoint to <dirpath> every <secs> seconds\n"
+              "    -r          resume from the checkpoint in <dirpath>, with the same\n"
+              "                arguments as the interrupted run\n"
+              "    -N <i>/<n>[/<seed>]\n"
+              "                convert only shard <i> of <n> of the CSVs, into\n"
+              "                <dirpath>/s<i>; the shards of one <seed> (default: 1)\n"
+              "                together hold the records the same way for every <n>,\n"
+              "                and as -s does for the default seed\n"
+              "    -M <n>      merge the shards <dirpath>/s0 to s<n-1> into <dirpath>,\n"
+              "                no CSVs needed\n"
+              "    -L          write an index of the rows of every label per partition\n"
+              "    -Z          write the minimum and maximum of every chunk of a column\n"
+              "                to a zone map next to the column file\n"
+              "    -F <filter> convert only the records for which all terms of\n"
+              "                <filter> hold, \"<column> <op> <value>\" joined with\n"
+              "                \"&&\", op one of == = != < <= > >=; may be repeated\n"
+              "    -I          parse integer columns with strtoull/strtoll in base 0,\n"
+              "                as before, so 010 is octal and 0x10 hexadecimal\n";
 
 int main(int argc, const char **argv)
 {
@@ -170,76 +490,489 @@ int main(int argc, const char **argv)
 
     int csv_idx;
     uint64_t total_reccount;
-    uint64_t file_reccount;
+    uint32_t threads;
+    uint64_t optval;
 
     rba_data_t data;
+    rba_strata_t strata;
+    int bylabel;
+    const char *rateslist, *repslist;
+    rba_dedup_t dedup;
+    int dedupe;
+    uint64_t dedupmem;
+    uint64_t timebucket;
+    int timeranges, timesort;
+    int64_t *timebounds;
+    uint32_t timecol, p;
+    int labelindex;
+    uint32_t labelcol;
+    uint32_t l, c;
+    rba_stats_t stats;
+    rba_stats_t *statsp;
+    const char *reportname;
+    uint32_t statsflags;
+    double progress, checkpoint;
+    rba_resume_t resume;
+    int resuming;
+    uint64_t shard, shards, shardseed, mergeshards;
+    char *sharddir;
+    rba_filter_t filter;
+    rba_filter_t *filterp;
+    const char **filterlist;
+    int filtercount, f;
 
-    if (argc < 5) {
-        fprintf (stderr, usagestring, argv[0]);
+    const char *progname = argv[0];
+    const char *cachename;
+    uint32_t flags, layouts;
+    int opt;
+
+    flags = 0;
+    layouts = 0;
+    bylabel = 0;
+    rateslist = NULL;
+    dedupe = 0;
+    dedupmem = 256;
+    timebucket = 0;
+    timeranges = 0;
+    timesort = 0;
+    timebounds = NULL;
+    for (timecol = 0; (timecol < cicfm_cols) && (&rba_type_timestamp != cicfm_rbaspec[timecol].type); timecol++);
+    labelindex = 0;
+    for (labelcol = 0; (labelcol < cicfm_cols) && (&rba_type_cicfm_label != cicfm_rbaspec[labelcol].type); labelcol++);
+    memset (&dedup, 0, sizeof(dedup));
+    memset (&stats, 0, sizeof(stats));
+    statsp = NULL;
+    reportname = NULL;
+    statsflags = 0;
+    progress = 0;
+    checkpoint = 0;
+    resuming = 0;
+    memset (&resume, 0, sizeof(resume));
+    shard = 0;
+    shards = 0;
+    shardseed = 1;
+    mergeshards = 0;
+    sharddir = NULL;
+    memset (&filter, 0, sizeof(filter));
+    filterp = NULL;
+    filterlist = (const char**)calloc (argc, sizeof(const char*));
+    filtercount = 0;
+    repslist = NULL;
+    memset (&strata, 0, sizeof(strata));
+    cachename = NULL;
+    threads = (uint32_t)sysconf (_SC_NPROCESSORS_ONLN);
+    ret = (NULL == filterlist) ? -1 : 0;
+    while ((0 == ret) && (-1 != (opt = getopt (argc, (char * const *)argv, "+asSk:x:dm:PT:ROzKl:c:j:J:Cv:w:rN:M:LZF:I")))) {
+        switch (opt) {
+            case 'a':
+                flags |= RBA_DATA_APPEND;
+                break;
+            case 's':
+                flags |= RBA_DATA_STREAM;
+                break;
+            case 'S':
+                bylabel = 1;
+                flags |= RBA_DATA_STRATIFY;
+                break;
+            case 'k':
+                rateslist = optarg;
+                break;
+            case 'x':
+                repslist = optarg;
+                break;
+            case 'd':
+                dedupe = 1;
+                break;
+            case 'm':
+                ret = strtouint64 (optarg, &dedupmem);
+                if ((0 == ret) && ((0 == dedupmem) || (dedupmem > (1 << 20)))) {
+                    fprintf (stderr, "ERROR: dedup memory must be between 1 and 1048576 MiB\n");
+                    ret = -1;
+                }
+                break;
+            case 'P':
+                for (c = 0; c < cicfm_cols; c++) {
+                    if (&rba_type_ipv4 == cicfm_rbaspec[c].type) {
+                        cicfm_rbaspec[c].type = &rba_type_ipv4_prefix24;
+                    }
+                }
+                break;
+            case 'T':
+                ret = strtouint64 (optarg, &timebucket);
+                if ((0 == ret) && ((0 == timebucket) || (timebucket > (UINT64_C(1) << 32)))) {
+                    fprintf (stderr, "ERROR: time bucket must be between 1 and 2^32 seconds\n");
+                    ret = -1;
+                }
+                break;
+            case 'R':
+                timeranges = 1;
+                break;
+            case 'O':
+                timesort = 1;
+                break;
+            case 'z':
+                flags |= RBA_DATA_PACKED;
+                break;
+            case 'K':
+                flags |= RBA_DATA_CHECKSUM;
+                break;
+            case 'l':
+                flags &= ~(RBA_DATA_ROWS | RBA_DATA_PAX | RBA_DATA_NOCOLS);
+                ret = parse_layouts (optarg, &layouts);
+                flags |= layouts;
+                break;
+            case 'c':
+                cachename = optarg;
+                break;
+            case 'j':
+                ret = strtouint64 (optarg, &optval);
+                if ((0 == ret) && ((0 == optval) || (optval > 1024))) {
+                    fprintf (stderr, "ERROR: thread count must be between 1 and 1024\n");
+                    ret = -1;
+                }
+                threads = (uint32_t)optval;
+                break;
+            case 'J':
+                reportname = optarg;
+                break;
+            case 'C':
+                statsflags |= RBA_STATS_COLUMNS;
+                break;
+            case 'v':
+                ret = strtodouble (optarg, &progress);
+                if ((0 == ret) && !(progress > 0)) {
+                    fprintf (stderr, "ERROR: progress interval must be positive\n");
+                    ret = -1;
+                }
+                break;
+            case 'w':
+                ret = strtodouble (optarg, &checkpoint);
+                if ((0 == ret) && !(checkpoint > 0)) {
+                    fprintf (stderr, "ERROR: checkpoint interval must be positive\n");
+                    ret = -1;
+                }
+                break;
+            case 'r':
+                resuming = 1;
+                break;
+            case 'N':
+                ret = parse_shard (optarg, &shard, &shards, &shardseed);
+                break;
+            case 'M':
+                ret = strtouint64 (optarg, &mergeshards);
+                if ((0 == ret) && ((0 == mergeshards) || (mergeshards > UINT32_MAX))) {
+                    fprintf (stderr, "ERROR: shard count must be between 1 and 2^32-1\n");
+                    ret = -1;
+                }
+                break;
+            case 'L':
+                labelindex = 1;
+                break;
+            case 'Z':
+                flags |= RBA_DATA_ZONEMAP;
+                break;
+            case 'F':
+                filterlist[filtercount++] = optarg;
+                break;
+            case 'I':
+                flags |= RBA_DATA_LEGACYINT;
+                break;
+            default:
+                ret = -1;
+                break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if ((0 == ret) && timeranges && ((flags & RBA_DATA_STREAM) || (0 != timebucket) || (flags & RBA_DATA_STRATIFY) ||
+                (NULL != rateslist) || (NULL != repslist))) {
+        fprintf (stderr, "ERROR: -R can not be combined with -s, -T, -S, -k or -x\n");
+        ret = -1;
+    } else if ((0 == ret) && timesort && (flags & (RBA_DATA_APPEND | RBA_DATA_PACKED | RBA_DATA_PAX | RBA_DATA_NOCOLS))) {
+        fprintf (stderr, "ERROR: -O needs unpacked column files and can not be combined with -a\n");
+        ret = -1;
+    } else if ((0 == ret) && ((checkpoint > 0) || resuming) && dedupe && (flags & RBA_DATA_STREAM)) {
+        fprintf (stderr, "ERROR: -w and -r can not be combined with -d and -s\n");
+        ret = -1;
+    } else if ((0 == ret) && (0 != shards) &&
+                (bylabel || (NULL != rateslist) || (NULL != repslist) || dedupe || timeranges || timesort ||
+                    (flags & RBA_DATA_APPEND) || (checkpoint > 0) || resuming || (0 != mergeshards))) {
+        fprintf (stderr, "ERROR: -N can not be combined with -S, -k, -x, -d, -R, -O, -a, -w, -r or -M\n");
+        ret = -1;
+    } else if ((0 == ret) && (0 != mergeshards) && (resuming || (checkpoint > 0) || (flags & RBA_DATA_APPEND))) {
+        fprintf (stderr, "ERROR: -M can not be combined with -a, -w or -r\n");
+        ret = -1;
+    } else if ((0 == ret) && labelindex && (flags & RBA_DATA_NOCOLS)) {
+        fprintf (stderr, "ERROR: -L needs the columns layout\n");
+        ret = -1;
+    }
+
+    /*  after -P, the terms are converted as the columns are stored */
+    if ((0 == ret) && (filtercount > 0)) {
+        rba_filter_init (&filter, cicfm_rbaspec, cicfm_cols, flags);
+        for (f = 0; (f < filtercount) && (0 == ret); f++) {
+            ret = rba_filter_add (&filter, filterlist[f]);
+            if (0 != ret) {
+                fprintf (stderr, "ERROR: bad filter \"%s\"\n", filterlist[f]);
+            }
+        }
+        filterp = &filter;
+    }
+
+    /*  shards are streamed, each into its own data set below <dirpath> */
+    if (0 != shards) {
+        flags |= RBA_DATA_STREAM;
+    }
+
+    /*  the interrupted run's files are rewound and appended to */
+    if (resuming) {
+        flags |= RBA_DATA_APPEND | RBA_DATA_RESUME;
+    }
+
+    if ((0 != ret) || (argc < ((0 != mergeshards) ? 4 : 5))) {
+        fprintf (stderr, usagestring, progname);
         ret = -1;
     } else {
 
         ret = strtouint64 (argv[1], &partitions);
         if (0 != ret) {
             fprintf (stderr, "ERROR: failed to parse first argument\n");
-            fprintf (stderr, usagestring, argv[0]);
+            fprintf (stderr, usagestring, progname);
         } else {
 
             ret = strtouint64 (argv[2], &repetitions);
             if (0 != ret) {
                 fprintf (stderr, "ERROR: failed to parse second argument\n");
-                fprintf (stderr, usagestring, argv[0]);
+                fprintf (stderr, usagestring, progname);
             } else {
                 dirpath = argv[3];
                 csvlist = argv + 4;
                 csvcount= argc - 4;
 
-                for (csv_idx = 0, total_reccount=0; 
-                        ((csv_idx < csvcount) && (0 == ret));
-                            csv_idx++) {
-                    ret = rba_checkhdr_countrecords (   cicfm_rbaspec,
-                                                        cicfm_cols,
-                                                        csvlist[csv_idx],
-                                                        &file_reccount);
-                    if (0 == ret) {
-                        printf("    %s is valid and contains %lu records\n",
-                                csvlist[csv_idx],
-                                file_reccount);
-                        total_reccount += file_reccount;
-                    }
-                    
+                if (0 != shards) {
+                    sharddir = shard_dirpath (dirpath, shard);
+                    ret = (NULL == sharddir) ? -1 : 0;
+                    dirpath = sharddir;
                 }
 
-                if (0 == ret) {
-                    printf("    Total number of records:    %lu\n",
-                            total_reccount);
-                    ret = rba_data_alloc (  &data,
-                                            cicfm_rbaspec,
-                                            cicfm_cols,
-                                            dirpath,
-                                            partitions,
-                                            repetitions,
-                                            total_reccount);
-                    if (0 == ret) {
-                        ret = rba_data_parse_csvs ( &data,
+                if ((0 == ret) && (0 != mergeshards)) {
+                    ret = merge_shards (dirpath, mergeshards, partitions, timesort, timecol, labelindex, labelcol);
+                } else if (0 == ret) {
+
+                    if (!(flags & RBA_DATA_STREAM)) {
+                        for (csv_idx = 0; ((csv_idx < csvcount) && (0 == ret)); csv_idx++) {
+                            if (!rba_input_seekable (csvlist[csv_idx])) {
+                                fprintf (stderr, "ERROR: %s can only be streamed, use -s\n", csvlist[csv_idx]);
+                                ret = -1;
+                            }
+                        }
+                    }
+
+                    if ((NULL != rateslist) || (NULL != repslist)) {
+                        bylabel = 1;
+                    }
+
+                    if ((0 == ret) && dedupe) {
+                        ret = rba_dedup_init (&dedup, (size_t)dedupmem << 20);
+                    }
+
+                    if ((0 == ret) && ((NULL != reportname) || (progress > 0))) {
+                        ret = rba_stats_init (&stats, cicfm_rbaspec, cicfm_cols, statsflags, progress);
+                        statsp = &stats;
+                    }
+
+                    rba_stats_switch (statsp, RBA_STAGE_COUNT);
+                    total_reccount = 0;
+                    if ((0 == ret) && bylabel) {
+                        ret = count_labels (csvlist,
+                                            csvcount,
+                                            flags,
+                                            dedupe ? &dedup : NULL,
+                                            filterp,
+                                            &strata,
+                                            &total_reccount);
+                    } else if ((0 == ret) && timeranges) {
+                        /*  the time ranges split the distinct records */
+                        if (dedupe) {
+                            ret = rba_dedup_scan (  &dedup,
+                                                    cicfm_rbaspec,
+                                                    cicfm_cols,
                                                     csvlist,
-                                                    csvcount);
-                        if (0 != ret) {
-                            fprintf (stderr, "ERROR: failed to parse CSVs!\n");
+                                                    csvcount,
+                                                    0,
+                                                    NULL,
+                                                    filterp,
+                                                    &total_reccount);
+                        }
+                        timebounds = (int64_t*)malloc (partitions * sizeof(int64_t));
+                        if ((0 == ret) && (NULL == timebounds)) {
                             ret = -1;
                         }
+                        if (0 == ret) {
+                            ret = rba_timerange_scan (  cicfm_rbaspec,
+                                                        cicfm_cols,
+                                                        timecol,
+                                                        csvlist,
+                                                        csvcount,
+                                                        partitions,
+                                                        filterp,
+                                                        dedupe ? &dedup : NULL,
+                                                        timebounds,
+                                                        &total_reccount);
+                        }
+                    } else if ((0 == ret) && dedupe && !(flags & RBA_DATA_STREAM)) {
+                        ret = rba_dedup_scan (  &dedup,
+                                                cicfm_rbaspec,
+                                                cicfm_cols,
+                                                csvlist,
+                                                csvcount,
+                                                0,
+                                                NULL,
+                                                filterp,
+                                                &total_reccount);
+                    } else if ((0 == ret) && (NULL != filterp) && !(flags & RBA_DATA_STREAM)) {
+                        ret = count_filtered (csvlist, csvcount, filterp, &total_reccount);
+                    } else if ((0 == ret) && !(flags & RBA_DATA_STREAM)) {
+                        ret = count_csvs (  csvlist,
+                                            csvcount,
+                                            cachename,
+                                            threads,
+                                            &total_reccount);
+                    }
+                    rba_stats_switch (statsp, RBA_STAGE_OTHER);
+                    stats.expected = total_reccount + dedup.duplicates;
 
-                        exit_ret = rba_data_free (&data);
-                        if (0 != exit_ret) {
-                            fprintf (stderr, "ERROR: clean up failed!\n");
-                            ret = -1;
+                    if ((0 == ret) && (NULL != rateslist)) {
+                        strata.rates = (double*)malloc (strata.classes * sizeof(double));
+                        ret = (NULL == strata.rates) ? -1 : 0;
+                        for (l = 0; (l < strata.classes) && (0 == ret); l++) {
+                            strata.rates[l] = 1.0;
+                        }
+                        if (0 == ret) {
+                            ret = parse_label_values (rateslist, strata.rates, NULL);
+                        }
+                    }
+                    if ((0 == ret) && (NULL != repslist)) {
+                        strata.repetitions = (uint32_t*)malloc (strata.classes * sizeof(uint32_t));
+                        ret = (NULL == strata.repetitions) ? -1 : 0;
+                        for (l = 0; (l < strata.classes) && (0 == ret); l++) {
+                            strata.repetitions[l] = (uint32_t)repetitions;
+                        }
+                        if (0 == ret) {
+                            ret = parse_label_values (repslist, NULL, strata.repetitions);
+                        }
+                    }
+
+                    if ((0 == ret) && resuming) {
+                        ret = rba_checkpoint_load (&resume, dirpath);
+                    }
+
+                    if (0 == ret) {
+                        if (dedupe && !(flags & RBA_DATA_STREAM)) {
+                            printf("    Duplicate records:          %lu\n",
+                                    dedup.duplicates);
+                        }
+                        if (!(flags & RBA_DATA_STREAM)) {
+                            printf("    Total number of records:    %lu\n",
+                                    total_reccount);
+                        }
+                        ret = rba_data_alloc (  &data,
+                                                cicfm_rbaspec,
+                                                cicfm_cols,
+                                                dirpath,
+                                                partitions,
+                                                repetitions,
+                                                total_reccount,
+                                                flags,
+                                                bylabel ? &strata : NULL);
+                        if (0 == ret) {
+                            if (dedupe) {
+                                rba_data_set_dedup (&data, &dedup);
+                            }
+                            if (NULL != filterp) {
+                                rba_data_set_filter (&data, filterp);
+                            }
+                            if (NULL != statsp) {
+                                rba_data_set_stats (&data, statsp);
+                            }
+                            if (0 != shards) {
+                                ret = rba_data_set_shard (&data, (uint32_t)shard, (uint32_t)shards, shardseed);
+                            }
+                            if ((0 == ret) && (0 != timebucket)) {
+                                ret = rba_data_set_timebuckets (&data, timecol, (int64_t)timebucket * 1000000);
+                            } else if ((0 == ret) && timeranges) {
+                                ret = rba_data_set_timeranges (&data, timecol, timebounds);
+                            }
+                            if ((0 == ret) && resuming) {
+                                ret = rba_data_resume (&data, &resume);
+                            }
+                            if ((0 == ret) && (checkpoint > 0)) {
+                                ret = rba_data_set_checkpoint (&data, dirpath, checkpoint);
+                            }
+                            if (0 == ret) {
+                                ret = rba_data_parse_csvs ( &data,
+                                                            csvlist,
+                                                            csvcount);
+                            }
+                            if (0 != ret) {
+                                fprintf (stderr, "ERROR: failed to parse CSVs!\n");
+                                ret = -1;
+                            } else {
+                                if (0 != data.filtered) {
+                                    printf("    Records rejected by filter:  %lu\n",
+                                            data.filtered);
+                                }
+                                if (0 != data.dropped) {
+                                    printf("    Records dropped by sampling: %lu\n",
+                                            data.dropped);
+                                }
+                            }
+
+                            exit_ret = rba_data_free (&data);
+                            if (0 != exit_ret) {
+                                fprintf (stderr, "ERROR: clean up failed!\n");
+                                ret = -1;
+                            }
+                            if ((0 == ret) && ((checkpoint > 0) || resuming)) {
+                                ret = rba_checkpoint_remove (dirpath);
+                            }
+
+                            rba_stats_switch (statsp, RBA_STAGE_SORT);
+                            for (p = 0; (p < partitions) && (0 == ret) && timesort; p++) {
+                                printf("    Sorting partition %u by timestamp\n", (unsigned)p);
+                                ret = rba_sort_partition (  cicfm_rbaspec,
+                                                            cicfm_cols,
+                                                            dirpath,
+                                                            p,
+                                                            timecol);
+                            }
+                            rba_stats_switch (statsp, RBA_STAGE_OTHER);
+                            for (p = 0; (p < partitions) && (0 == ret) && labelindex; p++) {
+                                ret = rba_labels_build (cicfm_rbaspec, cicfm_cols, dirpath, p, labelcol);
+                            }
                         }
                     }
                 }
+                if ((0 == ret) && (NULL != reportname) &&
+                        (0 != rba_stats_report (statsp, reportname))) {
+                    ret = -1;
+                }
+                rba_stats_free (&stats);
+                free (strata.samples);
+                free (strata.rates);
+                free (strata.repetitions);
+                rba_dedup_free (&dedup);
+                rba_checkpoint_free (&resume);
+                free (timebounds);
+                free (sharddir);
             }
         }
     }
 
+    rba_filter_free (&filter);
+    free (filterlist);
+
     return ret;
 }
 
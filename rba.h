@@ -36,6 +36,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
@@ -61,6 +62,17 @@ extern int
 strtodouble (   const char  *str,
                 double      *out_p);
 
+extern int
+rba_parse_decimal_u64 (const char  *str,
+                        uint64_t    max,
+                        uint64_t    *out_p);
+
+extern int
+rba_parse_decimal_i64 (const char  *str,
+                        int64_t     min,
+                        int64_t     max,
+                        int64_t     *out_p);
+
 #define RBA_HEADER_MAGIC 0x52414E4942574152 /* RAWBINAR */
 #ifndef RBA_HEADER_VERSION
     #define RBA_HEADER_VERSION 0x0000
@@ -75,28 +87,394 @@ typedef struct {
     uint16_t    rba_header_version;
 } rba_header_t;
 
+/*  A packed RBA file (rba_header_version RBA_HEADER_VERSION_PACKED) holds a
+    sequence of chunks from data_offset on, each an rba_chunk_header_t followed
+    by packed_size bytes, then an array of rba_chunk_index_t and finally an
+    rba_packed_trailer_t as the last bytes of the file. records in the
+    rba_header_t counts the unpacked elements. */
+#define RBA_HEADER_VERSION_PACKED (0x0001)
+#define RBA_PACKED_MAGIC 0x4B4E554843414252 /* RBACHUNK */
+
+#define RBA_CODEC_RAW           (0)
+#define RBA_CODEC_SHUFFLE_RLE   (1)
+#define RBA_CODEC_PAX_GROUP     (2)
+
+typedef struct {
+    uint32_t    records;
+    uint32_t    packed_size;
+    uint32_t    codec;
+    uint32_t    reserved;
+} rba_chunk_header_t;
+
+typedef struct {
+    uint64_t    offset;
+    uint64_t    first_record;
+    uint32_t    records;
+    uint32_t    packed_size;
+    uint32_t    codec;
+    uint32_t    reserved;
+} rba_chunk_index_t;
+
+typedef struct {
+    uint64_t    index_offset;
+    uint64_t    chunks;
+    uint64_t    magic;
+} rba_packed_trailer_t;
+
+extern size_t
+rba_codec_pack (const void  *src,
+                size_t      records,
+                size_t      elm_sz,
+                void        *dst,
+                void        *scratch);
+
+extern int
+rba_codec_unpack (  uint32_t    codec,
+                    const void  *src,
+                    size_t      srclen,
+                    size_t      records,
+                    size_t      elm_sz,
+                    void        *dst,
+                    void        *scratch);
+
+typedef struct {
+    int                 fd;
+    rba_header_t        hdr;
+    rba_chunk_index_t   *chunks;
+    uint64_t            chunk_count;
+    uint64_t            maxchunk;
+    void                *scratch;
+} rba_packed_file_t;
+
+extern int
+rba_packed_load_index ( int                 fd,
+                        const char          *filename,
+                        rba_header_t        *hdr,
+                        rba_chunk_index_t   **chunks_p,
+                        uint64_t            *chunk_count_p,
+                        uint64_t            *index_offset_p);
+
+extern int
+rba_packed_open (   rba_packed_file_t   *pf,
+                    const char          *filename);
+
+extern int
+rba_packed_read (   rba_packed_file_t   *pf,
+                    uint64_t            first,
+                    uint64_t            count,
+                    void                *dst);
+
+extern void
+rba_packed_close (rba_packed_file_t *pf);
+
+/*  With RBA_DATA_CHECKSUM, every RBA file gets a sidecar <file>.crc, an RBA
+    file of rba_crc_entry_t with the CRC32C of consecutive byte ranges of the
+    file: the header and descriptor, then every flushed buffer or chunk, and
+    for packed files the chunk index and trailer. */
+#define RBA_CRC_MAGIC 0x4332334352434252 /* RBCRC32C */
+#define RBA_CRC_SUFFIX ".crc"
+#define RBA_CRC_SPAN (1 << 20) /* bytes per range when checksumming a file */
+
+typedef struct {
+    uint64_t    offset;
+    uint32_t    length;
+    uint32_t    crc;
+} rba_crc_entry_t;
+
+extern uint32_t
+rba_crc32c (uint32_t    crc,
+            const void  *buf,
+            size_t      len);
+
+extern int
+rba_crc_write ( const char              *filename,
+                const rba_crc_entry_t   *entries,
+                uint64_t                count);
+
+extern int
+rba_crc_read (  const char      *filename,
+                rba_crc_entry_t **entries_p,
+                uint64_t        *count_p);
+
+extern int
+rba_crc_range ( int                 fd,
+                uint64_t            offset,
+                uint64_t            len,
+                rba_crc_entry_t     **entries_p,
+                uint64_t            *count_p,
+                uint64_t            *cap_p);
+
+extern int
+rba_crc_file (const char *filename);
+
+extern int
+rba_verify_file (   const char  *filename,
+                    int         *checked_p);
+
+/*  With RBA_DATA_ZONEMAP, every column file gets a sidecar <file>.zone, an
+    RBA file of rba_zone_entry_t with the minimum, maximum and NaN count of
+    every flushed buffer or chunk, after an rba_zone_desc_t. Values are
+    compared as the zone kind of the column type. NaNs are left out of the
+    minimum and maximum, and a zone of only NaNs has min > max. */
+#define RBA_ZONE_MAGIC 0x454E4F5A4D414252 /* RBAMZONE */
+#define RBA_ZONE_SUFFIX ".zone"
+
+#define RBA_ZONE_NONE   (0)
+#define RBA_ZONE_UINT   (1)
+#define RBA_ZONE_INT    (2)
+#define RBA_ZONE_FLOAT  (3)
+
+typedef union {
+    uint64_t            u;
+    int64_t             i;
+    double              f;
+} rba_zone_value_t;
+
+typedef struct {
+    uint64_t            first;
+    uint32_t            records;
+    uint32_t            nulls;
+    rba_zone_value_t    min;
+    rba_zone_value_t    max;
+} rba_zone_entry_t;
+
+typedef struct {
+    uint64_t            records;
+    uint32_t            kind;
+    uint32_t            typesize;
+} rba_zone_desc_t;
+
+/*  rows whose value in column col lies in [min, max], as the zone kind */
+typedef struct {
+    uint32_t            col;
+    uint32_t            reserved;
+    rba_zone_value_t    min;
+    rba_zone_value_t    max;
+} rba_predicate_t;
+
+typedef struct {
+    uint64_t            first;
+    uint64_t            records;
+} rba_range_t;
+
+extern int
+rba_zone_add (  uint32_t            kind,
+                size_t              elm_sz,
+                const void          *arr,
+                size_t              count,
+                uint64_t            first,
+                rba_zone_entry_t    *entry);
+
+extern int
+rba_zone_write (const char              *filename,
+                uint32_t                kind,
+                uint32_t                typesize,
+                const rba_zone_entry_t  *entries,
+                uint64_t                count);
+
+extern int
+rba_zone_read ( const char          *filename,
+                rba_zone_desc_t     *desc,
+                rba_zone_entry_t    **entries_p,
+                uint64_t            *count_p);
+
+extern int
+rba_zone_file ( const char  *filename,
+                uint32_t    kind);
+
+extern int
+rba_zone_refresh (const char *filename);
+
+/*  Concatenating RBA files and data sets of the same spec */
+extern int
+rba_merge_file (const char  *dst,
+                const char  **srcs,
+                uint32_t    n);
+
+extern int
+rba_merge_dataset ( const char  *dirpath,
+                    const char  **srcdirs,
+                    uint32_t    n,
+                    uint32_t    partitions);
+
 struct rba_type_s;
 typedef struct rba_type_s rba_type_t;
 
+struct rba_input_s;
+typedef struct rba_input_s rba_input_t;
+
+struct rba_stats_s;
+typedef struct rba_stats_s rba_stats_t;
+
+extern int
+rba_input_seekable (const char *name);
+
+extern int
+rba_input_open (rba_input_t **in_p,
+                const char  *name);
+
+extern int
+rba_input_open_at ( rba_input_t **in_p,
+                    const char  *name,
+                    uint64_t    offset);
+
+extern ssize_t
+rba_input_getline ( rba_input_t *in,
+                    char        **line_p,
+                    size_t      *bufsz_p);
+
+extern int
+rba_input_error (rba_input_t *in);
+
+extern int
+rba_input_close (rba_input_t *in);
+
+/*  called with the buffered elements before a buffer is flushed */
+typedef int (*rba_buf_hook_t) ( void        *ctx,
+                                const void  *arr,
+                                size_t      count);
+
 typedef struct {
-    FILE        *filep;
-    void        *arr;
-    uint64_t    total;
-    size_t      elm_sz;
-    size_t      len;
-    size_t      idx;
+    FILE                *filep;
+    void                *arr;
+    uint64_t            total;
+    size_t              elm_sz;
+    size_t              len;
+    size_t              idx;
+    uint32_t            flags;
+    void                *packbuf;
+    rba_chunk_index_t   *chunks;
+    uint64_t            chunk_count;
+    uint64_t            chunk_cap;
+    rba_buf_hook_t      hook;
+    void                *hookctx;
+    rba_stats_t         *stats;
+    char                *filename;
+    rba_crc_entry_t     *crcs;
+    uint64_t            crc_count;
+    uint64_t            crc_cap;
+    uint64_t            crc_pos;
+    uint32_t            zone;
+    rba_zone_entry_t    *zones;
+    uint64_t            zone_count;
+    uint64_t            zone_cap;
 } rba_buf_t;
 
 #define RBA_BUF_DEFAULTLEN (4096)
 
+/*  flags passed from rba_data_alloc down to each rba_type_t initbuf */
+#define RBA_DATA_APPEND (0x00000001) /* append to existing RBA files */
+#define RBA_DATA_STREAM (0x00000002) /* no record count, deal partitions */
+#define RBA_DATA_PACKED (0x00000004) /* write packed (compressed) files */
+#define RBA_DATA_ROWS   (0x00000008) /* write a row file per partition */
+#define RBA_DATA_NOCOLS (0x00000010) /* stage columns without writing them */
+#define RBA_DATA_PAX    (0x00000020) /* write a row group file per partition */
+#define RBA_DATA_STRATIFY (0x00000040) /* balance classes over partitions */
+#define RBA_DATA_LEGACYINT (0x00000080) /* strtoull integers, "010" is octal */
+#define RBA_DATA_CHECKSUM (0x00000100) /* write a CRC32C sidecar per file */
+#define RBA_DATA_RESUME (0x00000200) /* continue from a checkpoint */
+#define RBA_DATA_ZONEMAP (0x00000400) /* write a zone map sidecar per column */
+
+/*  Sharded conversions split the CSV files into blocks of RBA_SHARD_BLOCK
+    bytes, see rba_data_set_shard. */
+#define RBA_SHARD_BLOCK (64 * 1024 * 1024)
+
+/*  A checkpoint (<dirpath>/checkpoint.bin) is an RBA file of type
+    RBA_CHECKPOINT_MAGIC. The header is followed by an rba_checkpoint_desc_t
+    and one rba_checkpoint_buf_t per output buffer: the column buffers by
+    column and partition, then the row and the PAX buffers by partition.
+    After them come the partition picker state, partsmpl_remaining, the
+    partition decks and deck positions, stratsmpl_remaining, class_keep and
+    class_left, and finally the chunk index of every packed file. */
+#define RBA_CHECKPOINT_MAGIC 0x544E504B48434252 /* RBCHKPNT */
+#define RBA_CHECKPOINT_FILENAME "checkpoint.bin"
+
+#define RBA_CHECKPOINT_OPEN     (0x00000001) /* the buffer writes a file */
+#define RBA_CHECKPOINT_PACKED   (0x00000002) /* the file is packed */
+#define RBA_CHECKPOINT_CRC      (0x00000004) /* the file has a CRC sidecar */
+
+typedef struct {
+    uint64_t            total;
+    uint64_t            dataend;
+    uint64_t            chunks;
+    uint32_t            flags;
+    uint32_t            reserved;
+} rba_checkpoint_buf_t;
+
+typedef struct {
+    uint32_t            partitions;
+    uint32_t            cols;
+    uint32_t            strata;
+    uint32_t            classes;
+    uint32_t            flags;
+    uint32_t            csv;        /* CSV file being read */
+    uint64_t            csvhash;    /* of the CSV file names */
+    uint64_t            csvline;    /* lines read from it, with the header */
+    uint64_t            csvoffset;  /* bytes read from it */
+    uint64_t            lines;      /* records read from all CSV files */
+    uint64_t            rng_state;
+    uint64_t            totsmpl_remaining;
+    uint64_t            dropped;
+    uint64_t            duplicates;
+    uint64_t            dedup_position;
+    uint64_t            filtered;
+} rba_checkpoint_desc_t;
+
+struct rba_checkpoint_s;
+typedef struct rba_checkpoint_s rba_checkpoint_t;
+
+/*  a checkpoint read back by rba_checkpoint_load */
+typedef struct {
+    rba_checkpoint_desc_t   desc;
+    rba_checkpoint_buf_t    *bufs;
+    uint64_t                count;
+    uint32_t                *partsmpl_remaining;
+    uint32_t                *partdeck;
+    uint32_t                *deckpos;
+    uint64_t                *stratsmpl_remaining;
+    uint64_t                *class_keep;
+    uint64_t                *class_left;
+} rba_resume_t;
+
 extern int
 rba_buf_alloc ( rba_type_t  *type,
                 const char  *filename,
+                uint32_t    flags,
                 rba_buf_t   *buf);
 
+extern int
+rba_buf_alloc_desc (rba_type_t  *type,
+                    const char  *filename,
+                    uint32_t    flags,
+                    const void  *desc,
+                    size_t      desclen,
+                    rba_buf_t   *buf);
+
+extern int
+rba_buf_alloc_staging ( rba_type_t  *type,
+                        const char  *filename,
+                        uint32_t    flags,
+                        rba_buf_t   *buf);
+
+extern int
+rba_buf_write_chunk (   rba_buf_t   *buf,
+                        uint32_t    records,
+                        uint32_t    codec,
+                        const void  *payload,
+                        size_t      size);
+
 extern int
 rba_buf_simple_flush (rba_buf_t *buf);
 
+extern int
+rba_buf_sync (  rba_buf_t               *buf,
+                rba_checkpoint_buf_t    *entry);
+
+extern int
+rba_buf_rewind (const char                  *filename,
+                const rba_checkpoint_buf_t  *entry,
+                const rba_chunk_index_t     *chunks);
+
 extern int
 rba_buf_simple_free (   rba_type_t  *type,
                         rba_buf_t   *buf);
@@ -112,30 +490,585 @@ extern rba_type_t rba_type_u64;
 extern rba_type_t rba_type_i64;
 extern rba_type_t rba_type_float;
 extern rba_type_t rba_type_double;
+extern rba_type_t rba_type_ipv4;
+extern rba_type_t rba_type_ipv4_prefix24;
+extern rba_type_t rba_type_ipv6;
+extern rba_type_t rba_type_timestamp;
+
+extern int
+rba_parse_ipv4 (const char  *str,
+                uint32_t    *addr_p);
+
+extern int
+rba_parse_ipv6 (const char  *str,
+                uint64_t    *hi_p,
+                uint64_t    *lo_p);
+
+extern int
+rba_parse_timestamp (   const char  *str,
+                        int64_t     *usec_p);
 
 typedef struct {
     const char      *name;
     rba_type_t      *type;
 } rba_spec_entry_t;
 
+/*  A row file (p<partition>/rows.bin) stores one fixed size record per row
+    with every stored column of the spec as a field. The header is followed by
+    an rba_row_desc_t and its fields, data_offset points past them. Fields are
+    in spec order, each aligned to its size, and rows are padded to the
+    largest field size. */
+#define RBA_ROWS_MAGIC 0x000053574F524252 /* RBROWS */
+#define RBA_ROWS_FILENAME "rows.bin"
+#define RBA_ROW_NAMELEN (48)
+
+typedef struct {
+    char        name[RBA_ROW_NAMELEN];
+    uint64_t    type_magic;
+    uint32_t    column;
+    uint32_t    offset;
+    uint32_t    size;
+    uint32_t    reserved;
+} rba_row_field_t;
+
+typedef struct {
+    uint32_t    fields;
+    uint32_t    rowsize;
+} rba_row_desc_t;
+
+extern int
+rba_rows_layout (   rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    rba_row_desc_t      **desc_p,
+                    size_t              *desclen_p);
+
+/*  Records are classified by column col into classes classes. samples holds
+    the number of records of each class, and may be NULL for streamed input.
+    With RBA_DATA_STRATIFY, the share of every class is kept the same in all
+    partitions. rates holds the fraction of the records of each class that is
+    kept and repetitions the number of partitions each kept record is written
+    to. Either may be NULL for all 1.0 and the repetitions passed to
+    rba_data_alloc respectively. */
+typedef struct {
+    uint32_t            col;
+    uint32_t            classes;
+    uint64_t            *samples;
+    double              *rates;
+    uint32_t            *repetitions;
+} rba_strata_t;
+
+#define RBA_CLASS_MAXLEN (256)
+
+/*  A row filter keeps the records for which all of its terms hold, a term
+    compares one column with a constant: "<column> <op> <value>" with op one
+    of == != < <= > >=. Terms are joined with "&&". The value and the fields
+    are converted as the column type stores them and compared as its zone
+    kind, so NaN only passes !=. Rejected records are dropped before they
+    are sampled, deduplicated or assigned partitions. */
+#define RBA_FILTER_EQ   (0)
+#define RBA_FILTER_NE   (1)
+#define RBA_FILTER_LT   (2)
+#define RBA_FILTER_LE   (3)
+#define RBA_FILTER_GT   (4)
+#define RBA_FILTER_GE   (5)
+
+typedef struct {
+    uint32_t            col;
+    uint32_t            op;
+    rba_zone_value_t    value;
+} rba_filter_term_t;
+
+typedef struct {
+    rba_spec_entry_t    *spec;
+    uint32_t            cols;
+    uint32_t            flags;      /* RBA_DATA_LEGACYINT */
+    rba_filter_term_t   *terms;     /* sorted by column */
+    uint32_t            count;
+} rba_filter_t;
+
+extern int
+rba_filter_init (   rba_filter_t        *filter,
+                    rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    uint32_t            flags);
+
+extern int
+rba_filter_add (rba_filter_t    *filter,
+                const char      *expr);
+
+extern int
+rba_filter_line (   const rba_filter_t  *filter,
+                    const char          *line);
+
+extern int
+rba_filter_count (  const rba_filter_t  *filter,
+                    const char          *filename,
+                    uint64_t            *records_p);
+
+extern void
+rba_filter_free (rba_filter_t *filter);
+
+struct rba_rows_s;
+typedef struct rba_rows_s rba_rows_t;
+
+/*  A PAX file (p<partition>/pax.bin) is a packed RBA file of type
+    RBA_PAX_MAGIC whose chunks are row groups (codec RBA_CODEC_PAX_GROUP) of
+    up to RBA_BUF_DEFAULTLEN rows. The header is followed by the same
+    descriptor as a row file. The payload of a group starts with one uint64_t
+    per field, the offset of the field's column chunk from the start of the
+    payload, followed by the column chunks, each 8 byte aligned. */
+#define RBA_PAX_MAGIC 0x0000005841504252 /* RBPAX */
+#define RBA_PAX_FILENAME "pax.bin"
+
+struct rba_pax_s;
+typedef struct rba_pax_s rba_pax_t;
+
+typedef struct {
+    int                 fd;
+    rba_header_t        hdr;
+    rba_row_desc_t      *desc;
+    rba_row_field_t     *fields;
+    rba_chunk_index_t   *groups;
+    uint64_t            group_count;
+    uint64_t            *dir;
+    uint8_t             *scratch;
+    size_t              scratchlen;
+} rba_pax_file_t;
+
+extern int
+rba_pax_open (  rba_pax_file_t  *pf,
+                const char      *filename);
+
+extern int
+rba_pax_read (  rba_pax_file_t  *pf,
+                uint64_t        first,
+                uint64_t        count,
+                const uint32_t  *fields,
+                uint32_t        nfields,
+                void            *dst);
+
+extern void
+rba_pax_close (rba_pax_file_t *pf);
+
+/*  Duplicate row elimination. Rows are keyed on a 128 bit hash of their
+    stored fields, kept in an open addressing table of at most membound
+    bytes. */
+#define RBA_DEDUP_SPILLBITS (8)
+#define RBA_DEDUP_SPILLS    (1 << RBA_DEDUP_SPILLBITS)
+
+typedef struct {
+    uint64_t            lo;
+    uint64_t            hi;
+} rba_hash128_t;
+
+typedef struct {
+    rba_hash128_t       *table;
+    uint64_t            mask;
+    uint64_t            used;
+    size_t              membound;
+    uint8_t             *dupmap;
+    uint64_t            dupmaplen;
+    uint64_t            records;
+    uint64_t            duplicates;
+    uint64_t            position;
+    int                 scanned;
+    int                 spilled;
+    FILE                *spills[RBA_DEDUP_SPILLS];
+    char                *scratch;
+    size_t              scratchlen;
+} rba_dedup_t;
+
+extern void
+rba_hash128 (   const void      *key,
+                size_t          len,
+                rba_hash128_t   *hash);
+
+extern int
+rba_dedup_init (rba_dedup_t *dedup,
+                size_t      membound);
+
+extern int
+rba_dedup_hashline (rba_dedup_t         *dedup,
+                    rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *line,
+                    rba_hash128_t       *hash);
+
+extern int
+rba_dedup_insert (  rba_dedup_t         *dedup,
+                    const rba_hash128_t *hash);
+
+extern int
+rba_dedup_scan (rba_dedup_t         *dedup,
+                rba_spec_entry_t    *spec,
+                uint32_t            cols,
+                const char          **csvnames,
+                int                 csvcount,
+                uint32_t            col,
+                uint64_t            *classcounts,
+                const rba_filter_t  *filter,
+                uint64_t            *records_p);
+
+extern int
+rba_dedup_marked (  const rba_dedup_t   *dedup,
+                    uint64_t            ordinal);
+
+extern int
+rba_dedup_check (   rba_dedup_t         *dedup,
+                    rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *line);
+
+extern void
+rba_dedup_free (rba_dedup_t *dedup);
+
+/*  Stages of a conversion. Time is charged to one stage at a time, the one
+    last switched to, so the stages add up to the run time. */
+#define RBA_STAGE_OTHER     (0)
+#define RBA_STAGE_COUNT     (1) /* counting pass before the conversion */
+#define RBA_STAGE_READ      (2) /* reading and decompressing lines */
+#define RBA_STAGE_DEDUP     (3) /* duplicate check */
+#define RBA_STAGE_SELECT    (4) /* row filter, label lookup and sampling */
+#define RBA_STAGE_PICK      (5) /* picking partitions */
+#define RBA_STAGE_PARSE     (6) /* tokenizing and parsing the columns */
+#define RBA_STAGE_WRITE     (7) /* flushing buffers */
+#define RBA_STAGE_CLOSE     (8) /* closing the output files */
+#define RBA_STAGE_SORT      (9) /* sorting partitions */
+#define RBA_STAGES          (10)
+
+#define RBA_STATS_COLUMNS   (0x00000001) /* time the parsing of each column */
+
+struct rba_stats_s {
+    rba_spec_entry_t    *spec;
+    uint32_t            cols;
+    uint32_t            flags;
+    uint32_t            stage;
+    uint64_t            last;
+    uint64_t            ticks[RBA_STAGES];
+    uint64_t            *colticks;
+    uint64_t            records_read;
+    uint64_t            records_written;
+    uint64_t            bytes_read;
+    uint64_t            bytes_written;
+    uint64_t            flushes;
+    uint64_t            dropped;
+    uint64_t            duplicates;
+    uint64_t            filtered;
+    uint64_t            expected;
+    uint64_t            start_ticks;
+    double              start;
+    double              interval;
+    double              next_progress;
+    int                 progressed;
+};
+
+extern uint64_t
+rba_stats_ticks (void);
+
+extern int
+rba_stats_init (rba_stats_t         *stats,
+                rba_spec_entry_t    *spec,
+                uint32_t            cols,
+                uint32_t            flags,
+                double              interval);
+
+extern uint32_t
+rba_stats_switch (  rba_stats_t *stats,
+                    uint32_t    stage);
+
+extern void
+rba_stats_progress (rba_stats_t *stats);
+
+extern void
+rba_stats_progress_done (rba_stats_t *stats);
+
+extern int
+rba_stats_report (  rba_stats_t *stats,
+                    const char  *filename);
+
+extern void
+rba_stats_free (rba_stats_t *stats);
+
 typedef struct {
     rba_spec_entry_t    *spec;
     rba_buf_t           *bufs;
     uint32_t            *partsmpl_remaining;
     uint32_t            *partidxbuf;
+    uint32_t            *partdeck;
+    uint32_t            *deckpos;
+    uint64_t            *stratsmpl_remaining;
+    uint64_t            *fenwick;
+    uint32_t            fenwick_top;
+    uint32_t            strata;
+    uint32_t            classes;
+    uint32_t            classcol;
+    uint64_t            *class_keep;
+    uint64_t            *class_left;
+    double              *class_rates;
+    uint32_t            *class_reps;
+    uint32_t            maxrepetitions;
+    uint64_t            dropped;
+    rba_filter_t        *filter;
+    uint64_t            filtered;
+    rba_dedup_t         *dedup;
+    uint64_t            duplicates;
+    rba_stats_t         *stats;
+    uint32_t            timecol;
+    int64_t             timebucket;
+    int64_t             *timebounds;
+    rba_rows_t          *rows;
+    rba_pax_t           *pax;
+    rba_checkpoint_t    *checkpoint;
+    uint32_t            csv;
+    uint64_t            csvhash;
+    uint64_t            csvline;
+    uint64_t            csvoffset;
+    uint64_t            lines;
+    uint32_t            shard;
+    uint32_t            shards;
+    uint64_t            shardseed;
     uint64_t            totsmpl_remaining;
     uint32_t            cols;
     uint32_t            partitions;
     uint32_t            repetitions;
+    uint32_t            flags;
     uint64_t            rng_state;
 } rba_data_t;
 
+extern int
+rba_checkhdr_line ( rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    char                *line);
+
+extern int
+rba_checkhdr (  rba_spec_entry_t    *spec,
+                uint32_t            cols,
+                FILE*               filep);
+
 extern int
 rba_checkhdr_countrecords ( rba_spec_entry_t    *spec,
                             uint32_t            cols,
                             const char          *filename,
                             uint64_t            *reccount_p);
 
+extern int
+rba_line_class (rba_spec_entry_t    *spec,
+                uint32_t            col,
+                const char          *line,
+                uint32_t            *class_p);
+
+extern int
+rba_checkhdr_countclasses ( rba_spec_entry_t    *spec,
+                            uint32_t            cols,
+                            uint32_t            col,
+                            const char          *filename,
+                            const rba_filter_t  *filter,
+                            uint64_t            *classcounts);
+
+extern uint64_t
+rba_count_newlines (const char  *buf,
+                    size_t      len);
+
+extern int
+rba_checkhdr_countrecords_parallel (rba_spec_entry_t    *spec,
+                                    uint32_t            cols,
+                                    const char          **filenames,
+                                    int                 count,
+                                    uint32_t            threads,
+                                    uint64_t            *reccounts);
+
+typedef struct {
+    char        *path;
+    uint64_t    size;
+    int64_t     mtime_sec;
+    int64_t     mtime_nsec;
+    uint64_t    samplehash;
+    uint64_t    records;
+} rba_cache_entry_t;
+
+typedef struct {
+    const char          *filename;
+    rba_cache_entry_t   *entries;
+    size_t              count;
+    size_t              cap;
+    uint64_t            spechash;
+    int                 dirty;
+} rba_cache_t;
+
+extern int
+rba_cache_load (rba_cache_t         *cache,
+                const char          *filename,
+                rba_spec_entry_t    *spec,
+                uint32_t            cols);
+
+extern int
+rba_cache_save (rba_cache_t *cache);
+
+extern void
+rba_cache_free (rba_cache_t *cache);
+
+extern int
+rba_cache_lookup (  rba_cache_t *cache,
+                    const char  *filename,
+                    uint64_t    *reccount_p,
+                    int         *hit_p);
+
+extern int
+rba_cache_update (  rba_cache_t *cache,
+                    const char  *filename,
+                    uint64_t    reccount);
+
+/*  madvise hints for the mapped columns of an rba_reader_t */
+#define RBA_ADVICE_NORMAL       (0)
+#define RBA_ADVICE_SEQUENTIAL   (1)
+#define RBA_ADVICE_RANDOM       (2)
+#define RBA_ADVICE_WILLNEED     (3)
+#define RBA_ADVICE_DONTNEED     (4)
+
+/*  records of one column of a partition. data points into the mapping of the
+    column file, or into a decoded copy for packed files. */
+typedef struct {
+    const void          *data;
+    uint64_t            records;
+    size_t              typesize;
+    rba_type_t          *type;
+} rba_view_t;
+
+#define rba_view_as(view, ctype) ((const ctype*)((view)->data))
+
+typedef struct {
+    int                 fd;
+    int                 opened;
+    void                *map;
+    size_t              maplen;
+    void                *decoded;
+    rba_header_t        hdr;
+} rba_column_t;
+
+typedef struct {
+    char                *partpath;
+    rba_spec_entry_t    *spec;
+    rba_column_t        *columns;
+    uint32_t            cols;
+    uint32_t            partition;
+    int                 advice;
+} rba_reader_t;
+
+extern int
+rba_open (  rba_reader_t        *reader,
+            rba_spec_entry_t    *spec,
+            uint32_t            cols,
+            const char          *dirpath,
+            uint32_t            partition,
+            int                 advice);
+
+extern int
+rba_column_view (   rba_reader_t    *reader,
+                    uint32_t        col,
+                    rba_view_t      *view);
+
+extern int
+rba_column_advise ( rba_reader_t    *reader,
+                    uint32_t        col,
+                    int             advice);
+
+extern int
+rba_close (rba_reader_t *reader);
+
+extern int
+rba_zone_ranges (   rba_reader_t            *reader,
+                    const rba_predicate_t   *preds,
+                    uint32_t                n,
+                    rba_range_t             **ranges_p,
+                    uint64_t                *count_p);
+
+#define RBA_GATHER_ROWMAJOR     (0)
+#define RBA_GATHER_COLMAJOR     (1)
+
+#define RBA_GATHER_MMAP         (0)
+#define RBA_GATHER_PREADV       (1)
+
+#define RBA_GATHER_MAXGAP       (32*1024)   /* bytes skipped within a read */
+#define RBA_GATHER_MAXIOV       (1024)      /* iovecs per preadv, IOV_MAX */
+#define RBA_GATHER_PREFETCH     (8)         /* rows prefetched ahead */
+
+struct iovec;
+
+typedef struct {
+    rba_reader_t        *reader;
+    uint32_t            *cols;
+    size_t              *typesizes;
+    size_t              *offsets;
+    struct iovec        *iov;
+    void                *sink;
+    uint64_t            records;
+    size_t              rowsize;
+    size_t              count;
+    uint32_t            ncols;
+    int                 layout;
+    int                 method;
+} rba_gather_t;
+
+extern int
+rba_gather_init (   rba_gather_t    *gather,
+                    rba_reader_t    *reader,
+                    const uint32_t  *cols,
+                    uint32_t        ncols,
+                    size_t          count,
+                    int             layout,
+                    int             method);
+
+extern int
+rba_gather (rba_gather_t    *gather,
+            const uint64_t  *indices,
+            void            *dst);
+
+extern void
+rba_gather_free (rba_gather_t *gather);
+
+extern int
+rba_rows_alloc (rba_data_t  *data,
+                const char  *dirpath);
+
+extern int
+rba_rows_records (  rba_data_t  *data,
+                    uint32_t    p,
+                    uint64_t    *records_p);
+
+extern int
+rba_rows_store (rba_data_t *data);
+
+extern int
+rba_rows_free (rba_data_t *data);
+
+extern rba_buf_t*
+rba_rows_getbuf (   rba_data_t  *data,
+                    uint32_t    p);
+
+extern void
+rba_rows_set_stats (rba_data_t  *data,
+                    rba_stats_t *stats);
+
+extern int
+rba_pax_alloc ( rba_data_t  *data,
+                const char  *dirpath);
+
+extern int
+rba_pax_records (   rba_data_t  *data,
+                    uint32_t    p,
+                    uint64_t    *records_p);
+
+extern int
+rba_pax_free (rba_data_t *data);
+
+extern rba_buf_t*
+rba_pax_getbuf (rba_data_t  *data,
+                uint32_t    p);
+
+extern void
+rba_pax_set_stats ( rba_data_t  *data,
+                    rba_stats_t *stats);
+
 extern int
 rba_data_alloc (rba_data_t          *data,
                 rba_spec_entry_t    *spec,
@@ -143,11 +1076,162 @@ rba_data_alloc (rba_data_t          *data,
                 const char          *dirpath,
                 uint32_t            partitions,
                 uint32_t            repetitions,
-                uint64_t            samples);
+                uint64_t            samples,
+                uint32_t            flags,
+                const rba_strata_t  *strata);
 
 extern int
 rba_data_free (rba_data_t *data);
 
+extern void
+rba_data_set_dedup (rba_data_t  *data,
+                    rba_dedup_t *dedup);
+
+extern void
+rba_data_set_filter (rba_data_t     *data,
+                     rba_filter_t   *filter);
+
+extern void
+rba_data_set_stats (rba_data_t  *data,
+                    rba_stats_t *stats);
+
+extern int
+rba_data_set_timebuckets (  rba_data_t  *data,
+                            uint32_t    col,
+                            int64_t     width);
+
+extern int
+rba_data_set_timeranges (   rba_data_t      *data,
+                            uint32_t        col,
+                            const int64_t   *bounds);
+
+extern int
+rba_data_set_shard (rba_data_t  *data,
+                    uint32_t    shard,
+                    uint32_t    shards,
+                    uint64_t    seed);
+
+extern int
+rba_data_set_checkpoint (   rba_data_t  *data,
+                            const char  *dirpath,
+                            double      interval);
+
+extern int
+rba_data_checkpoint (rba_data_t *data);
+
+extern int
+rba_checkpoint_load (   rba_resume_t    *resume,
+                        const char      *dirpath);
+
+extern int
+rba_data_resume (   rba_data_t          *data,
+                    const rba_resume_t  *resume);
+
+extern void
+rba_checkpoint_free (rba_resume_t *resume);
+
+extern int
+rba_checkpoint_remove (const char *dirpath);
+
+/*  Timestamp columns sorted by rba_sort_partition carry the time range of
+    their partition in a descriptor between the header and the data. */
+#define RBA_TRANGE_MAGIC 0x45474E4152544252 /* RBTRANGE */
+
+typedef struct {
+    uint64_t            magic;
+    int64_t             min;
+    int64_t             max;
+    uint64_t            reserved;
+} rba_timerange_t;
+
+#define RBA_TIME_SAMPLES (1 << 20)
+
+extern int
+rba_timerange_scan (rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    uint32_t            col,
+                    const char          **csvnames,
+                    int                 csvcount,
+                    uint32_t            partitions,
+                    const rba_filter_t  *filter,
+                    const rba_dedup_t   *dedup,
+                    int64_t             *bounds,
+                    uint64_t            *records_p);
+
+extern int
+rba_sort_partition (rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *dirpath,
+                    uint32_t            partition,
+                    uint32_t            col);
+
+extern int
+rba_read_timerange (const char      *filename,
+                    rba_timerange_t *range);
+
+/*  A label index (p<partition>/labels.bin) holds the rows of the partition
+    with each class of a categorical column, roaring style: the rows are
+    cut into blocks of RBA_LABELS_BLOCK, and a class has a container for
+    every block it occurs in, either the sorted low 16 bits of its rows
+    there, padded to 8 bytes, or a bitmap of the block when it has more than
+    RBA_LABELS_ARRAYMAX rows. The header counts the uint64_t words of the
+    container payload (typesize 8) and is followed by an rba_labels_desc_t,
+    one rba_labels_class_t per class and the rba_labels_container_t of all
+    classes, class by class and block by block. */
+#define RBA_LABELS_MAGIC 0x534C4542414C4252 /* RBLABELS */
+#define RBA_LABELS_FILENAME "labels.bin"
+#define RBA_LABELS_BLOCK (65536)
+#define RBA_LABELS_ARRAYMAX (4096)
+
+typedef struct {
+    uint64_t            rows;
+    uint64_t            containers;
+    uint32_t            col;
+    uint32_t            classes;
+} rba_labels_desc_t;
+
+typedef struct {
+    uint64_t            rows;
+    uint64_t            first;
+    uint64_t            containers;
+} rba_labels_class_t;
+
+typedef struct {
+    uint64_t            block;
+    uint64_t            offset;
+    uint32_t            rows;
+    uint32_t            reserved;
+} rba_labels_container_t;
+
+typedef struct {
+    int                 fd;
+    rba_header_t        hdr;
+    rba_labels_desc_t   desc;
+    rba_labels_class_t  *classes;
+    rba_labels_container_t *containers;
+} rba_labels_t;
+
+extern int
+rba_labels_build (  rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *dirpath,
+                    uint32_t            partition,
+                    uint32_t            col);
+
+extern int
+rba_labels_open (   rba_labels_t    *labels,
+                    rba_reader_t    *reader);
+
+extern int
+rba_labels_rows (   rba_labels_t    *labels,
+                    const uint32_t  *classes,
+                    uint32_t        n,
+                    uint64_t        **rows_p,
+                    uint64_t        *count_p);
+
+extern void
+rba_labels_close (rba_labels_t *labels);
+
 #define rba_data_getcolbufs(data, col) (&(data->bufs[col * data->partitions]))
 
 extern int
@@ -161,6 +1245,7 @@ rba_data_parse_csvs (   rba_data_t  *data,
 
 typedef int (*rba_type_initbuf_t) ( rba_type_t  *type,
                                     const char  *filename,
+                                    uint32_t    flags,
                                     rba_buf_t   *buf);
 
 typedef int (*rba_type_freebuf_t) ( rba_type_t  *type,
@@ -170,6 +1255,17 @@ typedef int (*rba_type_parse_t) (   rba_data_t  *data,
                                     uint32_t    col,
                                     const char  *string);
 
+/*  map a value of a categorical type to its class, 0 to classes - 1 */
+typedef int (*rba_type_classify_t) (rba_type_t  *type,
+                                    const char  *string,
+                                    uint32_t    *class_p);
+
+/*  convert a field to the value parse would store, as the zone kind */
+typedef int (*rba_type_value_t) (   rba_type_t          *type,
+                                    const char          *string,
+                                    uint32_t            flags,
+                                    rba_zone_value_t    *value_p);
+
 struct rba_type_s {
     const char*         specname;
     uint64_t            magic;
@@ -177,6 +1273,10 @@ struct rba_type_s {
     rba_type_initbuf_t  initbuf;
     rba_type_freebuf_t  freebuf;
     rba_type_parse_t    parse;
+    rba_type_classify_t classify;
+    uint32_t            classes;
+    uint32_t            zone;       /* RBA_ZONE_* kind of the values */
+    rba_type_value_t    value;
 };
 
 #endif /* #ifndef __RBA_H__ __RBA_H__ */
@@ -29,13 +29,406 @@
 */
 
 #include <stddef.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <rba.h>
 
+/*  validate the header of an existing RBA file against the type and position
+    the file at the end of the data region, dropping anything written past the
+    last record the header accounts for. The chunk index of a packed file is
+    loaded into the buffer and dropped from the file, it is rewritten when the
+    buffer is freed. A descriptor stored between the header and the data must
+    match desc. */
+static int
+rba_buf_open_existing ( rba_type_t  *type,
+                        const char  *filename,
+                        FILE        *filep,
+                        uint32_t    flags,
+                        const void  *desc,
+                        size_t      desclen,
+                        rba_buf_t   *buf)
+{
+    int ret;
+
+    struct stat st;
+    rba_header_t hdr;
+    void *olddesc;
+    uint16_t version;
+    off_t dataend;
+    uint64_t index_offset;
+
+    version = (flags & RBA_DATA_PACKED) ? RBA_HEADER_VERSION_PACKED : RBA_HEADER_VERSION;
+
+    /*  columns that were not stored by the version or spec that wrote the
+        data set are left empty */
+    if ((0 == fstat (fileno(filep), &st)) && (0 == st.st_size)) {
+        RBA_ERR("File %s is empty, the data set was written by a version that did not store %s data in it and can not be appended to\n", filename, type->specname);
+        ret = -1;
+    } else if (1 != fread (&hdr,
+                    sizeof(rba_header_t),
+                    1,
+                    filep)) {
+        RBA_ERR("Failed to read header from file %s\n", filename);
+        ret = -1;
+    } else if ((RBA_HEADER_MAGIC != hdr.rba_header_magic) ||
+                (version != hdr.rba_header_version)) {
+        RBA_ERR("File %s is not an RBA file of version %u\n", filename, (unsigned)version);
+        ret = -1;
+    } else if ((type->magic != hdr.rba_type_magic) ||
+                (type->size != hdr.typesize)) {
+        RBA_ERR("File %s does not contain %s data\n", filename, type->specname);
+        ret = -1;
+    } else if (hdr.data_offset != sizeof(rba_header_t) + desclen) {
+        RBA_ERR("File %s has a different layout than %s data\n", filename, type->specname);
+        ret = -1;
+    } else {
+
+        if (desclen > 0) {
+            olddesc = malloc (desclen);
+            if ((NULL == olddesc) ||
+                    (1 != fread (olddesc, desclen, 1, filep)) ||
+                    (0 != memcmp (olddesc, desc, desclen))) {
+                RBA_ERR("File %s has a different layout than %s data\n", filename, type->specname);
+                ret = -1;
+            } else {
+                ret = 0;
+            }
+            free (olddesc);
+        } else {
+            ret = 0;
+        }
+
+        dataend = (off_t)hdr.data_offset + (off_t)(hdr.records * hdr.typesize);
+        if ((0 == ret) && (flags & RBA_DATA_PACKED)) {
+            ret = rba_packed_load_index (   fileno(filep),
+                                            filename,
+                                            &hdr,
+                                            &(buf->chunks),
+                                            &(buf->chunk_count),
+                                            &index_offset);
+            buf->chunk_cap = buf->chunk_count;
+            dataend = (off_t)index_offset;
+        }
+
+        if (0 == ret) {
+            ret = ftruncate (fileno(filep), dataend);
+            if (0 != ret) {
+                RBA_ERR("Failed to truncate file %s to %lli bytes\n", filename, (long long)dataend);
+                RBA_ERRNO();
+                ret = -1;
+            } else {
+
+                ret = fseeko (filep, dataend, SEEK_SET);
+                if (0 != ret) {
+                    RBA_ERRNO();
+                    ret = -1;
+                } else {
+                    buf->total = hdr.records;
+                    ret = 0;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/*  add the checksum of the next length bytes written to the file */
+static int
+rba_buf_crc_add (   rba_buf_t   *buf,
+                    size_t      length,
+                    uint32_t    crc)
+{
+    int ret;
+
+    rba_crc_entry_t *crcs;
+    uint64_t cap;
+
+    if (buf->crc_count == buf->crc_cap) {
+        cap = (buf->crc_cap > 0) ? 2 * buf->crc_cap : 64;
+        crcs = (rba_crc_entry_t*)realloc (buf->crcs, cap * sizeof(rba_crc_entry_t));
+        if (NULL == crcs) {
+            RBA_ERR("Failed to grow checksums to %llu entries\n", (unsigned long long)cap);
+            return -1;
+        }
+        buf->crcs = crcs;
+        buf->crc_cap = cap;
+    }
+
+    crcs = &(buf->crcs[buf->crc_count]);
+    crcs->offset = buf->crc_pos;
+    crcs->length = (uint32_t)length;
+    crcs->crc = crc;
+    buf->crc_count++;
+    buf->crc_pos += length;
+    ret = 0;
+
+    return ret;
+}
+
+/*  Start the checksums of a file positioned at the end of its data. The
+    first entry, for the header, is filled in when the file is closed. When
+    appending, the checksums of the existing data are taken from the sidecar
+    as far as it matches, the rest is read back. */
+static int
+rba_buf_crc_open (  rba_buf_t   *buf,
+                    const char  *filename,
+                    uint32_t    data_offset)
+{
+    int ret;
+
+    rba_crc_entry_t *old = NULL;
+    uint64_t oldcount = 0, e;
+    off_t pos;
+
+    buf->filename = strdup (filename);
+    pos = ftello (buf->filep);
+    if ((NULL == buf->filename) || (pos < 0)) {
+        RBA_ERR("Failed to start checksums of %s\n", filename);
+        return -1;
+    }
+
+    buf->crc_pos = 0;
+    ret = rba_buf_crc_add (buf, data_offset, 0);
+    if ((0 == ret) && ((uint64_t)pos > data_offset)) {
+        ret = rba_crc_read (filename, &old, &oldcount);
+        for (e = 1; (0 == ret) && (e < oldcount) &&
+                (old[e].offset == buf->crc_pos) &&
+                (old[e].offset + old[e].length <= (uint64_t)pos); e++) {
+            ret = rba_buf_crc_add (buf, old[e].length, old[e].crc);
+        }
+        if (0 <= ret) {
+            ret = rba_crc_range (   fileno (buf->filep),
+                                    buf->crc_pos,
+                                    (uint64_t)pos - buf->crc_pos,
+                                    &(buf->crcs),
+                                    &(buf->crc_count),
+                                    &(buf->crc_cap));
+            buf->crc_pos = (uint64_t)pos;
+        }
+        free (old);
+    }
+
+    return ret;
+}
+
+/*  a sidecar left from an earlier run must not go stale, keep it
+ *  current when appending and drop it when the file is rewritten */
+static int
+rba_buf_crc_stale ( const char  *filename,
+                    uint32_t    *flags)
+{
+    int ret = 0;
+
+    char *crcname;
+
+    crcname = (char*)malloc (strlen (filename) + sizeof(RBA_CRC_SUFFIX));
+    if (NULL == crcname) {
+        return -1;
+    }
+    sprintf (crcname, "%s" RBA_CRC_SUFFIX, filename);
+
+    if (0 != access (crcname, F_OK)) {
+        ;
+    } else if (*flags & RBA_DATA_APPEND) {
+        *flags |= RBA_DATA_CHECKSUM;
+    } else if (0 != unlink (crcname)) {
+        RBA_ERR("Failed to remove the stale checksums %s\n", crcname);
+        RBA_ERRNO();
+        ret = -1;
+    }
+    free (crcname);
+
+    return ret;
+}
+
+/*  write the header checksum and the sidecar */
+static int
+rba_buf_crc_close (rba_buf_t *buf)
+{
+    int ret;
+
+    void *hdr;
+    size_t len = buf->crcs[0].length;
+
+    hdr = malloc (len);
+    if (NULL == hdr) {
+        ret = -1;
+    } else if ((0 != fflush (buf->filep)) ||
+                ((ssize_t)len != pread (fileno (buf->filep), hdr, len, 0))) {
+        RBA_ERR("Failed to read back the header of %s\n", buf->filename);
+        ret = -1;
+    } else {
+        buf->crcs[0].crc = rba_crc32c (0, hdr, len);
+        ret = rba_crc_write (buf->filename, buf->crcs, buf->crc_count);
+    }
+    free (hdr);
+
+    return ret;
+}
+
+/*  With RBA_DATA_ZONEMAP the sidecar of a file that is appended to must
+    cover exactly the records in it, it is rebuilt from the file otherwise.
+    Without it, a sidecar left from an earlier run is kept current when
+    appending and dropped when the file is rewritten. */
+static int
+rba_buf_zone_prepare (  rba_type_t  *type,
+                        const char  *filename,
+                        uint32_t    *flags)
+{
+    int ret = 0;
+
+    FILE *filep;
+    rba_header_t hdr;
+    rba_zone_desc_t desc;
+    rba_zone_entry_t *entries = NULL;
+    uint64_t count;
+    char *zonename;
+
+    if (RBA_ZONE_NONE == type->zone) {
+        return 0;
+    }
+
+    zonename = (char*)malloc (strlen (filename) + sizeof(RBA_ZONE_SUFFIX));
+    if (NULL == zonename) {
+        return -1;
+    }
+    sprintf (zonename, "%s" RBA_ZONE_SUFFIX, filename);
+
+    if (*flags & RBA_DATA_ZONEMAP) {
+        ;
+    } else if (0 != access (zonename, F_OK)) {
+        ;
+    } else if (*flags & RBA_DATA_APPEND) {
+        *flags |= RBA_DATA_ZONEMAP;
+    } else if (0 != unlink (zonename)) {
+        RBA_ERR("Failed to remove the stale zone map %s\n", zonename);
+        RBA_ERRNO();
+        ret = -1;
+    }
+    free (zonename);
+
+    if ((0 == ret) && (*flags & RBA_DATA_ZONEMAP) && (*flags & RBA_DATA_APPEND)) {
+        filep = fopen (filename, "rb");
+        if ((NULL != filep) && (1 == fread (&hdr, sizeof(hdr), 1, filep))) {
+            ret = rba_zone_read (filename, &desc, &entries, &count);
+            if ((1 == ret) || ((0 == ret) && (desc.records != hdr.records))) {
+                ret = rba_zone_file (filename, type->zone);
+            }
+            free (entries);
+        }
+        if (NULL != filep) {
+            fclose (filep);
+        }
+    }
+
+    return ret;
+}
+
+/*  Start the zone map of an open file, with the zones of the records
+    already in it when appending */
+static int
+rba_buf_zone_open ( rba_buf_t   *buf,
+                    rba_type_t  *type,
+                    const char  *filename)
+{
+    int ret;
+
+    rba_zone_desc_t desc;
+
+    buf->zone = type->zone;
+    if (NULL == buf->filename) {
+        buf->filename = strdup (filename);
+        if (NULL == buf->filename) {
+            return -1;
+        }
+    }
+    if (buf->flags & RBA_DATA_APPEND) {
+        ret = rba_zone_read (filename, &desc, &(buf->zones), &(buf->zone_count));
+        if (1 == ret) {
+            RBA_ERR("Zone map of %s is missing\n", filename);
+            ret = -1;
+        }
+        buf->zone_cap = buf->zone_count;
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  add the zone of the buffered elements */
+static int
+rba_buf_zone_add (rba_buf_t *buf)
+{
+    uint64_t cap;
+    rba_zone_entry_t *zones;
+
+    if (buf->zone_count == buf->zone_cap) {
+        cap = (buf->zone_cap > 0) ? 2 * buf->zone_cap : 64;
+        zones = (rba_zone_entry_t*)realloc (buf->zones, cap * sizeof(rba_zone_entry_t));
+        if (NULL == zones) {
+            RBA_ERR("Failed to grow zone map to %llu entries\n", (unsigned long long)cap);
+            return -1;
+        }
+        buf->zones = zones;
+        buf->zone_cap = cap;
+    }
+
+    return rba_zone_add (   buf->zone,
+                            buf->elm_sz,
+                            buf->arr,
+                            buf->idx,
+                            buf->total,
+                            &(buf->zones[buf->zone_count++]));
+}
+
+static int
+rba_buf_write_header (  rba_type_t  *type,
+                        const char  *filename,
+                        uint32_t    flags,
+                        const void  *desc,
+                        size_t      desclen,
+                        FILE        *filep)
+{
+    int ret;
+
+    rba_header_t hdr;
+
+    hdr.rba_header_magic   = RBA_HEADER_MAGIC;
+    hdr.rba_type_magic     = type->magic;
+    hdr.records            = 0;
+    hdr.data_offset        = sizeof(rba_header_t) + desclen;
+    hdr.typesize           = type->size;
+    hdr.rba_header_version = (flags & RBA_DATA_PACKED) ? RBA_HEADER_VERSION_PACKED : RBA_HEADER_VERSION;
+    if (1 != fwrite (   &hdr,
+                        sizeof(rba_header_t),
+                        1,
+                        filep)) {
+        RBA_ERR("Failed to write header (%p) to file %s\n", (void*)&hdr, filename);
+        ret = -1;
+    } else if ((desclen > 0) &&
+                (1 != fwrite (desc, desclen, 1, filep))) {
+        RBA_ERR("Failed to write %lu byte descriptor to file %s\n", (unsigned long)desclen, filename);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  Open filename for elements of type. desclen bytes at desc describing the
+    elements are stored after the header, data_offset accounts for them. */
 int
-rba_buf_alloc ( rba_type_t  *type,
-                const char  *filename,
-                rba_buf_t   *buf)
+rba_buf_alloc_desc (rba_type_t  *type,
+                    const char  *filename,
+                    uint32_t    flags,
+                    const void  *desc,
+                    size_t      desclen,
+                    rba_buf_t   *buf)
 {
     int ret;
 
@@ -44,9 +437,13 @@ rba_buf_alloc ( rba_type_t  *type,
     size_t elm_sz, len;
     void *arr;
 
-    rba_header_t hdr;
+    memset (buf, 0, sizeof(rba_buf_t));
 
-    filep = fopen (filename, "wb");
+    if (0 != rba_buf_zone_prepare (type, filename, &flags)) {
+        return -1;
+    }
+
+    filep = fopen (filename, (flags & RBA_DATA_APPEND) ? "r+b" : "w+b");
     if (NULL == filep) {
         RBA_ERR("Failed to open file %s\n", filename);
         RBA_ERRNO();
@@ -55,37 +452,44 @@ rba_buf_alloc ( rba_type_t  *type,
 
         elm_sz = type->size;
         len = RBA_BUF_DEFAULTLEN;
-        arr = malloc(elm_sz * RBA_BUF_DEFAULTLEN);
+        /*  zeroed, the padding between the fields of a row is never written */
+        arr = calloc(RBA_BUF_DEFAULTLEN, elm_sz);
         if (NULL == arr) {
             RBA_ERR("Failed to malloc buffer for type %s\n", type->specname);
             ret = -1;
         } else {
 
-            hdr.rba_header_magic   = RBA_HEADER_MAGIC;
-            hdr.rba_type_magic     = type->magic;
-            hdr.records            = 0;
-            hdr.data_offset        = sizeof(rba_header_t);
-            hdr.typesize           = type->size;
-            hdr.rba_header_version = RBA_HEADER_VERSION;
-            if (1 != fwrite (   &hdr,
-                                sizeof(rba_header_t),
-                                1,
-                                filep)) {
-                RBA_ERR("Failed to write header (%p) to file %s\n", (void*)&hdr, filename);
-                ret = -1;
+            if (flags & RBA_DATA_APPEND) {
+                ret = rba_buf_open_existing (type, filename, filep, flags, desc, desclen, buf);
             } else {
+                ret = rba_buf_write_header (type, filename, flags, desc, desclen, filep);
+            }
 
+            if (0 == ret) {
                 buf->filep = filep;
                 buf->arr = arr;
-                buf->total = 0;
                 buf->elm_sz = elm_sz;
                 buf->len = len;
                 buf->idx = 0;
-                ret = 0;
+                buf->flags = flags;
+                if (!(flags & RBA_DATA_CHECKSUM)) {
+                    ret = rba_buf_crc_stale (filename, &flags);
+                }
+                if ((0 == ret) && (flags & RBA_DATA_CHECKSUM)) {
+                    ret = rba_buf_crc_open (buf, filename, sizeof(rba_header_t) + desclen);
+                }
+                if ((0 == ret) && (flags & RBA_DATA_ZONEMAP) && (RBA_ZONE_NONE != type->zone)) {
+                    ret = rba_buf_zone_open (buf, type, filename);
+                }
             }
-
             if (0 != ret) {
                 free (arr);
+                free (buf->packbuf);
+                free (buf->chunks);
+                free (buf->filename);
+                free (buf->crcs);
+                free (buf->zones);
+                memset (buf, 0, sizeof(rba_buf_t));
             }
         }
 
@@ -98,12 +502,192 @@ rba_buf_alloc ( rba_type_t  *type,
 }
 
 int
-rba_buf_simple_flush (rba_buf_t *buf)
+rba_buf_alloc ( rba_type_t  *type,
+                const char  *filename,
+                uint32_t    flags,
+                rba_buf_t   *buf)
+{
+    return rba_buf_alloc_desc (type, filename, flags, NULL, 0, buf);
+}
+
+/*  A buffer without a file, flushing only counts and discards the elements.
+    Used to stage column values that are written in another layout. */
+int
+rba_buf_alloc_staging ( rba_type_t  *type,
+                        const char  *filename,
+                        uint32_t    flags,
+                        rba_buf_t   *buf)
+{
+    int ret;
+
+    (void)filename;
+
+    memset (buf, 0, sizeof(rba_buf_t));
+
+    buf->arr = malloc(type->size * RBA_BUF_DEFAULTLEN);
+    if (NULL == buf->arr) {
+        RBA_ERR("Failed to malloc buffer for type %s\n", type->specname);
+        ret = -1;
+    } else {
+        buf->elm_sz = type->size;
+        buf->len = RBA_BUF_DEFAULTLEN;
+        buf->idx = 0;
+        buf->flags = flags & ~RBA_DATA_PACKED;
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  Write one chunk of records elements, stored as size bytes of payload
+    encoded with codec, at the end of a packed file and add it to the chunk
+    index. */
+int
+rba_buf_write_chunk (   rba_buf_t   *buf,
+                        uint32_t    records,
+                        uint32_t    codec,
+                        const void  *payload,
+                        size_t      size)
+{
+    int ret;
+
+    rba_chunk_header_t chdr;
+    rba_chunk_index_t *chunks;
+    uint64_t cap;
+    off_t offset;
+
+    if (buf->chunk_count == buf->chunk_cap) {
+        cap = (buf->chunk_cap > 0) ? 2 * buf->chunk_cap : 64;
+        chunks = (rba_chunk_index_t*)realloc (buf->chunks, cap * sizeof(rba_chunk_index_t));
+        if (NULL == chunks) {
+            RBA_ERR("Failed to grow chunk index to %llu entries\n", (unsigned long long)cap);
+            return -1;
+        }
+        buf->chunks = chunks;
+        buf->chunk_cap = cap;
+    }
+
+    chdr.records = records;
+    chdr.packed_size = (uint32_t)size;
+    chdr.codec = codec;
+    chdr.reserved = 0;
+
+    offset = ftello (buf->filep);
+    if ((offset < 0) ||
+            (1 != fwrite (&chdr, sizeof(chdr), 1, buf->filep)) ||
+            ((size > 0) && (1 != fwrite (payload, size, 1, buf->filep)))) {
+        RBA_ERR("failed to write %u byte chunk\n", (unsigned)chdr.packed_size);
+        ret = -1;
+    } else {
+        if (NULL != buf->stats) {
+            buf->stats->bytes_written += sizeof(chdr) + size;
+        }
+        if (NULL != buf->crcs) {
+            ret = rba_buf_crc_add ( buf,
+                                    sizeof(chdr) + size,
+                                    rba_crc32c (rba_crc32c (0, &chdr, sizeof(chdr)), payload, size));
+            if (0 != ret) {
+                return -1;
+            }
+        }
+        chunks = &(buf->chunks[buf->chunk_count]);
+        chunks->offset = (uint64_t)offset;
+        chunks->first_record = buf->total;
+        chunks->records = chdr.records;
+        chunks->packed_size = chdr.packed_size;
+        chunks->codec = chdr.codec;
+        chunks->reserved = 0;
+        buf->chunk_count++;
+        buf->total += records;
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  pack the buffered elements into one chunk */
+static int
+rba_buf_packed_flush (rba_buf_t *buf)
+{
+    int ret;
+
+    size_t packed_size;
+    uint8_t *packed, *scratch;
+
+    /*  packed output and shuffle planes for rba_codec_pack */
+    if (NULL == buf->packbuf) {
+        buf->packbuf = malloc(2 * buf->elm_sz * buf->len);
+        if (NULL == buf->packbuf) {
+            RBA_ERR("Failed to malloc pack buffer of %lu bytes\n", (unsigned long)(2 * buf->elm_sz * buf->len));
+            return -1;
+        }
+    }
+    packed = (uint8_t*)buf->packbuf;
+    scratch = packed + buf->len * buf->elm_sz;
+
+    packed_size = rba_codec_pack (buf->arr, buf->idx, buf->elm_sz, packed, scratch);
+    if (0 == packed_size) {
+        ret = rba_buf_write_chunk (buf, (uint32_t)buf->idx, RBA_CODEC_RAW, buf->arr, buf->idx * buf->elm_sz);
+    } else {
+        ret = rba_buf_write_chunk (buf, (uint32_t)buf->idx, RBA_CODEC_SHUFFLE_RLE, packed, packed_size);
+    }
+
+    return ret;
+}
+
+/*  write the chunk index and trailer after the last chunk */
+static int
+rba_buf_packed_finish (rba_buf_t *buf)
+{
+    int ret;
+
+    rba_packed_trailer_t trailer;
+    off_t offset;
+
+    offset = ftello (buf->filep);
+    trailer.index_offset = (uint64_t)offset;
+    trailer.chunks = buf->chunk_count;
+    trailer.magic = RBA_PACKED_MAGIC;
+    if ((offset < 0) ||
+            ((buf->chunk_count > 0) &&
+                (buf->chunk_count != fwrite (buf->chunks, sizeof(rba_chunk_index_t), buf->chunk_count, buf->filep))) ||
+            (1 != fwrite (&trailer, sizeof(trailer), 1, buf->filep))) {
+        RBA_ERR("failed to write chunk index of %llu entries\n", (unsigned long long)buf->chunk_count);
+        ret = -1;
+    } else if (NULL != buf->crcs) {
+        ret = rba_buf_crc_add ( buf,
+                                buf->chunk_count * sizeof(rba_chunk_index_t) + sizeof(trailer),
+                                rba_crc32c (rba_crc32c (0, buf->chunks, buf->chunk_count * sizeof(rba_chunk_index_t)),
+                                            &trailer, sizeof(trailer)));
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+static int
+rba_buf_flush (rba_buf_t *buf)
 {
     int ret;
 
     if (buf->idx == 0) {
         ret = 0;
+    } else if ((NULL != buf->hook) &&
+                (0 != buf->hook (buf->hookctx, buf->arr, buf->idx))) {
+        RBA_ERR("flush hook failed for %lu elements\n", (unsigned long)buf->idx);
+        ret = -1;
+    } else if (NULL == buf->filep) {
+        buf->total += buf->idx;
+        buf->idx = 0;
+        ret = 0;
+    } else if ((0 != buf->zone) && (0 != rba_buf_zone_add (buf))) {
+        ret = -1;
+    } else if (buf->flags & RBA_DATA_PACKED) {
+        ret = rba_buf_packed_flush (buf);
+        if (0 == ret) {
+            buf->idx = 0;
+        }
     } else {
         size_t write_sz = buf->idx * buf->elm_sz;
         if (1 != fwrite(buf->arr,
@@ -113,10 +697,159 @@ rba_buf_simple_flush (rba_buf_t *buf)
             RBA_ERR("failed to write %li bytes at %p\n", write_sz, (void*)buf->arr);
             ret = -1;
         } else {
+            if (NULL != buf->stats) {
+                buf->stats->bytes_written += write_sz;
+            }
             buf->total += buf->idx;
             buf->idx = 0;
-            ret = 0;
+            ret = (NULL != buf->crcs) ? rba_buf_crc_add (buf, write_sz, rba_crc32c (0, buf->arr, write_sz)) : 0;
+        }
+    }
+
+    return ret;
+}
+
+/*  write out the buffered elements, timed as RBA_STAGE_WRITE with stats */
+int
+rba_buf_simple_flush (rba_buf_t *buf)
+{
+    int ret;
+
+    uint32_t stage;
+
+    if ((NULL == buf->stats) || (0 == buf->idx)) {
+        ret = rba_buf_flush (buf);
+    } else {
+        stage = rba_stats_switch (buf->stats, RBA_STAGE_WRITE);
+        if (NULL != buf->filep) {
+            buf->stats->flushes++;
         }
+        ret = rba_buf_flush (buf);
+        rba_stats_switch (buf->stats, stage);
+    }
+
+    return ret;
+}
+
+/*  Write out the buffered elements and make the file durable for a
+    checkpoint. The header is brought up to date, so the file is readable up
+    to here even if the run never finishes, and entry records how far the
+    file is valid. Packed files get their chunk index only when they are
+    closed, the checkpoint keeps a copy of it. */
+int
+rba_buf_sync (  rba_buf_t               *buf,
+                rba_checkpoint_buf_t    *entry)
+{
+    int ret;
+
+    off_t dataend;
+
+    memset (entry, 0, sizeof(rba_checkpoint_buf_t));
+    if (0 == buf->len) {
+        return 0;
+    }
+
+    ret = rba_buf_simple_flush (buf);
+    entry->total = buf->total;
+    if ((0 != ret) || (NULL == buf->filep)) {
+        return ret;
+    }
+
+    dataend = ftello (buf->filep);
+    if ((dataend < 0) || (0 != fflush (buf->filep)) ||
+            ((ssize_t)sizeof(buf->total) != pwrite ( fileno (buf->filep),
+                                            &(buf->total),
+                                            sizeof(buf->total),
+                                            offsetof(rba_header_t, records))) ||
+            (0 != fdatasync (fileno (buf->filep)))) {
+        RBA_ERR("Failed to sync %s\n", (NULL != buf->filename) ? buf->filename : "RBA file");
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        entry->dataend = (uint64_t)dataend;
+        entry->chunks = buf->chunk_count;
+        entry->flags = RBA_CHECKPOINT_OPEN;
+        entry->flags |= (buf->flags & RBA_DATA_PACKED) ? RBA_CHECKPOINT_PACKED : 0;
+        entry->flags |= (NULL != buf->crcs) ? RBA_CHECKPOINT_CRC : 0;
+    }
+    if ((0 == ret) && (0 != buf->zone)) {
+        ret = rba_zone_write (buf->filename, buf->zone, (uint32_t)buf->elm_sz, buf->zones, buf->zone_count);
+    }
+
+    return ret;
+}
+
+/*  Put filename back into the state rba_buf_sync recorded in entry, as if
+    it had been closed then: drop everything written after it, fix up the
+    header, write the chunk index of a packed file and redo its checksums.
+    The file can then be appended to. */
+int
+rba_buf_rewind (const char                  *filename,
+                const rba_checkpoint_buf_t  *entry,
+                const rba_chunk_index_t     *chunks)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+    rba_packed_trailer_t trailer;
+    uint32_t flags = 0;
+    off_t size;
+
+    filep = fopen (filename, "r+b");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    if ((1 != fread (&hdr, sizeof(hdr), 1, filep)) ||
+            (RBA_HEADER_MAGIC != hdr.rba_header_magic) ||
+            (0 != fseeko (filep, 0, SEEK_END)) ||
+            ((size = ftello (filep)) < 0)) {
+        RBA_ERR("File %s is not an RBA file\n", filename);
+        ret = -1;
+    } else if ((uint64_t)size < entry->dataend) {
+        RBA_ERR("File %s holds %lli bytes, less than the %llu at the checkpoint\n", filename, (long long)size, (unsigned long long)entry->dataend);
+        ret = -1;
+    } else if ((0 != ftruncate (fileno (filep), (off_t)entry->dataend)) ||
+                (0 != fseeko (filep, (off_t)entry->dataend, SEEK_SET))) {
+        RBA_ERR("Failed to truncate file %s to %llu bytes\n", filename, (unsigned long long)entry->dataend);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        ret = 0;
+        if (entry->flags & RBA_CHECKPOINT_PACKED) {
+            trailer.index_offset = entry->dataend;
+            trailer.chunks = entry->chunks;
+            trailer.magic = RBA_PACKED_MAGIC;
+            if (((entry->chunks > 0) &&
+                        (entry->chunks != fwrite (chunks, sizeof(rba_chunk_index_t), entry->chunks, filep))) ||
+                    (1 != fwrite (&trailer, sizeof(trailer), 1, filep))) {
+                RBA_ERR("failed to write chunk index of %llu entries\n", (unsigned long long)entry->chunks);
+                ret = -1;
+            }
+        }
+        if ((0 == ret) &&
+                ((0 != fseeko (filep, offsetof(rba_header_t, records), SEEK_SET)) ||
+                    (1 != fwrite (&(entry->total), sizeof(entry->total), 1, filep)))) {
+            RBA_ERR("Failed to fix up the header of %s\n", filename);
+            ret = -1;
+        }
+    }
+
+    if (0 != fclose (filep)) {
+        RBA_ERRNO();
+        ret = -1;
+    }
+
+    /*  the sidecar may cover bytes that were just dropped */
+    if (0 != ret) {
+        ;
+    } else if (entry->flags & RBA_CHECKPOINT_CRC) {
+        ret = rba_crc_file (filename);
+    } else {
+        ret = rba_buf_crc_stale (filename, &flags);
     }
 
     return ret;
@@ -130,8 +863,18 @@ rba_buf_simple_free (   rba_type_t  *type,
 
     size_t offset;
 
+    if (NULL == buf->filep) {
+        ret = rba_buf_simple_flush (buf);
+        free(buf->arr);
+        memset(buf, 0, sizeof(rba_buf_t));
+        return ret;
+    }
+
     /*  write out any existing data */
     ret = rba_buf_simple_flush (buf);
+    if ((0 == ret) && (buf->flags & RBA_DATA_PACKED)) {
+        ret = rba_buf_packed_finish (buf);
+    }
     if (0 != ret) {
         RBA_ERR("rba_buf_simple_flush failed for %s rba_buf_t\n", type->specname);
         ret = -1;
@@ -154,15 +897,24 @@ rba_buf_simple_free (   rba_type_t  *type,
                 RBA_ERR("failed to write %li bytes at %p\n", sizeof(buf->total), (void*)&(buf->total));
                 ret = -1;
             } else {
-                RBA_ERR("Closing file\n");
+                if (NULL != buf->crcs) {
+                    ret = rba_buf_crc_close (buf);
+                }
+                if ((0 == ret) && (0 != buf->zone)) {
+                    ret = rba_zone_write (buf->filename, buf->zone, (uint32_t)buf->elm_sz, buf->zones, buf->zone_count);
+                }
                 if (0 != fclose(buf->filep)) {
                     RBA_ERRNO();
                     ret = -1;
                 } else {
 
                     free(buf->arr);
+                    free(buf->packbuf);
+                    free(buf->chunks);
+                    free(buf->filename);
+                    free(buf->crcs);
+                    free(buf->zones);
                     memset(buf, 0, sizeof(rba_buf_t));
-                    ret = 0;
                 }
             }
         }
@@ -170,4 +922,3 @@ rba_buf_simple_free (   rba_type_t  *type,
 
     return ret;
 }
-
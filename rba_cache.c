@@ -0,0 +1,454 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <rba.h>
+
+/*
+    The record count cache is a text file with one line per CSV file:
+
+    <spec hash> <size> <mtime s> <mtime ns> <sample hash> <records> <path>
+
+    The spec hash covers the column names and types the header was validated
+    against. The sample hash covers RBA_CACHE_SAMPLE bytes at the start, the
+    middle and the end of the file, which catches files rewritten in place
+    with the same size and a restored mtime.
+*/
+
+#define RBA_CACHE_MAGIC     "# rba record count cache v1\n"
+#define RBA_CACHE_SAMPLE    (4096)
+
+#define RBA_FNV_OFFSET  (0xCBF29CE484222325ULL)
+#define RBA_FNV_PRIME   (0x00000100000001B3ULL)
+
+static uint64_t
+fnv1a64 (   uint64_t    hash,
+            const void  *data,
+            size_t      len)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= RBA_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static uint64_t
+rba_cache_spechash (rba_spec_entry_t    *spec,
+                    uint32_t            cols)
+{
+    uint64_t hash = RBA_FNV_OFFSET;
+    uint32_t c;
+
+    for (c = 0; c < cols; c++) {
+        hash = fnv1a64 (hash, spec[c].name, strlen(spec[c].name) + 1);
+        hash = fnv1a64 (hash, &(spec[c].type->magic), sizeof(spec[c].type->magic));
+    }
+
+    return hash;
+}
+
+static int
+rba_cache_samplehash (  const char  *filename,
+                        uint64_t    size,
+                        uint64_t    *hash_p)
+{
+    int ret;
+
+    FILE *filep;
+    char sample[RBA_CACHE_SAMPLE];
+    uint64_t offsets[3];
+    uint64_t hash;
+    size_t readin;
+    int i;
+
+    filep = fopen (filename, "rb");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+
+        offsets[0] = 0;
+        offsets[1] = (size > RBA_CACHE_SAMPLE) ? (size - RBA_CACHE_SAMPLE) / 2 : 0;
+        offsets[2] = (size > RBA_CACHE_SAMPLE) ? (size - RBA_CACHE_SAMPLE) : 0;
+
+        hash = fnv1a64 (RBA_FNV_OFFSET, &size, sizeof(size));
+        for (i = 0, ret = 0; (i < 3) && (0 == ret); i++) {
+            if (0 != fseeko (filep, (off_t)offsets[i], SEEK_SET)) {
+                RBA_ERRNO();
+                ret = -1;
+            } else {
+                readin = fread (sample, 1, sizeof(sample), filep);
+                if ((readin < sizeof(sample)) && ferror(filep)) {
+                    RBA_ERR("Error reading file %s\n", filename);
+                    ret = -1;
+                } else {
+                    hash = fnv1a64 (hash, sample, readin);
+                }
+            }
+        }
+
+        if (0 == ret) {
+            *hash_p = hash;
+        }
+
+        fclose (filep);
+    }
+
+    return ret;
+}
+
+static rba_cache_entry_t*
+rba_cache_find (rba_cache_t *cache,
+                const char  *path)
+{
+    size_t i;
+
+    for (i = 0; i < cache->count; i++) {
+        if (0 == strcmp (cache->entries[i].path, path)) {
+            return &(cache->entries[i]);
+        }
+    }
+
+    return NULL;
+}
+
+static rba_cache_entry_t*
+rba_cache_add ( rba_cache_t *cache,
+                const char  *path)
+{
+    rba_cache_entry_t *entries, *entry;
+    size_t cap;
+
+    entry = NULL;
+    if (cache->count == cache->cap) {
+        cap = (cache->cap > 0) ? 2 * cache->cap : 64;
+        entries = (rba_cache_entry_t*)realloc ( cache->entries,
+                                                cap * sizeof(rba_cache_entry_t));
+        if (NULL == entries) {
+            RBA_ERR("Failed to grow record count cache to %u entries\n", (unsigned)cap);
+        } else {
+            cache->entries = entries;
+            cache->cap = cap;
+        }
+    }
+
+    if (cache->count < cache->cap) {
+        entry = &(cache->entries[cache->count]);
+        memset (entry, 0, sizeof(rba_cache_entry_t));
+        entry->path = strdup (path);
+        if (NULL == entry->path) {
+            RBA_ERR("Failed to copy path %s\n", path);
+            entry = NULL;
+        } else {
+            cache->count++;
+        }
+    }
+
+    return entry;
+}
+
+int
+rba_cache_load (rba_cache_t         *cache,
+                const char          *filename,
+                rba_spec_entry_t    *spec,
+                uint32_t            cols)
+{
+    int ret;
+
+    FILE *filep;
+    char *line;
+    size_t bufsz;
+    ssize_t len;
+    int pathpos;
+
+    rba_cache_entry_t entry, *added;
+    unsigned long long spechash, size, samplehash, records;
+    long long mtime_sec, mtime_nsec;
+
+    memset (cache, 0, sizeof(rba_cache_t));
+    cache->filename = filename;
+    cache->spechash = rba_cache_spechash (spec, cols);
+
+    filep = fopen (filename, "r");
+    if (NULL == filep) {
+        if (ENOENT == errno) {
+            /*  no cache yet, it is created on save */
+            ret = 0;
+        } else {
+            RBA_ERR("Failed to open record count cache %s\n", filename);
+            RBA_ERRNO();
+            ret = -1;
+        }
+    } else {
+
+        line = NULL;
+        bufsz = 0;
+        len = getline (&line, &bufsz, filep);
+        if ((len < 0) || (0 != strcmp (line, RBA_CACHE_MAGIC))) {
+            RBA_ERR("%s is not a record count cache, ignoring it\n", filename);
+            ret = 0;
+        } else {
+
+            ret = 0;
+            while ((0 == ret) && ((len = getline (&line, &bufsz, filep)) > 0)) {
+                if ('\n' == line[len - 1]) {
+                    line[len - 1] = '\0';
+                }
+                pathpos = -1;
+                if ((6 != sscanf (  line,
+                                    "%llx %llu %lld %lld %llx %llu %n",
+                                    &spechash,
+                                    &size,
+                                    &mtime_sec,
+                                    &mtime_nsec,
+                                    &samplehash,
+                                    &records,
+                                    &pathpos)) || (pathpos < 0)) {
+                    RBA_ERR("Skipping malformed record count cache line: %s\n", line);
+                } else if (spechash == cache->spechash) {
+                    /*  entries for other specs are dropped on save */
+                    added = rba_cache_add (cache, line + pathpos);
+                    if (NULL == added) {
+                        ret = -1;
+                    } else {
+                        entry.path          = added->path;
+                        entry.size          = size;
+                        entry.mtime_sec     = mtime_sec;
+                        entry.mtime_nsec    = mtime_nsec;
+                        entry.samplehash    = samplehash;
+                        entry.records       = records;
+                        *added = entry;
+                    }
+                }
+            }
+        }
+
+        free (line);
+        fclose (filep);
+
+        if (0 != ret) {
+            rba_cache_free (cache);
+        }
+    }
+
+    return ret;
+}
+
+int
+rba_cache_save (rba_cache_t *cache)
+{
+    int ret;
+
+    FILE *filep;
+    char *tmpname;
+    size_t tmplen, i;
+    rba_cache_entry_t *entry;
+
+    if (!cache->dirty) {
+        ret = 0;
+    } else {
+
+        tmplen = strlen (cache->filename) + strlen (".tmp") + 1;
+        tmpname = (char*)malloc (tmplen);
+        if (NULL == tmpname) {
+            RBA_ERR("Failed to allocate %u bytes for file path\n", (unsigned)tmplen);
+            ret = -1;
+        } else {
+
+            snprintf (tmpname, tmplen, "%s.tmp", cache->filename);
+            filep = fopen (tmpname, "w");
+            if (NULL == filep) {
+                RBA_ERR("Failed to create record count cache %s\n", tmpname);
+                RBA_ERRNO();
+                ret = -1;
+            } else {
+
+                ret = (fputs (RBA_CACHE_MAGIC, filep) < 0) ? -1 : 0;
+                for (i = 0; (i < cache->count) && (0 == ret); i++) {
+                    entry = &(cache->entries[i]);
+                    if (fprintf (filep,
+                                 "%016llx %llu %lld %lld %016llx %llu %s\n",
+                                 (unsigned long long)cache->spechash,
+                                 (unsigned long long)entry->size,
+                                 (long long)entry->mtime_sec,
+                                 (long long)entry->mtime_nsec,
+                                 (unsigned long long)entry->samplehash,
+                                 (unsigned long long)entry->records,
+                                 entry->path) < 0) {
+                        ret = -1;
+                    }
+                }
+
+                if (0 != fclose (filep)) {
+                    ret = -1;
+                }
+
+                if (0 != ret) {
+                    RBA_ERR("Failed to write record count cache %s\n", tmpname);
+                    unlink (tmpname);
+                } else if (0 != rename (tmpname, cache->filename)) {
+                    RBA_ERR("Failed to replace record count cache %s\n", cache->filename);
+                    RBA_ERRNO();
+                    unlink (tmpname);
+                    ret = -1;
+                } else {
+                    cache->dirty = 0;
+                }
+            }
+
+            free (tmpname);
+        }
+    }
+
+    return ret;
+}
+
+void
+rba_cache_free (rba_cache_t *cache)
+{
+    size_t i;
+
+    for (i = 0; i < cache->count; i++) {
+        free (cache->entries[i].path);
+    }
+    free (cache->entries);
+    memset (cache, 0, sizeof(rba_cache_t));
+}
+
+/*  stat the file and compute the key fields of its cache entry */
+static int
+rba_cache_key ( const char          *filename,
+                rba_cache_entry_t   *key)
+{
+    int ret;
+
+    struct stat st;
+
+    memset (key, 0, sizeof(rba_cache_entry_t));
+
+    if (0 != stat (filename, &st)) {
+        RBA_ERR("Failed to stat file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+
+        /*  key on the canonical path so relative and absolute names match */
+        key->path = realpath (filename, NULL);
+        if (NULL == key->path) {
+            RBA_ERR("Failed to resolve path %s\n", filename);
+            RBA_ERRNO();
+            ret = -1;
+        } else {
+
+            key->size       = (uint64_t)st.st_size;
+            key->mtime_sec  = (int64_t)st.st_mtim.tv_sec;
+            key->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+            ret = rba_cache_samplehash (filename, key->size, &(key->samplehash));
+            if (0 != ret) {
+                free (key->path);
+                key->path = NULL;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int
+rba_cache_lookup (  rba_cache_t *cache,
+                    const char  *filename,
+                    uint64_t    *reccount_p,
+                    int         *hit_p)
+{
+    int ret;
+
+    rba_cache_entry_t key, *entry;
+
+    *hit_p = 0;
+
+    ret = rba_cache_key (filename, &key);
+    if (0 == ret) {
+        entry = rba_cache_find (cache, key.path);
+        if ((NULL != entry) &&
+            (entry->size == key.size) &&
+            (entry->mtime_sec == key.mtime_sec) &&
+            (entry->mtime_nsec == key.mtime_nsec) &&
+            (entry->samplehash == key.samplehash)) {
+
+            *reccount_p = entry->records;
+            *hit_p = 1;
+        }
+
+        free (key.path);
+    }
+
+    return ret;
+}
+
+int
+rba_cache_update (  rba_cache_t *cache,
+                    const char  *filename,
+                    uint64_t    reccount)
+{
+    int ret;
+
+    rba_cache_entry_t key, *entry;
+
+    ret = rba_cache_key (filename, &key);
+    if (0 == ret) {
+        entry = rba_cache_find (cache, key.path);
+        if (NULL == entry) {
+            entry = rba_cache_add (cache, key.path);
+        }
+        if (NULL == entry) {
+            ret = -1;
+        } else {
+            free (entry->path);
+            key.records = reccount;
+            *entry = key;
+            key.path = NULL;
+            cache->dirty = 1;
+        }
+
+        free (key.path);
+    }
+
+    return ret;
+}
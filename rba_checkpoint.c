@@ -0,0 +1,404 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <time.h>
+#include <unistd.h>
+
+#include <rba.h>
+
+/*
+    A checkpoint makes every output file durable and records, in one small
+    file, how far each file is valid and everything needed to carry on from
+    there: the partition picker, the sampling state and the position in the
+    CSV files. It is written to a temporary file that is renamed over the
+    last checkpoint, so there always is one complete checkpoint. Resuming
+    rewinds the output files to the checkpoint, reopens them for appending
+    and restores the state, so the run goes on as if it had not stopped.
+*/
+
+struct rba_checkpoint_s {
+    char                *filename;
+    char                *tmpname;
+    double              interval;
+    double              next;
+};
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*  number of buffers in a checkpoint of partitions partitions */
+static uint64_t
+checkpoint_count (  uint32_t    partitions,
+                    uint32_t    cols,
+                    uint32_t    flags)
+{
+    return (uint64_t)partitions * (cols +
+                                    ((flags & RBA_DATA_ROWS) ? 1 : 0) +
+                                    ((flags & RBA_DATA_PAX) ? 1 : 0));
+}
+
+/*  the buffer at index i of a checkpoint */
+static rba_buf_t*
+checkpoint_buf (rba_data_t  *data,
+                uint64_t    i)
+{
+    uint64_t colbufs = (uint64_t)data->cols * data->partitions;
+
+    if (i < colbufs) {
+        return &(data->bufs[i]);
+    } else if ((NULL != data->rows) && (i < colbufs + data->partitions)) {
+        return rba_rows_getbuf (data, (uint32_t)(i - colbufs));
+    } else if (NULL != data->rows) {
+        return rba_pax_getbuf (data, (uint32_t)(i - colbufs - data->partitions));
+    } else {
+        return rba_pax_getbuf (data, (uint32_t)(i - colbufs));
+    }
+}
+
+/*  the file of the buffer at index i of a checkpoint */
+static void
+checkpoint_filename (   const char                  *dirpath,
+                        const rba_checkpoint_desc_t *desc,
+                        uint64_t                    i,
+                        char                        *filename,
+                        size_t                      len)
+{
+    uint64_t colbufs = (uint64_t)desc->cols * desc->partitions;
+    const char *name = RBA_PAX_FILENAME;
+
+    if (i < colbufs) {
+        snprintf (filename, len, "%s/p%08X/c%08X.bin", dirpath,
+                    (unsigned)(i % desc->partitions), (unsigned)(i / desc->partitions));
+        return;
+    }
+
+    i -= colbufs;
+    if ((desc->flags & RBA_DATA_ROWS) && (i < desc->partitions)) {
+        name = RBA_ROWS_FILENAME;
+    } else if (desc->flags & RBA_DATA_ROWS) {
+        i -= desc->partitions;
+    }
+    snprintf (filename, len, "%s/p%08X/%s", dirpath, (unsigned)i, name);
+}
+
+/*  Write a checkpoint to <dirpath>/checkpoint.bin every interval seconds
+    while the CSV files are parsed. */
+int
+rba_data_set_checkpoint (   rba_data_t  *data,
+                            const char  *dirpath,
+                            double      interval)
+{
+    rba_checkpoint_t *ckpt;
+    size_t len;
+
+    len = strlen (dirpath) + sizeof("/" RBA_CHECKPOINT_FILENAME ".tmp");
+    ckpt = (rba_checkpoint_t*)malloc (sizeof(rba_checkpoint_t) + 2 * len);
+    if (NULL == ckpt) {
+        RBA_ERR("malloc failed for checkpoint of %s\n", dirpath);
+        return -1;
+    }
+
+    ckpt->filename = (char*)(ckpt + 1);
+    ckpt->tmpname = ckpt->filename + len;
+    snprintf (ckpt->filename, len, "%s/" RBA_CHECKPOINT_FILENAME, dirpath);
+    snprintf (ckpt->tmpname, len, "%s/" RBA_CHECKPOINT_FILENAME ".tmp", dirpath);
+    ckpt->interval = interval;
+    ckpt->next = now () + interval;
+
+    free (data->checkpoint);
+    data->checkpoint = ckpt;
+
+    return 0;
+}
+
+static int
+write_array (   FILE        *filep,
+                const void  *arr,
+                size_t      size,
+                uint64_t    count)
+{
+    if ((0 == count) || (NULL == arr)) {
+        return 0;
+    }
+    return (count == fwrite (arr, size, count, filep)) ? 0 : -1;
+}
+
+static int
+read_array (FILE        *filep,
+            void        **arr_p,
+            size_t      size,
+            uint64_t    count)
+{
+    *arr_p = malloc ((count > 0) ? count * size : 1);
+    if (NULL == *arr_p) {
+        return -1;
+    }
+    return (count == fread (*arr_p, size, count, filep)) ? 0 : -1;
+}
+
+/*  Write a checkpoint if the interval has passed since the last one. Called
+    between records, so every buffer of a partition holds the same records. */
+int
+rba_data_checkpoint (rba_data_t *data)
+{
+    int ret = 0;
+
+    rba_checkpoint_t *ckpt = data->checkpoint;
+    rba_checkpoint_buf_t *entries;
+    rba_checkpoint_desc_t desc;
+    rba_header_t hdr;
+    rba_buf_t *buf;
+    FILE *filep;
+    uint64_t count, i;
+    uint32_t stage, slots;
+
+    if ((NULL == ckpt) || (now () < ckpt->next)) {
+        return 0;
+    }
+
+    stage = rba_stats_switch (data->stats, RBA_STAGE_WRITE);
+
+    count = checkpoint_count (data->partitions, data->cols, data->flags);
+    entries = (rba_checkpoint_buf_t*)malloc (count * sizeof(rba_checkpoint_buf_t));
+    if (NULL == entries) {
+        RBA_ERR("malloc failed for %llu checkpoint entries\n", (unsigned long long)count);
+        ret = -1;
+    }
+
+    /*  the column buffers go first, their flushes complete the PAX groups */
+    for (i = 0; (i < count) && (0 == ret); i++) {
+        ret = rba_buf_sync (checkpoint_buf (data, i), &(entries[i]));
+    }
+
+    if (0 == ret) {
+        memset (&desc, 0, sizeof(desc));
+        desc.partitions         = data->partitions;
+        desc.cols               = data->cols;
+        desc.strata             = data->strata;
+        desc.classes            = data->classes;
+        desc.flags              = data->flags;
+        desc.csv                = data->csv;
+        desc.csvhash            = data->csvhash;
+        desc.csvline            = data->csvline;
+        desc.csvoffset          = data->csvoffset;
+        desc.lines              = data->lines;
+        desc.rng_state          = data->rng_state;
+        desc.totsmpl_remaining  = data->totsmpl_remaining;
+        desc.dropped            = data->dropped;
+        desc.duplicates         = data->duplicates;
+        desc.dedup_position     = (NULL != data->dedup) ? data->dedup->position : 0;
+        desc.filtered           = data->filtered;
+
+        hdr.rba_header_magic   = RBA_HEADER_MAGIC;
+        hdr.rba_type_magic     = RBA_CHECKPOINT_MAGIC;
+        hdr.records            = count;
+        hdr.data_offset        = sizeof(rba_header_t) + sizeof(desc);
+        hdr.typesize           = sizeof(rba_checkpoint_buf_t);
+        hdr.rba_header_version = RBA_HEADER_VERSION;
+
+        slots = data->strata * data->partitions;
+        filep = fopen (ckpt->tmpname, "wb");
+        if (NULL == filep) {
+            RBA_ERR("Failed to open file %s\n", ckpt->tmpname);
+            RBA_ERRNO();
+            ret = -1;
+        } else {
+            ret = write_array (filep, &hdr, sizeof(hdr), 1);
+            ret |= write_array (filep, &desc, sizeof(desc), 1);
+            ret |= write_array (filep, entries, sizeof(rba_checkpoint_buf_t), count);
+            ret |= write_array (filep, data->partsmpl_remaining, sizeof(uint32_t), slots);
+            if (data->flags & RBA_DATA_STREAM) {
+                ret |= write_array (filep, data->partdeck, sizeof(uint32_t), slots);
+                ret |= write_array (filep, data->deckpos, sizeof(uint32_t), data->strata);
+            }
+            ret |= write_array (filep, data->stratsmpl_remaining, sizeof(uint64_t), data->strata);
+            ret |= write_array (filep, data->class_keep, sizeof(uint64_t), data->classes);
+            ret |= write_array (filep, data->class_left, sizeof(uint64_t), data->classes);
+            for (i = 0; (i < count) && (0 == ret); i++) {
+                if (entries[i].flags & RBA_CHECKPOINT_PACKED) {
+                    buf = checkpoint_buf (data, i);
+                    ret = write_array (filep, buf->chunks, sizeof(rba_chunk_index_t), entries[i].chunks);
+                }
+            }
+            if ((0 != ret) || (0 != fflush (filep)) || (0 != fsync (fileno (filep)))) {
+                RBA_ERR("Failed to write checkpoint %s\n", ckpt->tmpname);
+                ret = -1;
+            }
+            if (0 != fclose (filep)) {
+                ret = -1;
+            }
+        }
+    }
+
+    if ((0 == ret) && (0 != rename (ckpt->tmpname, ckpt->filename))) {
+        RBA_ERR("Failed to rename %s to %s\n", ckpt->tmpname, ckpt->filename);
+        RBA_ERRNO();
+        ret = -1;
+    }
+
+    free (entries);
+    ckpt->next = now () + ckpt->interval;
+    rba_stats_switch (data->stats, stage);
+
+    return ret;
+}
+
+/*  Read the checkpoint in dirpath and rewind the output files to it. The
+    data set is then opened with RBA_DATA_APPEND | RBA_DATA_RESUME and the
+    rest of the state restored with rba_data_resume. */
+int
+rba_checkpoint_load (   rba_resume_t    *resume,
+                        const char      *dirpath)
+{
+    int ret;
+
+    rba_checkpoint_desc_t *desc = &(resume->desc);
+    rba_chunk_index_t *chunks;
+    rba_header_t hdr;
+    FILE *filep;
+    char *filename;
+    size_t len;
+    uint64_t i, slots;
+
+    memset (resume, 0, sizeof(rba_resume_t));
+
+    len = strlen (dirpath) + sizeof("/p00000000/c00000000.bin") + sizeof(RBA_CHECKPOINT_FILENAME);
+    filename = (char*)malloc (len);
+    if (NULL == filename) {
+        return -1;
+    }
+    snprintf (filename, len, "%s/" RBA_CHECKPOINT_FILENAME, dirpath);
+
+    filep = fopen (filename, "rb");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open checkpoint %s\n", filename);
+        RBA_ERRNO();
+        free (filename);
+        return -1;
+    }
+
+    if ((1 != fread (&hdr, sizeof(hdr), 1, filep)) ||
+            (RBA_HEADER_MAGIC != hdr.rba_header_magic) ||
+            (RBA_CHECKPOINT_MAGIC != hdr.rba_type_magic) ||
+            (sizeof(rba_checkpoint_buf_t) != hdr.typesize) ||
+            (sizeof(rba_header_t) + sizeof(rba_checkpoint_desc_t) != hdr.data_offset) ||
+            (1 != fread (desc, sizeof(rba_checkpoint_desc_t), 1, filep)) ||
+            (hdr.records != checkpoint_count (desc->partitions, desc->cols, desc->flags))) {
+        RBA_ERR("File %s is not a checkpoint\n", filename);
+        ret = -1;
+    } else {
+
+        resume->count = hdr.records;
+        slots = (uint64_t)desc->strata * desc->partitions;
+        ret = read_array (filep, (void**)&(resume->bufs), sizeof(rba_checkpoint_buf_t), resume->count);
+        ret |= read_array (filep, (void**)&(resume->partsmpl_remaining), sizeof(uint32_t), slots);
+        if (desc->flags & RBA_DATA_STREAM) {
+            ret |= read_array (filep, (void**)&(resume->partdeck), sizeof(uint32_t), slots);
+            ret |= read_array (filep, (void**)&(resume->deckpos), sizeof(uint32_t), desc->strata);
+        }
+        ret |= read_array (filep, (void**)&(resume->stratsmpl_remaining), sizeof(uint64_t), desc->strata);
+        ret |= read_array (filep, (void**)&(resume->class_keep), sizeof(uint64_t), desc->classes);
+        ret |= read_array (filep, (void**)&(resume->class_left), sizeof(uint64_t), desc->classes);
+        if (0 != ret) {
+            RBA_ERR("Checkpoint %s is truncated\n", filename);
+            ret = -1;
+        }
+
+        /*  the chunk indexes follow in the order of the buffers */
+        for (i = 0; (i < resume->count) && (0 == ret); i++) {
+            chunks = NULL;
+            if ((resume->bufs[i].flags & RBA_CHECKPOINT_PACKED) &&
+                    (0 != read_array (filep, (void**)&chunks, sizeof(rba_chunk_index_t), resume->bufs[i].chunks))) {
+                RBA_ERR("Checkpoint %s is truncated\n", filename);
+                ret = -1;
+            } else if (resume->bufs[i].flags & RBA_CHECKPOINT_OPEN) {
+                checkpoint_filename (dirpath, desc, i, filename, len);
+                ret = rba_buf_rewind (filename, &(resume->bufs[i]), chunks);
+            }
+            free (chunks);
+        }
+    }
+
+    fclose (filep);
+    free (filename);
+    if (0 != ret) {
+        rba_checkpoint_free (resume);
+    }
+
+    return ret;
+}
+
+void
+rba_checkpoint_free (rba_resume_t *resume)
+{
+    free (resume->bufs);
+    free (resume->partsmpl_remaining);
+    free (resume->partdeck);
+    free (resume->deckpos);
+    free (resume->stratsmpl_remaining);
+    free (resume->class_keep);
+    free (resume->class_left);
+    memset (resume, 0, sizeof(rba_resume_t));
+}
+
+/*  remove the checkpoint of a finished conversion */
+int
+rba_checkpoint_remove (const char *dirpath)
+{
+    int ret;
+
+    char *filename;
+    size_t len;
+
+    len = strlen (dirpath) + sizeof("/" RBA_CHECKPOINT_FILENAME);
+    filename = (char*)malloc (len);
+    if (NULL == filename) {
+        return -1;
+    }
+    snprintf (filename, len, "%s/" RBA_CHECKPOINT_FILENAME, dirpath);
+
+    ret = unlink (filename);
+    if ((0 != ret) && (ENOENT == errno)) {
+        ret = 0;
+    } else if (0 != ret) {
+        RBA_ERR("Failed to remove checkpoint %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    }
+    free (filename);
+
+    return ret;
+}
@@ -0,0 +1,541 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#include <rba.h>
+
+/*
+    RBA_CODEC_SHUFFLE_RLE
+
+    The elements of a chunk are byte-shuffled: byte j of every element is
+    gathered into plane j, so the always-zero low mantissa bytes of small
+    integers stored as float, or the high bytes of small unsigned integers,
+    end up in long runs. The planes are then run-length coded as a sequence
+    of tokens, each starting with a LEB128 varint v:
+
+        v & 1 == 0  literal: the next (v >> 1) bytes are copied as is
+        v & 1 == 1  run:     the next byte is repeated (v >> 1) times
+
+    Decoding is a sequence of memcpy/memset calls followed by an unshuffle,
+    both of which run at memory bandwidth.
+*/
+
+#define RBA_RLE_MINRUN (4)
+
+/******************************************************************************/
+/*  byte shuffle                                                              */
+/******************************************************************************/
+
+static void
+shuffle (   const uint8_t   *src,
+            size_t          records,
+            size_t          elm_sz,
+            uint8_t         *dst)
+{
+    size_t i, j;
+
+    for (j = 0; j < elm_sz; j++) {
+        for (i = 0; i < records; i++) {
+            dst[j * records + i] = src[i * elm_sz + j];
+        }
+    }
+}
+
+static void
+unshuffle ( const uint8_t   *src,
+            size_t          records,
+            size_t          elm_sz,
+            uint8_t         *dst)
+{
+    size_t i = 0, j;
+
+#ifdef __SSE2__
+    if (4 == elm_sz) {
+        const uint8_t *p0 = src, *p1 = src + records, *p2 = src + 2 * records, *p3 = src + 3 * records;
+        for (; i + 16 <= records; i += 16) {
+            __m128i a = _mm_loadu_si128 ((const __m128i*)(p0 + i));
+            __m128i b = _mm_loadu_si128 ((const __m128i*)(p1 + i));
+            __m128i c = _mm_loadu_si128 ((const __m128i*)(p2 + i));
+            __m128i d = _mm_loadu_si128 ((const __m128i*)(p3 + i));
+            __m128i ab_lo = _mm_unpacklo_epi8 (a, b);
+            __m128i ab_hi = _mm_unpackhi_epi8 (a, b);
+            __m128i cd_lo = _mm_unpacklo_epi8 (c, d);
+            __m128i cd_hi = _mm_unpackhi_epi8 (c, d);
+            _mm_storeu_si128 ((__m128i*)(dst + 4 * i),      _mm_unpacklo_epi16 (ab_lo, cd_lo));
+            _mm_storeu_si128 ((__m128i*)(dst + 4 * i + 16), _mm_unpackhi_epi16 (ab_lo, cd_lo));
+            _mm_storeu_si128 ((__m128i*)(dst + 4 * i + 32), _mm_unpacklo_epi16 (ab_hi, cd_hi));
+            _mm_storeu_si128 ((__m128i*)(dst + 4 * i + 48), _mm_unpackhi_epi16 (ab_hi, cd_hi));
+        }
+    }
+#endif
+
+    for (; i < records; i++) {
+        for (j = 0; j < elm_sz; j++) {
+            dst[i * elm_sz + j] = src[j * records + i];
+        }
+    }
+}
+
+/******************************************************************************/
+/*  run-length coding                                                         */
+/******************************************************************************/
+
+static size_t
+put_varint (uint8_t     *dst,
+            uint64_t    val)
+{
+    size_t len = 0;
+
+    while (val >= 0x80) {
+        dst[len++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    dst[len++] = (uint8_t)val;
+
+    return len;
+}
+
+static int
+get_varint (const uint8_t   **src_p,
+            const uint8_t   *end,
+            uint64_t        *val_p)
+{
+    const uint8_t *src = *src_p;
+    uint64_t val = 0;
+    unsigned shift = 0;
+
+    do {
+        if ((src == end) || (shift > 63)) {
+            return -1;
+        }
+        val |= (uint64_t)(*src & 0x7F) << shift;
+        shift += 7;
+    } while (*(src++) & 0x80);
+
+    *src_p = src;
+    *val_p = val;
+
+    return 0;
+}
+
+/*  returns the encoded size, or 0 if it would not fit in dstcap bytes */
+static size_t
+rle_encode (const uint8_t   *src,
+            size_t          len,
+            uint8_t         *dst,
+            size_t          dstcap)
+{
+    size_t i, j, lit_start, out;
+
+    /*  a token never needs more than 10 varint bytes plus one value byte */
+    #define RLE_FITS(n) ((out + 11 + (n)) <= dstcap)
+
+    out = 0;
+    lit_start = 0;
+    i = 0;
+    while (i < len) {
+        for (j = i + 1; (j < len) && (src[j] == src[i]); j++);
+
+        if (j - i >= RBA_RLE_MINRUN) {
+            if (lit_start < i) {
+                if (!RLE_FITS(i - lit_start)) {
+                    return 0;
+                }
+                out += put_varint (dst + out, (uint64_t)(i - lit_start) << 1);
+                memcpy (dst + out, src + lit_start, i - lit_start);
+                out += i - lit_start;
+            }
+            if (!RLE_FITS(0)) {
+                return 0;
+            }
+            out += put_varint (dst + out, ((uint64_t)(j - i) << 1) | 1);
+            dst[out++] = src[i];
+            lit_start = j;
+        }
+        i = j;
+    }
+
+    if (lit_start < len) {
+        if (!RLE_FITS(len - lit_start)) {
+            return 0;
+        }
+        out += put_varint (dst + out, (uint64_t)(len - lit_start) << 1);
+        memcpy (dst + out, src + lit_start, len - lit_start);
+        out += len - lit_start;
+    }
+
+    #undef RLE_FITS
+
+    return out;
+}
+
+static int
+rle_decode (const uint8_t   *src,
+            size_t          srclen,
+            uint8_t         *dst,
+            size_t          dstlen)
+{
+    const uint8_t *end = src + srclen;
+    size_t out = 0;
+    uint64_t token, len;
+
+    while (src < end) {
+        if (0 != get_varint (&src, end, &token)) {
+            return -1;
+        }
+        len = token >> 1;
+        if (len > dstlen - out) {
+            return -1;
+        }
+        if (token & 1) {
+            if (src == end) {
+                return -1;
+            }
+            memset (dst + out, *(src++), len);
+        } else {
+            if (len > (uint64_t)(end - src)) {
+                return -1;
+            }
+            memcpy (dst + out, src, len);
+            src += len;
+        }
+        out += len;
+    }
+
+    return (out == dstlen) ? 0 : -1;
+}
+
+/******************************************************************************/
+/*  chunk codec                                                               */
+/******************************************************************************/
+
+/*  Pack records elements of elm_sz bytes from src into dst, using scratch
+    (records * elm_sz bytes) for the shuffled planes. Returns the packed size,
+    or 0 if packing does not save space, in which case the chunk should be
+    stored with RBA_CODEC_RAW. dst must hold records * elm_sz bytes. */
+size_t
+rba_codec_pack (const void  *src,
+                size_t      records,
+                size_t      elm_sz,
+                void        *dst,
+                void        *scratch)
+{
+    size_t len = records * elm_sz;
+
+    if (elm_sz > 1) {
+        shuffle ((const uint8_t*)src, records, elm_sz, (uint8_t*)scratch);
+        src = scratch;
+    }
+
+    return rle_encode ((const uint8_t*)src, len, (uint8_t*)dst, len);
+}
+
+/*  Unpack a chunk of records elements into dst. scratch must hold
+    records * elm_sz bytes unless elm_sz is 1 or the codec is RBA_CODEC_RAW. */
+int
+rba_codec_unpack (  uint32_t    codec,
+                    const void  *src,
+                    size_t      srclen,
+                    size_t      records,
+                    size_t      elm_sz,
+                    void        *dst,
+                    void        *scratch)
+{
+    int ret;
+    size_t len = records * elm_sz;
+
+    switch (codec) {
+        case RBA_CODEC_RAW:
+            if (srclen != len) {
+                ret = -1;
+            } else {
+                memcpy (dst, src, len);
+                ret = 0;
+            }
+            break;
+
+        case RBA_CODEC_SHUFFLE_RLE:
+            if (elm_sz == 1) {
+                ret = rle_decode ((const uint8_t*)src, srclen, (uint8_t*)dst, len);
+            } else {
+                ret = rle_decode ((const uint8_t*)src, srclen, (uint8_t*)scratch, len);
+                if (0 == ret) {
+                    unshuffle ((const uint8_t*)scratch, records, elm_sz, (uint8_t*)dst);
+                }
+            }
+            break;
+
+        default:
+            ret = -1;
+            break;
+    }
+
+    if (0 != ret) {
+        RBA_ERR("Corrupt chunk (codec %u, %u bytes, %u records)\n", (unsigned)codec, (unsigned)srclen, (unsigned)records);
+    }
+
+    return ret;
+}
+
+/******************************************************************************/
+/*  packed file reader                                                        */
+/******************************************************************************/
+
+int
+rba_packed_load_index ( int                 fd,
+                        const char          *filename,
+                        rba_header_t        *hdr,
+                        rba_chunk_index_t   **chunks_p,
+                        uint64_t            *chunk_count_p,
+                        uint64_t            *index_offset_p)
+{
+    int ret;
+
+    struct stat st;
+    rba_packed_trailer_t trailer;
+    rba_chunk_index_t *chunks;
+    uint64_t c, records, raw;
+    size_t index_sz;
+
+    *chunks_p = NULL;
+    *chunk_count_p = 0;
+
+    if (0 != fstat (fd, &st)) {
+        RBA_ERRNO();
+        ret = -1;
+    } else if ((0 == hdr->records) && ((uint64_t)st.st_size == hdr->data_offset)) {
+        /*  nothing was ever written */
+        *index_offset_p = hdr->data_offset;
+        ret = 0;
+    } else if (((uint64_t)st.st_size < hdr->data_offset + sizeof(trailer)) ||
+                (sizeof(trailer) != pread (fd, &trailer, sizeof(trailer), st.st_size - sizeof(trailer))) ||
+                (RBA_PACKED_MAGIC != trailer.magic) ||
+                (trailer.index_offset < hdr->data_offset) ||
+                (trailer.chunks > ((uint64_t)st.st_size - trailer.index_offset) / sizeof(rba_chunk_index_t))) {
+        RBA_ERR("Packed RBA file %s has no valid chunk index\n", filename);
+        ret = -1;
+    } else {
+
+        index_sz = trailer.chunks * sizeof(rba_chunk_index_t);
+        chunks = (rba_chunk_index_t*)malloc (index_sz > 0 ? index_sz : 1);
+        if (NULL == chunks) {
+            RBA_ERR("Failed to allocate chunk index of %llu entries\n", (unsigned long long)trailer.chunks);
+            ret = -1;
+        } else if ((ssize_t)index_sz != pread (fd, chunks, index_sz, trailer.index_offset)) {
+            RBA_ERR("Failed to read chunk index from %s\n", filename);
+            free (chunks);
+            ret = -1;
+        } else {
+
+            ret = 0;
+            records = 0;
+            for (c = 0; (c < trailer.chunks) && (0 == ret); c++) {
+                /*  readers size their buffers from the record counts, so
+                    a chunk may not pack to more than its records */
+                raw = (uint64_t)chunks[c].records * hdr->typesize;
+                if ((chunks[c].first_record != records) ||
+                        (chunks[c].offset > trailer.index_offset) ||
+                        (chunks[c].offset + sizeof(rba_chunk_header_t) + chunks[c].packed_size > trailer.index_offset) ||
+                        (chunks[c].codec > RBA_CODEC_PAX_GROUP) ||
+                        ((RBA_CODEC_RAW == chunks[c].codec) && (chunks[c].packed_size != raw)) ||
+                        ((RBA_CODEC_SHUFFLE_RLE == chunks[c].codec) && (chunks[c].packed_size > raw))) {
+                    ret = -1;
+                }
+                records += chunks[c].records;
+            }
+            if ((0 != ret) || (records != hdr->records)) {
+                RBA_ERR("Chunk index of %s does not match its header\n", filename);
+                free (chunks);
+                ret = -1;
+            } else {
+                *chunks_p = chunks;
+                *chunk_count_p = trailer.chunks;
+                *index_offset_p = trailer.index_offset;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int
+rba_packed_open (   rba_packed_file_t   *pf,
+                    const char          *filename)
+{
+    int ret;
+
+    uint64_t c, maxrecords, index_offset;
+
+    memset (pf, 0, sizeof(rba_packed_file_t));
+
+    pf->fd = open (filename, O_RDONLY);
+    if (pf->fd < 0) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else if (sizeof(rba_header_t) != pread (pf->fd, &(pf->hdr), sizeof(rba_header_t), 0)) {
+        RBA_ERR("Failed to read header from file %s\n", filename);
+        ret = -1;
+    } else if ((RBA_HEADER_MAGIC != pf->hdr.rba_header_magic) ||
+                (RBA_HEADER_VERSION_PACKED != pf->hdr.rba_header_version) ||
+                (0 == pf->hdr.typesize)) {
+        RBA_ERR("File %s is not a packed RBA file\n", filename);
+        ret = -1;
+    } else {
+
+        ret = rba_packed_load_index (   pf->fd,
+                                        filename,
+                                        &(pf->hdr),
+                                        &(pf->chunks),
+                                        &(pf->chunk_count),
+                                        &index_offset);
+        for (c = 0; (c < pf->chunk_count) && (0 == ret); c++) {
+            if (RBA_CODEC_PAX_GROUP == pf->chunks[c].codec) {
+                RBA_ERR("File %s is a PAX file, not a packed RBA file\n", filename);
+                free (pf->chunks);
+                ret = -1;
+            }
+        }
+        if (0 == ret) {
+            for (c = 0, maxrecords = 0; c < pf->chunk_count; c++) {
+                maxrecords = (pf->chunks[c].records > maxrecords) ? pf->chunks[c].records : maxrecords;
+            }
+            pf->maxchunk = maxrecords;
+            /*  packed payload, shuffle planes and a decoded chunk */
+            pf->scratch = malloc (3 * maxrecords * pf->hdr.typesize + 1);
+            if (NULL == pf->scratch) {
+                RBA_ERR("Failed to allocate decode buffers for %s\n", filename);
+                free (pf->chunks);
+                ret = -1;
+            }
+        }
+    }
+
+    if ((0 != ret) && (pf->fd >= 0)) {
+        close (pf->fd);
+        pf->fd = -1;
+    }
+
+    return ret;
+}
+
+/*  index of the chunk holding record, the index is sorted by first_record */
+static uint64_t
+find_chunk (rba_packed_file_t   *pf,
+            uint64_t            record)
+{
+    uint64_t lo = 0, hi = pf->chunk_count, mid;
+
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (pf->chunks[mid].first_record <= record) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*  Decode count records starting at record first into dst. Chunks that are
+    fully covered are decoded directly into dst. */
+int
+rba_packed_read (   rba_packed_file_t   *pf,
+                    uint64_t            first,
+                    uint64_t            count,
+                    void                *dst)
+{
+    int ret = 0;
+
+    size_t elm_sz = pf->hdr.typesize;
+    uint8_t *packed = (uint8_t*)pf->scratch;
+    uint8_t *planes = packed + pf->maxchunk * elm_sz;
+    uint8_t *decoded = planes + pf->maxchunk * elm_sz;
+    uint8_t *out = (uint8_t*)dst;
+    uint64_t c, skip, take;
+    rba_chunk_index_t *chunk;
+
+    if ((first > pf->hdr.records) || (count > pf->hdr.records - first)) {
+        RBA_ERR("Records %llu..%llu are out of range\n", (unsigned long long)first, (unsigned long long)(first + count));
+        return -1;
+    }
+
+    for (c = (count > 0) ? find_chunk (pf, first) : pf->chunk_count;
+            (c < pf->chunk_count) && (count > 0) && (0 == ret);
+                c++) {
+
+        chunk = &(pf->chunks[c]);
+        skip = first - chunk->first_record;
+        take = chunk->records - skip;
+        take = (take < count) ? take : count;
+
+        if ((ssize_t)chunk->packed_size != pread (  pf->fd,
+                                                    packed,
+                                                    chunk->packed_size,
+                                                    chunk->offset + sizeof(rba_chunk_header_t))) {
+            RBA_ERR("Failed to read chunk %llu\n", (unsigned long long)c);
+            ret = -1;
+        } else if ((0 == skip) && (take == chunk->records)) {
+            ret = rba_codec_unpack (chunk->codec, packed, chunk->packed_size, chunk->records, elm_sz, out, planes);
+        } else {
+            ret = rba_codec_unpack (chunk->codec, packed, chunk->packed_size, chunk->records, elm_sz, decoded, planes);
+            if (0 == ret) {
+                memcpy (out, decoded + skip * elm_sz, take * elm_sz);
+            }
+        }
+
+        out += take * elm_sz;
+        first += take;
+        count -= take;
+    }
+
+    return ret;
+}
+
+void
+rba_packed_close (rba_packed_file_t *pf)
+{
+    if (pf->fd >= 0) {
+        close (pf->fd);
+    }
+    free (pf->chunks);
+    free (pf->scratch);
+    memset (pf, 0, sizeof(rba_packed_file_t));
+    pf->fd = -1;
+}
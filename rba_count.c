@@ -0,0 +1,369 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #include <immintrin.h>
+    #define RBA_COUNT_HAVE_AVX2
+#endif
+
+#include <rba.h>
+
+/*  large files are split into ranges of this many bytes, each range is read
+    into the worker's buffer RBA_COUNT_READSZ bytes at a time */
+#define RBA_COUNT_RANGE     (64*1024*1024)
+#define RBA_COUNT_READSZ    (4*1024*1024)
+
+/******************************************************************************/
+/*  newline counting kernels                                                  */
+/******************************************************************************/
+
+static uint64_t
+count_newlines_scalar ( const char  *buf,
+                        size_t      len)
+{
+    const char *nextnewline = buf;
+    const char *bufend = buf + len;
+    uint64_t count = 0;
+
+    while ((nextnewline < bufend) &&
+            (NULL != (nextnewline = memchr (nextnewline, '\n', (bufend - nextnewline))))) {
+        nextnewline++;
+        count++;
+    }
+
+    return count;
+}
+
+#ifdef RBA_COUNT_HAVE_AVX2
+/*  compare 32 bytes at a time and accumulate the matches in per-byte counters,
+    which are folded into 64-bit lanes with a SAD before they can overflow */
+__attribute__((target("avx2")))
+static uint64_t
+count_newlines_avx2 (   const char  *buf,
+                        size_t      len)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = _mm256_setzero_si256();
+    __m256i acc;
+    size_t i = 0;
+    size_t blockend;
+    uint64_t count;
+
+    while (i + 32 <= len) {
+        acc = _mm256_setzero_si256();
+        /*  at most 255 iterations per block so the byte counters don't wrap */
+        blockend = i + 255 * 32;
+        if (blockend > len) {
+            blockend = len;
+        }
+        for (; i + 32 <= blockend; i += 32) {
+            __m256i v = _mm256_loadu_si256 ((const __m256i*)(buf + i));
+            /*  matches are 0xFF, i.e. -1, so subtracting counts them */
+            acc = _mm256_sub_epi8 (acc, _mm256_cmpeq_epi8 (v, newline));
+        }
+        total = _mm256_add_epi64 (total, _mm256_sad_epu8 (acc, zero));
+    }
+
+    count = (uint64_t)_mm256_extract_epi64 (total, 0) +
+            (uint64_t)_mm256_extract_epi64 (total, 1) +
+            (uint64_t)_mm256_extract_epi64 (total, 2) +
+            (uint64_t)_mm256_extract_epi64 (total, 3);
+
+    return count + count_newlines_scalar (buf + i, len - i);
+}
+#endif
+
+uint64_t
+rba_count_newlines (const char  *buf,
+                    size_t      len)
+{
+#ifdef RBA_COUNT_HAVE_AVX2
+    static int have_avx2 = -1;
+
+    if (have_avx2 < 0) {
+        __builtin_cpu_init ();
+        have_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+    }
+    if (have_avx2) {
+        return count_newlines_avx2 (buf, len);
+    }
+#endif
+    return count_newlines_scalar (buf, len);
+}
+
+/******************************************************************************/
+/*  parallel record counting                                                  */
+/******************************************************************************/
+
+typedef struct {
+    int         file;
+    off_t       offset;
+    off_t       len;
+    uint64_t    count;
+} rba_count_range_t;
+
+typedef struct {
+    const char          **filenames;
+    rba_count_range_t   *ranges;
+    size_t              range_count;
+    size_t              next_range;
+    int                 failed;
+    pthread_mutex_t     lock;
+} rba_count_work_t;
+
+static int
+count_range (   const char          *filename,
+                rba_count_range_t   *range,
+                char                *buf)
+{
+    int ret;
+
+    int fd;
+    off_t offset, end;
+    ssize_t readin;
+    size_t readsz;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+
+        ret = 0;
+        range->count = 0;
+        offset = range->offset;
+        end = range->offset + range->len;
+        while ((0 == ret) && (offset < end)) {
+            readsz = ((end - offset) < RBA_COUNT_READSZ) ? (size_t)(end - offset) : RBA_COUNT_READSZ;
+            readin = pread (fd, buf, readsz, offset);
+            if (readin < 0) {
+                RBA_ERR("Error reading file %s\n", filename);
+                RBA_ERRNO();
+                ret = -1;
+            } else if (0 == readin) {
+                RBA_ERR("File %s was truncated while counting records\n", filename);
+                ret = -1;
+            } else {
+                range->count += rba_count_newlines (buf, (size_t)readin);
+                offset += readin;
+            }
+        }
+
+        close (fd);
+    }
+
+    return ret;
+}
+
+static void*
+count_worker (void *arg)
+{
+    rba_count_work_t *work = (rba_count_work_t*)arg;
+    rba_count_range_t *range;
+    char *buf;
+    size_t r;
+
+    buf = malloc (RBA_COUNT_READSZ);
+    if (NULL == buf) {
+        RBA_ERR("Failed to allocate %u byte read buffer\n", (unsigned)RBA_COUNT_READSZ);
+        pthread_mutex_lock (&(work->lock));
+        work->failed = 1;
+        pthread_mutex_unlock (&(work->lock));
+    } else {
+
+        for (;;) {
+            pthread_mutex_lock (&(work->lock));
+            r = work->next_range;
+            if ((r < work->range_count) && !work->failed) {
+                work->next_range++;
+            } else {
+                r = work->range_count;
+            }
+            pthread_mutex_unlock (&(work->lock));
+
+            if (r == work->range_count) {
+                break;
+            }
+
+            range = &(work->ranges[r]);
+            if (0 != count_range (work->filenames[range->file], range, buf)) {
+                pthread_mutex_lock (&(work->lock));
+                work->failed = 1;
+                pthread_mutex_unlock (&(work->lock));
+            }
+        }
+
+        free (buf);
+    }
+
+    return NULL;
+}
+
+/*  check the header of a CSV file and find the byte range holding the records */
+static int
+checkhdr_datarange (rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *filename,
+                    off_t               *start_p,
+                    off_t               *end_p)
+{
+    int ret;
+
+    struct stat st;
+
+    FILE* filep = fopen (filename, "r");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        ret = -1;
+    } else {
+        ret = rba_checkhdr (spec,
+                            cols,
+                            filep);
+        if (0 != ret) {
+            RBA_ERR("Header check for CSV file %s failed\n", filename);
+            ret = -1;
+        } else if (0 != fstat (fileno(filep), &st)) {
+            RBA_ERRNO();
+            ret = -1;
+        } else {
+            *start_p = ftello (filep);
+            *end_p = st.st_size;
+            ret = (*start_p < 0) ? -1 : 0;
+        }
+
+        fclose(filep);
+    }
+
+    return ret;
+}
+
+/*  Check the header and count the records of every file using up to threads
+    workers. Each file is cut into RBA_COUNT_RANGE byte ranges after its header
+    line, the ranges of all files are counted concurrently, and the per-range
+    counts are summed per file once all workers are done. */
+int
+rba_checkhdr_countrecords_parallel (rba_spec_entry_t    *spec,
+                                    uint32_t            cols,
+                                    const char          **filenames,
+                                    int                 count,
+                                    uint32_t            threads,
+                                    uint64_t            *reccounts)
+{
+    int ret;
+
+    rba_count_work_t work;
+    pthread_t *workers;
+    off_t *starts, *ends, offset;
+    size_t r;
+    uint32_t t, started;
+    int f;
+
+    memset (&work, 0, sizeof(work));
+    work.filenames = filenames;
+
+    starts = (off_t*)malloc (2 * (count > 0 ? count : 1) * sizeof(off_t));
+    if (NULL == starts) {
+        RBA_ERR("malloc failed for %d file ranges\n", count);
+        ret = -1;
+    } else {
+        ends = starts + count;
+
+        for (f = 0, ret = 0; (f < count) && (0 == ret); f++) {
+            ret = checkhdr_datarange (spec, cols, filenames[f], &(starts[f]), &(ends[f]));
+            if (0 == ret) {
+                work.range_count += (ends[f] - starts[f] + RBA_COUNT_RANGE - 1) / RBA_COUNT_RANGE;
+            }
+        }
+
+        if (0 == ret) {
+            work.ranges = (rba_count_range_t*)calloc (work.range_count + 1, sizeof(rba_count_range_t));
+            workers = (pthread_t*)malloc ((threads > 0 ? threads : 1) * sizeof(pthread_t));
+            if ((NULL == work.ranges) || (NULL == workers)) {
+                RBA_ERR("malloc failed for %u count ranges\n", (unsigned)work.range_count);
+                ret = -1;
+            } else {
+
+                for (f = 0, r = 0; f < count; f++) {
+                    for (offset = starts[f]; offset < ends[f]; offset += RBA_COUNT_RANGE, r++) {
+                        work.ranges[r].file = f;
+                        work.ranges[r].offset = offset;
+                        work.ranges[r].len = ((ends[f] - offset) < RBA_COUNT_RANGE) ? (ends[f] - offset) : RBA_COUNT_RANGE;
+                    }
+                }
+
+                if (threads > work.range_count) {
+                    threads = (uint32_t)work.range_count;
+                }
+
+                pthread_mutex_init (&(work.lock), NULL);
+                for (t = 1, started = 0; t < threads; t++) {
+                    if (0 != pthread_create (&(workers[started]), NULL, count_worker, &work)) {
+                        RBA_ERR("Failed to start counting thread %u\n", (unsigned)t);
+                        break;
+                    }
+                    started++;
+                }
+                /*  the calling thread always takes part, so a failure to start
+                    the workers only costs parallelism */
+                count_worker (&work);
+                for (t = 0; t < started; t++) {
+                    pthread_join (workers[t], NULL);
+                }
+                pthread_mutex_destroy (&(work.lock));
+
+                if (work.failed) {
+                    ret = -1;
+                } else {
+                    for (f = 0; f < count; f++) {
+                        reccounts[f] = 0;
+                    }
+                    for (r = 0; r < work.range_count; r++) {
+                        reccounts[work.ranges[r].file] += work.ranges[r].count;
+                    }
+                }
+            }
+
+            free (workers);
+            free (work.ranges);
+        }
+
+        free (starts);
+    }
+
+    return ret;
+}
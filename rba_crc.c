@@ -0,0 +1,570 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <rba.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define RBA_CRC_HW (1)
+#endif
+
+/*  CRC32C (Castagnoli), reflected polynomial. The hardware version runs
+    three independent crc32 instruction streams over adjacent blocks and
+    combines them by shifting the first two CRCs over the length of the
+    blocks that follow, with tables built once from the GF(2) matrix of the
+    shift (after Mark Adler's crc32c.c). */
+#define CRC32C_POLY     (0x82F63B78)
+#define CRC32C_LONG     (8192)
+#define CRC32C_SHORT    (256)
+
+static uint32_t crc32c_table[256];
+#ifdef RBA_CRC_HW
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+static int crc32c_hw;
+#endif
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+#ifdef RBA_CRC_HW
+static uint32_t
+gf2_matrix_times (  const uint32_t  *mat,
+                    uint32_t        vec)
+{
+    uint32_t sum = 0;
+
+    for (; 0 != vec; vec >>= 1, mat++) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+    }
+
+    return sum;
+}
+
+static void
+gf2_matrix_square ( uint32_t        *square,
+                    const uint32_t  *mat)
+{
+    int n;
+
+    for (n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times (mat, mat[n]);
+    }
+}
+
+/*  tables that feed len zero bytes through a CRC, one per byte of the CRC */
+static void
+crc32c_zeros (  uint32_t    zeros[][256],
+                size_t      len)
+{
+    uint32_t even[32], odd[32], row;
+    int n;
+
+    odd[0] = CRC32C_POLY;
+    for (n = 1, row = 1; n < 32; n++, row <<= 1) {
+        odd[n] = row;
+    }
+    gf2_matrix_square (even, odd);  /* two zero bits */
+    gf2_matrix_square (odd, even);  /* four zero bits */
+
+    /*  square up to len bytes, starting from one byte */
+    for (;;) {
+        gf2_matrix_square (even, odd);
+        len >>= 1;
+        if (0 == len) {
+            memcpy (odd, even, sizeof(odd));
+            break;
+        }
+        gf2_matrix_square (odd, even);
+        len >>= 1;
+        if (0 == len) {
+            break;
+        }
+    }
+
+    for (n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times (odd, (uint32_t)n);
+        zeros[1][n] = gf2_matrix_times (odd, (uint32_t)n << 8);
+        zeros[2][n] = gf2_matrix_times (odd, (uint32_t)n << 16);
+        zeros[3][n] = gf2_matrix_times (odd, (uint32_t)n << 24);
+    }
+}
+
+static inline uint32_t
+crc32c_shift (  uint32_t    zeros[][256],
+                uint32_t    crc)
+{
+    return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^
+            zeros[2][(crc >> 16) & 0xFF] ^ zeros[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw_update (  uint32_t        crc,
+                    const uint8_t   *next,
+                    size_t          len)
+{
+    uint64_t crc0, crc1, crc2, word0, word1, word2;
+    const uint8_t *end;
+
+    crc0 = crc;
+    for (; (0 != len) && (0 != ((uintptr_t)next & 7)); next++, len--) {
+        crc0 = _mm_crc32_u8 ((uint32_t)crc0, *next);
+    }
+
+    for (; len >= 3 * CRC32C_LONG; len -= 3 * CRC32C_LONG, next += 2 * CRC32C_LONG) {
+        crc1 = 0;
+        crc2 = 0;
+        for (end = next + CRC32C_LONG; next < end; next += 8) {
+            memcpy (&word0, next, 8);
+            memcpy (&word1, next + CRC32C_LONG, 8);
+            memcpy (&word2, next + 2 * CRC32C_LONG, 8);
+            crc0 = _mm_crc32_u64 (crc0, word0);
+            crc1 = _mm_crc32_u64 (crc1, word1);
+            crc2 = _mm_crc32_u64 (crc2, word2);
+        }
+        crc0 = crc32c_shift (crc32c_long, (uint32_t)crc0) ^ crc1;
+        crc0 = crc32c_shift (crc32c_long, (uint32_t)crc0) ^ crc2;
+    }
+
+    for (; len >= 3 * CRC32C_SHORT; len -= 3 * CRC32C_SHORT, next += 2 * CRC32C_SHORT) {
+        crc1 = 0;
+        crc2 = 0;
+        for (end = next + CRC32C_SHORT; next < end; next += 8) {
+            memcpy (&word0, next, 8);
+            memcpy (&word1, next + CRC32C_SHORT, 8);
+            memcpy (&word2, next + 2 * CRC32C_SHORT, 8);
+            crc0 = _mm_crc32_u64 (crc0, word0);
+            crc1 = _mm_crc32_u64 (crc1, word1);
+            crc2 = _mm_crc32_u64 (crc2, word2);
+        }
+        crc0 = crc32c_shift (crc32c_short, (uint32_t)crc0) ^ crc1;
+        crc0 = crc32c_shift (crc32c_short, (uint32_t)crc0) ^ crc2;
+    }
+
+    for (; len >= 8; len -= 8, next += 8) {
+        memcpy (&word0, next, 8);
+        crc0 = _mm_crc32_u64 (crc0, word0);
+    }
+    for (; 0 != len; len--, next++) {
+        crc0 = _mm_crc32_u8 ((uint32_t)crc0, *next);
+    }
+
+    return (uint32_t)crc0;
+}
+#endif
+
+static void
+crc32c_init (void)
+{
+    uint32_t n, k, crc;
+
+    for (n = 0; n < 256; n++) {
+        crc = n;
+        for (k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[n] = crc;
+    }
+
+#ifdef RBA_CRC_HW
+    crc32c_hw = __builtin_cpu_supports ("sse4.2");
+    if (crc32c_hw) {
+        crc32c_zeros (crc32c_long, CRC32C_LONG);
+        crc32c_zeros (crc32c_short, CRC32C_SHORT);
+    }
+#endif
+}
+
+/*  Continue the CRC32C crc of earlier bytes over len bytes at buf, start
+    with crc 0. */
+uint32_t
+rba_crc32c (uint32_t    crc,
+            const void  *buf,
+            size_t      len)
+{
+    const uint8_t *next = (const uint8_t*)buf;
+
+    pthread_once (&crc32c_once, crc32c_init);
+
+    crc = ~crc;
+#ifdef RBA_CRC_HW
+    if (crc32c_hw) {
+        return ~crc32c_hw_update (crc, next, len);
+    }
+#endif
+    for (; 0 != len; len--, next++) {
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ *next) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+/*  The sidecar of an RBA file is the RBA file <filename>.crc holding one
+    rba_crc_entry_t per byte range of the file, in order and covering all of
+    it. */
+int
+rba_crc_write ( const char              *filename,
+                const rba_crc_entry_t   *entries,
+                uint64_t                count)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+    char *crcname;
+
+    crcname = (char*)malloc (strlen (filename) + sizeof(RBA_CRC_SUFFIX));
+    if (NULL == crcname) {
+        return -1;
+    }
+    sprintf (crcname, "%s" RBA_CRC_SUFFIX, filename);
+
+    hdr.rba_header_magic   = RBA_HEADER_MAGIC;
+    hdr.rba_type_magic     = RBA_CRC_MAGIC;
+    hdr.records            = count;
+    hdr.data_offset        = sizeof(rba_header_t);
+    hdr.typesize           = sizeof(rba_crc_entry_t);
+    hdr.rba_header_version = RBA_HEADER_VERSION;
+
+    filep = fopen (crcname, "wb");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", crcname);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        if ((1 != fwrite (&hdr, sizeof(hdr), 1, filep)) ||
+                ((count > 0) && (count != fwrite (entries, sizeof(rba_crc_entry_t), count, filep)))) {
+            RBA_ERR("Failed to write %llu checksums to %s\n", (unsigned long long)count, crcname);
+            ret = -1;
+        } else {
+            ret = 0;
+        }
+        if (0 != fclose (filep)) {
+            ret = -1;
+        }
+    }
+    free (crcname);
+
+    return ret;
+}
+
+/*  Read the sidecar of filename into a new array. Returns 1 when there is
+    none. */
+int
+rba_crc_read (  const char      *filename,
+                rba_crc_entry_t **entries_p,
+                uint64_t        *count_p)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+    rba_crc_entry_t *entries = NULL;
+    struct stat st;
+    char *crcname;
+
+    crcname = (char*)malloc (strlen (filename) + sizeof(RBA_CRC_SUFFIX));
+    if (NULL == crcname) {
+        return -1;
+    }
+    sprintf (crcname, "%s" RBA_CRC_SUFFIX, filename);
+
+    filep = fopen (crcname, "rb");
+    if ((NULL == filep) && (ENOENT == errno)) {
+        ret = 1;
+    } else if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", crcname);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        if ((0 != fstat (fileno (filep), &st)) ||
+                (1 != fread (&hdr, sizeof(hdr), 1, filep)) ||
+                (RBA_HEADER_MAGIC != hdr.rba_header_magic) ||
+                (RBA_CRC_MAGIC != hdr.rba_type_magic) ||
+                (sizeof(rba_crc_entry_t) != hdr.typesize) ||
+                (sizeof(rba_header_t) != hdr.data_offset) ||
+                ((uint64_t)st.st_size != sizeof(rba_header_t) + hdr.records * sizeof(rba_crc_entry_t))) {
+            RBA_ERR("File %s is not a checksum file\n", crcname);
+            ret = -1;
+        } else {
+            entries = (rba_crc_entry_t*)malloc ((hdr.records > 0) ? hdr.records * sizeof(rba_crc_entry_t) : 1);
+            if ((NULL == entries) ||
+                    ((hdr.records > 0) && (hdr.records != fread (entries, sizeof(rba_crc_entry_t), hdr.records, filep)))) {
+                RBA_ERR("Failed to read %llu checksums from %s\n", (unsigned long long)hdr.records, crcname);
+                free (entries);
+                entries = NULL;
+                ret = -1;
+            } else {
+                ret = 0;
+            }
+        }
+        fclose (filep);
+    }
+    free (crcname);
+
+    *entries_p = entries;
+    *count_p = (0 == ret) ? hdr.records : 0;
+
+    return ret;
+}
+
+/*  Append checksums of the len bytes at offset of the file fd to entries,
+    RBA_CRC_SPAN bytes per entry. */
+int
+rba_crc_range ( int                 fd,
+                uint64_t            offset,
+                uint64_t            len,
+                rba_crc_entry_t     **entries_p,
+                uint64_t            *count_p,
+                uint64_t            *cap_p)
+{
+    int ret = 0;
+
+    uint8_t *buf;
+    rba_crc_entry_t *entries;
+    size_t span;
+    uint64_t cap;
+
+    buf = (uint8_t*)malloc (RBA_CRC_SPAN);
+    if (NULL == buf) {
+        return -1;
+    }
+
+    while ((len > 0) && (0 == ret)) {
+        span = (len > RBA_CRC_SPAN) ? RBA_CRC_SPAN : (size_t)len;
+        if (*count_p == *cap_p) {
+            cap = (*cap_p > 0) ? 2 * *cap_p : 64;
+            entries = (rba_crc_entry_t*)realloc (*entries_p, cap * sizeof(rba_crc_entry_t));
+            if (NULL == entries) {
+                RBA_ERR("Failed to grow checksums to %llu entries\n", (unsigned long long)cap);
+                ret = -1;
+                break;
+            }
+            *entries_p = entries;
+            *cap_p = cap;
+        }
+        if ((ssize_t)span != pread (fd, buf, span, (off_t)offset)) {
+            RBA_ERR("Failed to read %lu bytes at %llu\n", (unsigned long)span, (unsigned long long)offset);
+            ret = -1;
+        } else {
+            entries = &((*entries_p)[*count_p]);
+            entries->offset = offset;
+            entries->length = (uint32_t)span;
+            entries->crc = rba_crc32c (0, buf, span);
+            (*count_p)++;
+            offset += span;
+            len -= span;
+        }
+    }
+    free (buf);
+
+    return ret;
+}
+
+/*  (Re)write the sidecar of an existing file from its contents */
+int
+rba_crc_file (const char *filename)
+{
+    int ret;
+
+    int fd;
+    struct stat st;
+    rba_crc_entry_t *entries = NULL;
+    uint64_t count = 0, cap = 0;
+
+    fd = open (filename, O_RDONLY);
+    if ((fd < 0) || (0 != fstat (fd, &st))) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        ret = rba_crc_range (fd, 0, (uint64_t)st.st_size, &entries, &count, &cap);
+        if (0 == ret) {
+            ret = rba_crc_write (filename, entries, count);
+        }
+    }
+    if (fd >= 0) {
+        close (fd);
+    }
+    free (entries);
+
+    return ret;
+}
+
+/*  check the layout of an RBA file against its header */
+static int
+verify_layout ( int                 fd,
+                const char          *filename,
+                uint64_t            size)
+{
+    int ret;
+
+    rba_header_t hdr;
+    rba_chunk_index_t *chunks = NULL;
+    uint64_t count, index_offset;
+
+    if ((sizeof(hdr) != pread (fd, &hdr, sizeof(hdr), 0)) ||
+            (RBA_HEADER_MAGIC != hdr.rba_header_magic) ||
+            (hdr.data_offset < sizeof(hdr)) || (hdr.data_offset > size)) {
+        RBA_ERR("File %s has no valid RBA header\n", filename);
+        ret = -1;
+    } else if (RBA_HEADER_VERSION_PACKED == hdr.rba_header_version) {
+        ret = rba_packed_load_index (fd, filename, &hdr, &chunks, &count, &index_offset);
+        if ((0 == ret) && (count > 0) &&
+                (index_offset + count * sizeof(rba_chunk_index_t) + sizeof(rba_packed_trailer_t) != size)) {
+            RBA_ERR("File %s has %llu bytes after its chunk index\n", filename,
+                    (unsigned long long)(size - index_offset - count * sizeof(rba_chunk_index_t) - sizeof(rba_packed_trailer_t)));
+            ret = -1;
+        }
+        free (chunks);
+    } else if (RBA_HEADER_VERSION != hdr.rba_header_version) {
+        RBA_ERR("File %s has unknown version %u\n", filename, (unsigned)hdr.rba_header_version);
+        ret = -1;
+    } else if (hdr.data_offset + hdr.records * hdr.typesize != size) {
+        RBA_ERR("File %s holds %llu bytes, its header %llu records of %u bytes after %u\n",
+                filename, (unsigned long long)size, (unsigned long long)hdr.records,
+                (unsigned)hdr.typesize, (unsigned)hdr.data_offset);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  Check that the ranges of the sidecar cover the file and match its
+    contents, reading the file once in RBA_CRC_SPAN blocks. */
+static int
+verify_crcs (   int                     fd,
+                const char              *filename,
+                uint64_t                size,
+                const rba_crc_entry_t   *entries,
+                uint64_t                count)
+{
+    int ret = 0;
+
+    uint8_t *buf;
+    uint64_t e, pos, end, covered;
+    size_t n, off, take;
+    ssize_t got;
+    uint32_t crc = 0;
+
+    for (e = 0, covered = 0; (e < count) && (0 == ret); e++) {
+        if (entries[e].offset != covered) {
+            ret = -1;
+        }
+        covered += entries[e].length;
+    }
+    if ((0 != ret) || (covered != size)) {
+        RBA_ERR("Checksums of %s do not cover the file\n", filename);
+        return -1;
+    }
+
+    buf = (uint8_t*)malloc (RBA_CRC_SPAN);
+    if (NULL == buf) {
+        return -1;
+    }
+
+    for (pos = 0, e = 0; (pos < size) && (0 == ret); pos += n) {
+        n = (size - pos > RBA_CRC_SPAN) ? RBA_CRC_SPAN : (size_t)(size - pos);
+        got = pread (fd, buf, n, (off_t)pos);
+        if ((ssize_t)n != got) {
+            RBA_ERR("Failed to read %lu bytes at %llu of %s\n", (unsigned long)n, (unsigned long long)pos, filename);
+            ret = -1;
+            break;
+        }
+        for (off = 0; (off < n) && (0 == ret); off += take) {
+            end = entries[e].offset + entries[e].length;
+            take = (end - (pos + off) < n - off) ? (size_t)(end - (pos + off)) : n - off;
+            crc = rba_crc32c (crc, buf + off, take);
+            if (pos + off + take == end) {
+                if (crc != entries[e].crc) {
+                    RBA_ERR("Checksum mismatch in %s at bytes %llu to %llu\n", filename,
+                            (unsigned long long)entries[e].offset, (unsigned long long)end);
+                    ret = -1;
+                }
+                crc = 0;
+                e++;
+            }
+        }
+    }
+    free (buf);
+
+    return ret;
+}
+
+/*  Verify an RBA file: its header against its size or chunk index and,
+    when it has a sidecar, its checksums. *checked_p tells whether there
+    was a sidecar. Empty files pass unchecked. */
+int
+rba_verify_file (   const char  *filename,
+                    int         *checked_p)
+{
+    int ret;
+
+    int fd;
+    struct stat st;
+    rba_crc_entry_t *entries = NULL;
+    uint64_t count;
+
+    *checked_p = 0;
+    fd = open (filename, O_RDONLY);
+    if ((fd < 0) || (0 != fstat (fd, &st))) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else if (0 == st.st_size) {
+        /*  columns that are not stored leave an empty file */
+        ret = 0;
+    } else {
+        ret = verify_layout (fd, filename, (uint64_t)st.st_size);
+        if (0 == ret) {
+            ret = rba_crc_read (filename, &entries, &count);
+            if (1 == ret) {
+                ret = 0;
+            } else if (0 == ret) {
+                *checked_p = 1;
+                ret = verify_crcs (fd, filename, (uint64_t)st.st_size, entries, count);
+            }
+        }
+    }
+    if (fd >= 0) {
+        close (fd);
+    }
+    free (entries);
+
+    return ret;
+}
@@ -24,16 +24,55 @@ rba_strtrim (char *string)
     return cp;
 }
 
-static int
+int
+rba_checkhdr_line ( rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    char                *line)
+{
+    int ret;
+
+    char *iterator, *token;
+    size_t token_idx;
+
+    ret = 0;
+    token_idx = 0;
+    for_each_csvtoken(line, iterator, token) {
+
+        token = rba_strtrim (token);
+        if (token_idx >= cols) {
+            RBA_ERR("Header contains more columns than expected: \"%s\"\n", token);
+            ret = -1;
+            break;
+        } else {
+
+            if (0 != strcmp (spec[token_idx].name, token)) {
+                RBA_ERR("Header mismatch for column %u. expected \"%s\", got \"%s\".\n", (unsigned)token_idx, spec[token_idx].name, token);
+                ret = -1;
+                break;
+            } else {
+
+                token_idx++;
+            }
+        }
+    }
+
+    if ((0 == ret) && (token_idx < cols)) {
+        RBA_ERR("Header contains fewer columns (%u) than expected (%u) \n", (unsigned)token_idx, (unsigned)cols);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int
 rba_checkhdr (  rba_spec_entry_t    *spec,
                 uint32_t            cols,
                 FILE*               filep)
 {
     int ret;
 
-    char *line, *iterator, *token;
+    char *line;
     size_t bufsz;
-    size_t token_idx;
     ssize_t len;
 
     line = NULL;
@@ -44,36 +83,11 @@ rba_checkhdr (  rba_spec_entry_t    *spec,
         RBA_ERRNO();
         ret = -1;
     } else {
-        ret = 0;
-        token_idx = 0;
-        for_each_csvtoken(line, iterator, token) {
-
-            token = rba_strtrim (token);
-            if (token_idx >= cols) {
-                RBA_ERR("Header contains more columns than expected: \"%s\"\n", token);
-                ret = -1;
-                break;
-            } else {
-
-                if (0 != strcmp (spec[token_idx].name, token)) {
-                    RBA_ERR("Header mismatch for column %u. expected \"%s\", got \"%s\".\n", (unsigned)token_idx, spec[token_idx].name, token);
-                    ret = -1;
-                    break;
-                } else {
-
-                    token_idx++;
-                }
-            }
-        }
-
-        if (token_idx < cols) {
-            RBA_ERR("Header contains fewer columns (%u) than expected (%u) \n", (unsigned)token_idx, (unsigned)cols);
-            ret = -1;
-        }
-
-        free (line);
+        ret = rba_checkhdr_line (spec, cols, line);
     }
 
+    free (line);
+
     return ret;
 }
 
@@ -85,7 +99,7 @@ rba_checkhdr_countrecords ( rba_spec_entry_t    *spec,
 {
     int ret;
 
-    char *buf, *bufend, *nextnewline;
+    char *buf;
     size_t readin;
     uint64_t reccount;
 
@@ -115,19 +129,7 @@ rba_checkhdr_countrecords ( rba_spec_entry_t    *spec,
                         RBA_ERR("Error reading file\n");
                         ret = -1;
                     } else {
-                        if (readin > 0) {
-                            nextnewline = buf;
-                            bufend = buf + readin;
-                            do{
-                                nextnewline = memchr (  nextnewline,
-                                                        '\n',
-                                                        (bufend-nextnewline));
-                                if (NULL != nextnewline) {
-                                    nextnewline++;
-                                    reccount++;
-                                }
-                            } while (NULL != nextnewline);
-                        }
+                        reccount += rba_count_newlines (buf, readin);
                     }
                 } while((ret == 0) && (readin == (16*1024*1024)));
 
@@ -145,6 +147,125 @@ rba_checkhdr_countrecords ( rba_spec_entry_t    *spec,
     return ret;
 }
 
+/*  Copy column col of a CSV line into field, without white space and without
+    modifying the line. */
+static int
+line_field (const char  *line,
+            uint32_t    col,
+            char        *field,
+            size_t      fieldlen)
+{
+    int ret;
+
+    const char *start, *end;
+    uint32_t c;
+
+    for (c = 0, start = line; (c < col) && (NULL != start); c++) {
+        start = strchr (start, ',');
+        start = (NULL != start) ? (start + 1) : NULL;
+    }
+
+    if (NULL == start) {
+        RBA_ERR("line contains fewer columns than expected (%u) \n", (unsigned)(col + 1));
+        ret = -1;
+    } else {
+        end = strchr (start, ',');
+        end = (NULL != end) ? end : (start + strlen (start));
+        for (; (start < end) && isspace((unsigned char)start[0]); start++);
+        for (; (end > start) && isspace((unsigned char)end[-1]); end--);
+        if ((size_t)(end - start) >= fieldlen) {
+            RBA_ERR("column %u is too long\n", (unsigned)col);
+            ret = -1;
+        } else {
+            memcpy (field, start, end - start);
+            field[end - start] = '\0';
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+/*  Look up the class of column col of a CSV line without modifying the line,
+    ahead of parsing it. */
+int
+rba_line_class (rba_spec_entry_t    *spec,
+                uint32_t            col,
+                const char          *line,
+                uint32_t            *class_p)
+{
+    int ret;
+
+    char field[RBA_CLASS_MAXLEN];
+    rba_type_t *type = spec[col].type;
+
+    ret = line_field (line, col, field, sizeof(field));
+    if (0 == ret) {
+        ret = type->classify (type, field, class_p);
+        if (0 != ret) {
+            RBA_ERR("failed to classify column (%u) \"%s\"\n", (unsigned)col, field);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*  Check the header of a CSV file and add the number of records of each class
+    of column col to classcounts, counting only the records filter keeps if
+    it is not NULL. */
+int
+rba_checkhdr_countclasses ( rba_spec_entry_t    *spec,
+                            uint32_t            cols,
+                            uint32_t            col,
+                            const char          *filename,
+                            const rba_filter_t  *filter,
+                            uint64_t            *classcounts)
+{
+    int ret;
+
+    rba_input_t *in;
+    char *line = NULL;
+    size_t bufsz = 0;
+    ssize_t len;
+    uint32_t class;
+
+    ret = rba_input_open (&in, filename);
+    if (0 == ret) {
+        len = rba_input_getline (in, &line, &bufsz);
+        if (len <= 0) {
+            RBA_ERR("CSV file %s has no header\n", filename);
+            ret = -1;
+        } else {
+            ret = rba_checkhdr_line (spec, cols, line);
+        }
+
+        while ((0 == ret) && ((len = rba_input_getline (in, &line, &bufsz)) > 0)) {
+            if (NULL != filter) {
+                ret = rba_filter_line (filter, line);
+                if (1 != ret) {
+                    ret = (0 == ret) ? 0 : -1;
+                    continue;
+                }
+            }
+            ret = rba_line_class (spec, col, line, &class);
+            if (0 == ret) {
+                classcounts[class]++;
+            }
+        }
+
+        if ((0 == ret) && (0 != rba_input_error (in))) {
+            ret = -1;
+        }
+        if (0 != rba_input_close (in)) {
+            ret = -1;
+        }
+        free (line);
+    }
+
+    return ret;
+}
+
 /*  linear congruential generator (X = X*C + A mod M) as fast PRNG */
 #define RBA_LCG_X0 (1)
 #define RBA_LCG_A (6364136223846793005ULL)
@@ -156,56 +277,475 @@ rba_checkhdr_countrecords ( rba_spec_entry_t    *spec,
 #define LCG_GET_INRANGE(X, RANGEMIN, RANGEMAX) ((uint64_t)(LCG_GET_DOUBLE(X) * (double)(RANGEMAX -RANGEMIN)) + RANGEMIN)
 
 static int
-init_partpicker(rba_data_t  *data,
-                uint64_t    total_samples)
+cmp_int64 (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*  Check the headers of the CSV files, count their records and find the
+    timestamps of column col that split them into partitions time ranges of
+    about the same number of records. The quantiles are taken from a uniform
+    sample of RBA_TIME_SAMPLES timestamps (reservoir sampling), so the
+    partition sizes are balanced to within the sampling error. With a
+    non-NULL dedup, which must have scanned the same files with the same
+    filter, the rows it marked as duplicates are skipped. */
+int
+rba_timerange_scan (rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    uint32_t            col,
+                    const char          **csvnames,
+                    int                 csvcount,
+                    uint32_t            partitions,
+                    const rba_filter_t  *filter,
+                    const rba_dedup_t   *dedup,
+                    int64_t             *bounds,
+                    uint64_t            *records_p)
 {
     int ret;
-    uint32_t samples_par_partition;
-    uint32_t arrlen = data->partitions + data->repetitions;
+
+    rba_input_t *in;
+    char *line = NULL;
+    size_t bufsz = 0;
+    ssize_t len;
+    char field[RBA_CLASS_MAXLEN];
+    int csv_idx;
+    int64_t usec, *sample;
+    uint64_t records = 0, ordinal = 0, rng_state, slot, kept;
+    uint32_t p;
+
+    RBA_LCG_INIT(rng_state);
+    sample = (int64_t*)malloc (RBA_TIME_SAMPLES * sizeof(int64_t));
+    ret = (NULL == sample) ? -1 : 0;
+
+    for (csv_idx = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+        ret = rba_input_open (&in, csvnames[csv_idx]);
+        if (0 != ret) {
+            break;
+        }
+
+        len = rba_input_getline (in, &line, &bufsz);
+        if (len <= 0) {
+            RBA_ERR("CSV file %s has no header\n", csvnames[csv_idx]);
+            ret = -1;
+        } else {
+            ret = rba_checkhdr_line (spec, cols, line);
+        }
+
+        while ((0 == ret) && ((len = rba_input_getline (in, &line, &bufsz)) > 0)) {
+            if (NULL != filter) {
+                ret = rba_filter_line (filter, line);
+                if (1 != ret) {
+                    ret = (0 == ret) ? 0 : -1;
+                    continue;
+                }
+            }
+            if ((NULL != dedup) && rba_dedup_marked (dedup, ordinal++)) {
+                ret = 0;
+                continue;
+            }
+            ret = line_field (line, col, field, sizeof(field));
+            if (0 == ret) {
+                ret = rba_parse_timestamp (field, &usec);
+            }
+            if ((0 == ret) && (records < RBA_TIME_SAMPLES)) {
+                sample[records] = usec;
+            } else if (0 == ret) {
+                RBA_LCG_NEXT(rng_state);
+                slot = LCG_GET_INRANGE(rng_state, 0, (records + 1));
+                if (slot < RBA_TIME_SAMPLES) {
+                    sample[slot] = usec;
+                }
+            }
+            records++;
+        }
+
+        if ((0 == ret) && (0 != rba_input_error (in))) {
+            ret = -1;
+        }
+        if (0 != rba_input_close (in)) {
+            ret = -1;
+        }
+    }
+
+    if ((0 == ret) && (0 == records)) {
+        RBA_ERR("No records to split into time ranges\n");
+        ret = -1;
+    }
+
+    if (0 == ret) {
+        kept = (records < RBA_TIME_SAMPLES) ? records : RBA_TIME_SAMPLES;
+        qsort (sample, kept, sizeof(int64_t), cmp_int64);
+        for (p = 1; p < partitions; p++) {
+            bounds[p - 1] = sample[(kept * p) / partitions];
+        }
+        *records_p = records;
+    }
+
+    free (sample);
+    free (line);
+
+    return ret;
+}
+
+/*  number of records already stored in partition p, which must be the same for
+    every column that is backed by a file and for the row and PAX files */
+static int
+partition_records ( rba_data_t  *data,
+                    uint32_t    p,
+                    uint64_t    *records_p)
+{
+    int ret = 0;
+    int found = 0;
+    uint32_t c;
+    uint64_t records = 0;
+    uint64_t paxrecords;
+    rba_buf_t *bufs;
+
+    if (NULL != data->rows) {
+        ret = rba_rows_records (data, p, &records);
+        found = (0 == ret);
+    }
+
+    if ((0 == ret) && (NULL != data->pax)) {
+        ret = rba_pax_records (data, p, &paxrecords);
+        if ((0 == ret) && found && (paxrecords != records)) {
+            RBA_ERR("Partition %u is inconsistent: PAX file holds %llu records, expected %llu\n", (unsigned)p, (unsigned long long)paxrecords, (unsigned long long)records);
+            ret = -1;
+        }
+        records = paxrecords;
+        found = (0 == ret);
+    }
+
+    for (c = 0; (c < data->cols) && (0 == ret); c++) {
+        bufs = rba_data_getcolbufs(data, c);
+        if ((0 != bufs[p].elm_sz) && (NULL != bufs[p].filep)) {
+            if (!found) {
+                records = bufs[p].total;
+                found = 1;
+            } else if (records != bufs[p].total) {
+                RBA_ERR("Partition %u is inconsistent: column %u holds %llu records, expected %llu\n", (unsigned)p, (unsigned)c, (unsigned long long)bufs[p].total, (unsigned long long)records);
+                ret = -1;
+            }
+        }
+    }
+
+    if (0 == ret) {
+        *records_p = records;
+    }
+
+    return ret;
+}
+
+/*  Split total_samples new records over the partitions so that the final
+    partition sizes are as even as possible. The smallest level L with
+    sum(max(0, L - existing[p])) >= total_samples is found by bisection, every
+    partition is filled up to L - 1, and the remainder is handed out one record
+    each to partitions that are still below L. With no existing records this
+    reduces to an even split. */
+static int
+fill_partition_quotas ( rba_data_t      *data,
+                        const uint64_t  *existing,
+                        uint64_t        total_samples)
+{
+    int ret = 0;
     uint32_t p;
+    uint64_t lo, hi, level, fill, quota, remainder;
+
+    lo = UINT64_MAX;
+    hi = 0;
+    for (p = 0; p < data->partitions; p++) {
+        lo = (existing[p] < lo) ? existing[p] : lo;
+        hi = (existing[p] > hi) ? existing[p] : hi;
+    }
+    hi += total_samples;
+
+    /*  invariant: fill(lo) < total_samples <= fill(hi) */
+    while (hi - lo > 1) {
+        level = lo + (hi - lo) / 2;
+        for (p = 0, fill = 0; p < data->partitions; p++) {
+            fill += (level > existing[p]) ? (level - existing[p]) : 0;
+        }
+        if (fill < total_samples) {
+            lo = level;
+        } else {
+            hi = level;
+        }
+    }
+    level = hi;
+
+    remainder = total_samples;
+    for (p = 0; (p < data->partitions) && (0 == ret); p++) {
+        quota = (level - 1 > existing[p]) ? (level - 1 - existing[p]) : 0;
+        if (total_samples == 0) {
+            quota = 0;
+        }
+        if (quota > UINT32_MAX) {
+            RBA_ERR("Partition %u would receive more than %u new records\n", (unsigned)p, (unsigned)UINT32_MAX);
+            ret = -1;
+        } else {
+            data->partsmpl_remaining[p] = (uint32_t)quota;
+            remainder -= quota;
+        }
+    }
+
+    for (p = 0; (p < data->partitions) && (remainder > 0); p++) {
+        if (existing[p] < level) {
+            data->partsmpl_remaining[p]++;
+            remainder--;
+        }
+    }
+
+    return ret;
+}
+
+/*  Split the records of every stratum evenly over the partitions. Partitions
+    that get one record more than the others rotate from stratum to stratum,
+    so that partition sizes differ by at most one record overall. */
+static int
+fill_strata_quotas (rba_data_t          *data,
+                    const uint64_t      *picks)
+{
+    int ret = 0;
+    uint32_t s, p, next;
+    uint64_t records, base, remainder;
+
+    next = 0;
+    for (s = 0; (s < data->strata) && (0 == ret); s++) {
+        records = picks[s];
+        base = records / data->partitions;
+        remainder = records % data->partitions;
+        if (base + 1 > UINT32_MAX) {
+            RBA_ERR("Partitions would receive more than %u records of stratum %u\n", (unsigned)UINT32_MAX, (unsigned)s);
+            ret = -1;
+        } else {
+            for (p = 0; p < data->partitions; p++) {
+                data->partsmpl_remaining[s * data->partitions + p] = (uint32_t)base;
+            }
+            for (; remainder > 0; remainder--) {
+                data->partsmpl_remaining[s * data->partitions + next]++;
+                next = (next + 1) % data->partitions;
+            }
+            data->stratsmpl_remaining[s] = records;
+        }
+    }
+
+    return ret;
+}
+
+/*  Fenwick trees over partsmpl_remaining, one per stratum, so that the
+    partition holding a given remaining sample is found in O(log P) */
+static void
+fenwick_build (rba_data_t *data)
+{
+    uint32_t s, i, j;
+    uint64_t *tree;
+
+    for (s = 0; s < data->strata; s++) {
+        tree = data->fenwick + s * (data->partitions + 1);
+        tree[0] = 0;
+        for (i = 1; i <= data->partitions; i++) {
+            tree[i] = data->partsmpl_remaining[s * data->partitions + i - 1];
+        }
+        for (i = 1; i <= data->partitions; i++) {
+            j = i + (i & (~i + 1));
+            if (j <= data->partitions) {
+                tree[j] += tree[i];
+            }
+        }
+    }
+}
+
+/*  smallest partition whose prefix sum of remaining samples reaches pick */
+static uint32_t
+fenwick_find (  rba_data_t  *data,
+                uint32_t    stratum,
+                uint64_t    pick)
+{
+    uint64_t *tree = data->fenwick + stratum * (data->partitions + 1);
+    uint32_t pos = 0, step;
+
+    for (step = data->fenwick_top; step > 0; step >>= 1) {
+        if ((pos + step <= data->partitions) && (tree[pos + step] < pick)) {
+            pos += step;
+            pick -= tree[pos];
+        }
+    }
+
+    return pos;
+}
+
+static void
+fenwick_decrement ( rba_data_t  *data,
+                    uint32_t    stratum,
+                    uint32_t    p)
+{
+    uint64_t *tree = data->fenwick + stratum * (data->partitions + 1);
+    uint32_t i;
+
+    for (i = p + 1; i <= data->partitions; i += i & (~i + 1)) {
+        tree[i]--;
+    }
+}
+
+/*  total_picks is the number of partition picks, records times repetitions.
+    stratum_picks holds the picks of every stratum when the data is
+    stratified, NULL otherwise. */
+static int
+init_partpicker(rba_data_t      *data,
+                uint64_t        total_picks,
+                const uint64_t  *stratum_picks)
+{
+    int ret;
+    uint32_t arrlen = data->strata * data->partitions + data->maxrepetitions;
+    uint32_t p, s;
+
+    uint64_t *existing;
 
     data->partsmpl_remaining = (uint32_t*)malloc (arrlen*sizeof(uint32_t));
-    if (NULL == data->partsmpl_remaining) {
+    data->stratsmpl_remaining = (uint64_t*)malloc (data->strata*sizeof(uint64_t));
+    data->fenwick = (uint64_t*)malloc (data->strata*(data->partitions + 1)*sizeof(uint64_t));
+    existing = (uint64_t*)malloc (data->partitions*sizeof(uint64_t));
+    if ((NULL == data->partsmpl_remaining) || (NULL == data->stratsmpl_remaining) ||
+            (NULL == data->fenwick) || (NULL == existing)) {
         RBA_ERR("malloc failed for uint32_t array of length %u\n", (unsigned)arrlen);
         ret = -1;
     } else {
 
-        data->partidxbuf = data->partsmpl_remaining + data->partitions;
+        data->partidxbuf = data->partsmpl_remaining + data->strata * data->partitions;
 
         RBA_LCG_INIT(data->rng_state);
-        data->totsmpl_remaining = total_samples * data->repetitions;
-        samples_par_partition = data->totsmpl_remaining / data->partitions;
+        data->totsmpl_remaining = total_picks;
+        for (data->fenwick_top = 1; data->fenwick_top * 2 <= data->partitions; data->fenwick_top *= 2);
 
-        for (p = 0; p < data->partitions; p++) {
-            data->partsmpl_remaining[p] = samples_par_partition;
+        for (p = 0, ret = 0; (p < data->partitions) && (0 == ret); p++) {
+            ret = partition_records (data, p, &(existing[p]));
         }
 
-        ret = 0;
+        if ((0 == ret) && (data->flags & RBA_DATA_STREAM)) {
+            /*  the decks start out empty and are shuffled on first use */
+            data->partdeck = (uint32_t*)malloc (data->strata*data->partitions*sizeof(uint32_t));
+            data->deckpos = (uint32_t*)calloc (data->strata, sizeof(uint32_t));
+            if ((NULL == data->partdeck) || (NULL == data->deckpos)) {
+                RBA_ERR("malloc failed for %u partition decks\n", (unsigned)data->strata);
+                ret = -1;
+            } else {
+                for (s = 0; s < data->strata; s++) {
+                    for (p = 0; p < data->partitions; p++) {
+                        data->partdeck[s * data->partitions + p] = p;
+                    }
+                }
+            }
+        } else if ((0 == ret) && (NULL != stratum_picks)) {
+            for (p = 0; (p < data->partitions) && (0 == ret) && !(data->flags & RBA_DATA_RESUME); p++) {
+                if (0 != existing[p]) {
+                    RBA_ERR("Stratified partitions can not be appended to\n");
+                    ret = -1;
+                }
+            }
+            if (0 == ret) {
+                ret = fill_strata_quotas (data, stratum_picks);
+            }
+        } else if (0 == ret) {
+            ret = fill_partition_quotas (   data,
+                                            existing,
+                                            data->totsmpl_remaining);
+            data->stratsmpl_remaining[0] = data->totsmpl_remaining;
+        }
+
+        if ((0 == ret) && !(data->flags & RBA_DATA_STREAM)) {
+            fenwick_build (data);
+        }
+    }
+
+    if (0 != ret) {
+        free (data->partsmpl_remaining);
+        free (data->stratsmpl_remaining);
+        free (data->fenwick);
+        free (data->partdeck);
+        free (data->deckpos);
+        data->partsmpl_remaining = NULL;
+        data->stratsmpl_remaining = NULL;
+        data->fenwick = NULL;
+        data->partdeck = NULL;
+        data->deckpos = NULL;
     }
 
+    free (existing);
+
     return ret;
 }
 
+/* Fisher-Yates shuffle of a deck of partitions */
 static void
-pick_next_partitions(rba_data_t *data)
+shuffle_deck (  rba_data_t  *data,
+                uint32_t    *deck)
+{
+    uint32_t i, j, tmp;
+
+    for (i = data->partitions - 1; i > 0; i--) {
+        RBA_LCG_NEXT(data->rng_state);
+        j = (uint32_t)LCG_GET_INRANGE(data->rng_state, 0, (i + 1));
+        tmp = deck[i];
+        deck[i] = deck[j];
+        deck[j] = tmp;
+    }
+}
+
+/*  Without a record count there are no quotas to sample from. Partitions are
+    instead dealt from a deck holding each partition once, reshuffled every
+    time it runs out, so partition sizes never drift apart by more than one
+    record per repetition. Every stratum has its own deck. */
+static void
+pick_next_partitions_stream(rba_data_t  *data,
+                            uint32_t    stratum)
+{
+    uint32_t r;
+    uint32_t *deck = data->partdeck + stratum * data->partitions;
+    uint32_t *deckpos = &(data->deckpos[stratum]);
+
+    for(r=0; r <data->repetitions; r++) {
+        if (0 == *deckpos) {
+            shuffle_deck (data, deck);
+            *deckpos = data->partitions;
+        }
+        (*deckpos)--;
+        data->partidxbuf[r] = deck[*deckpos];
+    }
+}
+
+static int
+pick_next_partitions(rba_data_t *data,
+                     uint32_t   stratum)
 {
     uint32_t r, p;
     uint64_t rem_pick_idx;
+    if (data->flags & RBA_DATA_STREAM) {
+        pick_next_partitions_stream(data, stratum);
+        return 0;
+    }
+    if (data->stratsmpl_remaining[stratum] < data->repetitions) {
+        RBA_ERR("More records of stratum %u than counted\n", (unsigned)stratum);
+        return -1;
+    }
     for(r=0; r <data->repetitions; r++) {
-        /* pick a random number from 0 to totsmpl_remaining */
+        /* pick a random number from 0 to the samples remaining in the stratum */
         RBA_LCG_NEXT(data->rng_state);
-        rem_pick_idx = LCG_GET_INRANGE(data->rng_state, 1, data->totsmpl_remaining);
+        rem_pick_idx = LCG_GET_INRANGE(data->rng_state, 1, data->stratsmpl_remaining[stratum]);
         /* find which partition it falls in */
-        for (p=0;
-                rem_pick_idx > data->partsmpl_remaining[p];
-                    rem_pick_idx -= data->partsmpl_remaining[p], p++);
+        p = fenwick_find (data, stratum, rem_pick_idx);
         /* select the partition */
         data->partidxbuf[r] = p;
         /* decrement the samples remaining for that partition */
-        data->partsmpl_remaining[p]--;
-        /* decrement the total samples remaining */
-        data->totsmpl_remaining--;       
+        data->partsmpl_remaining[stratum * data->partitions + p]--;
+        fenwick_decrement (data, stratum, p);
+        /* decrement the samples remaining in the stratum and in total */
+        data->stratsmpl_remaining[stratum]--;
+        data->totsmpl_remaining--;
     }
+    return 0;
 }
 
 
@@ -302,6 +842,128 @@ rba_data_setup_dir_structure (  const char  *dirpath,
     return ret;
 }
 
+/*  Verify that an existing RBA directory tree under dirpath holds exactly the
+    given number of partitions, and allocate a file path buffer for it. */
+static int
+rba_data_check_dir_structure (  const char  *dirpath,
+                                uint32_t    partitions,
+                                char**      filepath_buf_p,
+                                size_t*     filepathlen_p)
+{
+    int ret;
+
+    uint32_t p;
+
+    size_t filepathlen;
+    size_t dirpathlen = strlen(dirpath);
+
+    char *filepath_buf;
+
+    struct stat st;
+
+    printf ("    Opening directory structure under \"%s\"\n", dirpath);
+
+    filepathlen = dirpathlen + strlen("/p00000000/c00000000.bin") + 1;
+
+    filepath_buf = (char*)malloc(filepathlen * sizeof(char));
+    if (NULL == filepath_buf) {
+        RBA_ERR("Failed to allocate %u bytes for file path\n", (unsigned)filepathlen);
+        ret = -1;
+    } else {
+
+        /*  one past the last partition must not exist */
+        for (p = 0, ret = 0; (p <= partitions) && (0 == ret); p++) {
+            ret = snprintf (filepath_buf,
+                            filepathlen,
+                            "%s/p%08X",
+                            dirpath,
+                            p);
+            if (ret < 0) {
+                RBA_ERR("Failed to create RBA partition directory path %08x\n", p);
+                ret = -1;
+            } else if (p < partitions) {
+
+                ret = stat (filepath_buf, &st);
+                if ((0 != ret) || !S_ISDIR(st.st_mode)) {
+                    RBA_ERR("RBA partition directory %s is missing\n", filepath_buf);
+                    ret = -1;
+                }
+            } else {
+
+                if (0 == stat (filepath_buf, &st)) {
+                    RBA_ERR("%s holds more than %u partitions\n", dirpath, (unsigned)partitions);
+                    ret = -1;
+                } else {
+                    ret = 0;
+                }
+            }
+        }
+
+        if (0 != ret) {
+            free (filepath_buf);
+        } else {
+            *filepath_buf_p = filepath_buf;
+            *filepathlen_p = filepathlen;
+        }
+    }
+
+    return ret;
+}
+
+/*  Set up the per-class sampling rates and repetitions. Without streaming,
+    round(rate * records) records of each class are kept, chosen by selection
+    sampling, so the number of partition picks per class is known exactly. */
+static int
+init_classes (  rba_data_t          *data,
+                const rba_strata_t  *strata,
+                uint64_t            *picks_p,
+                uint64_t            **stratum_picks_p)
+{
+    int ret = 0;
+
+    uint32_t l;
+    double rate;
+
+    data->classes = strata->classes;
+    data->classcol = strata->col;
+
+    /*  class_keep, class_left, stratum picks, class_rates, class_reps */
+    data->class_keep = (uint64_t*)calloc (data->classes, 4 * sizeof(uint64_t) + sizeof(uint32_t));
+    *stratum_picks_p = (uint64_t*)calloc (data->classes, sizeof(uint64_t));
+    if ((NULL == data->class_keep) || (NULL == *stratum_picks_p)) {
+        RBA_ERR("malloc failed for %u classes\n", (unsigned)data->classes);
+        free (data->class_keep);
+        data->class_keep = NULL;
+        ret = -1;
+    } else {
+
+        data->class_left = data->class_keep + data->classes;
+        data->class_rates = (double*)(data->class_left + data->classes);
+        data->class_reps = (uint32_t*)(data->class_rates + data->classes);
+
+        *picks_p = 0;
+        for (l = 0; (l < data->classes) && (0 == ret); l++) {
+            rate = (NULL != strata->rates) ? strata->rates[l] : 1.0;
+            if (!(rate >= 0.0) || (rate > 1.0)) {
+                RBA_ERR("Sampling rate %f of class %u is not between 0 and 1\n", rate, (unsigned)l);
+                ret = -1;
+            } else {
+                data->class_rates[l] = rate;
+                data->class_reps[l] = (NULL != strata->repetitions) ? strata->repetitions[l] : data->repetitions;
+                data->maxrepetitions = (data->class_reps[l] > data->maxrepetitions) ? data->class_reps[l] : data->maxrepetitions;
+                if (NULL != strata->samples) {
+                    data->class_left[l] = strata->samples[l];
+                    data->class_keep[l] = (uint64_t)(rate * (double)strata->samples[l] + 0.5);
+                    (*stratum_picks_p)[l] = data->class_keep[l] * data->class_reps[l];
+                    *picks_p += (*stratum_picks_p)[l];
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
 int
 rba_data_alloc (rba_data_t          *data,
                 rba_spec_entry_t    *spec,
@@ -309,7 +971,9 @@ rba_data_alloc (rba_data_t          *data,
                 const char          *dirpath,
                 uint32_t            partitions,
                 uint32_t            repetitions,
-                uint64_t            samples)
+                uint64_t            samples,
+                uint32_t            flags,
+                const rba_strata_t  *strata)
 {
     int ret;
 
@@ -323,11 +987,27 @@ rba_data_alloc (rba_data_t          *data,
     rba_buf_t *bufs;
     rba_type_t *type;
 
-    ret = rba_data_setup_dir_structure (dirpath,
-                                        partitions,
-                                        cols,
-                                        &filepath_buf,
-                                        &filepathlen);
+    uint64_t picks, *stratum_picks;
+
+    if (((NULL != strata) &&
+                ((strata->col >= cols) || (0 == strata->classes) ||
+                    (NULL == spec[strata->col].type->classify) ||
+                    ((NULL == strata->samples) && !(flags & RBA_DATA_STREAM)))) ||
+            ((NULL == strata) && (flags & RBA_DATA_STRATIFY))) {
+        RBA_ERR("Column %u can not be used to classify records\n", (NULL != strata) ? (unsigned)strata->col : 0);
+        ret = -1;
+    } else if (flags & RBA_DATA_APPEND) {
+        ret = rba_data_check_dir_structure (dirpath,
+                                            partitions,
+                                            &filepath_buf,
+                                            &filepathlen);
+    } else {
+        ret = rba_data_setup_dir_structure (dirpath,
+                                            partitions,
+                                            (flags & RBA_DATA_NOCOLS) ? 0 : cols,
+                                            &filepath_buf,
+                                            &filepathlen);
+    }
     if (0 != ret) {
         RBA_ERR("Failed to setup directory structure under %s\n", dirpath);
         ret = -1;
@@ -338,77 +1018,224 @@ rba_data_alloc (rba_data_t          *data,
         data->cols = cols;
         data->partitions = partitions;
         data->repetitions = repetitions;
-        ret = init_partpicker(data, samples);
+        data->flags = flags;
+        data->rows = NULL;
+        data->pax = NULL;
+        data->partdeck = NULL;
+        data->deckpos = NULL;
+        data->fenwick = NULL;
+        data->stratsmpl_remaining = NULL;
+        data->maxrepetitions = repetitions;
+        data->strata = ((NULL != strata) && (flags & RBA_DATA_STRATIFY)) ? strata->classes : 1;
+        data->classes = 0;
+        data->class_keep = NULL;
+        data->dropped = 0;
+        data->filter = NULL;
+        data->filtered = 0;
+        data->dedup = NULL;
+        data->duplicates = 0;
+        data->stats = NULL;
+        data->timecol = 0;
+        data->timebucket = 0;
+        data->timebounds = NULL;
+        data->checkpoint = NULL;
+        data->csv = 0;
+        data->csvhash = 0;
+        data->csvline = 0;
+        data->csvoffset = 0;
+        data->lines = 0;
+        data->shard = 0;
+        data->shards = 0;
+        data->shardseed = 0;
+        picks = samples * repetitions;
+        stratum_picks = NULL;
+        if (NULL != strata) {
+            ret = init_classes (data, strata, &picks, &stratum_picks);
+        }
+
+        buf_count = cols * partitions;
+        data->bufs = (rba_buf_t*)malloc(buf_count * sizeof(rba_buf_t));
         if (0 != ret) {
-            RBA_ERR("init_partpicker failed\n");
+            free (data->bufs);
+        } else if (NULL == data->bufs) {
+            RBA_ERR("Failed to allocate memory for the rba_buf_t array.\n");
             ret = -1;
         } else {
 
-            buf_count = cols * partitions;
-            data->bufs = (rba_buf_t*)malloc(buf_count * sizeof(rba_buf_t));
-            if (NULL == data->bufs) {
-                RBA_ERR("Failed to allocate memory for the rba_buf_t array.\n");
-                ret = -1;
-            } else {
+            memset (data->bufs, 0, buf_count * sizeof(rba_buf_t));
+
+            for (c=0; (c < data->cols) && (0 == ret); c++) {
 
-                memset (data->bufs, 0, buf_count * sizeof(rba_buf_t));
+                bufs = rba_data_getcolbufs(data, c);
+                type = data->spec[c].type;
 
-                for (c=0; (c < data->cols) && (0 == ret); c++) {
+                for (p = 0; (p < data->partitions) && (0 == ret); p++) {
+
+                    ret = snprintf (filepath_buf,
+                                    filepathlen,
+                                    "%s/p%08X/c%08X.bin", dirpath, p, c);
+                    if (ret < 0) {
+                        RBA_ERR("Failed to create RBA file path p%08X/c%08X.bin\n", p, c);
+                        ret = -1;
+                    } else {
+
+                        if ((flags & RBA_DATA_NOCOLS) && (0 != type->size)) {
+                            ret = rba_buf_alloc_staging (   type,
+                                                            filepath_buf,
+                                                            flags,
+                                                            &(bufs[p]));
+                        } else {
+                            ret = type->initbuf (   type,
+                                                    filepath_buf,
+                                                    flags,
+                                                    &(bufs[p]));
+                        }
+                        if (0 != ret) {
+                            RBA_ERR("Failed to initialize rba_buf_t for column %u, partition %u\n", (unsigned)c, (unsigned)p);
+                            ret = -1;
+                        } else {
+                            ret = 0;
+                        }
+                    }
+                }
+            }
+
+            if ((0 == ret) && (flags & RBA_DATA_ROWS)) {
+                ret = rba_rows_alloc (data, dirpath);
+                if (0 != ret) {
+                    RBA_ERR("Failed to open row files under %s\n", dirpath);
+                    ret = -1;
+                }
+            }
+
+            if ((0 == ret) && (flags & RBA_DATA_PAX)) {
+                ret = rba_pax_alloc (data, dirpath);
+                if (0 != ret) {
+                    RBA_ERR("Failed to open PAX files under %s\n", dirpath);
+                    ret = -1;
+                }
+            }
+
+            /*  the partition picker needs the record counts of the opened
+                buffers when appending */
+            if (0 == ret) {
+                ret = init_partpicker(data, picks, (data->strata > 1) ? stratum_picks : NULL);
+                if (0 != ret) {
+                    RBA_ERR("init_partpicker failed\n");
+                    ret = -1;
+                }
+            }
 
+            if (0 != ret) {
+                rba_rows_free (data);
+                rba_pax_free (data);
+                for (c=0; (c < data->cols); c++) {
                     bufs = rba_data_getcolbufs(data, c);
                     type = data->spec[c].type;
 
-                    for (p = 0; (p < data->partitions) && (0 == ret); p++) {
-
-                        ret = snprintf (filepath_buf,
-                                        filepathlen,
-                                        "%s/p%08X/c%08X.bin", dirpath, p, c);
-                        if (ret < 0) {
-                            RBA_ERR("Failed to create RBA file path p%08X/c%08X.bin\n", p, c);
-                            ret = -1;
-                        } else {
-
-                            ret = type->initbuf (   type,
-                                                    filepath_buf,
-                                                    &(bufs[p]));
-                            if (0 != ret) {
-                                RBA_ERR("Failed to initialize rba_buf_t for column %u, partition %u\n", (unsigned)p, (unsigned)c);
-                                ret = -1;
-                            } else {
-                                ret = 0;
-                            }
-                        }
-                    }
-                }
-
-                if (0 != ret) {
-                    for (c=0; (c < data->cols); c++) {
-                        bufs = rba_data_getcolbufs(data, c);
-                        type = data->spec[c].type;
-
-                        for (p = 0; (p < data->partitions); p++) {
-                            if (0 != bufs[p].len) {
-                                fprintf(stderr, "freeing %u %u", c, p);
-                                type->freebuf(type, &(bufs[p]));
-                            }
+                    for (p = 0; (p < data->partitions); p++) {
+                        if (0 != bufs[p].len) {
+                            fprintf(stderr, "freeing %u %u", c, p);
+                            type->freebuf(type, &(bufs[p]));
                         }
                     }
-                    free (data->bufs);
                 }
+                free (data->bufs);
             }
+        }
 
-            if (0 != ret) {
-                free (data->partsmpl_remaining);
-                memset (data, 0, sizeof(rba_data_t));
-            }
+        if (0 != ret) {
+            free (data->class_keep);
+            memset (data, 0, sizeof(rba_data_t));
         }
 
+        free (stratum_picks);
         free (filepath_buf);
     }
 
     return ret;
 }
 
+/*  Send the record to the partitions of its time bucket. Bucket b goes to
+    partition b mod partitions and its repetitions to the partitions after
+    it, so records of the same bucket always share their partitions. With
+    time ranges, partition p holds the records from timebounds[p - 1] up to
+    but excluding timebounds[p]. */
+static int
+pick_time_partitions(rba_data_t *data,
+                     const char *line)
+{
+    int ret;
+
+    char field[RBA_CLASS_MAXLEN];
+    int64_t usec, bucket;
+    uint32_t r, p, lo, hi;
+
+    ret = line_field (line, data->timecol, field, sizeof(field));
+    if (0 == ret) {
+        ret = rba_parse_timestamp (field, &usec);
+    }
+    if (0 == ret) {
+        if (NULL != data->timebounds) {
+            /*  the number of bounds at or before usec */
+            for (lo = 0, hi = data->partitions - 1; lo < hi; ) {
+                if (data->timebounds[lo + (hi - lo) / 2] <= usec) {
+                    lo += (hi - lo) / 2 + 1;
+                } else {
+                    hi = lo + (hi - lo) / 2;
+                }
+            }
+            p = lo;
+        } else {
+            bucket = usec / data->timebucket - ((usec % data->timebucket) < 0);
+            p = (uint32_t)(((bucket % data->partitions) + data->partitions) % data->partitions);
+        }
+        for (r = 0; r < data->repetitions; r++) {
+            data->partidxbuf[r] = p;
+            p = (p + 1 == data->partitions) ? 0 : (p + 1);
+        }
+    }
+
+    return ret;
+}
+
+/*  Decide whether to keep a record of class. With known class counts this is
+    selection sampling, which keeps exactly class_keep of the records: each
+    record is kept with probability records still to keep / records left.
+    Streamed records are kept with probability rate. No random number is drawn
+    when the outcome is certain. */
+static int
+keep_record (   rba_data_t  *data,
+                uint32_t    class)
+{
+    int keep;
+
+    if (data->flags & RBA_DATA_STREAM) {
+        if (data->class_rates[class] >= 1.0) {
+            keep = 1;
+        } else {
+            RBA_LCG_NEXT(data->rng_state);
+            keep = (LCG_GET_DOUBLE(data->rng_state) < data->class_rates[class]);
+        }
+    } else if (0 == data->class_left[class]) {
+        /*  more records than counted, pick_next_partitions reports it */
+        keep = 1;
+    } else {
+        if (data->class_keep[class] == data->class_left[class]) {
+            keep = 1;
+        } else if (0 == data->class_keep[class]) {
+            keep = 0;
+        } else {
+            RBA_LCG_NEXT(data->rng_state);
+            keep = (LCG_GET_DOUBLE(data->rng_state) * (double)data->class_left[class] < (double)data->class_keep[class]);
+        }
+        data->class_left[class]--;
+        data->class_keep[class] -= keep ? 1 : 0;
+    }
+
+    return keep;
+}
+
 extern int
 rba_data_parse_line (   rba_data_t  *data,
                         char        *nextline)
@@ -421,15 +1248,83 @@ rba_data_parse_line (   rba_data_t  *data,
 
     rba_type_t *type;
 
-    pick_next_partitions(data);
+    uint32_t class = 0;
+    int keep = 1;
+
+    rba_stats_t *stats = data->stats;
+    uint64_t start, written;
+
+    if (NULL != data->filter) {
+        rba_stats_switch (stats, RBA_STAGE_SELECT);
+        ret = rba_filter_line (data->filter, nextline);
+        if (0 == ret) {
+            /*  dropped before it takes a random number or a dedup slot */
+            data->filtered++;
+            return 0;
+        } else if (1 != ret) {
+            return -1;
+        }
+        ret = 0;
+    }
+
+    if (NULL != data->dedup) {
+        rba_stats_switch (stats, RBA_STAGE_DEDUP);
+        ret = rba_dedup_check (data->dedup, data->spec, data->cols, nextline);
+        if (1 == ret) {
+            data->duplicates++;
+            return 0;
+        } else if (0 != ret) {
+            return -1;
+        }
+    }
+
+    if (data->classes > 0) {
+        rba_stats_switch (stats, RBA_STAGE_SELECT);
+        ret = rba_line_class (  data->spec,
+                                data->classcol,
+                                nextline,
+                                &class);
+        if (0 == ret) {
+            keep = keep_record (data, class);
+            data->repetitions = data->class_reps[class];
+        }
+    }
+    if (0 != ret) {
+        return -1;
+    } else if (!keep || (0 == data->repetitions)) {
+        /*  dropped before any of the columns is parsed */
+        data->dropped++;
+        return 0;
+    }
+
+    rba_stats_switch (stats, RBA_STAGE_PICK);
+    if ((0 != data->timebucket) || (NULL != data->timebounds)) {
+        ret = pick_time_partitions(data, nextline);
+    } else {
+        ret = pick_next_partitions(data, (data->strata > 1) ? class : 0);
+    }
+    if (0 != ret) {
+        return -1;
+    }
 
+    rba_stats_switch (stats, RBA_STAGE_PARSE);
     c = 0;
     for_each_csvtoken(nextline, iterator, token) {
         token = rba_strtrim (token);
         type = data->spec[c].type;
-        ret = type->parse ( data,
-                            c,
-                            token);
+        if ((NULL != stats) && (NULL != stats->colticks) && (c < data->cols)) {
+            /*  the flushes the column triggers count as writes */
+            written = stats->ticks[RBA_STAGE_WRITE];
+            start = rba_stats_ticks ();
+            ret = type->parse ( data,
+                                c,
+                                token);
+            stats->colticks[c] += rba_stats_ticks () - start - (stats->ticks[RBA_STAGE_WRITE] - written);
+        } else {
+            ret = type->parse ( data,
+                                c,
+                                token);
+        }
         if (0 != ret) {
             RBA_ERR("failed to parse column (%u) \"%s\"\n", (unsigned)c, token);
             ret = -1;
@@ -449,9 +1344,183 @@ rba_data_parse_line (   rba_data_t  *data,
         ret = -1;
     }
 
+    if ((0 == ret) && (NULL != data->rows)) {
+        ret = rba_rows_store (data);
+    }
+
+    if ((0 == ret) && (NULL != stats)) {
+        stats->records_written += data->repetitions;
+    }
+
+    return ret;
+}
+
+/*  Count the records of a CSV file whose lines start before byte end, as
+    rba_data_parse_csvs would read them. */
+static int
+shard_records_before (  rba_data_t  *data,
+                        const char  *csvname,
+                        uint64_t    end,
+                        uint64_t    *records_p)
+{
+    int ret;
+
+    rba_input_t *input;
+    char *line = NULL;
+    size_t buf_sz = 0;
+    ssize_t line_sz;
+    uint64_t offset;
+    int keep;
+
+    ret = rba_input_open (&input, csvname);
+    if (0 != ret) {
+        RBA_ERR("Failed to open CSV flie %s\n", csvname);
+        ret = -1;
+    } else {
+
+        /* the header */
+        line_sz = rba_input_getline (input, &line, &buf_sz);
+        offset = (line_sz > 0) ? (uint64_t)line_sz : 0;
+
+        while ((0 == ret) && (offset < end) &&
+                ((line_sz = rba_input_getline (input, &line, &buf_sz)) > 0)) {
+            keep = (NULL != data->filter) ? rba_filter_line (data->filter, line) : 1;
+            if (keep < 0) {
+                RBA_ERR("Failed to filter a line of CSV file %s\n", csvname);
+                ret = -1;
+            } else {
+                *records_p += (uint64_t)keep;
+                offset += (uint64_t)line_sz;
+            }
+        }
+
+        if (0 != rba_input_error (input)) {
+            RBA_ERR("Error reading CSV file %s\n", csvname);
+            ret = -1;
+        }
+        if (0 != rba_input_close (input)) {
+            ret = -1;
+        }
+        free (line);
+    }
+
+    return ret;
+}
+
+/*  Deal the records before the shard from the decks without writing them,
+    so that the shard carries on where a single conversion would be. The
+    generator starts from the seed, as RBA_LCG_INIT does for a single
+    conversion. */
+static void
+shard_skip (rba_data_t  *data,
+            uint64_t    records)
+{
+    uint64_t draws = records * data->repetitions;
+    uint32_t step;
+
+    data->rng_state = data->shardseed;
+    for (step = 0; step < data->partitions; step++) {
+        data->partdeck[step] = step;
+    }
+    data->deckpos[0] = 0;
+
+    while (draws > 0) {
+        if (0 == data->deckpos[0]) {
+            shuffle_deck (data, data->partdeck);
+            data->deckpos[0] = data->partitions;
+        }
+        step = (draws < data->deckpos[0]) ? (uint32_t)draws : data->deckpos[0];
+        data->deckpos[0] -= step;
+        draws -= step;
+    }
+}
+
+/*  The byte range [ranges[2 * f], ranges[2 * f + 1]) of every CSV file f
+    that belongs to the shard. The blocks of all files are numbered in
+    order, and shard i of n gets blocks i * blocks / n up to (i + 1) *
+    blocks / n. The records before the first block of the shard are counted
+    and dealt with shard_skip. */
+static int
+shard_ranges (  rba_data_t  *data,
+                const char  **csvnames,
+                int         csvcount,
+                uint64_t    **ranges_p)
+{
+    int ret = 0;
+
+    struct stat st;
+    uint64_t *ranges;
+    uint64_t blocks, lo, hi, first, last, records;
+    int csv_idx;
+
+    ranges = (uint64_t*)calloc (2 * csvcount, sizeof(uint64_t));
+    if (NULL == ranges) {
+        RBA_ERR("malloc failed for %d shard ranges\n", csvcount);
+        return -1;
+    }
+
+    for (csv_idx = 0, blocks = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+        if ((0 == strcmp (csvnames[csv_idx], "-")) ||
+                !rba_input_seekable (csvnames[csv_idx]) ||
+                (0 != stat (csvnames[csv_idx], &st))) {
+            RBA_ERR("%s is not a plain file and can not be sharded\n", csvnames[csv_idx]);
+            ret = -1;
+        } else {
+            ranges[2 * csv_idx + 1] = (uint64_t)st.st_size;
+            blocks += ((uint64_t)st.st_size + RBA_SHARD_BLOCK - 1) / RBA_SHARD_BLOCK;
+        }
+    }
+
+    lo = blocks * data->shard / data->shards;
+    hi = blocks * (data->shard + 1) / data->shards;
+    for (csv_idx = 0, first = 0, records = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+        last = first + (ranges[2 * csv_idx + 1] + RBA_SHARD_BLOCK - 1) / RBA_SHARD_BLOCK;
+        if (lo > first) {
+            ret = shard_records_before (data,
+                                        csvnames[csv_idx],
+                                        (lo >= last) ? ranges[2 * csv_idx + 1] : (lo - first) * RBA_SHARD_BLOCK,
+                                        &records);
+        }
+        if ((lo >= last) || (hi <= first)) {
+            ranges[2 * csv_idx] = 0;
+            ranges[2 * csv_idx + 1] = 0;
+        } else {
+            ranges[2 * csv_idx] = (((lo > first) ? lo : first) - first) * RBA_SHARD_BLOCK;
+            ranges[2 * csv_idx + 1] = (hi < last) ? (hi - first) * RBA_SHARD_BLOCK : ranges[2 * csv_idx + 1];
+        }
+        first = last;
+    }
+
+    if (0 != ret) {
+        free (ranges);
+    } else {
+        if (lo > 0) {
+            printf("    Dealing the %llu records before shard %u\n", (unsigned long long)records, (unsigned)data->shard);
+        }
+        shard_skip (data, records);
+        *ranges_p = ranges;
+    }
+
     return ret;
 }
 
+/*  identifies the list of CSV files a checkpoint was taken of */
+static uint64_t
+csvs_hash ( const char  **csvnames,
+            int         csvcount)
+{
+    rba_hash128_t hash;
+    uint64_t h = (uint64_t)csvcount;
+    int csv_idx;
+
+    for (csv_idx = 0; csv_idx < csvcount; csv_idx++) {
+        rba_hash128 (csvnames[csv_idx], strlen (csvnames[csv_idx]), &hash);
+        h = h * 0x9E3779B97F4A7C15ULL + hash.lo;
+    }
+
+    return h;
+}
+
 extern int
 rba_data_parse_csvs (   rba_data_t  *data,
                         const char  **csvnames,
@@ -459,7 +1528,7 @@ rba_data_parse_csvs (   rba_data_t  *data,
 {
     int ret;
 
-    FILE *filep;
+    rba_input_t *input;
 
     char    *nextline;
     size_t  buf_sz;
@@ -467,59 +1536,319 @@ rba_data_parse_csvs (   rba_data_t  *data,
 
     int csv_idx;
 
-    uint64_t lineno;
+    uint64_t lineno, duplicates, csvhash;
+    uint64_t first, end, *ranges = NULL;
+    int resumed, seek;
+
+    rba_stats_t *stats = data->stats;
 
     nextline = NULL;
     buf_sz = 0;
 
-    for (csv_idx = 0, ret = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
-        
-        filep = fopen(csvnames[csv_idx], "r");
-        if (NULL == filep) {
+    /*  a resumed conversion carries on in the file it stopped in */
+    csvhash = csvs_hash (csvnames, csvcount);
+    if ((0 != data->csvline) &&
+            ((csvhash != data->csvhash) || (data->csv >= (uint32_t)csvcount))) {
+        RBA_ERR("The CSV files are not the ones of the checkpoint\n");
+        return -1;
+    }
+    data->csvhash = csvhash;
+
+    ret = (0 != data->shards) ? shard_ranges (data, csvnames, csvcount, &ranges) : 0;
+
+    for (csv_idx = data->csv; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+
+        /*  a shard starts with the line after the one its first byte is in,
+            unless that byte starts a line */
+        first = (NULL != ranges) ? ranges[2 * csv_idx] : 0;
+        end = (NULL != ranges) ? ranges[2 * csv_idx + 1] : UINT64_MAX;
+        if (first >= end) {
+            continue;
+        }
+
+        resumed = ((uint32_t)csv_idx == data->csv) && (0 != data->csvline);
+        seek = resumed && rba_input_seekable (csvnames[csv_idx]);
+        if (seek) {
+            first = data->csvoffset;
+        } else if (first > 0) {
+            first--;
+        }
+        ret = rba_input_open_at (&input, csvnames[csv_idx], first);
+        if (0 != ret) {
 
             RBA_ERR("Failed to open CSV flie %s\n", csvnames[csv_idx]);
-            RBA_ERRNO();
             ret = -1;
         } else {
 
             lineno = 0;
-           /* Read the header */
-            line_sz = getline(&nextline, &buf_sz, filep);
+            line_sz = 0;
+            if (seek) {
+                lineno = data->csvline;
+            } else {
+                /* Read the header, streamed input has not been checked before */
+                line_sz = rba_input_getline(input, &nextline, &buf_sz);
+            }
             if (line_sz < 0) {
 
                 RBA_ERR("Failed to read header file from CSV file %s\n", csvnames[csv_idx]);
-                RBA_ERRNO();
+                ret = -1;
+            } else if (!seek && (0 == first) && (0 != rba_checkhdr_line (data->spec, data->cols, nextline))) {
+
+                RBA_ERR("Header check for CSV file %s failed\n", csvnames[csv_idx]);
                 ret = -1;
             } else {
-                printf("    Parsing CSV file %s\n", csvnames[csv_idx]);
+                duplicates = data->duplicates;
+                if (NULL != ranges) {
+                    printf("    Parsing bytes %llu to %llu of CSV file %s\n", (unsigned long long)ranges[2 * csv_idx], (unsigned long long)end, csvnames[csv_idx]);
+                    data->csv = (uint32_t)csv_idx;
+                    data->csvoffset = first + (uint64_t)line_sz;
+                } else if (!resumed) {
+                    printf("    Parsing CSV file %s\n", csvnames[csv_idx]);
+                    data->csv = (uint32_t)csv_idx;
+                    data->csvoffset = (uint64_t)line_sz;
+                } else {
+                    printf("    Resuming CSV file %s after line %llu\n", csvnames[csv_idx], (unsigned long long)data->csvline);
+                }
+
+                /*  lines read before that could not be seeked past */
+                rba_stats_switch (stats, RBA_STAGE_READ);
+                while ((lineno < data->csvline) && (line_sz >= 0)) {
+                    line_sz = rba_input_getline(input, &nextline, &buf_sz);
+                    lineno++;
+                }
+                if (line_sz < 0) {
+                    RBA_ERR("CSV file %s ends before line %llu of the checkpoint\n", csvnames[csv_idx], (unsigned long long)data->csvline);
+                    ret = -1;
+                }
 
                 /* Read the remaining lines */
-                do {
+                while ((line_sz >= 0) && (0 == ret) && (data->csvoffset < end)) {
                     lineno++;
-                    line_sz = getline(&nextline, &buf_sz, filep);
+                    rba_stats_switch (stats, RBA_STAGE_READ);
+                    line_sz = rba_input_getline(input, &nextline, &buf_sz);
                     if (line_sz > 0) {
+                        if (NULL != stats) {
+                            stats->records_read++;
+                            stats->bytes_read += (uint64_t)line_sz;
+                            if (0 == (stats->records_read & 0x3FF)) {
+                                rba_stats_progress (stats);
+                            }
+                        }
                         ret = rba_data_parse_line (data, nextline);
                         if (0 != ret) {
 
                             RBA_ERR("Failed to parse line %llu from CSV file %s\n", (unsigned long long)lineno, csvnames[csv_idx]);
                             ret = -1;
+                        } else {
+                            data->csvline = lineno;
+                            data->csvoffset += (uint64_t)line_sz;
+                            data->lines++;
+                            if ((NULL != data->checkpoint) && (0 == (data->lines & 0x3FF))) {
+                                ret = rba_data_checkpoint (data);
+                            }
                         }
                     }
-                } while((line_sz >= 0) && (0 == ret));
-            
-                if (0 != errno) {
+                }
+                rba_stats_switch (stats, RBA_STAGE_OTHER);
+                rba_stats_progress_done (stats);
+
+                if (0 != rba_input_error (input)) {
                     RBA_ERR("Error parsing CSV file %s\n", csvnames[csv_idx]);
                     ret = -1;
+                } else if ((0 == ret) && (NULL != data->dedup)) {
+                    printf("    %s contains %lu duplicate records\n",
+                            csvnames[csv_idx],
+                            data->duplicates - duplicates);
                 }
             }
 
-            fclose (filep);
+            if (0 != rba_input_close (input)) {
+                ret = -1;
+            }
         }
+
+        data->csvline = 0;
     }
 
     if (buf_sz > 0) {
         free(nextline);
     }
+    free (ranges);
+
+    return ret;
+}
+
+/*  Drop the records filter rejects. The record count passed to
+    rba_data_alloc, and the class counts and scans, must then count only the
+    records it keeps, see rba_filter_count. */
+void
+rba_data_set_filter (rba_data_t     *data,
+                     rba_filter_t   *filter)
+{
+    data->filter = filter;
+}
+
+/*  Skip the rows found to be duplicates by dedup, which must have scanned
+    the same CSV files or be empty for streamed input. */
+void
+rba_data_set_dedup (rba_data_t  *data,
+                    rba_dedup_t *dedup)
+{
+    data->dedup = dedup;
+}
+
+/*  Convert shard shard of shards of the CSV files, see shard_ranges. The
+    partitions are dealt from the deck of streamed input, from a generator
+    started at seed, after dealing the records before the shard. With seed
+    1 the shards together write every record to the same partition as a
+    single streamed conversion. Needs RBA_DATA_STREAM and no sampling or
+    stratification. */
+int
+rba_data_set_shard (rba_data_t  *data,
+                    uint32_t    shard,
+                    uint32_t    shards,
+                    uint64_t    seed)
+{
+    int ret;
+
+    if ((shard >= shards) || !(data->flags & RBA_DATA_STREAM) ||
+            (data->strata > 1) || (data->classes > 0)) {
+        RBA_ERR("Shard %u of %u needs streamed input without sampling\n", (unsigned)shard, (unsigned)shards);
+        ret = -1;
+    } else {
+        data->shard = shard;
+        data->shards = shards;
+        data->shardseed = seed;
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  Count and time the conversion in stats, see rba_stats_switch. */
+void
+rba_data_set_stats (rba_data_t  *data,
+                    rba_stats_t *stats)
+{
+    uint64_t i;
+
+    data->stats = stats;
+    for (i = 0; i < (uint64_t)data->cols * data->partitions; i++) {
+        data->bufs[i].stats = stats;
+    }
+    rba_rows_set_stats (data, stats);
+    rba_pax_set_stats (data, stats);
+}
+
+/*  Partition by time instead of at random, in buckets of width microseconds
+    of the timestamp in column col. Not for stratified data. */
+int
+rba_data_set_timebuckets (  rba_data_t  *data,
+                            uint32_t    col,
+                            int64_t     width)
+{
+    int ret;
+
+    if ((col >= data->cols) || (&rba_type_timestamp != data->spec[col].type)) {
+        RBA_ERR("Column %u is not a timestamp\n", (unsigned)col);
+        ret = -1;
+    } else if ((width <= 0) || (data->strata > 1)) {
+        RBA_ERR("Time buckets need a positive width and unstratified data\n");
+        ret = -1;
+    } else {
+        data->timecol = col;
+        data->timebucket = width;
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  Partition by time ranges. bounds holds the partitions - 1 timestamps at
+    which the partitions after the first start, in ascending order. */
+int
+rba_data_set_timeranges (   rba_data_t      *data,
+                            uint32_t        col,
+                            const int64_t   *bounds)
+{
+    int ret;
+
+    if (NULL == bounds) {
+        RBA_ERR("No time bounds given for %u partitions\n", (unsigned)data->partitions);
+        ret = -1;
+    } else {
+        ret = rba_data_set_timebuckets (data, col, 1);
+    }
+    if (0 == ret) {
+        data->timebucket = 0;
+        data->timebounds = (int64_t*)malloc (data->partitions * sizeof(int64_t));
+        if (NULL == data->timebounds) {
+            RBA_ERR("malloc failed for %u time bounds\n", (unsigned)data->partitions);
+            ret = -1;
+        } else {
+            memcpy (data->timebounds, bounds, (data->partitions - 1) * sizeof(int64_t));
+        }
+    }
+
+    return ret;
+}
+
+/*  Continue from the checkpoint in resume, after the data set was opened
+    with RBA_DATA_APPEND | RBA_DATA_RESUME and the same arguments as the run
+    that wrote it, and after rba_data_set_dedup and rba_data_set_stats.
+    rba_data_parse_csvs then skips the lines read before. */
+int
+rba_data_resume (   rba_data_t          *data,
+                    const rba_resume_t  *resume)
+{
+    int ret;
+
+    const rba_checkpoint_desc_t *desc = &(resume->desc);
+    uint32_t layout = RBA_DATA_STREAM | RBA_DATA_PACKED | RBA_DATA_ROWS |
+                        RBA_DATA_NOCOLS | RBA_DATA_PAX | RBA_DATA_STRATIFY;
+    uint32_t slots = data->strata * data->partitions;
+
+    if ((desc->partitions != data->partitions) || (desc->cols != data->cols) ||
+            (desc->strata != data->strata) || (desc->classes != data->classes) ||
+            ((desc->flags & layout) != (data->flags & layout))) {
+        RBA_ERR("The checkpoint was written by a conversion with other arguments\n");
+        ret = -1;
+    } else if ((NULL != data->dedup) && !data->dedup->scanned) {
+        RBA_ERR("Streamed duplicate removal keeps its table in memory and can not be resumed\n");
+        ret = -1;
+    } else {
+
+        data->csv = desc->csv;
+        data->csvhash = desc->csvhash;
+        data->csvline = desc->csvline;
+        data->csvoffset = desc->csvoffset;
+        data->lines = desc->lines;
+        data->rng_state = desc->rng_state;
+        data->totsmpl_remaining = desc->totsmpl_remaining;
+        data->dropped = desc->dropped;
+        data->filtered = desc->filtered;
+        data->duplicates = desc->duplicates;
+        if (NULL != data->dedup) {
+            data->dedup->position = desc->dedup_position;
+        }
+        if (NULL != data->stats) {
+            data->stats->records_read = desc->lines;
+        }
+
+        memcpy (data->partsmpl_remaining, resume->partsmpl_remaining, slots * sizeof(uint32_t));
+        memcpy (data->stratsmpl_remaining, resume->stratsmpl_remaining, data->strata * sizeof(uint64_t));
+        if (data->classes > 0) {
+            memcpy (data->class_keep, resume->class_keep, data->classes * sizeof(uint64_t));
+            memcpy (data->class_left, resume->class_left, data->classes * sizeof(uint64_t));
+        }
+        if (data->flags & RBA_DATA_STREAM) {
+            memcpy (data->partdeck, resume->partdeck, slots * sizeof(uint32_t));
+            memcpy (data->deckpos, resume->deckpos, data->strata * sizeof(uint32_t));
+        } else {
+            fenwick_build (data);
+        }
+        ret = 0;
+    }
 
     return ret;
 }
@@ -534,16 +1863,47 @@ rba_data_free (rba_data_t *data)
     rba_buf_t *bufs;
     rba_type_t *type;
 
+    uint32_t stage;
+
+    stage = rba_stats_switch (data->stats, RBA_STAGE_CLOSE);
+    if (NULL != data->stats) {
+        data->stats->dropped += data->dropped;
+        data->stats->filtered += data->filtered;
+        data->stats->duplicates += data->duplicates;
+    }
+
+    if (0 != rba_rows_free (data)) {
+        ret = -1;
+    }
+
     for (c=0; c < data->cols; c++) {
         bufs = rba_data_getcolbufs(data, c);
         type = data->spec[c].type;
 
         for (p = 0; p < data->partitions; p++) {
-            type->freebuf(type, &(bufs[p]));
+            if (NULL == bufs[p].filep) {
+                rba_buf_simple_free (type, &(bufs[p]));
+            } else if (0 != type->freebuf(type, &(bufs[p]))) {
+                ret = -1;
+            }
         }
     }
+
+    /*  the column buffers wrote the last row groups when they were freed */
+    if (0 != rba_pax_free (data)) {
+        ret = -1;
+    }
+
     /*free (data->bufs);*/
     free (data->partsmpl_remaining);
+    free (data->stratsmpl_remaining);
+    free (data->fenwick);
+    free (data->partdeck);
+    free (data->deckpos);
+    free (data->class_keep);
+    free (data->timebounds);
+    free (data->checkpoint);
+    rba_stats_switch (data->stats, stage);
     memset (data, 0, sizeof(rba_data_t));
     return ret;
 }
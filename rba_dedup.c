@@ -0,0 +1,567 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <ctype.h>
+
+#include <rba.h>
+
+/*  A spill file entry. Rows that were already in the table when it spilled
+    are written first, with ordinal RBA_DEDUP_KEPT. */
+typedef struct {
+    uint64_t        lo;
+    uint64_t        hi;
+    uint64_t        ordinal;
+    uint32_t        class;
+    uint32_t        reserved;
+} rba_dedup_spill_t;
+
+#define RBA_DEDUP_KEPT  (UINT64_MAX)
+#define RBA_DEDUP_LOAD(cap) (((cap) >> 2) * 3)  /* at most 3/4 full */
+
+/*  MurmurHash3 x64 128 (public domain, Austin Appleby) */
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t
+fmix64 (uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+void
+rba_hash128 (   const void      *key,
+                size_t          len,
+                rba_hash128_t   *hash)
+{
+    const uint8_t *data = (const uint8_t*)key;
+    const uint8_t *tail;
+    size_t nblocks = len / 16;
+    size_t i;
+
+    uint64_t h1 = 0, h2 = 0;
+    uint64_t k1, k2;
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    for (i = 0; i < nblocks; i++) {
+        memcpy (&k1, data + i * 16, sizeof(k1));
+        memcpy (&k2, data + i * 16 + 8, sizeof(k2));
+
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    tail = data + nblocks * 16;
+    k1 = 0;
+    k2 = 0;
+
+    switch (len & 15) {
+        case 15: k2 ^= ((uint64_t)tail[14]) << 48; /* fall through */
+        case 14: k2 ^= ((uint64_t)tail[13]) << 40; /* fall through */
+        case 13: k2 ^= ((uint64_t)tail[12]) << 32; /* fall through */
+        case 12: k2 ^= ((uint64_t)tail[11]) << 24; /* fall through */
+        case 11: k2 ^= ((uint64_t)tail[10]) << 16; /* fall through */
+        case 10: k2 ^= ((uint64_t)tail[ 9]) << 8;  /* fall through */
+        case  9: k2 ^= ((uint64_t)tail[ 8]) << 0;
+                 k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+                 /* fall through */
+        case  8: k1 ^= ((uint64_t)tail[ 7]) << 56; /* fall through */
+        case  7: k1 ^= ((uint64_t)tail[ 6]) << 48; /* fall through */
+        case  6: k1 ^= ((uint64_t)tail[ 5]) << 40; /* fall through */
+        case  5: k1 ^= ((uint64_t)tail[ 4]) << 32; /* fall through */
+        case  4: k1 ^= ((uint64_t)tail[ 3]) << 24; /* fall through */
+        case  3: k1 ^= ((uint64_t)tail[ 2]) << 16; /* fall through */
+        case  2: k1 ^= ((uint64_t)tail[ 1]) << 8;  /* fall through */
+        case  1: k1 ^= ((uint64_t)tail[ 0]) << 0;
+                 k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+                 break;
+        default:
+                 break;
+    }
+
+    h1 ^= (uint64_t)len;
+    h2 ^= (uint64_t)len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64 (h1);
+    h2 = fmix64 (h2);
+    h1 += h2;
+    h2 += h1;
+
+    hash->lo = h1;
+    hash->hi = h2;
+}
+
+/*  Hash the fields of a CSV line that are stored, ignoring the columns of type
+    rba_type_ignore and the white space around each field, without modifying
+    the line. */
+int
+rba_dedup_hashline (rba_dedup_t         *dedup,
+                    rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *line,
+                    rba_hash128_t       *hash)
+{
+    int ret = 0;
+
+    const char *start, *end, *next;
+    size_t linelen = strlen (line);
+    size_t len = 0;
+    uint32_t c;
+
+    if (dedup->scratchlen < linelen + 1) {
+        free (dedup->scratch);
+        dedup->scratchlen = linelen + 1;
+        dedup->scratch = (char*)malloc (dedup->scratchlen);
+        if (NULL == dedup->scratch) {
+            RBA_ERR("malloc failed for %lu bytes\n", (unsigned long)dedup->scratchlen);
+            dedup->scratchlen = 0;
+            ret = -1;
+        }
+    }
+
+    for (c = 0, start = line; (0 == ret) && (c < cols) && (NULL != start); c++, start = next) {
+        end = strchr (start, ',');
+        next = (NULL != end) ? (end + 1) : NULL;
+        end = (NULL != end) ? end : (line + linelen);
+        if (&rba_type_ignore != spec[c].type) {
+            for (; (start < end) && isspace((unsigned char)start[0]); start++);
+            for (; (end > start) && isspace((unsigned char)end[-1]); end--);
+            memcpy (dedup->scratch + len, start, end - start);
+            len += end - start;
+            dedup->scratch[len++] = ',';
+        }
+    }
+
+    if (0 == ret) {
+        rba_hash128 (dedup->scratch, len, hash);
+        /*  the all zero hash marks empty slots */
+        if ((0 == hash->lo) && (0 == hash->hi)) {
+            hash->hi = 1;
+        }
+    }
+
+    return ret;
+}
+
+static int
+table_alloc (   rba_dedup_t *dedup,
+                uint64_t    entries)
+{
+    int ret;
+
+    uint64_t capacity;
+
+    for (capacity = 1024; RBA_DEDUP_LOAD(capacity) < entries; capacity *= 2);
+
+    if (capacity * sizeof(rba_hash128_t) > dedup->membound) {
+        RBA_ERR("%lu distinct rows do not fit in %lu bytes of hash table\n", (unsigned long)entries, (unsigned long)dedup->membound);
+        ret = -1;
+    } else {
+        dedup->table = (rba_hash128_t*)calloc (capacity, sizeof(rba_hash128_t));
+        if (NULL == dedup->table) {
+            RBA_ERR("calloc failed for %lu hash table slots\n", (unsigned long)capacity);
+            ret = -1;
+        } else {
+            dedup->mask = capacity - 1;
+            dedup->used = 0;
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+int
+rba_dedup_init (rba_dedup_t *dedup,
+                size_t      membound)
+{
+    int ret;
+
+    uint64_t capacity;
+
+    memset (dedup, 0, sizeof(rba_dedup_t));
+    dedup->membound = membound;
+
+    /*  the largest table that fits, so streamed input can use all of it */
+    for (capacity = 1024; capacity * 2 * sizeof(rba_hash128_t) <= membound; capacity *= 2);
+    ret = table_alloc (dedup, RBA_DEDUP_LOAD(capacity));
+
+    return ret;
+}
+
+/*  Insert hash into the table with linear probing. Returns 1 if it is new, 0
+    if it was already there and -1 if the table is full. */
+int
+rba_dedup_insert (  rba_dedup_t         *dedup,
+                    const rba_hash128_t *hash)
+{
+    int ret;
+
+    uint64_t slot;
+    rba_hash128_t *entry;
+
+    for (slot = hash->lo & dedup->mask; ; slot = (slot + 1) & dedup->mask) {
+        entry = &(dedup->table[slot]);
+        if ((0 == entry->lo) && (0 == entry->hi)) {
+            if (dedup->used >= RBA_DEDUP_LOAD(dedup->mask + 1)) {
+                ret = -1;
+            } else {
+                *entry = *hash;
+                dedup->used++;
+                ret = 1;
+            }
+            break;
+        } else if ((entry->lo == hash->lo) && (entry->hi == hash->hi)) {
+            ret = 0;
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static int
+mark_duplicate (rba_dedup_t *dedup,
+                uint64_t    ordinal)
+{
+    int ret = 0;
+
+    uint64_t bytes = (ordinal / 8) + 1;
+    uint8_t *dupmap;
+
+    if (bytes > dedup->dupmaplen) {
+        bytes = (bytes > 2 * dedup->dupmaplen) ? bytes : (2 * dedup->dupmaplen);
+        dupmap = (uint8_t*)realloc (dedup->dupmap, bytes);
+        if (NULL == dupmap) {
+            RBA_ERR("realloc failed for %lu bytes of duplicate map\n", (unsigned long)bytes);
+            ret = -1;
+        } else {
+            memset (dupmap + dedup->dupmaplen, 0, bytes - dedup->dupmaplen);
+            dedup->dupmap = dupmap;
+            dedup->dupmaplen = bytes;
+        }
+    }
+
+    if (0 == ret) {
+        dedup->dupmap[ordinal / 8] |= (uint8_t)(1 << (ordinal % 8));
+        dedup->duplicates++;
+    }
+
+    return ret;
+}
+
+/*  The table is full: move its rows to the spill files, each row to the file
+    picked by the top bits of its hash, and spill all further rows too. */
+static int
+spill_row ( rba_dedup_t         *dedup,
+            const rba_hash128_t *hash,
+            uint32_t            class)
+{
+    int ret = 0;
+
+    rba_dedup_spill_t entry;
+    uint32_t s = (uint32_t)(hash->hi >> (64 - RBA_DEDUP_SPILLBITS));
+
+    entry.lo = hash->lo;
+    entry.hi = hash->hi;
+    entry.ordinal = dedup->records;
+    entry.class = class;
+    entry.reserved = 0;
+    if (1 != fwrite (&entry, sizeof(entry), 1, dedup->spills[s])) {
+        RBA_ERR("Failed to write dedup spill file\n");
+        RBA_ERRNO();
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int
+spill_table (rba_dedup_t *dedup)
+{
+    int ret = 0;
+
+    uint64_t slot;
+    uint32_t s;
+    rba_dedup_spill_t entry;
+
+    for (s = 0; (s < RBA_DEDUP_SPILLS) && (0 == ret); s++) {
+        dedup->spills[s] = tmpfile ();
+        if (NULL == dedup->spills[s]) {
+            RBA_ERR("Failed to create dedup spill file\n");
+            RBA_ERRNO();
+            ret = -1;
+        }
+    }
+
+    memset (&entry, 0, sizeof(entry));
+    entry.ordinal = RBA_DEDUP_KEPT;
+    for (slot = 0; (slot <= dedup->mask) && (0 == ret); slot++) {
+        if ((0 != dedup->table[slot].lo) || (0 != dedup->table[slot].hi)) {
+            entry.lo = dedup->table[slot].lo;
+            entry.hi = dedup->table[slot].hi;
+            s = (uint32_t)(entry.hi >> (64 - RBA_DEDUP_SPILLBITS));
+            if (1 != fwrite (&entry, sizeof(entry), 1, dedup->spills[s])) {
+                RBA_ERR("Failed to write dedup spill file\n");
+                ret = -1;
+            }
+        }
+    }
+
+    free (dedup->table);
+    dedup->table = NULL;
+    dedup->spilled = 1;
+
+    return ret;
+}
+
+/*  Second pass over the spill files. Each holds the rows of 1 /
+    RBA_DEDUP_SPILLS of the hashes, in input order, and is deduplicated with a
+    table of its own. */
+static int
+dedup_spills (  rba_dedup_t *dedup,
+                uint64_t    *classcounts)
+{
+    int ret = 0;
+
+    uint32_t s;
+    long size;
+    rba_dedup_spill_t entry;
+    rba_hash128_t hash;
+
+    for (s = 0; (s < RBA_DEDUP_SPILLS) && (0 == ret); s++) {
+        if ((0 != fseek (dedup->spills[s], 0, SEEK_END)) ||
+                ((size = ftell (dedup->spills[s])) < 0) ||
+                (0 != fseek (dedup->spills[s], 0, SEEK_SET))) {
+            RBA_ERR("Failed to rewind dedup spill file\n");
+            RBA_ERRNO();
+            ret = -1;
+        } else {
+            ret = table_alloc (dedup, (uint64_t)size / sizeof(entry));
+        }
+
+        while ((0 == ret) && (1 == fread (&entry, sizeof(entry), 1, dedup->spills[s]))) {
+            hash.lo = entry.lo;
+            hash.hi = entry.hi;
+            ret = rba_dedup_insert (dedup, &hash);
+            if (1 == ret) {
+                ret = 0;
+            } else if ((0 == ret) && (RBA_DEDUP_KEPT != entry.ordinal)) {
+                ret = mark_duplicate (dedup, entry.ordinal);
+                if (NULL != classcounts) {
+                    classcounts[entry.class]--;
+                }
+            }
+        }
+        if ((0 == ret) && ferror (dedup->spills[s])) {
+            RBA_ERR("Failed to read dedup spill file\n");
+            ret = -1;
+        }
+
+        fclose (dedup->spills[s]);
+        dedup->spills[s] = NULL;
+        free (dedup->table);
+        dedup->table = NULL;
+    }
+
+    return ret;
+}
+
+/*  Check the headers of the CSV files and find the duplicate rows, the rows
+    whose stored fields hash the same as an earlier row. They are marked in a
+    bitmap by their position in the input, for rba_data_parse_line to skip. As
+    long as the distinct rows fit in the table, this is one pass. Once it
+    fills up, the rows are spilled to RBA_DEDUP_SPILLS temporary files by hash
+    and each file is deduplicated separately in a second pass. The number of
+    distinct records is returned in records_p, and with a non-NULL classcounts
+    the number of distinct records of each class of column col is added to
+    it. With a filter, the records it rejects are skipped before they are
+    hashed, as rba_data_parse_line does. */
+int
+rba_dedup_scan (rba_dedup_t         *dedup,
+                rba_spec_entry_t    *spec,
+                uint32_t            cols,
+                const char          **csvnames,
+                int                 csvcount,
+                uint32_t            col,
+                uint64_t            *classcounts,
+                const rba_filter_t  *filter,
+                uint64_t            *records_p)
+{
+    int ret;
+
+    rba_input_t *in;
+    char *line = NULL;
+    size_t bufsz = 0;
+    ssize_t len;
+    int csv_idx;
+    uint32_t class = 0;
+    int isnew = 1;
+    rba_hash128_t hash;
+
+    for (csv_idx = 0, ret = 0; (csv_idx < csvcount) && (0 == ret); csv_idx++) {
+        ret = rba_input_open (&in, csvnames[csv_idx]);
+        if (0 != ret) {
+            continue;
+        }
+
+        len = rba_input_getline (in, &line, &bufsz);
+        if (len <= 0) {
+            RBA_ERR("CSV file %s has no header\n", csvnames[csv_idx]);
+            ret = -1;
+        } else {
+            ret = rba_checkhdr_line (spec, cols, line);
+        }
+
+        while ((0 == ret) && ((len = rba_input_getline (in, &line, &bufsz)) > 0)) {
+            if (NULL != filter) {
+                ret = rba_filter_line (filter, line);
+                if (1 != ret) {
+                    ret = (0 == ret) ? 0 : -1;
+                    continue;
+                }
+                ret = 0;
+            }
+            if (NULL != classcounts) {
+                ret = rba_line_class (spec, col, line, &class);
+            }
+            if (0 == ret) {
+                ret = rba_dedup_hashline (dedup, spec, cols, line, &hash);
+            }
+            if ((0 == ret) && !dedup->spilled) {
+                isnew = rba_dedup_insert (dedup, &hash);
+                if (-1 == isnew) {
+                    ret = spill_table (dedup);
+                }
+            }
+            if ((0 == ret) && dedup->spilled) {
+                /*  counted as new until the second pass finds otherwise */
+                ret = spill_row (dedup, &hash, class);
+                isnew = 1;
+            } else if ((0 == ret) && !isnew) {
+                ret = mark_duplicate (dedup, dedup->records);
+            }
+            if (0 == ret) {
+                if (isnew && (NULL != classcounts)) {
+                    classcounts[class]++;
+                }
+                dedup->records++;
+            }
+        }
+
+        if ((0 == ret) && (0 != rba_input_error (in))) {
+            ret = -1;
+        }
+        if (0 != rba_input_close (in)) {
+            ret = -1;
+        }
+    }
+
+    if ((0 == ret) && dedup->spilled) {
+        printf ("    Deduplicating %lu records in %u spill files\n", (unsigned long)dedup->records, (unsigned)RBA_DEDUP_SPILLS);
+        ret = dedup_spills (dedup, classcounts);
+    }
+
+    if (0 == ret) {
+        *records_p = dedup->records - dedup->duplicates;
+        dedup->scanned = 1;
+    }
+
+    free (line);
+
+    return ret;
+}
+
+/*  Whether record ordinal of the input, counting the records the filter of
+    rba_dedup_scan keeps, was marked as a duplicate by rba_dedup_scan. */
+int
+rba_dedup_marked (  const rba_dedup_t   *dedup,
+                    uint64_t            ordinal)
+{
+    return ((ordinal / 8) < dedup->dupmaplen) &&
+            (dedup->dupmap[ordinal / 8] & (1 << (ordinal % 8)));
+}
+
+/*  Decide whether the next record of the input is a duplicate, from the
+    bitmap of rba_dedup_scan, or for streamed input by inserting its hash into
+    the table. Returns 1 for duplicates, 0 for new records and -1 when the
+    table is full. */
+int
+rba_dedup_check (   rba_dedup_t         *dedup,
+                    rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *line)
+{
+    int ret;
+
+    uint64_t ordinal = dedup->position++;
+    rba_hash128_t hash;
+
+    if (dedup->scanned) {
+        ret = rba_dedup_marked (dedup, ordinal);
+    } else {
+        ret = rba_dedup_hashline (dedup, spec, cols, line, &hash);
+        if (0 == ret) {
+            ret = rba_dedup_insert (dedup, &hash);
+            if (-1 == ret) {
+                RBA_ERR("Dedup hash table is full after %lu distinct records\n", (unsigned long)dedup->used);
+            } else {
+                ret = !ret;
+            }
+        }
+    }
+
+    return ret;
+}
+
+void
+rba_dedup_free (rba_dedup_t *dedup)
+{
+    uint32_t s;
+
+    for (s = 0; s < RBA_DEDUP_SPILLS; s++) {
+        if (NULL != dedup->spills[s]) {
+            fclose (dedup->spills[s]);
+        }
+    }
+    free (dedup->table);
+    free (dedup->dupmap);
+    free (dedup->scratch);
+    memset (dedup, 0, sizeof(rba_dedup_t));
+}
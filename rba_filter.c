@@ -0,0 +1,319 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <ctype.h>
+#include <math.h>
+
+#include <rba.h>
+
+#define RBA_FILTER_AND "&&"
+
+int
+rba_filter_init (   rba_filter_t        *filter,
+                    rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    uint32_t            flags)
+{
+    memset (filter, 0, sizeof(rba_filter_t));
+    filter->spec = spec;
+    filter->cols = cols;
+    filter->flags = flags & RBA_DATA_LEGACYINT;
+
+    return 0;
+}
+
+/*  the [start, end) of string without white space */
+static void
+trim_range (const char  **start,
+            const char  **end)
+{
+    for (; (*start < *end) && isspace((unsigned char)(*start)[0]); (*start)++);
+    for (; (*end > *start) && isspace((unsigned char)(*end)[-1]); (*end)--);
+}
+
+/*  parse one "<column> <op> <value>" term of len bytes at expr */
+static int
+parse_term (rba_filter_t        *filter,
+            const char          *expr,
+            size_t              len,
+            rba_filter_term_t   *term)
+{
+    int ret = 0;
+
+    const char *start, *end, *opstart;
+    char value[RBA_CLASS_MAXLEN], *endptr;
+    rba_type_t *type;
+    size_t namelen;
+    uint32_t c;
+
+    start = expr;
+    end = expr + len;
+    for (opstart = start; (opstart < end) && (NULL == strchr ("=!<>", opstart[0])); opstart++);
+    if (opstart == end) {
+        RBA_ERR("Filter term \"%.*s\" has no operator\n", (int)len, expr);
+        return -1;
+    }
+
+    /*  the column */
+    end = opstart;
+    trim_range (&start, &end);
+    namelen = end - start;
+    for (c = 0; (c < filter->cols) &&
+            ((strlen (filter->spec[c].name) != namelen) || (0 != strncmp (filter->spec[c].name, start, namelen))); c++);
+    if (c == filter->cols) {
+        RBA_ERR("Filter term \"%.*s\" names no column\n", (int)len, expr);
+        return -1;
+    }
+    type = filter->spec[c].type;
+    if (NULL == type->value) {
+        RBA_ERR("Column %s of type %s can not be filtered\n", filter->spec[c].name, type->specname);
+        return -1;
+    }
+    term->col = c;
+
+    /*  the operator */
+    start = opstart;
+    end = expr + len;
+    if ((end - start >= 2) && ('=' == start[1])) {
+        switch (start[0]) {
+            case '=': term->op = RBA_FILTER_EQ; break;
+            case '!': term->op = RBA_FILTER_NE; break;
+            case '<': term->op = RBA_FILTER_LE; break;
+            default:  term->op = RBA_FILTER_GE; break;
+        }
+        start += 2;
+    } else if (('<' == start[0]) || ('>' == start[0])) {
+        term->op = ('<' == start[0]) ? RBA_FILTER_LT : RBA_FILTER_GT;
+        start++;
+    } else if ('=' == start[0]) {
+        /* a single = is taken as == */
+        term->op = RBA_FILTER_EQ;
+        start++;
+    } else {
+        RBA_ERR("Filter term \"%.*s\" has an unknown operator\n", (int)len, expr);
+        return -1;
+    }
+
+    /*  the value, converted as the column */
+    trim_range (&start, &end);
+    if ((start == end) || ((size_t)(end - start) >= sizeof(value))) {
+        RBA_ERR("Filter term \"%.*s\" needs a value\n", (int)len, expr);
+        ret = -1;
+    } else {
+        memcpy (value, start, end - start);
+        value[end - start] = '\0';
+        ret = type->value (type, value, filter->flags, &(term->value));
+        /*  a missing float is stored as 0, but here it is a typo such as
+            "=<" or "6x" */
+        if ((0 == ret) && (RBA_ZONE_FLOAT == type->zone)) {
+            strtod (value, &endptr);
+            ret = ((endptr == value) || ('\0' != *endptr)) ? -1 : 0;
+        }
+        if (0 != ret) {
+            RBA_ERR("Filter term \"%.*s\" has a bad value\n", (int)len, expr);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*  Add the terms of expr, joined with "&&", to filter. The terms are kept
+    sorted by column, so a line is walked once to evaluate them. */
+int
+rba_filter_add (rba_filter_t    *filter,
+                const char      *expr)
+{
+    int ret = 0;
+
+    const char *next;
+    rba_filter_term_t term, *terms;
+    uint32_t t;
+
+    do {
+        next = strstr (expr, RBA_FILTER_AND);
+        ret = parse_term (filter, expr, (NULL != next) ? (size_t)(next - expr) : strlen (expr), &term);
+        if (0 == ret) {
+            terms = (rba_filter_term_t*)realloc (filter->terms, (filter->count + 1) * sizeof(rba_filter_term_t));
+            if (NULL == terms) {
+                RBA_ERR("Failed to grow filter to %u terms\n", (unsigned)(filter->count + 1));
+                ret = -1;
+            } else {
+                filter->terms = terms;
+                for (t = filter->count; (t > 0) && (terms[t - 1].col > term.col); t--) {
+                    terms[t] = terms[t - 1];
+                }
+                terms[t] = term;
+                filter->count++;
+            }
+        }
+        expr = (NULL != next) ? (next + strlen (RBA_FILTER_AND)) : NULL;
+    } while ((0 == ret) && (NULL != expr));
+
+    return ret;
+}
+
+/*  whether value of a column of kind satisfies term */
+static int
+term_holds (const rba_filter_term_t *term,
+            uint32_t                kind,
+            const rba_zone_value_t  *value)
+{
+    int cmp;
+
+    switch (kind) {
+        case RBA_ZONE_UINT:
+            cmp = (value->u > term->value.u) - (value->u < term->value.u);
+            break;
+        case RBA_ZONE_INT:
+            cmp = (value->i > term->value.i) - (value->i < term->value.i);
+            break;
+        default:
+            if (isnan (value->f) || isnan (term->value.f)) {
+                return (RBA_FILTER_NE == term->op);
+            }
+            cmp = (value->f > term->value.f) - (value->f < term->value.f);
+            break;
+    }
+
+    switch (term->op) {
+        case RBA_FILTER_EQ: return (0 == cmp);
+        case RBA_FILTER_NE: return (0 != cmp);
+        case RBA_FILTER_LT: return (cmp < 0);
+        case RBA_FILTER_LE: return (cmp <= 0);
+        case RBA_FILTER_GT: return (cmp > 0);
+        default:            return (cmp >= 0);
+    }
+}
+
+/*  Evaluate the filter on a CSV line without modifying it. Only the fields
+    of the filtered columns are converted, and none after the first term
+    that fails. Returns 1 to keep the record, 0 to drop it and -1 when a
+    field can not be converted. */
+int
+rba_filter_line (   const rba_filter_t  *filter,
+                    const char          *line)
+{
+    int ret = 1;
+
+    const char *start = line, *end;
+    char field[RBA_CLASS_MAXLEN];
+    rba_zone_value_t value;
+    rba_type_t *type;
+    uint32_t c = 0, t = 0;
+
+    while ((1 == ret) && (t < filter->count)) {
+        for (; (c < filter->terms[t].col) && (NULL != start); c++) {
+            start = strchr (start, ',');
+            start = (NULL != start) ? (start + 1) : NULL;
+        }
+        if (NULL == start) {
+            RBA_ERR("line contains fewer columns than expected (%u) \n", (unsigned)(filter->terms[t].col + 1));
+            ret = -1;
+            break;
+        }
+
+        end = strchr (start, ',');
+        end = (NULL != end) ? end : (start + strlen (start));
+        trim_range (&start, &end);
+        if ((size_t)(end - start) >= sizeof(field)) {
+            RBA_ERR("column %u is too long\n", (unsigned)c);
+            ret = -1;
+            break;
+        }
+        memcpy (field, start, end - start);
+        field[end - start] = '\0';
+
+        type = filter->spec[c].type;
+        if (0 != type->value (type, field, filter->flags, &value)) {
+            RBA_ERR("failed to filter column (%u) \"%s\"\n", (unsigned)c, field);
+            ret = -1;
+            break;
+        }
+        for (; (1 == ret) && (t < filter->count) && (c == filter->terms[t].col); t++) {
+            ret = term_holds (&(filter->terms[t]), type->zone, &value);
+        }
+    }
+
+    return ret;
+}
+
+/*  Check the header of a CSV file and count the records the filter keeps */
+int
+rba_filter_count (  const rba_filter_t  *filter,
+                    const char          *filename,
+                    uint64_t            *records_p)
+{
+    int ret;
+
+    rba_input_t *in;
+    char *line = NULL;
+    size_t bufsz = 0;
+    ssize_t len;
+    uint64_t records = 0;
+
+    ret = rba_input_open (&in, filename);
+    if (0 == ret) {
+        len = rba_input_getline (in, &line, &bufsz);
+        if (len <= 0) {
+            RBA_ERR("CSV file %s has no header\n", filename);
+            ret = -1;
+        } else {
+            ret = rba_checkhdr_line (filter->spec, filter->cols, line);
+        }
+
+        while ((0 == ret) && ((len = rba_input_getline (in, &line, &bufsz)) > 0)) {
+            ret = rba_filter_line (filter, line);
+            records += (1 == ret);
+            ret = (-1 == ret) ? -1 : 0;
+        }
+
+        if ((0 == ret) && (0 != rba_input_error (in))) {
+            ret = -1;
+        }
+        if (0 != rba_input_close (in)) {
+            ret = -1;
+        }
+        free (line);
+    }
+
+    if (0 == ret) {
+        *records_p = records;
+    }
+
+    return ret;
+}
+
+void
+rba_filter_free (rba_filter_t *filter)
+{
+    free (filter->terms);
+    memset (filter, 0, sizeof(rba_filter_t));
+}
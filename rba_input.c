@@ -0,0 +1,695 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#ifdef RBA_WITH_ZLIB
+    #include <zlib.h>
+#endif
+#ifdef RBA_WITH_ZSTD
+    #include <zstd.h>
+#endif
+
+#include <rba.h>
+
+/*
+    An rba_input_t reads a CSV stream on its own thread. The reader thread
+    fills a ring of RBA_INPUT_RINGLEN buffers with plain text, decompressing
+    gzip or zstd input on the way, while rba_input_getline() hands out lines
+    from the filled buffers on the caller's thread. Reading and decompression
+    therefore overlap with parsing, and nothing needs to be seekable.
+*/
+
+#define RBA_INPUT_RINGLEN   (4)
+#define RBA_INPUT_BUFSZ     (4*1024*1024)
+
+typedef enum {
+    rba_codec_plain = 0,
+    rba_codec_gzip,
+    rba_codec_zstd
+} rba_input_codec_t;
+
+typedef struct {
+    char    *data;
+    size_t  len;
+} rba_input_slot_t;
+
+struct rba_input_s {
+    const char          *name;
+    int                 fd;
+    rba_input_codec_t   codec;
+
+    /*  bytes read while detecting the codec, consumed before the fd */
+    uint8_t             prefix[4];
+    size_t              prefix_len;
+
+    pthread_t           reader;
+    pthread_mutex_t     lock;
+    pthread_cond_t      filled_cond;
+    pthread_cond_t      free_cond;
+
+    rba_input_slot_t    ring[RBA_INPUT_RINGLEN];
+    uint32_t            filled;     /* slots ready for the consumer */
+    uint32_t            head;       /* next slot the consumer reads */
+    uint32_t            tail;       /* next slot the reader fills */
+    int                 eof;        /* the reader has published everything */
+    int                 error;      /* the reader failed */
+    int                 closing;    /* the consumer is shutting down */
+
+    /*  consumer position in the slot at head */
+    size_t              pos;
+    int                 holding;
+};
+
+/******************************************************************************/
+/*  raw input                                                                 */
+/******************************************************************************/
+
+static ssize_t
+input_read_raw (rba_input_t *in,
+                void        *buf,
+                size_t      len)
+{
+    ssize_t readin;
+    size_t copied = 0;
+
+    if (in->prefix_len > 0) {
+        copied = (in->prefix_len < len) ? in->prefix_len : len;
+        memcpy (buf, in->prefix, copied);
+        memmove (in->prefix, in->prefix + copied, in->prefix_len - copied);
+        in->prefix_len -= copied;
+        if (copied == len) {
+            return (ssize_t)copied;
+        }
+    }
+
+    do {
+        readin = read (in->fd, (char*)buf + copied, len - copied);
+    } while ((readin < 0) && (EINTR == errno));
+
+    if (readin < 0) {
+        RBA_ERR("Failed to read from %s\n", in->name);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    return (ssize_t)copied + readin;
+}
+
+/******************************************************************************/
+/*  ring buffer                                                               */
+/******************************************************************************/
+
+/*  wait for a free slot, returns NULL if the consumer is closing */
+static rba_input_slot_t*
+ring_acquire_free (rba_input_t *in)
+{
+    rba_input_slot_t *slot = NULL;
+
+    pthread_mutex_lock (&(in->lock));
+    while ((in->filled == RBA_INPUT_RINGLEN) && !in->closing) {
+        pthread_cond_wait (&(in->free_cond), &(in->lock));
+    }
+    if (!in->closing) {
+        slot = &(in->ring[in->tail]);
+    }
+    pthread_mutex_unlock (&(in->lock));
+
+    if (NULL != slot) {
+        slot->len = 0;
+    }
+
+    return slot;
+}
+
+static void
+ring_publish (rba_input_t *in)
+{
+    pthread_mutex_lock (&(in->lock));
+    in->tail = (in->tail + 1) % RBA_INPUT_RINGLEN;
+    in->filled++;
+    pthread_cond_signal (&(in->filled_cond));
+    pthread_mutex_unlock (&(in->lock));
+}
+
+static void
+ring_finish (   rba_input_t *in,
+                int         error)
+{
+    pthread_mutex_lock (&(in->lock));
+    in->eof = 1;
+    in->error = error;
+    pthread_cond_signal (&(in->filled_cond));
+    pthread_mutex_unlock (&(in->lock));
+}
+
+/******************************************************************************/
+/*  reader thread bodies, one per codec                                       */
+/******************************************************************************/
+
+static int
+reader_plain (rba_input_t *in)
+{
+    int ret = 0;
+    rba_input_slot_t *slot;
+    ssize_t readin;
+
+    while ((0 == ret) && (NULL != (slot = ring_acquire_free (in)))) {
+        readin = input_read_raw (in, slot->data, RBA_INPUT_BUFSZ);
+        if (readin < 0) {
+            ret = -1;
+        } else if (0 == readin) {
+            break;
+        } else {
+            slot->len = (size_t)readin;
+            ring_publish (in);
+        }
+    }
+
+    return ret;
+}
+
+#ifdef RBA_WITH_ZLIB
+static int
+reader_gzip (rba_input_t *in)
+{
+    int ret;
+    int zret;
+    z_stream strm;
+    rba_input_slot_t *slot;
+    unsigned char *inbuf;
+    ssize_t readin;
+    int input_eof = 0;
+    int stream_done = 0;
+
+    inbuf = (unsigned char*)malloc (RBA_INPUT_BUFSZ);
+    if (NULL == inbuf) {
+        RBA_ERR("Failed to allocate %u byte input buffer\n", (unsigned)RBA_INPUT_BUFSZ);
+        return -1;
+    }
+
+    memset (&strm, 0, sizeof(strm));
+    /*  15 window bits + 32 for automatic gzip/zlib header detection */
+    if (Z_OK != inflateInit2 (&strm, 15 + 32)) {
+        RBA_ERR("inflateInit2 failed for %s\n", in->name);
+        free (inbuf);
+        return -1;
+    }
+
+    ret = 0;
+    slot = ring_acquire_free (in);
+    while ((0 == ret) && (NULL != slot)) {
+
+        if ((0 == strm.avail_in) && !input_eof) {
+            readin = input_read_raw (in, inbuf, RBA_INPUT_BUFSZ);
+            if (readin < 0) {
+                ret = -1;
+                break;
+            }
+            input_eof = (0 == readin);
+            strm.next_in = inbuf;
+            strm.avail_in = (uInt)readin;
+        }
+
+        if ((0 == strm.avail_in) && input_eof) {
+            if (!stream_done) {
+                RBA_ERR("Truncated gzip stream in %s\n", in->name);
+                ret = -1;
+            }
+            break;
+        }
+
+        strm.next_out = (Bytef*)slot->data + slot->len;
+        strm.avail_out = (uInt)(RBA_INPUT_BUFSZ - slot->len);
+        zret = inflate (&strm, Z_NO_FLUSH);
+        slot->len = RBA_INPUT_BUFSZ - strm.avail_out;
+
+        if (Z_STREAM_END == zret) {
+            /*  concatenated gzip members continue after the end of a stream */
+            stream_done = 1;
+            if (Z_OK != inflateReset (&strm)) {
+                ret = -1;
+            }
+        } else if (Z_OK == zret) {
+            stream_done = 0;
+        } else if (Z_BUF_ERROR != zret) {
+            RBA_ERR("Failed to decompress %s: %s\n", in->name, (NULL != strm.msg) ? strm.msg : "inflate error");
+            ret = -1;
+        }
+
+        if ((0 == ret) && (slot->len == RBA_INPUT_BUFSZ)) {
+            ring_publish (in);
+            slot = ring_acquire_free (in);
+        }
+    }
+
+    if ((0 == ret) && (NULL != slot) && (slot->len > 0)) {
+        ring_publish (in);
+    }
+
+    inflateEnd (&strm);
+    free (inbuf);
+
+    return ret;
+}
+#endif
+
+#ifdef RBA_WITH_ZSTD
+static int
+reader_zstd (rba_input_t *in)
+{
+    int ret;
+    size_t zret;
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
+    rba_input_slot_t *slot;
+    void *inbuf;
+    ssize_t readin;
+    int input_eof = 0;
+    size_t inbufsz = ZSTD_DStreamInSize ();
+
+    inbuf = malloc (inbufsz);
+    dctx = ZSTD_createDCtx ();
+    if ((NULL == inbuf) || (NULL == dctx)) {
+        RBA_ERR("Failed to set up zstd decompression for %s\n", in->name);
+        free (inbuf);
+        ZSTD_freeDCtx (dctx);
+        return -1;
+    }
+
+    ret = 0;
+    zret = 0;
+    zin.src = inbuf;
+    zin.size = 0;
+    zin.pos = 0;
+    slot = ring_acquire_free (in);
+    while ((0 == ret) && (NULL != slot)) {
+
+        if ((zin.pos == zin.size) && !input_eof) {
+            readin = input_read_raw (in, inbuf, inbufsz);
+            if (readin < 0) {
+                ret = -1;
+                break;
+            }
+            input_eof = (0 == readin);
+            zin.size = (size_t)readin;
+            zin.pos = 0;
+        }
+
+        if ((zin.pos == zin.size) && input_eof) {
+            if (0 != zret) {
+                RBA_ERR("Truncated zstd stream in %s\n", in->name);
+                ret = -1;
+            }
+            break;
+        }
+
+        zout.dst = slot->data;
+        zout.size = RBA_INPUT_BUFSZ;
+        zout.pos = slot->len;
+        zret = ZSTD_decompressStream (dctx, &zout, &zin);
+        slot->len = zout.pos;
+        if (ZSTD_isError (zret)) {
+            RBA_ERR("Failed to decompress %s: %s\n", in->name, ZSTD_getErrorName (zret));
+            ret = -1;
+        } else if (slot->len == RBA_INPUT_BUFSZ) {
+            ring_publish (in);
+            slot = ring_acquire_free (in);
+        }
+    }
+
+    if ((0 == ret) && (NULL != slot) && (slot->len > 0)) {
+        ring_publish (in);
+    }
+
+    ZSTD_freeDCtx (dctx);
+    free (inbuf);
+
+    return ret;
+}
+#endif
+
+static void*
+input_reader (void *arg)
+{
+    rba_input_t *in = (rba_input_t*)arg;
+    int ret;
+
+    switch (in->codec) {
+#ifdef RBA_WITH_ZLIB
+        case rba_codec_gzip:
+            ret = reader_gzip (in);
+            break;
+#endif
+#ifdef RBA_WITH_ZSTD
+        case rba_codec_zstd:
+            ret = reader_zstd (in);
+            break;
+#endif
+        case rba_codec_plain:
+            ret = reader_plain (in);
+            break;
+        default:
+            ret = -1;
+            break;
+    }
+
+    ring_finish (in, (0 != ret));
+
+    return NULL;
+}
+
+/******************************************************************************/
+/*  public interface                                                          */
+/******************************************************************************/
+
+static rba_input_codec_t
+detect_codec (  const uint8_t   *magic,
+                size_t          len)
+{
+    if ((len >= 2) && (0x1F == magic[0]) && (0x8B == magic[1])) {
+        return rba_codec_gzip;
+    }
+    if ((len >= 4) && (0x28 == magic[0]) && (0xB5 == magic[1]) &&
+            (0x2F == magic[2]) && (0xFD == magic[3])) {
+        return rba_codec_zstd;
+    }
+    return rba_codec_plain;
+}
+
+int
+rba_input_seekable (const char *name)
+{
+    int fd;
+    ssize_t readin;
+    uint8_t magic[4];
+    int seekable;
+
+    if (0 == strcmp (name, "-")) {
+        return 0;
+    }
+
+    fd = open (name, O_RDONLY);
+    if (fd < 0) {
+        /*  let the caller report the failure when it opens the file */
+        return 1;
+    }
+    readin = read (fd, magic, sizeof(magic));
+    seekable = (readin < 0) || (rba_codec_plain == detect_codec (magic, (size_t)readin));
+    close (fd);
+
+    return seekable;
+}
+
+int
+rba_input_open (rba_input_t **in_p,
+                const char  *name)
+{
+    return rba_input_open_at (in_p, name, 0);
+}
+
+/*  Open name to read from offset bytes into the file on. Only plain files
+    can start anywhere but at the beginning. */
+int
+rba_input_open_at ( rba_input_t **in_p,
+                    const char  *name,
+                    uint64_t    offset)
+{
+    int ret;
+
+    rba_input_t *in;
+    ssize_t readin;
+    uint32_t s;
+
+    in = (rba_input_t*)calloc (1, sizeof(rba_input_t));
+    if (NULL == in) {
+        RBA_ERR("Failed to allocate input for %s\n", name);
+        return -1;
+    }
+
+    in->name = name;
+    if (0 == strcmp (name, "-")) {
+        in->name = "<stdin>";
+        in->fd = STDIN_FILENO;
+    } else {
+        in->fd = open (name, O_RDONLY);
+    }
+
+    if (in->fd < 0) {
+        RBA_ERR("Failed to open %s\n", name);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+
+        /*  sniff the codec from the first bytes and keep them for the reader */
+        do {
+            readin = read (in->fd, in->prefix + in->prefix_len, sizeof(in->prefix) - in->prefix_len);
+            if (readin > 0) {
+                in->prefix_len += (size_t)readin;
+            }
+        } while (((readin > 0) && (in->prefix_len < sizeof(in->prefix))) ||
+                    ((readin < 0) && (EINTR == errno)));
+
+        if (readin < 0) {
+            RBA_ERR("Failed to read from %s\n", in->name);
+            RBA_ERRNO();
+            ret = -1;
+        } else {
+
+            in->codec = detect_codec (in->prefix, in->prefix_len);
+            ret = 0;
+#ifndef RBA_WITH_ZLIB
+            if (rba_codec_gzip == in->codec) {
+                RBA_ERR("%s is gzip compressed, rebuild with -DRBA_WITH_ZLIB -lz\n", in->name);
+                ret = -1;
+            }
+#endif
+#ifndef RBA_WITH_ZSTD
+            if (rba_codec_zstd == in->codec) {
+                RBA_ERR("%s is zstd compressed, rebuild with -DRBA_WITH_ZSTD -lzstd\n", in->name);
+                ret = -1;
+            }
+#endif
+            if ((0 == ret) && (offset > 0)) {
+                if ((rba_codec_plain != in->codec) || (STDIN_FILENO == in->fd) ||
+                        ((off_t)offset != lseek (in->fd, (off_t)offset, SEEK_SET))) {
+                    RBA_ERR("Can not start reading %s at byte %llu\n", in->name, (unsigned long long)offset);
+                    ret = -1;
+                } else {
+                    in->prefix_len = 0;
+                }
+            }
+        }
+
+        for (s = 0; (s < RBA_INPUT_RINGLEN) && (0 == ret); s++) {
+            in->ring[s].data = (char*)malloc (RBA_INPUT_BUFSZ);
+            if (NULL == in->ring[s].data) {
+                RBA_ERR("Failed to allocate %u byte input buffer\n", (unsigned)RBA_INPUT_BUFSZ);
+                ret = -1;
+            }
+        }
+
+        if (0 == ret) {
+            pthread_mutex_init (&(in->lock), NULL);
+            pthread_cond_init (&(in->filled_cond), NULL);
+            pthread_cond_init (&(in->free_cond), NULL);
+            if (0 != pthread_create (&(in->reader), NULL, input_reader, in)) {
+                RBA_ERR("Failed to start reader thread for %s\n", in->name);
+                pthread_mutex_destroy (&(in->lock));
+                pthread_cond_destroy (&(in->filled_cond));
+                pthread_cond_destroy (&(in->free_cond));
+                ret = -1;
+            }
+        }
+
+        if (0 != ret) {
+            for (s = 0; s < RBA_INPUT_RINGLEN; s++) {
+                free (in->ring[s].data);
+            }
+            if (STDIN_FILENO != in->fd) {
+                close (in->fd);
+            }
+        }
+    }
+
+    if (0 != ret) {
+        free (in);
+    } else {
+        *in_p = in;
+    }
+
+    return ret;
+}
+
+/*  hand the slot at head back to the reader */
+static void
+input_release (rba_input_t *in)
+{
+    pthread_mutex_lock (&(in->lock));
+    in->head = (in->head + 1) % RBA_INPUT_RINGLEN;
+    in->filled--;
+    pthread_cond_signal (&(in->free_cond));
+    pthread_mutex_unlock (&(in->lock));
+    in->holding = 0;
+    in->pos = 0;
+}
+
+/*  wait for the slot at head, returns 0 at the end of the input */
+static int
+input_hold (rba_input_t *in)
+{
+    pthread_mutex_lock (&(in->lock));
+    while ((0 == in->filled) && !in->eof) {
+        pthread_cond_wait (&(in->filled_cond), &(in->lock));
+    }
+    in->holding = (in->filled > 0);
+    pthread_mutex_unlock (&(in->lock));
+
+    return in->holding;
+}
+
+static int
+line_reserve (  char    **line_p,
+                size_t  *bufsz_p,
+                size_t  needed)
+{
+    char *line;
+    size_t bufsz;
+
+    if (needed <= *bufsz_p) {
+        return 0;
+    }
+
+    bufsz = (*bufsz_p > 0) ? *bufsz_p : 256;
+    while (bufsz < needed) {
+        bufsz *= 2;
+    }
+    line = (char*)realloc (*line_p, bufsz);
+    if (NULL == line) {
+        RBA_ERR("Failed to grow line buffer to %u bytes\n", (unsigned)bufsz);
+        return -1;
+    }
+    *line_p = line;
+    *bufsz_p = bufsz;
+
+    return 0;
+}
+
+/*  Same contract as getline(): returns the length of the next line including
+    its newline, or -1 at the end of the input or on error, in which case
+    rba_input_error() tells the two apart. */
+ssize_t
+rba_input_getline ( rba_input_t *in,
+                    char        **line_p,
+                    size_t      *bufsz_p)
+{
+    rba_input_slot_t *slot;
+    const char *start, *newline;
+    size_t linelen, chunk;
+
+    linelen = 0;
+    for (;;) {
+        if (!in->holding && !input_hold (in)) {
+            break;
+        }
+
+        slot = &(in->ring[in->head]);
+        start = slot->data + in->pos;
+        newline = memchr (start, '\n', slot->len - in->pos);
+        chunk = (NULL != newline) ? (size_t)(newline - start) + 1 : slot->len - in->pos;
+
+        if (0 != line_reserve (line_p, bufsz_p, linelen + chunk + 1)) {
+            return -1;
+        }
+        memcpy (*line_p + linelen, start, chunk);
+        linelen += chunk;
+        in->pos += chunk;
+
+        if (in->pos == slot->len) {
+            input_release (in);
+        }
+        if (NULL != newline) {
+            break;
+        }
+    }
+
+    if (0 == linelen) {
+        return -1;
+    }
+
+    (*line_p)[linelen] = '\0';
+    return (ssize_t)linelen;
+}
+
+int
+rba_input_error (rba_input_t *in)
+{
+    int error;
+
+    pthread_mutex_lock (&(in->lock));
+    error = in->error;
+    pthread_mutex_unlock (&(in->lock));
+
+    return error;
+}
+
+int
+rba_input_close (rba_input_t *in)
+{
+    int ret;
+    uint32_t s;
+
+    /*  unblock the reader if the consumer stops before the end */
+    pthread_mutex_lock (&(in->lock));
+    in->closing = 1;
+    pthread_cond_signal (&(in->free_cond));
+    pthread_mutex_unlock (&(in->lock));
+
+    pthread_join (in->reader, NULL);
+
+    ret = in->error ? -1 : 0;
+
+    pthread_mutex_destroy (&(in->lock));
+    pthread_cond_destroy (&(in->filled_cond));
+    pthread_cond_destroy (&(in->free_cond));
+    for (s = 0; s < RBA_INPUT_RINGLEN; s++) {
+        free (in->ring[s].data);
+    }
+    if (STDIN_FILENO != in->fd) {
+        close (in->fd);
+    }
+    free (in);
+
+    return ret;
+}
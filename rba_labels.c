@@ -0,0 +1,409 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <rba.h>
+
+#define RBA_LABELS_WORDS (RBA_LABELS_BLOCK / 64)
+
+/*  the uint64_t words of a container of rows rows */
+static uint64_t
+container_words (uint64_t rows)
+{
+    return (rows > RBA_LABELS_ARRAYMAX) ? RBA_LABELS_WORDS : (rows + 3) / 4;
+}
+
+/*  write the index to <partpath>/labels.bin, with checksums if the column
+    it was built from has them */
+static int
+write_index (   const char                      *partpath,
+                uint32_t                        col,
+                const rba_labels_desc_t         *desc,
+                const rba_labels_class_t        *classes,
+                const rba_labels_container_t    *containers,
+                const uint64_t                  *payload,
+                uint64_t                        words)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+    char filename[strlen(partpath) + sizeof("/c00000000.bin" RBA_CRC_SUFFIX) + sizeof(RBA_LABELS_FILENAME)];
+
+    hdr.rba_header_magic = RBA_HEADER_MAGIC;
+    hdr.rba_type_magic = RBA_LABELS_MAGIC;
+    hdr.records = words;
+    hdr.data_offset = (uint32_t)(sizeof(rba_header_t) + sizeof(rba_labels_desc_t) +
+                                    desc->classes * sizeof(rba_labels_class_t) +
+                                    desc->containers * sizeof(rba_labels_container_t));
+    hdr.typesize = sizeof(uint64_t);
+    hdr.rba_header_version = RBA_HEADER_VERSION;
+
+    snprintf (filename, sizeof(filename), "%s/" RBA_LABELS_FILENAME, partpath);
+    filep = fopen (filename, "wb");
+    if (NULL == filep) {
+        RBA_ERR("Failed to create file %s\n", filename);
+        RBA_ERRNO();
+        return -1;
+    }
+    if ((1 != fwrite (&hdr, sizeof(hdr), 1, filep)) ||
+            (1 != fwrite (desc, sizeof(rba_labels_desc_t), 1, filep)) ||
+            (desc->classes != fwrite (classes, sizeof(rba_labels_class_t), desc->classes, filep)) ||
+            (desc->containers != fwrite (containers, sizeof(rba_labels_container_t), desc->containers, filep)) ||
+            (words != fwrite (payload, sizeof(uint64_t), words, filep))) {
+        RBA_ERR("Failed to write file %s\n", filename);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+    if (0 != fclose (filep)) {
+        ret = -1;
+    }
+
+    /*  checksum the index like the column, and drop a stale checksum file */
+    if (0 == ret) {
+        snprintf (filename, sizeof(filename), "%s/c%08X.bin" RBA_CRC_SUFFIX, partpath, col);
+        if (0 == access (filename, F_OK)) {
+            snprintf (filename, sizeof(filename), "%s/" RBA_LABELS_FILENAME, partpath);
+            ret = rba_crc_file (filename);
+        } else {
+            snprintf (filename, sizeof(filename), "%s/" RBA_LABELS_FILENAME RBA_CRC_SUFFIX, partpath);
+            unlink (filename);
+        }
+    }
+
+    return ret;
+}
+
+/*  Build the label index of a partition from its categorical column col,
+    which must hold one byte class ids. The column is read twice, once to
+    count the rows of every class in every block and once to fill the
+    containers. */
+int
+rba_labels_build (  rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *dirpath,
+                    uint32_t            partition,
+                    uint32_t            col)
+{
+    int ret;
+
+    rba_reader_t reader;
+    rba_view_t view;
+    rba_labels_desc_t desc;
+    rba_labels_class_t *classes = NULL;
+    rba_labels_container_t *containers = NULL;
+    uint64_t *payload = NULL, *slot = NULL;
+    uint32_t *counts = NULL;
+    uint64_t blocks, words, r, b, c, i;
+    uint32_t l, low;
+    const uint8_t *ids;
+    rba_type_t *type = spec[col].type;
+
+    if ((col >= cols) || (NULL == type->classify) ||
+            (sizeof(uint8_t) != type->size) || (type->classes > 256)) {
+        RBA_ERR("Column %u can not be indexed by class\n", (unsigned)col);
+        return -1;
+    }
+
+    ret = rba_open (&reader, spec, cols, dirpath, partition, RBA_ADVICE_SEQUENTIAL);
+    if (0 != ret) {
+        return ret;
+    }
+    ret = rba_column_view (&reader, col, &view);
+
+    memset (&desc, 0, sizeof(desc));
+    desc.rows = view.records;
+    desc.col = col;
+    desc.classes = type->classes;
+    blocks = (view.records + RBA_LABELS_BLOCK - 1) / RBA_LABELS_BLOCK;
+    ids = rba_view_as(&view, uint8_t);
+
+    if (0 == ret) {
+        counts = (uint32_t*)calloc (desc.classes * blocks + 1, sizeof(uint32_t));
+        classes = (rba_labels_class_t*)calloc (desc.classes, sizeof(rba_labels_class_t));
+        if ((NULL == counts) || (NULL == classes)) {
+            RBA_ERR("malloc failed for %llu blocks of %u classes\n", (unsigned long long)blocks, (unsigned)desc.classes);
+            ret = -1;
+        }
+    }
+
+    for (r = 0; (r < view.records) && (0 == ret); r++) {
+        if (ids[r] >= desc.classes) {
+            RBA_ERR("Row %llu of partition %u has class %u of %u\n", (unsigned long long)r,
+                    (unsigned)partition, (unsigned)ids[r], (unsigned)desc.classes);
+            ret = -1;
+        } else {
+            counts[ids[r] * blocks + r / RBA_LABELS_BLOCK]++;
+        }
+    }
+
+    /*  lay out the containers class by class */
+    for (l = 0, words = 0; (l < desc.classes) && (0 == ret); l++) {
+        classes[l].first = desc.containers;
+        for (b = 0; b < blocks; b++) {
+            if (counts[l * blocks + b] > 0) {
+                classes[l].rows += counts[l * blocks + b];
+                classes[l].containers++;
+                words += container_words (counts[l * blocks + b]);
+            }
+        }
+        desc.containers += classes[l].containers;
+    }
+
+    if (0 == ret) {
+        containers = (rba_labels_container_t*)calloc (desc.containers + 1, sizeof(rba_labels_container_t));
+        payload = (uint64_t*)calloc (words + 1, sizeof(uint64_t));
+        slot = (uint64_t*)malloc ((desc.classes * blocks + 1) * sizeof(uint64_t));
+        if ((NULL == containers) || (NULL == payload) || (NULL == slot)) {
+            RBA_ERR("malloc failed for %llu containers of %llu words\n",
+                    (unsigned long long)desc.containers, (unsigned long long)words);
+            ret = -1;
+        }
+    }
+
+    for (i = 0, c = 0, words = 0; (i < desc.classes * blocks) && (0 == ret); i++) {
+        if (counts[i] > 0) {
+            containers[c].block = i % blocks;
+            containers[c].offset = words;
+            containers[c].rows = counts[i];
+            words += container_words (counts[i]);
+            slot[i] = c++;
+            counts[i] = 0;
+        }
+    }
+
+    /*  counts now tracks the rows filled into each array container */
+    for (r = 0; (r < view.records) && (0 == ret); r++) {
+        i = ids[r] * blocks + r / RBA_LABELS_BLOCK;
+        c = slot[i];
+        low = (uint32_t)(r % RBA_LABELS_BLOCK);
+        if (containers[c].rows > RBA_LABELS_ARRAYMAX) {
+            payload[containers[c].offset + low / 64] |= UINT64_C(1) << (low % 64);
+        } else {
+            ((uint16_t*)(payload + containers[c].offset))[counts[i]++] = (uint16_t)low;
+        }
+    }
+
+    if (0 == ret) {
+        ret = write_index (reader.partpath, col, &desc, classes, containers, payload, words);
+    }
+
+    if (0 != rba_close (&reader)) {
+        ret = -1;
+    }
+    free (counts);
+    free (classes);
+    free (containers);
+    free (payload);
+    free (slot);
+
+    return ret;
+}
+
+/*  Open the label index of the partition of reader. The index must cover
+    all rows of the column it was built from, so an index left behind by
+    appending to the data set is refused. */
+int
+rba_labels_open (   rba_labels_t    *labels,
+                    rba_reader_t    *reader)
+{
+    int ret;
+
+    int fd;
+    rba_header_t hdr;
+    size_t len;
+    char filename[strlen(reader->partpath) + sizeof("/c00000000.bin") + sizeof(RBA_LABELS_FILENAME)];
+
+    memset (labels, 0, sizeof(rba_labels_t));
+    snprintf (filename, sizeof(filename), "%s/" RBA_LABELS_FILENAME, reader->partpath);
+    labels->fd = open (filename, O_RDONLY);
+    if (labels->fd < 0) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    if ((sizeof(rba_header_t) != pread (labels->fd, &(labels->hdr), sizeof(rba_header_t), 0)) ||
+            (RBA_HEADER_MAGIC != labels->hdr.rba_header_magic) ||
+            (RBA_LABELS_MAGIC != labels->hdr.rba_type_magic) ||
+            (sizeof(rba_labels_desc_t) != pread (labels->fd, &(labels->desc), sizeof(rba_labels_desc_t), sizeof(rba_header_t))) ||
+            (labels->hdr.data_offset != sizeof(rba_header_t) + sizeof(rba_labels_desc_t) +
+                                        labels->desc.classes * sizeof(rba_labels_class_t) +
+                                        labels->desc.containers * sizeof(rba_labels_container_t))) {
+        RBA_ERR("File %s is not a label index\n", filename);
+        ret = -1;
+    } else {
+        len = labels->desc.classes * sizeof(rba_labels_class_t) +
+                labels->desc.containers * sizeof(rba_labels_container_t);
+        labels->classes = (rba_labels_class_t*)malloc (len + 1);
+        labels->containers = (rba_labels_container_t*)(labels->classes + labels->desc.classes);
+        ret = ((NULL != labels->classes) &&
+                ((ssize_t)len == pread (labels->fd, labels->classes, len, sizeof(rba_header_t) + sizeof(rba_labels_desc_t)))) ? 0 : -1;
+        if (0 != ret) {
+            RBA_ERR("Failed to read the classes of %s\n", filename);
+        }
+    }
+
+    /*  the index is stale if the column has more or fewer rows */
+    if (0 == ret) {
+        snprintf (filename, sizeof(filename), "%s/c%08X.bin", reader->partpath, labels->desc.col);
+        fd = open (filename, O_RDONLY);
+        if ((fd < 0) || (sizeof(rba_header_t) != pread (fd, &hdr, sizeof(rba_header_t), 0)) ||
+                (hdr.records != labels->desc.rows)) {
+            RBA_ERR("Label index of %s does not match %s\n", reader->partpath, filename);
+            ret = -1;
+        }
+        if (fd >= 0) {
+            close (fd);
+        }
+    }
+
+    if (0 != ret) {
+        rba_labels_close (labels);
+    }
+
+    return ret;
+}
+
+/*  The sorted rows of the partition holding any of the n classes, in a
+    buffer for the caller to free, for rba_gather. The containers of a class
+    are read with one pread, and the containers of a block are merged in a
+    bitmap of the block. */
+int
+rba_labels_rows (   rba_labels_t    *labels,
+                    const uint32_t  *classes,
+                    uint32_t        n,
+                    uint64_t        **rows_p,
+                    uint64_t        *count_p)
+{
+    int ret = 0;
+
+    const rba_labels_class_t *cls;
+    const rba_labels_container_t *cont;
+    uint64_t **payloads, *next, *rows = NULL;
+    uint64_t bitmap[RBA_LABELS_WORDS];
+    uint64_t block, count, start, end, word;
+    uint32_t i, w, j;
+    const uint16_t *arr;
+
+    payloads = (uint64_t**)calloc (n + 1, sizeof(uint64_t*));
+    next = (uint64_t*)calloc (n + 1, sizeof(uint64_t));
+    if ((NULL == payloads) || (NULL == next)) {
+        ret = -1;
+    }
+
+    for (i = 0, count = 0; (i < n) && (0 == ret); i++) {
+        if (classes[i] >= labels->desc.classes) {
+            RBA_ERR("Class %u is not in the label index of %u classes\n", (unsigned)classes[i], (unsigned)labels->desc.classes);
+            ret = -1;
+            break;
+        }
+        cls = &(labels->classes[classes[i]]);
+        count += cls->rows;
+        if (0 == cls->containers) {
+            continue;
+        }
+        cont = &(labels->containers[cls->first + cls->containers - 1]);
+        start = labels->containers[cls->first].offset * sizeof(uint64_t);
+        end = (cont->offset + container_words (cont->rows)) * sizeof(uint64_t);
+        payloads[i] = (uint64_t*)malloc (end - start);
+        if ((NULL == payloads[i]) ||
+                ((ssize_t)(end - start) != pread (labels->fd, payloads[i], end - start, labels->hdr.data_offset + start))) {
+            RBA_ERR("Failed to read the rows of class %u\n", (unsigned)classes[i]);
+            ret = -1;
+        }
+    }
+
+    if (0 == ret) {
+        rows = (uint64_t*)malloc (count * sizeof(uint64_t) + 1);
+        ret = (NULL == rows) ? -1 : 0;
+    }
+
+    /*  walk the blocks in order, merging the containers of every class */
+    count = 0;
+    for (block = 0; (block * RBA_LABELS_BLOCK < labels->desc.rows) && (0 == ret); block++) {
+        memset (bitmap, 0, sizeof(bitmap));
+        for (i = 0; i < n; i++) {
+            cls = &(labels->classes[classes[i]]);
+            if ((next[i] == cls->containers) ||
+                    (labels->containers[cls->first + next[i]].block != block)) {
+                continue;
+            }
+            cont = &(labels->containers[cls->first + next[i]]);
+            start = labels->containers[cls->first].offset;
+            if (cont->rows > RBA_LABELS_ARRAYMAX) {
+                for (w = 0; w < RBA_LABELS_WORDS; w++) {
+                    bitmap[w] |= payloads[i][cont->offset - start + w];
+                }
+            } else {
+                arr = (const uint16_t*)(payloads[i] + cont->offset - start);
+                for (j = 0; j < cont->rows; j++) {
+                    bitmap[arr[j] / 64] |= UINT64_C(1) << (arr[j] % 64);
+                }
+            }
+            next[i]++;
+        }
+        for (w = 0; w < RBA_LABELS_WORDS; w++) {
+            for (word = bitmap[w]; 0 != word; word &= word - 1) {
+                rows[count++] = block * RBA_LABELS_BLOCK + w * 64 + (uint64_t)__builtin_ctzll (word);
+            }
+        }
+    }
+
+    if (0 == ret) {
+        *rows_p = rows;
+        *count_p = count;
+    } else {
+        free (rows);
+    }
+    for (i = 0; (NULL != payloads) && (i < n); i++) {
+        free (payloads[i]);
+    }
+    free (payloads);
+    free (next);
+
+    return ret;
+}
+
+void
+rba_labels_close (rba_labels_t *labels)
+{
+    if (labels->fd >= 0) {
+        close (labels->fd);
+    }
+    free (labels->classes);
+    memset (labels, 0, sizeof(rba_labels_t));
+    labels->fd = -1;
+}
@@ -0,0 +1,539 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if defined(__linux__)
+    #define _GNU_SOURCE
+    #define RBA_MERGE_HAVE_COPY_RANGE
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef RBA_MERGE_HAVE_COPY_RANGE
+    #include <linux/fs.h>
+    #include <sys/ioctl.h>
+#endif
+
+#include <rba.h>
+
+#define RBA_MERGE_BUFSZ (1 << 20)
+
+typedef struct {
+    const char          *name;
+    int                 fd;
+    rba_header_t        hdr;
+    uint64_t            dataend;
+    rba_chunk_index_t   *chunks;
+    uint64_t            chunk_count;
+    int                 trange;
+    rba_timerange_t     range;
+} rba_merge_src_t;
+
+/*  copy len bytes at src_off of srcfd to dst_off of dstfd, in the kernel
+    with copy_file_range where the file systems support it */
+static int
+copy_bytes (int         dstfd,
+            uint64_t    dst_off,
+            int         srcfd,
+            uint64_t    src_off,
+            uint64_t    len,
+            char        *buf)
+{
+    ssize_t readin;
+    size_t chunk;
+
+#ifdef RBA_MERGE_HAVE_COPY_RANGE
+    loff_t in, out;
+    ssize_t copied;
+
+    while (len > 0) {
+        in = (loff_t)src_off;
+        out = (loff_t)dst_off;
+        chunk = (len < (1 << 30)) ? (size_t)len : (1 << 30);
+        copied = copy_file_range (srcfd, &in, dstfd, &out, chunk, 0);
+        if (copied <= 0) {
+            break;
+        }
+        src_off += (uint64_t)copied;
+        dst_off += (uint64_t)copied;
+        len -= (uint64_t)copied;
+    }
+#endif
+
+    while (len > 0) {
+        chunk = (len < RBA_MERGE_BUFSZ) ? (size_t)len : RBA_MERGE_BUFSZ;
+        readin = pread (srcfd, buf, chunk, (off_t)src_off);
+        if ((readin <= 0) ||
+                (readin != pwrite (dstfd, buf, (size_t)readin, (off_t)dst_off))) {
+            RBA_ERRNO();
+            return -1;
+        }
+        src_off += (uint64_t)readin;
+        dst_off += (uint64_t)readin;
+        len -= (uint64_t)readin;
+    }
+
+    return 0;
+}
+
+/*  Copy len bytes at src_off of srcfd to dst_off of dstfd, which must end
+    at dst_off. When both offsets are at the same place in a block, the
+    whole blocks are cloned with FICLONERANGE, so on file systems with
+    reflinks (XFS, btrfs) they are shared instead of copied. */
+static int
+copy_range (int         dstfd,
+            uint64_t    dst_off,
+            int         srcfd,
+            uint64_t    src_off,
+            uint64_t    len,
+            char        *buf)
+{
+    int ret = 0;
+
+#ifdef RBA_MERGE_HAVE_COPY_RANGE
+    struct file_clone_range clone;
+    struct stat st;
+    uint64_t bs, head, body;
+
+    if ((0 == fstat (dstfd, &st)) && (st.st_blksize > 0)) {
+        bs = (uint64_t)st.st_blksize;
+        head = (bs - src_off % bs) % bs;
+        body = (len > head) ? (len - head) / bs * bs : 0;
+        if ((src_off % bs == dst_off % bs) && (body > 0)) {
+            ret = copy_bytes (dstfd, dst_off, srcfd, src_off, head, buf);
+            clone.src_fd = srcfd;
+            clone.src_offset = src_off + head;
+            clone.src_length = body;
+            clone.dest_offset = dst_off + head;
+            if ((0 == ret) && (0 == ioctl (dstfd, FICLONERANGE, &clone))) {
+                src_off += head + body;
+                dst_off += head + body;
+                len -= head + body;
+            } else if (0 == ret) {
+                src_off += head;
+                dst_off += head;
+                len -= head;
+            }
+        }
+    }
+#endif
+
+    if (0 == ret) {
+        ret = copy_bytes (dstfd, dst_off, srcfd, src_off, len, buf);
+    }
+
+    return ret;
+}
+
+/*  note whether the descriptor of src is the time range of a sorted column */
+static int
+merge_read_range (rba_merge_src_t *src)
+{
+    src->trange = 0;
+    if (sizeof(rba_header_t) + sizeof(rba_timerange_t) == src->hdr.data_offset) {
+        if (sizeof(rba_timerange_t) != pread (src->fd, &(src->range), sizeof(rba_timerange_t), sizeof(rba_header_t))) {
+            return -1;
+        }
+        src->trange = (RBA_TRANGE_MAGIC == src->range.magic);
+    }
+
+    return 0;
+}
+
+/*  files without a descriptor or with a time range can be merged with each
+    other, other descriptors must be the same in all files */
+static int
+merge_plain (const rba_merge_src_t *src)
+{
+    return src->trange || (sizeof(rba_header_t) == src->hdr.data_offset);
+}
+
+/*  Read and check the header of src against first, the first source. The
+    descriptor between header and data must match too, see merge_plain. */
+static int
+merge_open_src (rba_merge_src_t         *src,
+                const rba_merge_src_t   *first)
+{
+    int ret;
+
+    struct stat st;
+    uint8_t *desc, *firstdesc;
+    size_t desclen;
+
+    src->fd = open (src->name, O_RDONLY);
+    if ((src->fd < 0) || (0 != fstat (src->fd, &st))) {
+        RBA_ERR("Failed to open file %s\n", src->name);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    /*  columns that are not stored leave an empty file */
+    if (0 == st.st_size) {
+        memset (&(src->hdr), 0, sizeof(rba_header_t));
+        ret = ((NULL == first) || (0 == first->hdr.rba_header_magic)) ? 0 : -1;
+    } else if ((sizeof(rba_header_t) != pread (src->fd, &(src->hdr), sizeof(rba_header_t), 0)) ||
+                (RBA_HEADER_MAGIC != src->hdr.rba_header_magic) ||
+                ((RBA_HEADER_VERSION != src->hdr.rba_header_version) &&
+                    (RBA_HEADER_VERSION_PACKED != src->hdr.rba_header_version)) ||
+                (src->hdr.data_offset < sizeof(rba_header_t)) ||
+                (0 != merge_read_range (src))) {
+        RBA_ERR("File %s is not an RBA file\n", src->name);
+        return -1;
+    } else if ((NULL != first) &&
+                ((first->hdr.rba_header_magic != src->hdr.rba_header_magic) ||
+                    (first->hdr.rba_type_magic != src->hdr.rba_type_magic) ||
+                    (first->hdr.typesize != src->hdr.typesize) ||
+                    (first->hdr.rba_header_version != src->hdr.rba_header_version))) {
+        ret = -1;
+    } else if ((NULL != first) && !(merge_plain (src) && merge_plain (first)) &&
+                (first->hdr.data_offset != src->hdr.data_offset)) {
+        ret = -1;
+    } else if ((NULL != first) && !(merge_plain (src) && merge_plain (first))) {
+        desclen = src->hdr.data_offset - sizeof(rba_header_t);
+        desc = (uint8_t*)malloc (2 * desclen);
+        firstdesc = desc + desclen;
+        ret = ((NULL != desc) &&
+                ((ssize_t)desclen == pread (src->fd, desc, desclen, sizeof(rba_header_t))) &&
+                ((ssize_t)desclen == pread (first->fd, firstdesc, desclen, sizeof(rba_header_t))) &&
+                (0 == memcmp (desc, firstdesc, desclen))) ? 0 : -1;
+        free (desc);
+    } else {
+        ret = 0;
+    }
+
+    if (0 != ret) {
+        RBA_ERR("File %s has a different type or layout than %s\n", src->name, first->name);
+    } else if (0 == st.st_size) {
+        src->dataend = 0;
+    } else if (RBA_HEADER_VERSION_PACKED == src->hdr.rba_header_version) {
+        ret = rba_packed_load_index (   src->fd,
+                                        src->name,
+                                        &(src->hdr),
+                                        &(src->chunks),
+                                        &(src->chunk_count),
+                                        &(src->dataend));
+    } else {
+        src->dataend = src->hdr.data_offset + src->hdr.records * src->hdr.typesize;
+        if (src->dataend > (uint64_t)st.st_size) {
+            RBA_ERR("File %s is shorter than its header says\n", src->name);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*  the zone map of dst, the zone maps of the sources one after the other
+    when they all have one, rebuilt from dst when only some do */
+static int
+merge_zones (   const char  *dst,
+                const char  **srcs,
+                uint32_t    n)
+{
+    int ret = 0;
+
+    rba_zone_desc_t desc, srcdesc;
+    rba_zone_entry_t *zones = NULL, *entries, *grown;
+    uint64_t count = 0, srccount, records = 0, z;
+    uint32_t i, have = 0;
+
+    memset (&desc, 0, sizeof(desc));
+    for (i = 0; (i < n) && (0 <= ret); i++) {
+        ret = rba_zone_read (srcs[i], &srcdesc, &entries, &srccount);
+        if (0 != ret) {
+            continue;
+        }
+        desc = srcdesc;
+        have++;
+        grown = (rba_zone_entry_t*)realloc (zones, (count + srccount) * sizeof(rba_zone_entry_t) + 1);
+        if (NULL == grown) {
+            ret = -1;
+        } else {
+            zones = grown;
+            for (z = 0; z < srccount; z++) {
+                zones[count] = entries[z];
+                zones[count].first += records;
+                count++;
+            }
+            records += srcdesc.records;
+        }
+        free (entries);
+    }
+
+    if (ret < 0) {
+        ;
+    } else if (have == n) {
+        ret = rba_zone_write (dst, desc.kind, desc.typesize, zones, count);
+    } else if (have > 0) {
+        ret = rba_zone_file (dst, desc.kind);
+    } else {
+        ret = 0;
+    }
+    free (zones);
+
+    return ret;
+}
+
+/*  Concatenate the records of the n RBA files srcs into the new file dst.
+    The files must hold the same type with the same descriptor. The data of
+    every file is copied after the header and descriptor of the first, and
+    the chunk indexes of packed files are joined and rebased. Sorted
+    timestamp columns give dst the union of their time ranges if all of them
+    are sorted, and no time range otherwise; dst is not sorted. The data is
+    moved with copy_range, so on file systems with reflinks most of it is
+    shared with the sources. dst gets a checksum sidecar, and a zone map,
+    when any of the files has one. */
+int
+rba_merge_file (const char  *dst,
+                const char  **srcs,
+                uint32_t    n)
+{
+    int ret = 0;
+
+    rba_merge_src_t *src;
+    rba_header_t hdr;
+    rba_packed_trailer_t trailer;
+    rba_chunk_index_t *chunks = NULL;
+    uint64_t chunk_count = 0, pos, c;
+    uint32_t i;
+    int dstfd, crc = 0, plain, trange;
+    rba_timerange_t range;
+    char *buf, *crcname;
+
+    src = (rba_merge_src_t*)calloc (n, sizeof(rba_merge_src_t));
+    buf = (char*)malloc (RBA_MERGE_BUFSZ);
+    if ((NULL == src) || (NULL == buf) || (0 == n)) {
+        free (src);
+        free (buf);
+        return -1;
+    }
+
+    for (i = 0; (i < n) && (0 == ret); i++) {
+        src[i].name = srcs[i];
+        ret = merge_open_src (&(src[i]), (i > 0) ? &(src[0]) : NULL);
+        chunk_count += src[i].chunk_count;
+    }
+
+    dstfd = -1;
+    if (0 == ret) {
+        dstfd = open (dst, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (dstfd < 0) {
+            RBA_ERR("Failed to create file %s\n", dst);
+            RBA_ERRNO();
+            ret = -1;
+        }
+    }
+
+    if ((0 == ret) && (0 != src[0].hdr.rba_header_magic)) {
+
+        hdr = src[0].hdr;
+        hdr.records = 0;
+        range = src[0].range;
+        plain = 1;
+        trange = 1;
+        for (i = 0; i < n; i++) {
+            hdr.records += src[i].hdr.records;
+            plain &= merge_plain (&(src[i]));
+            trange &= src[i].trange;
+            range.min = (src[i].range.min < range.min) ? src[i].range.min : range.min;
+            range.max = (src[i].range.max > range.max) ? src[i].range.max : range.max;
+        }
+        if (plain) {
+            hdr.data_offset = sizeof(rba_header_t) + (trange ? sizeof(rba_timerange_t) : 0);
+        }
+
+        chunks = (rba_chunk_index_t*)malloc ((chunk_count > 0) ? chunk_count * sizeof(rba_chunk_index_t) : 1);
+        if (NULL == chunks) {
+            RBA_ERR("Failed to allocate chunk index of %llu entries\n", (unsigned long long)chunk_count);
+            ret = -1;
+        } else if ((sizeof(hdr) != pwrite (dstfd, &hdr, sizeof(hdr), 0)) ||
+                    (trange && (sizeof(range) != pwrite (dstfd, &range, sizeof(range), sizeof(hdr)))) ||
+                    (!plain && (0 != copy_range (dstfd, sizeof(hdr), src[0].fd, sizeof(hdr), hdr.data_offset - sizeof(hdr), buf)))) {
+            RBA_ERR("Failed to write the header of %s\n", dst);
+            ret = -1;
+        }
+
+        pos = hdr.data_offset;
+        hdr.records = 0;
+        chunk_count = 0;
+        for (i = 0; (i < n) && (0 == ret); i++) {
+            ret = copy_range (  dstfd,
+                                pos,
+                                src[i].fd,
+                                src[i].hdr.data_offset,
+                                src[i].dataend - src[i].hdr.data_offset,
+                                buf);
+            if (0 != ret) {
+                RBA_ERR("Failed to copy %s to %s\n", src[i].name, dst);
+                ret = -1;
+            }
+            for (c = 0; c < src[i].chunk_count; c++) {
+                chunks[chunk_count] = src[i].chunks[c];
+                chunks[chunk_count].offset += pos - src[i].hdr.data_offset;
+                chunks[chunk_count].first_record += hdr.records;
+                chunk_count++;
+            }
+            pos += src[i].dataend - src[i].hdr.data_offset;
+            hdr.records += src[i].hdr.records;
+        }
+
+        if ((0 == ret) && (RBA_HEADER_VERSION_PACKED == hdr.rba_header_version)) {
+            trailer.index_offset = pos;
+            trailer.chunks = chunk_count;
+            trailer.magic = RBA_PACKED_MAGIC;
+            if (((ssize_t)(chunk_count * sizeof(rba_chunk_index_t)) !=
+                        pwrite (dstfd, chunks, chunk_count * sizeof(rba_chunk_index_t), (off_t)pos)) ||
+                    (sizeof(trailer) != pwrite (dstfd, &trailer, sizeof(trailer), (off_t)(pos + chunk_count * sizeof(rba_chunk_index_t))))) {
+                RBA_ERR("failed to write chunk index of %llu entries\n", (unsigned long long)chunk_count);
+                ret = -1;
+            }
+        }
+    }
+
+    if ((dstfd >= 0) && (0 != close (dstfd))) {
+        RBA_ERRNO();
+        ret = -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        crcname = (char*)malloc (strlen (srcs[i]) + sizeof(RBA_CRC_SUFFIX));
+        if (NULL != crcname) {
+            sprintf (crcname, "%s" RBA_CRC_SUFFIX, srcs[i]);
+            crc |= (0 == access (crcname, F_OK));
+            free (crcname);
+        }
+        if (src[i].fd > 0) {
+            close (src[i].fd);
+        }
+        free (src[i].chunks);
+    }
+    if ((0 == ret) && crc && (0 != src[0].hdr.rba_header_magic)) {
+        ret = rba_crc_file (dst);
+    }
+    if ((0 == ret) && (0 != src[0].hdr.rba_header_magic)) {
+        ret = merge_zones (dst, srcs, n);
+    }
+
+    free (chunks);
+    free (src);
+    free (buf);
+
+    return ret;
+}
+
+/*  Merge the data sets in the n directories srcdirs, with partitions
+    partitions each, into dirpath. Every file in the partition directories
+    of the first data set is concatenated with the same file of the others,
+    in order. Label indexes are left out, they have to be built again for
+    the merged partitions. dirpath may exist but not its partition
+    directories. */
+int
+rba_merge_dataset ( const char  *dirpath,
+                    const char  **srcdirs,
+                    uint32_t    n,
+                    uint32_t    partitions)
+{
+    int ret;
+
+    DIR *dir;
+    struct dirent *entry;
+    const char **srcs;
+    char **names, *dst;
+    size_t len, namelen;
+    uint32_t i, p;
+    uint64_t files = 0;
+
+    for (i = 0, len = strlen (dirpath); i < n; i++) {
+        len = (strlen (srcdirs[i]) > len) ? strlen (srcdirs[i]) : len;
+    }
+    len += sizeof("/p00000000/") + NAME_MAX;
+
+    srcs = (const char**)calloc (n, sizeof(char*));
+    names = (char**)calloc (n, sizeof(char*));
+    dst = (char*)malloc (len);
+    ret = ((NULL == srcs) || (NULL == names) || (NULL == dst)) ? -1 : 0;
+    for (i = 0; (i < n) && (0 == ret); i++) {
+        names[i] = (char*)malloc (len);
+        srcs[i] = names[i];
+        ret = (NULL == names[i]) ? -1 : 0;
+    }
+
+    if ((0 == ret) && (0 != mkdir (dirpath, 0777)) && (EEXIST != errno)) {
+        RBA_ERR("Failed to create root RBA directory %s\n", dirpath);
+        RBA_ERRNO();
+        ret = -1;
+    }
+
+    for (p = 0; (p < partitions) && (0 == ret); p++) {
+        snprintf (dst, len, "%s/p%08X", dirpath, p);
+        snprintf (names[0], len, "%s/p%08X", srcdirs[0], p);
+        if (0 != mkdir (dst, 0777)) {
+            RBA_ERR("Failed to create RBA partition directory %s\n", dst);
+            RBA_ERRNO();
+            ret = -1;
+        } else if (NULL == (dir = opendir (names[0]))) {
+            RBA_ERR("Failed to open directory %s\n", names[0]);
+            RBA_ERRNO();
+            ret = -1;
+        } else {
+
+            while ((0 == ret) && (NULL != (entry = readdir (dir)))) {
+                namelen = strlen (entry->d_name);
+                if ((namelen < 4) || (0 != strcmp (entry->d_name + namelen - 4, ".bin")) ||
+                        (0 == strcmp (entry->d_name, RBA_LABELS_FILENAME))) {
+                    continue;
+                }
+                snprintf (dst, len, "%s/p%08X/%s", dirpath, p, entry->d_name);
+                for (i = 0; i < n; i++) {
+                    snprintf (names[i], len, "%s/p%08X/%s", srcdirs[i], p, entry->d_name);
+                }
+                ret = rba_merge_file (dst, srcs, n);
+                files++;
+            }
+            closedir (dir);
+        }
+    }
+
+    if (0 == ret) {
+        printf ("    Merged %llu files of %u data sets into %s\n", (unsigned long long)files, (unsigned)n, dirpath);
+    }
+
+    for (i = 0; (NULL != names) && (i < n); i++) {
+        free (names[i]);
+    }
+    free (names);
+    free (srcs);
+    free (dst);
+
+    return ret;
+}
@@ -0,0 +1,479 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <rba.h>
+
+#define PAX_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+typedef struct {
+    rba_pax_t           *pax;
+    uint32_t            p;
+    uint32_t            f;
+} rba_pax_hookctx_t;
+
+typedef struct {
+    rba_buf_t           buf;
+    uint8_t             *group;
+    size_t              grouplen;
+    uint32_t            filled;
+    uint32_t            records;
+} rba_pax_part_t;
+
+struct rba_pax_s {
+    rba_type_t          type;
+    rba_row_desc_t      *desc;
+    rba_row_field_t     *fields;
+    size_t              desclen;
+    rba_pax_part_t      *parts;
+    rba_pax_hookctx_t   *hookctxs;
+    uint32_t            partitions;
+};
+
+/*  offset of the column chunk of field f in a group of records rows */
+static size_t
+pax_chunk_offset (  const rba_row_field_t   *fields,
+                    uint32_t                nfields,
+                    uint32_t                f,
+                    uint64_t                records)
+{
+    size_t offset = PAX_ALIGN(nfields * sizeof(uint64_t));
+    uint32_t k;
+
+    for (k = 0; k < f; k++) {
+        offset += PAX_ALIGN(records * fields[k].size);
+    }
+
+    return offset;
+}
+
+/******************************************************************************/
+/*  writer                                                                    */
+/******************************************************************************/
+
+/*  Flush hook of the column buffers. Each column copies its flushed elements
+    into the partition's pending group, and the group is written once every
+    field has arrived. All columns of a partition flush the same number of
+    elements, at the same lines. */
+static int
+pax_hook (  void        *ctx,
+            const void  *arr,
+            size_t      count)
+{
+    int ret;
+
+    rba_pax_hookctx_t *hookctx = (rba_pax_hookctx_t*)ctx;
+    rba_pax_t *pax = hookctx->pax;
+    rba_pax_part_t *part = &(pax->parts[hookctx->p]);
+    rba_row_field_t *field = &(pax->fields[hookctx->f]);
+    uint64_t *dir = (uint64_t*)part->group;
+    uint32_t f, fields = pax->desc->fields;
+    size_t end;
+
+    if (0 == part->filled) {
+        part->records = (uint32_t)count;
+        for (f = 0; f < fields; f++) {
+            dir[f] = pax_chunk_offset (pax->fields, fields, f, count);
+        }
+    }
+
+    if (count != part->records) {
+        RBA_ERR("Column %u of partition %u flushed %lu records, expected %u\n",
+                (unsigned)field->column, (unsigned)hookctx->p, (unsigned long)count, (unsigned)part->records);
+        ret = -1;
+    } else {
+
+        memcpy (part->group + dir[hookctx->f], arr, count * field->size);
+        part->filled++;
+        ret = 0;
+
+        if (part->filled == fields) {
+            end = pax_chunk_offset (pax->fields, fields, fields, count);
+            ret = rba_buf_write_chunk ( &(part->buf),
+                                        part->records,
+                                        RBA_CODEC_PAX_GROUP,
+                                        part->group,
+                                        end);
+            part->filled = 0;
+        }
+    }
+
+    return ret;
+}
+
+/*  Open the PAX file of every partition and hook it into the flushes of the
+    column buffers, which must already be allocated. */
+int
+rba_pax_alloc ( rba_data_t  *data,
+                const char  *dirpath)
+{
+    int ret;
+
+    rba_pax_t *pax;
+    rba_pax_part_t *part;
+    rba_buf_t *colbuf;
+    char *filepath_buf;
+    size_t filepathlen;
+    uint32_t p, f;
+
+    filepathlen = strlen(dirpath) + sizeof("/p00000000/" RBA_PAX_FILENAME);
+    filepath_buf = (char*)malloc (filepathlen);
+    pax = (rba_pax_t*)calloc (1, sizeof(rba_pax_t));
+    if ((NULL == pax) || (NULL == filepath_buf)) {
+        RBA_ERR("malloc failed for PAX files\n");
+        free (pax);
+        ret = -1;
+    } else {
+
+        ret = rba_rows_layout (data->spec, data->cols, &(pax->desc), &(pax->desclen));
+        if (0 == ret) {
+            pax->fields = (rba_row_field_t*)(pax->desc + 1);
+            pax->partitions = data->partitions;
+            pax->type.specname = "pax";
+            pax->type.magic = RBA_PAX_MAGIC;
+            pax->type.size = pax->desc->rowsize;
+            pax->type.initbuf = rba_buf_alloc;
+            pax->type.freebuf = rba_buf_simple_free;
+            pax->type.parse = NULL;
+
+            pax->parts = (rba_pax_part_t*)calloc (data->partitions, sizeof(rba_pax_part_t));
+            pax->hookctxs = (rba_pax_hookctx_t*)calloc (data->partitions * pax->desc->fields, sizeof(rba_pax_hookctx_t));
+            if ((NULL == pax->parts) || (NULL == pax->hookctxs)) {
+                RBA_ERR("malloc failed for %u PAX partitions\n", (unsigned)data->partitions);
+                ret = -1;
+            }
+        }
+
+        for (p = 0; (p < data->partitions) && (0 == ret); p++) {
+            part = &(pax->parts[p]);
+            part->grouplen = pax_chunk_offset (pax->fields, pax->desc->fields, pax->desc->fields, RBA_BUF_DEFAULTLEN);
+            part->group = (uint8_t*)calloc (1, part->grouplen);
+            if (NULL == part->group) {
+                RBA_ERR("malloc failed for %lu byte row group\n", (unsigned long)part->grouplen);
+                ret = -1;
+            } else {
+
+                /*  groups are chunks of a packed file, -z does not pack them */
+                snprintf (filepath_buf, filepathlen, "%s/p%08X/" RBA_PAX_FILENAME, dirpath, p);
+                ret = rba_buf_alloc_desc (  &(pax->type),
+                                            filepath_buf,
+                                            data->flags | RBA_DATA_PACKED,
+                                            pax->desc,
+                                            pax->desclen,
+                                            &(part->buf));
+                if (0 != ret) {
+                    RBA_ERR("Failed to initialize PAX buffer for partition %u\n", (unsigned)p);
+                    ret = -1;
+                }
+            }
+
+            for (f = 0; (f < pax->desc->fields) && (0 == ret); f++) {
+                pax->hookctxs[p * pax->desc->fields + f].pax = pax;
+                pax->hookctxs[p * pax->desc->fields + f].p = p;
+                pax->hookctxs[p * pax->desc->fields + f].f = f;
+                colbuf = &(rba_data_getcolbufs(data, pax->fields[f].column)[p]);
+                colbuf->hook = pax_hook;
+                colbuf->hookctx = &(pax->hookctxs[p * pax->desc->fields + f]);
+            }
+        }
+
+        data->pax = pax;
+        if (0 != ret) {
+            rba_pax_free (data);
+        }
+    }
+
+    free (filepath_buf);
+
+    return ret;
+}
+
+int
+rba_pax_records (   rba_data_t  *data,
+                    uint32_t    p,
+                    uint64_t    *records_p)
+{
+    if ((NULL == data->pax) || (p >= data->partitions)) {
+        return -1;
+    }
+    *records_p = data->pax->parts[p].buf.total;
+    return 0;
+}
+
+/*  the PAX buffer of partition p, NULL without PAX files */
+rba_buf_t*
+rba_pax_getbuf (rba_data_t  *data,
+                uint32_t    p)
+{
+    if ((NULL == data->pax) || (p >= data->partitions)) {
+        return NULL;
+    }
+    return &(data->pax->parts[p].buf);
+}
+
+void
+rba_pax_set_stats ( rba_data_t  *data,
+                    rba_stats_t *stats)
+{
+    uint32_t p;
+
+    for (p = 0; (NULL != data->pax) && (p < data->pax->partitions); p++) {
+        data->pax->parts[p].buf.stats = stats;
+    }
+}
+
+/*  Close the PAX files. The column buffers must have been freed before, their
+    final flush writes the last, partial group. */
+int
+rba_pax_free (rba_data_t *data)
+{
+    int ret = 0;
+
+    rba_pax_t *pax = data->pax;
+    rba_buf_t *colbuf;
+    uint32_t p, f;
+
+    if (NULL != pax) {
+        for (p = 0; (NULL != pax->parts) && (p < pax->partitions); p++) {
+            for (f = 0; f < pax->desc->fields; f++) {
+                colbuf = &(rba_data_getcolbufs(data, pax->fields[f].column)[p]);
+                colbuf->hook = NULL;
+                colbuf->hookctx = NULL;
+            }
+            if (0 != pax->parts[p].filled) {
+                RBA_ERR("Row group of partition %u is incomplete\n", (unsigned)p);
+                ret = -1;
+            }
+            if ((0 != pax->parts[p].buf.len) &&
+                    (0 != pax->type.freebuf (&(pax->type), &(pax->parts[p].buf)))) {
+                ret = -1;
+            }
+            free (pax->parts[p].group);
+        }
+        free (pax->parts);
+        free (pax->hookctxs);
+        free (pax->desc);
+        free (pax);
+        data->pax = NULL;
+    }
+
+    return ret;
+}
+
+/******************************************************************************/
+/*  reader                                                                    */
+/******************************************************************************/
+
+int
+rba_pax_open (  rba_pax_file_t  *pf,
+                const char      *filename)
+{
+    int ret;
+
+    rba_row_desc_t desc;
+    size_t desclen;
+    uint64_t index_offset;
+
+    memset (pf, 0, sizeof(rba_pax_file_t));
+
+    pf->fd = open (filename, O_RDONLY);
+    if (pf->fd < 0) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else if ((sizeof(rba_header_t) != pread (pf->fd, &(pf->hdr), sizeof(rba_header_t), 0)) ||
+                (sizeof(desc) != pread (pf->fd, &desc, sizeof(desc), sizeof(rba_header_t)))) {
+        RBA_ERR("Failed to read header from file %s\n", filename);
+        ret = -1;
+    } else if ((RBA_HEADER_MAGIC != pf->hdr.rba_header_magic) ||
+                (RBA_HEADER_VERSION_PACKED != pf->hdr.rba_header_version) ||
+                (RBA_PAX_MAGIC != pf->hdr.rba_type_magic) ||
+                (desc.rowsize != pf->hdr.typesize) ||
+                (pf->hdr.data_offset != sizeof(rba_header_t) + sizeof(desc) + desc.fields * sizeof(rba_row_field_t))) {
+        RBA_ERR("File %s is not a PAX RBA file\n", filename);
+        ret = -1;
+    } else {
+
+        desclen = sizeof(desc) + desc.fields * sizeof(rba_row_field_t);
+        pf->desc = (rba_row_desc_t*)malloc (desclen);
+        pf->dir = (uint64_t*)malloc ((desc.fields + 1) * sizeof(uint64_t));
+        if ((NULL == pf->desc) || (NULL == pf->dir)) {
+            RBA_ERR("malloc failed for descriptor of %s\n", filename);
+            ret = -1;
+        } else if ((ssize_t)desclen != pread (pf->fd, pf->desc, desclen, sizeof(rba_header_t))) {
+            RBA_ERR("Failed to read descriptor from file %s\n", filename);
+            ret = -1;
+        } else {
+            pf->fields = (rba_row_field_t*)(pf->desc + 1);
+            ret = rba_packed_load_index (   pf->fd,
+                                            filename,
+                                            &(pf->hdr),
+                                            &(pf->groups),
+                                            &(pf->group_count),
+                                            &index_offset);
+        }
+    }
+
+    if (0 != ret) {
+        rba_pax_close (pf);
+    }
+
+    return ret;
+}
+
+/*  index of the row group holding row, the groups are sorted by first_record */
+static uint64_t
+find_group (rba_pax_file_t  *pf,
+            uint64_t        row)
+{
+    uint64_t lo = 0, hi = pf->group_count, mid;
+
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (pf->groups[mid].first_record <= row) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*  Read count rows starting at row first of the nfields fields listed in
+    fields into dst, which receives count values of each field one field
+    after the other. Each row group is fetched with a single read spanning
+    the requested part of its column chunks. */
+int
+rba_pax_read (  rba_pax_file_t  *pf,
+                uint64_t        first,
+                uint64_t        count,
+                const uint32_t  *fields,
+                uint32_t        nfields,
+                void            *dst)
+{
+    int ret = 0;
+
+    rba_chunk_index_t *group;
+    rba_row_field_t *field;
+    uint64_t g, lo, hi, done, spanlo, spanhi, start, end;
+    uint8_t *out;
+    size_t dirlen, dstoff;
+    uint32_t k;
+    void *scratch;
+
+    if ((first > pf->hdr.records) || (count > pf->hdr.records - first)) {
+        RBA_ERR("Rows %llu..%llu are out of range\n", (unsigned long long)first, (unsigned long long)(first + count));
+        return -1;
+    }
+    for (k = 0; k < nfields; k++) {
+        if (fields[k] >= pf->desc->fields) {
+            RBA_ERR("Field %u is out of range\n", (unsigned)fields[k]);
+            return -1;
+        }
+    }
+
+    dirlen = pf->desc->fields * sizeof(uint64_t);
+    done = 0;
+    for (g = find_group (pf, first); (0 == ret) && (done < count) && (g < pf->group_count); g++) {
+        group = &(pf->groups[g]);
+        lo = first + done - group->first_record;
+        hi = ((first + count) < (group->first_record + group->records)) ? (first + count - group->first_record) : group->records;
+
+        if ((ssize_t)dirlen != pread (pf->fd, pf->dir, dirlen, group->offset + sizeof(rba_chunk_header_t))) {
+            RBA_ERR("Failed to read directory of row group %llu\n", (unsigned long long)g);
+            ret = -1;
+            break;
+        }
+
+        spanlo = UINT64_MAX;
+        spanhi = 0;
+        for (k = 0; k < nfields; k++) {
+            field = &(pf->fields[fields[k]]);
+            start = pf->dir[fields[k]] + lo * field->size;
+            end = pf->dir[fields[k]] + hi * field->size;
+            if (pf->dir[fields[k]] + group->records * field->size > group->packed_size) {
+                RBA_ERR("Row group %llu is corrupt\n", (unsigned long long)g);
+                ret = -1;
+            }
+            spanlo = (start < spanlo) ? start : spanlo;
+            spanhi = (end > spanhi) ? end : spanhi;
+        }
+
+        if ((0 == ret) && (nfields > 0)) {
+            if (spanhi - spanlo > pf->scratchlen) {
+                scratch = realloc (pf->scratch, spanhi - spanlo);
+                if (NULL == scratch) {
+                    RBA_ERR("Failed to allocate %llu byte read buffer\n", (unsigned long long)(spanhi - spanlo));
+                    ret = -1;
+                    break;
+                }
+                pf->scratch = (uint8_t*)scratch;
+                pf->scratchlen = spanhi - spanlo;
+            }
+
+            if ((ssize_t)(spanhi - spanlo) != pread (pf->fd,
+                                                    pf->scratch,
+                                                    spanhi - spanlo,
+                                                    group->offset + sizeof(rba_chunk_header_t) + spanlo)) {
+                RBA_ERR("Failed to read row group %llu\n", (unsigned long long)g);
+                ret = -1;
+            } else {
+                for (k = 0, dstoff = 0; k < nfields; k++) {
+                    field = &(pf->fields[fields[k]]);
+                    out = (uint8_t*)dst + dstoff + done * field->size;
+                    memcpy (out, pf->scratch + pf->dir[fields[k]] + lo * field->size - spanlo, (hi - lo) * field->size);
+                    dstoff += count * field->size;
+                }
+            }
+        }
+
+        done += hi - lo;
+    }
+
+    return ret;
+}
+
+void
+rba_pax_close (rba_pax_file_t *pf)
+{
+    if (pf->fd >= 0) {
+        close (pf->fd);
+    }
+    free (pf->desc);
+    free (pf->groups);
+    free (pf->dir);
+    free (pf->scratch);
+    memset (pf, 0, sizeof(rba_pax_file_t));
+    pf->fd = -1;
+}
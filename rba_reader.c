@@ -0,0 +1,523 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <rba.h>
+
+static int
+madvice (int advice)
+{
+    switch (advice) {
+        case RBA_ADVICE_SEQUENTIAL:
+            return MADV_SEQUENTIAL;
+        case RBA_ADVICE_RANDOM:
+            return MADV_RANDOM;
+        case RBA_ADVICE_WILLNEED:
+            return MADV_WILLNEED;
+        case RBA_ADVICE_DONTNEED:
+            return MADV_DONTNEED;
+        default:
+            return MADV_NORMAL;
+    }
+}
+
+/*  Open the partition directory <dirpath>/p<partition> for reading. Column
+    files are only opened and mapped once rba_column_view asks for them. */
+int
+rba_open (  rba_reader_t        *reader,
+            rba_spec_entry_t    *spec,
+            uint32_t            cols,
+            const char          *dirpath,
+            uint32_t            partition,
+            int                 advice)
+{
+    int ret;
+
+    struct stat st;
+    size_t pathlen;
+    uint32_t c;
+
+    memset (reader, 0, sizeof(rba_reader_t));
+
+    pathlen = strlen (dirpath) + sizeof("/p00000000");
+    reader->partpath = (char*)malloc (pathlen);
+    reader->columns = (rba_column_t*)calloc (cols, sizeof(rba_column_t));
+    if ((NULL == reader->partpath) || (NULL == reader->columns)) {
+        RBA_ERR("malloc failed for reader of %u columns\n", cols);
+        ret = -1;
+    } else {
+
+        snprintf (reader->partpath, pathlen, "%s/p%08X", dirpath, partition);
+        if ((0 != stat (reader->partpath, &st)) || !S_ISDIR(st.st_mode)) {
+            RBA_ERR("Partition directory %s not found\n", reader->partpath);
+            ret = -1;
+        } else {
+            for (c = 0; c < cols; c++) {
+                reader->columns[c].fd = -1;
+            }
+            reader->spec = spec;
+            reader->cols = cols;
+            reader->partition = partition;
+            reader->advice = advice;
+            ret = 0;
+        }
+    }
+
+    if (0 != ret) {
+        free (reader->partpath);
+        free (reader->columns);
+        memset (reader, 0, sizeof(rba_reader_t));
+    }
+
+    return ret;
+}
+
+/*  decode a packed column file into a private buffer */
+static int
+column_decode ( rba_column_t    *column,
+                const char      *filename)
+{
+    int ret;
+
+    rba_packed_file_t pf;
+
+    ret = rba_packed_open (&pf, filename);
+    if (0 == ret) {
+        column->hdr = pf.hdr;
+        column->decoded = malloc (pf.hdr.records * pf.hdr.typesize + 1);
+        if (NULL == column->decoded) {
+            RBA_ERR("Failed to allocate %llu records for %s\n", (unsigned long long)pf.hdr.records, filename);
+            ret = -1;
+        } else if ((pf.hdr.records > 0) &&
+                    (0 != rba_packed_read (&pf, 0, pf.hdr.records, column->decoded))) {
+            RBA_ERR("Failed to decode %s\n", filename);
+            free (column->decoded);
+            column->decoded = NULL;
+            ret = -1;
+        }
+        rba_packed_close (&pf);
+    }
+
+    return ret;
+}
+
+/*  map the header and data region of an unpacked column file */
+static int
+column_map (rba_column_t    *column,
+            const char      *filename,
+            int             advice)
+{
+    int ret;
+
+    struct stat st;
+    uint64_t dataend;
+
+    dataend = column->hdr.data_offset + column->hdr.records * column->hdr.typesize;
+    if (0 != fstat (column->fd, &st)) {
+        RBA_ERRNO();
+        ret = -1;
+    } else if ((uint64_t)st.st_size < dataend) {
+        RBA_ERR("File %s is truncated, %llu of %llu bytes\n", filename,
+                (unsigned long long)st.st_size, (unsigned long long)dataend);
+        ret = -1;
+    } else {
+
+        /*  data_offset is not page aligned, so the header is mapped too */
+        column->maplen = (size_t)dataend;
+        column->map = mmap (NULL, column->maplen, PROT_READ, MAP_SHARED, column->fd, 0);
+        if (MAP_FAILED == column->map) {
+            RBA_ERR("Failed to map %s\n", filename);
+            RBA_ERRNO();
+            column->map = NULL;
+            ret = -1;
+        } else {
+            if ((RBA_ADVICE_NORMAL != advice) &&
+                    (0 != madvise (column->map, column->maplen, madvice (advice)))) {
+                RBA_ERRNO();
+            }
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+static int
+column_open (   rba_reader_t    *reader,
+                uint32_t        col)
+{
+    int ret;
+
+    rba_column_t *column = &(reader->columns[col]);
+    rba_type_t *type = reader->spec[col].type;
+    char filename[strlen(reader->partpath) + sizeof("/c00000000.bin")];
+
+    snprintf (filename, sizeof(filename), "%s/c%08X.bin", reader->partpath, col);
+
+    column->fd = open (filename, O_RDONLY);
+    if (column->fd < 0) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else if (sizeof(rba_header_t) != pread (column->fd, &(column->hdr), sizeof(rba_header_t), 0)) {
+        RBA_ERR("Failed to read header from file %s\n", filename);
+        ret = -1;
+    } else if (RBA_HEADER_MAGIC != column->hdr.rba_header_magic) {
+        RBA_ERR("File %s is not an RBA file\n", filename);
+        ret = -1;
+    } else if ((type->magic != column->hdr.rba_type_magic) ||
+                (type->size != column->hdr.typesize)) {
+        RBA_ERR("File %s does not contain %s data\n", filename, type->specname);
+        ret = -1;
+    } else if (RBA_HEADER_VERSION_PACKED == column->hdr.rba_header_version) {
+        ret = column_decode (column, filename);
+    } else if (RBA_HEADER_VERSION == column->hdr.rba_header_version) {
+        ret = column_map (column, filename, reader->advice);
+    } else {
+        RBA_ERR("File %s has unknown version %u\n", filename, (unsigned)column->hdr.rba_header_version);
+        ret = -1;
+    }
+
+    /*  mapped columns keep their descriptor for rba_gather */
+    if ((column->fd >= 0) && ((0 != ret) || (NULL != column->decoded))) {
+        close (column->fd);
+        column->fd = -1;
+    }
+    column->opened = (0 == ret);
+
+    return ret;
+}
+
+int
+rba_column_view (   rba_reader_t    *reader,
+                    uint32_t        col,
+                    rba_view_t      *view)
+{
+    int ret;
+
+    rba_column_t *column;
+
+    if ((col >= reader->cols) || (0 == reader->spec[col].type->size)) {
+        RBA_ERR("Column %u is not stored\n", col);
+        ret = -1;
+    } else {
+
+        column = &(reader->columns[col]);
+        ret = column->opened ? 0 : column_open (reader, col);
+        if (0 == ret) {
+            view->data = (NULL != column->decoded) ? column->decoded
+                            : ((const uint8_t*)column->map + column->hdr.data_offset);
+            view->records = column->hdr.records;
+            view->typesize = column->hdr.typesize;
+            view->type = reader->spec[col].type;
+        }
+    }
+
+    return ret;
+}
+
+/*  change the paging hint of one column, or of all open columns if col is
+    reader->cols or larger. The hint also applies to columns opened later. */
+int
+rba_column_advise ( rba_reader_t    *reader,
+                    uint32_t        col,
+                    int             advice)
+{
+    int ret = 0;
+
+    uint32_t c, first, last;
+
+    if (col < reader->cols) {
+        first = col;
+        last = col + 1;
+    } else {
+        first = 0;
+        last = reader->cols;
+        reader->advice = advice;
+    }
+
+    for (c = first; c < last; c++) {
+        if ((NULL != reader->columns[c].map) &&
+                (0 != madvise (reader->columns[c].map, reader->columns[c].maplen, madvice (advice)))) {
+            RBA_ERRNO();
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int
+rba_close (rba_reader_t *reader)
+{
+    int ret = 0;
+
+    uint32_t c;
+
+    for (c = 0; c < reader->cols; c++) {
+        if ((NULL != reader->columns[c].map) &&
+                (0 != munmap (reader->columns[c].map, reader->columns[c].maplen))) {
+            RBA_ERRNO();
+            ret = -1;
+        }
+        if (reader->columns[c].fd >= 0) {
+            close (reader->columns[c].fd);
+        }
+        free (reader->columns[c].decoded);
+    }
+
+    free (reader->columns);
+    free (reader->partpath);
+    memset (reader, 0, sizeof(rba_reader_t));
+
+    return ret;
+}
+
+/******************************************************************************/
+/*  batch gather                                                              */
+/******************************************************************************/
+
+/*  destination of the record for batch row i of column k */
+static inline uint8_t*
+gather_slot (rba_gather_t   *gather,
+             uint8_t        *dst,
+             uint32_t       k,
+             size_t         i)
+{
+    if (RBA_GATHER_ROWMAJOR == gather->layout) {
+        return dst + i * gather->rowsize + gather->offsets[k];
+    } else {
+        return dst + gather->count * gather->offsets[k] + i * gather->typesizes[k];
+    }
+}
+
+/*  Copy the records from the mapping of a column. The mapping is touched a
+    few rows ahead so that page faults and cache misses overlap. */
+static void
+gather_mapped ( rba_gather_t    *gather,
+                uint32_t        k,
+                const uint8_t   *data,
+                const uint64_t  *indices,
+                uint8_t         *dst)
+{
+    size_t i;
+    size_t sz = gather->typesizes[k];
+
+    for (i = 0; i < gather->count; i++) {
+        if (i + RBA_GATHER_PREFETCH < gather->count) {
+            __builtin_prefetch (data + indices[i + RBA_GATHER_PREFETCH] * sz);
+        }
+        memcpy (gather_slot (gather, dst, k, i), data + indices[i] * sz, sz);
+    }
+}
+
+/*  Read the records with preadv. Indices closer than RBA_GATHER_MAXGAP bytes
+    are coalesced into one read whose iovecs scatter the wanted records
+    straight into the batch and the bytes between them into a sink buffer. */
+static int
+gather_preadv ( rba_gather_t    *gather,
+                uint32_t        k,
+                int             fd,
+                off_t           data_offset,
+                const uint64_t  *indices,
+                uint8_t         *dst)
+{
+    int ret = 0;
+
+    struct iovec *iov = gather->iov;
+    size_t sz = gather->typesizes[k];
+    size_t i, first, nvec;
+    uint64_t next, gap;
+    ssize_t want, readin;
+
+    i = 0;
+    while ((0 == ret) && (i < gather->count)) {
+
+        first = i;
+        nvec = 0;
+        want = 0;
+        next = indices[i];
+        while ((i < gather->count) && (nvec + 2 <= RBA_GATHER_MAXIOV)) {
+            if ((i > first) && (indices[i] < next)) {
+                /*  repeated index, copied once the range is read */
+                i++;
+                continue;
+            }
+            gap = (indices[i] - next) * sz;
+            if (gap > RBA_GATHER_MAXGAP) {
+                break;
+            }
+            if (gap > 0) {
+                iov[nvec].iov_base = gather->sink;
+                iov[nvec].iov_len = gap;
+                nvec++;
+            }
+            iov[nvec].iov_base = gather_slot (gather, dst, k, i);
+            iov[nvec].iov_len = sz;
+            nvec++;
+            want += gap + sz;
+            next = indices[i] + 1;
+            i++;
+        }
+
+        readin = preadv (fd, iov, (int)nvec, data_offset + (off_t)(indices[first] * sz));
+        if (readin != want) {
+            RBA_ERR("Short read of %lli bytes for column %u\n", (long long)want, (unsigned)gather->cols[k]);
+            if (readin < 0) {
+                RBA_ERRNO();
+            }
+            ret = -1;
+        }
+        for (; (0 == ret) && (first + 1 < i); first++) {
+            if (indices[first + 1] == indices[first]) {
+                memcpy (gather_slot (gather, dst, k, first + 1), gather_slot (gather, dst, k, first), sz);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/*  Prepare gathering count rows of the ncols columns in cols from reader into
+    batches laid out as layout. method is RBA_GATHER_MMAP or RBA_GATHER_PREADV,
+    packed columns are always copied from their decoded buffer. */
+int
+rba_gather_init (   rba_gather_t    *gather,
+                    rba_reader_t    *reader,
+                    const uint32_t  *cols,
+                    uint32_t        ncols,
+                    size_t          count,
+                    int             layout,
+                    int             method)
+{
+    int ret;
+
+    rba_view_t view;
+    uint32_t k;
+
+    memset (gather, 0, sizeof(rba_gather_t));
+
+    gather->cols = (uint32_t*)malloc (ncols * sizeof(uint32_t));
+    gather->typesizes = (size_t*)malloc (ncols * sizeof(size_t));
+    gather->offsets = (size_t*)malloc (ncols * sizeof(size_t));
+    gather->iov = (struct iovec*)malloc (RBA_GATHER_MAXIOV * sizeof(struct iovec));
+    gather->sink = malloc (RBA_GATHER_MAXGAP);
+    if ((NULL == gather->cols) || (NULL == gather->typesizes) || (NULL == gather->offsets) ||
+            (NULL == gather->iov) || (NULL == gather->sink)) {
+        RBA_ERR("malloc failed for gather of %u columns\n", ncols);
+        ret = -1;
+    } else {
+
+        memcpy (gather->cols, cols, ncols * sizeof(uint32_t));
+        gather->reader = reader;
+        gather->ncols = ncols;
+        gather->count = count;
+        gather->layout = layout;
+        gather->method = method;
+        gather->records = UINT64_MAX;
+
+        for (k = 0, ret = 0; (k < ncols) && (0 == ret); k++) {
+            ret = rba_column_view (reader, cols[k], &view);
+            if (0 == ret) {
+                gather->typesizes[k] = view.typesize;
+                gather->offsets[k] = gather->rowsize;
+                gather->rowsize += view.typesize;
+                gather->records = (view.records < gather->records) ? view.records : gather->records;
+            }
+        }
+    }
+
+    if (0 != ret) {
+        rba_gather_free (gather);
+    }
+
+    return ret;
+}
+
+/*  Fill dst with the rows at the count sorted indices. Row-major batches hold
+    rowsize bytes per row with the columns in the order given to
+    rba_gather_init, column-major batches hold count records of each column
+    one after the other. */
+int
+rba_gather (rba_gather_t    *gather,
+            const uint64_t  *indices,
+            void            *dst)
+{
+    int ret = 0;
+
+    rba_column_t *column;
+    rba_view_t view;
+    uint32_t k;
+    size_t i;
+
+    for (i = 0; (0 == ret) && (i < gather->count); i++) {
+        if ((indices[i] >= gather->records) || ((i > 0) && (indices[i] < indices[i - 1]))) {
+            RBA_ERR("Gather index %llu at %llu is out of range or not sorted\n",
+                    (unsigned long long)indices[i], (unsigned long long)i);
+            ret = -1;
+        }
+    }
+
+    for (k = 0; (0 == ret) && (k < gather->ncols); k++) {
+        column = &(gather->reader->columns[gather->cols[k]]);
+        if ((RBA_GATHER_PREADV == gather->method) && (column->fd >= 0)) {
+            ret = gather_preadv (   gather,
+                                    k,
+                                    column->fd,
+                                    (off_t)column->hdr.data_offset,
+                                    indices,
+                                    (uint8_t*)dst);
+        } else {
+            ret = rba_column_view (gather->reader, gather->cols[k], &view);
+            if (0 == ret) {
+                gather_mapped (gather, k, (const uint8_t*)view.data, indices, (uint8_t*)dst);
+            }
+        }
+    }
+
+    return ret;
+}
+
+void
+rba_gather_free (rba_gather_t *gather)
+{
+    free (gather->cols);
+    free (gather->typesizes);
+    free (gather->offsets);
+    free (gather->iov);
+    free (gather->sink);
+    memset (gather, 0, sizeof(rba_gather_t));
+}
@@ -0,0 +1,263 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <rba.h>
+
+struct rba_rows_s {
+    rba_type_t          type;
+    rba_row_desc_t      *desc;
+    rba_row_field_t     *fields;
+    size_t              desclen;
+    rba_buf_t           *bufs;
+};
+
+/*  Lay out the stored columns of the spec as the fields of a row. The
+    descriptor is allocated, its fields follow it. */
+int
+rba_rows_layout (   rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    rba_row_desc_t      **desc_p,
+                    size_t              *desclen_p)
+{
+    int ret;
+
+    rba_row_desc_t *desc;
+    rba_row_field_t *field;
+    uint32_t c, fields;
+    size_t size, offset, align, desclen;
+
+    for (c = 0, fields = 0; c < cols; c++) {
+        fields += (spec[c].type->size > 0) ? 1 : 0;
+    }
+
+    desclen = sizeof(rba_row_desc_t) + fields * sizeof(rba_row_field_t);
+    desc = (rba_row_desc_t*)calloc (1, desclen);
+    if (NULL == desc) {
+        RBA_ERR("malloc failed for row descriptor of %u fields\n", (unsigned)fields);
+        ret = -1;
+    } else {
+
+        field = (rba_row_field_t*)(desc + 1);
+        offset = 0;
+        align = 1;
+        for (c = 0; c < cols; c++) {
+            size = spec[c].type->size;
+            if (size > 0) {
+                offset = (offset + size - 1) / size * size;
+                strncpy (field->name, spec[c].name, RBA_ROW_NAMELEN - 1);
+                field->type_magic = spec[c].type->magic;
+                field->column = c;
+                field->offset = (uint32_t)offset;
+                field->size = (uint32_t)size;
+                offset += size;
+                align = (size > align) ? size : align;
+                field++;
+            }
+        }
+        offset = (offset + align - 1) / align * align;
+
+        if ((0 == fields) || (offset > UINT16_MAX)) {
+            RBA_ERR("Rows of %lu bytes can not be stored in a row file\n", (unsigned long)offset);
+            free (desc);
+            ret = -1;
+        } else {
+            desc->fields = fields;
+            desc->rowsize = (uint32_t)offset;
+            *desc_p = desc;
+            *desclen_p = desclen;
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+/*  Open the row file of every partition. Must be called after the column
+    buffers are allocated, rows are assembled from their last elements. */
+int
+rba_rows_alloc (rba_data_t  *data,
+                const char  *dirpath)
+{
+    int ret;
+
+    rba_rows_t *rows;
+    char *filepath_buf;
+    size_t filepathlen;
+    uint32_t p;
+
+    filepathlen = strlen(dirpath) + sizeof("/p00000000/" RBA_ROWS_FILENAME);
+    filepath_buf = (char*)malloc (filepathlen);
+    rows = (rba_rows_t*)calloc (1, sizeof(rba_rows_t));
+    if ((NULL == rows) || (NULL == filepath_buf)) {
+        RBA_ERR("malloc failed for row files\n");
+        free (rows);
+        ret = -1;
+    } else {
+
+        ret = rba_rows_layout (data->spec, data->cols, &(rows->desc), &(rows->desclen));
+        if (0 == ret) {
+            rows->fields = (rba_row_field_t*)(rows->desc + 1);
+            rows->type.specname = "row";
+            rows->type.magic = RBA_ROWS_MAGIC;
+            rows->type.size = rows->desc->rowsize;
+            rows->type.initbuf = rba_buf_alloc;
+            rows->type.freebuf = rba_buf_simple_free;
+            rows->type.parse = NULL;
+
+            rows->bufs = (rba_buf_t*)calloc (data->partitions, sizeof(rba_buf_t));
+            if (NULL == rows->bufs) {
+                RBA_ERR("malloc failed for %u row buffers\n", (unsigned)data->partitions);
+                ret = -1;
+            }
+        }
+
+        for (p = 0; (p < data->partitions) && (0 == ret); p++) {
+            snprintf (filepath_buf, filepathlen, "%s/p%08X/" RBA_ROWS_FILENAME, dirpath, p);
+            ret = rba_buf_alloc_desc (  &(rows->type),
+                                        filepath_buf,
+                                        data->flags,
+                                        rows->desc,
+                                        rows->desclen,
+                                        &(rows->bufs[p]));
+            if (0 != ret) {
+                RBA_ERR("Failed to initialize row buffer for partition %u\n", (unsigned)p);
+                ret = -1;
+            }
+        }
+
+        data->rows = rows;
+        if (0 != ret) {
+            rba_rows_free (data);
+        }
+    }
+
+    free (filepath_buf);
+
+    return ret;
+}
+
+int
+rba_rows_records (  rba_data_t  *data,
+                    uint32_t    p,
+                    uint64_t    *records_p)
+{
+    if ((NULL == data->rows) || (p >= data->partitions)) {
+        return -1;
+    }
+    *records_p = data->rows->bufs[p].total;
+    return 0;
+}
+
+/*  Append the line just parsed to the row buffers of the partitions it was
+    sent to. Every column buffer of a partition receives the same number of
+    elements, so the newest one is at idx - 1, or at len - 1 right after the
+    buffers were flushed. */
+int
+rba_rows_store (rba_data_t *data)
+{
+    int ret = 0;
+
+    rba_rows_t *rows = data->rows;
+    rba_row_field_t *field;
+    rba_buf_t *colbuf, *rowbuf;
+    uint8_t *row;
+    size_t last;
+    uint32_t r, p, f;
+
+    for (r = 0; (r < data->repetitions) && (0 == ret); r++) {
+        p = data->partidxbuf[r];
+        rowbuf = &(rows->bufs[p]);
+        row = (uint8_t*)(rowbuf->arr) + rowbuf->idx * rowbuf->elm_sz;
+
+        for (f = 0; f < rows->desc->fields; f++) {
+            field = &(rows->fields[f]);
+            colbuf = &(rba_data_getcolbufs(data, field->column)[p]);
+            last = (colbuf->idx > 0) ? (colbuf->idx - 1) : (colbuf->len - 1);
+            memcpy (row + field->offset, (uint8_t*)(colbuf->arr) + last * field->size, field->size);
+        }
+
+        rowbuf->idx++;
+        if (rowbuf->idx == rowbuf->len) {
+            ret = rba_buf_simple_flush (rowbuf);
+            if (0 != ret) {
+                RBA_ERR("rba_buf_simple_flush failed for rows of partition %u\n", (unsigned)p);
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/*  the row buffer of partition p, NULL without row files */
+rba_buf_t*
+rba_rows_getbuf (   rba_data_t  *data,
+                    uint32_t    p)
+{
+    if ((NULL == data->rows) || (p >= data->partitions)) {
+        return NULL;
+    }
+    return &(data->rows->bufs[p]);
+}
+
+void
+rba_rows_set_stats (rba_data_t  *data,
+                    rba_stats_t *stats)
+{
+    uint32_t p;
+
+    for (p = 0; (NULL != data->rows) && (p < data->partitions); p++) {
+        data->rows->bufs[p].stats = stats;
+    }
+}
+
+int
+rba_rows_free (rba_data_t *data)
+{
+    int ret = 0;
+
+    rba_rows_t *rows = data->rows;
+    uint32_t p;
+
+    if (NULL != rows) {
+        for (p = 0; (NULL != rows->bufs) && (p < data->partitions); p++) {
+            if ((0 != rows->bufs[p].len) &&
+                    (0 != rows->type.freebuf (&(rows->type), &(rows->bufs[p])))) {
+                ret = -1;
+            }
+        }
+        free (rows->bufs);
+        free (rows->desc);
+        free (rows);
+        data->rows = NULL;
+    }
+
+    return ret;
+}
@@ -0,0 +1,369 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <rba.h>
+
+#define SORT_KEY(ts) ((uint64_t)(ts) ^ ((uint64_t)1 << 63))
+
+/*  Stable LSD radix sort of the record indices by timestamp, one byte per
+    pass. Passes in which all timestamps share the byte are skipped, which
+    leaves only a few passes for timestamps close together. */
+static int
+radix_order (   const int64_t   *ts,
+                uint64_t        n,
+                uint32_t        **perm_p)
+{
+    int ret;
+
+    uint32_t *perm, *tmp, *swap;
+    uint64_t count[256], offset, i;
+    uint32_t shift, d;
+
+    perm = (uint32_t*)malloc (n * sizeof(uint32_t));
+    tmp = (uint32_t*)malloc (n * sizeof(uint32_t));
+    if ((NULL == perm) || (NULL == tmp)) {
+        RBA_ERR("malloc failed for %llu record indices\n", (unsigned long long)n);
+        free (perm);
+        ret = -1;
+    } else {
+        for (i = 0; i < n; i++) {
+            perm[i] = (uint32_t)i;
+        }
+
+        for (shift = 0; shift < 64; shift += 8) {
+            memset (count, 0, sizeof(count));
+            for (i = 0; i < n; i++) {
+                count[(SORT_KEY(ts[i]) >> shift) & 0xFF]++;
+            }
+            if (count[(SORT_KEY(ts[0]) >> shift) & 0xFF] == n) {
+                continue;
+            }
+            for (d = 0, offset = 0; d < 256; d++) {
+                offset += count[d];
+                count[d] = offset - count[d];
+            }
+            for (i = 0; i < n; i++) {
+                d = (uint32_t)((SORT_KEY(ts[perm[i]]) >> shift) & 0xFF);
+                tmp[count[d]++] = perm[i];
+            }
+            swap = perm;
+            perm = tmp;
+            tmp = swap;
+        }
+
+        *perm_p = perm;
+        ret = 0;
+    }
+
+    free (tmp);
+
+    return ret;
+}
+
+static int
+read_header (   FILE            *filep,
+                const char      *filename,
+                rba_header_t    *hdr)
+{
+    int ret;
+
+    if ((0 != fseeko (filep, 0, SEEK_SET)) ||
+            (1 != fread (hdr, sizeof(rba_header_t), 1, filep))) {
+        RBA_ERR("Failed to read header from file %s\n", filename);
+        ret = -1;
+    } else if ((RBA_HEADER_MAGIC != hdr->rba_header_magic) ||
+                (RBA_HEADER_VERSION != hdr->rba_header_version)) {
+        RBA_ERR("File %s is not an unpacked RBA file\n", filename);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  Read the records of an unpacked RBA file into a new buffer */
+static int
+read_data ( FILE                *filep,
+            const char          *filename,
+            const rba_header_t  *hdr,
+            void                **data_p)
+{
+    int ret;
+
+    size_t size = (size_t)(hdr->records * hdr->typesize);
+
+    *data_p = malloc ((size > 0) ? size : 1);
+    if (NULL == *data_p) {
+        RBA_ERR("malloc failed for %lu bytes of %s\n", (unsigned long)size, filename);
+        ret = -1;
+    } else if ((0 != fseeko (filep, hdr->data_offset, SEEK_SET)) ||
+                ((size > 0) && (1 != fread (*data_p, size, 1, filep)))) {
+        RBA_ERR("Failed to read %lu bytes of data from file %s\n", (unsigned long)size, filename);
+        free (*data_p);
+        *data_p = NULL;
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  Rewrite the records of filename in the order perm. With range, the file
+    is rewritten from the start with the time range descriptor after the
+    header. */
+static int
+permute_file (  const char              *filename,
+                const uint32_t          *perm,
+                uint64_t                n,
+                const rba_timerange_t   *range)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+    uint8_t *src, *dst;
+    uint64_t i;
+    size_t sz;
+    char *crcname;
+
+    filep = fopen (filename, "r+b");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    src = NULL;
+    dst = NULL;
+    ret = read_header (filep, filename, &hdr);
+    if ((0 == ret) && (hdr.records != n)) {
+        RBA_ERR("File %s holds %llu records, expected %llu\n", filename, (unsigned long long)hdr.records, (unsigned long long)n);
+        ret = -1;
+    }
+    if (0 == ret) {
+        ret = read_data (filep, filename, &hdr, (void**)&src);
+    }
+    if (0 == ret) {
+        sz = hdr.typesize;
+        dst = (uint8_t*)malloc ((n * sz > 0) ? (n * sz) : 1);
+        if (NULL == dst) {
+            RBA_ERR("malloc failed for %llu bytes of %s\n", (unsigned long long)(n * sz), filename);
+            ret = -1;
+        } else {
+            switch (sz) {
+                case 1:
+                    for (i = 0; i < n; i++) {
+                        dst[i] = src[perm[i]];
+                    }
+                    break;
+                case 4:
+                    for (i = 0; i < n; i++) {
+                        ((uint32_t*)dst)[i] = ((const uint32_t*)src)[perm[i]];
+                    }
+                    break;
+                case 8:
+                    for (i = 0; i < n; i++) {
+                        ((uint64_t*)dst)[i] = ((const uint64_t*)src)[perm[i]];
+                    }
+                    break;
+                default:
+                    for (i = 0; i < n; i++) {
+                        memcpy (dst + i * sz, src + perm[i] * sz, sz);
+                    }
+                    break;
+            }
+        }
+    }
+
+    if ((0 == ret) && (NULL != range)) {
+        hdr.data_offset = sizeof(rba_header_t) + sizeof(rba_timerange_t);
+        if ((0 != fseeko (filep, 0, SEEK_SET)) ||
+                (1 != fwrite (&hdr, sizeof(hdr), 1, filep)) ||
+                (1 != fwrite (range, sizeof(rba_timerange_t), 1, filep))) {
+            RBA_ERR("Failed to write header of file %s\n", filename);
+            ret = -1;
+        }
+    } else if (0 == ret) {
+        ret = fseeko (filep, hdr.data_offset, SEEK_SET);
+    }
+    if ((0 == ret) && (n > 0) && (1 != fwrite (dst, n * sz, 1, filep))) {
+        RBA_ERR("Failed to write sorted data to file %s\n", filename);
+        ret = -1;
+    }
+    if ((0 == ret) && (0 != fflush (filep))) {
+        ret = -1;
+    }
+    if ((0 == ret) && (0 != ftruncate (fileno (filep), (off_t)(hdr.data_offset + n * sz)))) {
+        RBA_ERR("Failed to truncate file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    }
+
+    if (0 != fclose (filep)) {
+        ret = -1;
+    }
+    free (src);
+    free (dst);
+
+    /*  a checksummed file gets new checksums, and a new zone map */
+    crcname = (char*)malloc (strlen (filename) + sizeof(RBA_CRC_SUFFIX));
+    if (NULL == crcname) {
+        ret = -1;
+    } else {
+        sprintf (crcname, "%s" RBA_CRC_SUFFIX, filename);
+        if ((0 == ret) && (0 == access (crcname, F_OK))) {
+            ret = rba_crc_file (filename);
+        }
+        free (crcname);
+    }
+    if (0 == ret) {
+        ret = rba_zone_refresh (filename);
+    }
+
+    return ret;
+}
+
+/*  Sort all column files of a partition, and its row file, by the timestamp
+    in column col, keeping the input order of equal timestamps. One column is
+    read, reordered and written back at a time, so the memory needed is the
+    timestamps, the order and two copies of one column. The timestamp column
+    gets the time range of the partition for pruning, see
+    rba_read_timerange. Packed files and PAX files can not be sorted. */
+int
+rba_sort_partition (rba_spec_entry_t    *spec,
+                    uint32_t            cols,
+                    const char          *dirpath,
+                    uint32_t            partition,
+                    uint32_t            col)
+{
+    int ret;
+
+    char *filename;
+    size_t filenamelen;
+    FILE *filep;
+    rba_header_t hdr;
+    rba_timerange_t range;
+    int64_t *ts = NULL;
+    uint32_t *perm = NULL;
+    uint32_t c;
+
+    filenamelen = strlen (dirpath) + strlen ("/p00000000/c00000000.bin") + strlen (RBA_ROWS_FILENAME) + 1;
+    filename = (char*)malloc (filenamelen);
+    if (NULL == filename) {
+        return -1;
+    }
+
+    snprintf (filename, filenamelen, "%s/p%08X/c%08X.bin", dirpath, (unsigned)partition, (unsigned)col);
+    filep = fopen (filename, "rb");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        ret = read_header (filep, filename, &hdr);
+        if ((0 == ret) && ((rba_type_timestamp.magic != hdr.rba_type_magic) ||
+                            (hdr.records > UINT32_MAX))) {
+            RBA_ERR("File %s is not a timestamp column of at most 2^32 records\n", filename);
+            ret = -1;
+        }
+        if (0 == ret) {
+            ret = read_data (filep, filename, &hdr, (void**)&ts);
+        }
+        fclose (filep);
+    }
+
+    if ((0 == ret) && (hdr.records > 0)) {
+        ret = radix_order (ts, hdr.records, &perm);
+        if (0 == ret) {
+            range.magic = RBA_TRANGE_MAGIC;
+            range.min = ts[perm[0]];
+            range.max = ts[perm[hdr.records - 1]];
+            range.reserved = 0;
+        }
+    } else if (0 == ret) {
+        range.magic = RBA_TRANGE_MAGIC;
+        range.min = INT64_MAX;
+        range.max = INT64_MIN;
+        range.reserved = 0;
+    }
+    free (ts);
+
+    for (c = 0; (c < cols) && (0 == ret); c++) {
+        if (0 != spec[c].type->size) {
+            snprintf (filename, filenamelen, "%s/p%08X/c%08X.bin", dirpath, (unsigned)partition, (unsigned)c);
+            ret = permute_file (filename, perm, hdr.records, (c == col) ? &range : NULL);
+        }
+    }
+
+    snprintf (filename, filenamelen, "%s/p%08X/%s", dirpath, (unsigned)partition, RBA_ROWS_FILENAME);
+    if ((0 == ret) && (0 == access (filename, F_OK))) {
+        ret = permute_file (filename, perm, hdr.records, NULL);
+    }
+
+    free (perm);
+    free (filename);
+
+    return ret;
+}
+
+/*  Read the time range of a sorted timestamp column */
+int
+rba_read_timerange (const char      *filename,
+                    rba_timerange_t *range)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+
+    filep = fopen (filename, "rb");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", filename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        ret = read_header (filep, filename, &hdr);
+        if ((0 == ret) &&
+                ((hdr.data_offset != sizeof(rba_header_t) + sizeof(rba_timerange_t)) ||
+                    (1 != fread (range, sizeof(rba_timerange_t), 1, filep)) ||
+                    (RBA_TRANGE_MAGIC != range->magic))) {
+            RBA_ERR("File %s has no time range\n", filename);
+            ret = -1;
+        }
+        fclose (filep);
+    }
+
+    return ret;
+}
@@ -0,0 +1,280 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <time.h>
+#include <sys/resource.h>
+
+#include <rba.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const char *stage_names[RBA_STAGES] = {
+    "other",
+    "count",
+    "read",
+    "dedup",
+    "select",
+    "pick",
+    "parse",
+    "write",
+    "close",
+    "sort",
+};
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*  The time stamp counter where there is one, it costs a few nanoseconds
+    and is converted to seconds against the monotonic clock in the report.
+    Nanoseconds of the monotonic clock elsewhere. */
+uint64_t
+rba_stats_ticks (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc ();
+#else
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*  Start the clock in RBA_STAGE_OTHER. Progress is printed every interval
+    seconds by rba_stats_progress, or never when interval is 0. */
+int
+rba_stats_init (rba_stats_t         *stats,
+                rba_spec_entry_t    *spec,
+                uint32_t            cols,
+                uint32_t            flags,
+                double              interval)
+{
+    int ret = 0;
+
+    memset (stats, 0, sizeof(rba_stats_t));
+    stats->spec = spec;
+    stats->cols = cols;
+    stats->flags = flags;
+    stats->interval = interval;
+
+    if (flags & RBA_STATS_COLUMNS) {
+        stats->colticks = (uint64_t*)calloc (cols, sizeof(uint64_t));
+        if (NULL == stats->colticks) {
+            RBA_ERR("calloc failed for %u column timers\n", (unsigned)cols);
+            ret = -1;
+        }
+    }
+
+    stats->start = now ();
+    stats->next_progress = stats->start + interval;
+    stats->start_ticks = rba_stats_ticks ();
+    stats->last = stats->start_ticks;
+
+    return ret;
+}
+
+/*  Charge the time since the last switch to the current stage and make
+    stage the current one. Returns the previous stage, so that nested stages
+    can switch back. Does nothing without stats. */
+uint32_t
+rba_stats_switch (  rba_stats_t *stats,
+                    uint32_t    stage)
+{
+    uint32_t prev;
+    uint64_t t;
+
+    if (NULL == stats) {
+        return RBA_STAGE_OTHER;
+    }
+
+    t = rba_stats_ticks ();
+    stats->ticks[stats->stage] += t - stats->last;
+    stats->last = t;
+    prev = stats->stage;
+    stats->stage = stage;
+
+    return prev;
+}
+
+/*  Print the progress and the estimated time left to stderr once the
+    interval has passed. Cheap enough to call every few records. */
+void
+rba_stats_progress (rba_stats_t *stats)
+{
+    double t, elapsed, rate;
+
+    if ((NULL == stats) || (0 == stats->interval)) {
+        return;
+    }
+
+    t = now ();
+    if (t < stats->next_progress) {
+        return;
+    }
+    stats->next_progress = t + stats->interval;
+
+    elapsed = t - stats->start;
+    rate = (double)stats->records_read / elapsed;
+    if ((stats->expected > 0) && (stats->records_read <= stats->expected) && (rate > 0)) {
+        fprintf (stderr, "\r    %llu/%llu records (%.1f%%), %.0f records/s, %.1f MB/s, ETA %.0f s    ",
+                (unsigned long long)stats->records_read,
+                (unsigned long long)stats->expected,
+                100.0 * (double)stats->records_read / (double)stats->expected,
+                rate,
+                (double)stats->bytes_read / elapsed / 1e6,
+                (double)(stats->expected - stats->records_read) / rate);
+    } else {
+        fprintf (stderr, "\r    %llu records, %.0f records/s, %.1f MB/s    ",
+                (unsigned long long)stats->records_read,
+                rate,
+                (double)stats->bytes_read / elapsed / 1e6);
+    }
+    stats->progressed = 1;
+}
+
+/*  end the progress line */
+void
+rba_stats_progress_done (rba_stats_t *stats)
+{
+    if ((NULL != stats) && stats->progressed) {
+        fprintf (stderr, "\n");
+        stats->progressed = 0;
+    }
+}
+
+static void
+json_string (   FILE        *filep,
+                const char  *str)
+{
+    fputc ('"', filep);
+    for (; '\0' != *str; str++) {
+        if (('"' == *str) || ('\\' == *str)) {
+            fprintf (filep, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf (filep, "\\u%04x", (unsigned)(unsigned char)*str);
+        } else {
+            fputc (*str, filep);
+        }
+    }
+    fputc ('"', filep);
+}
+
+/*  Write the counters, the seconds spent in each stage and, with
+    RBA_STATS_COLUMNS, in each column as JSON to filename. With column
+    timers, the parse stage is split into the time of the columns and the
+    rest, which is tokenizing. */
+int
+rba_stats_report (  rba_stats_t *stats,
+                    const char  *filename)
+{
+    int ret;
+
+    FILE *filep;
+    struct rusage usage;
+    double elapsed, seconds_per_tick, colsum;
+    uint32_t s, c;
+
+    rba_stats_switch (stats, stats->stage);
+    elapsed = now () - stats->start;
+    seconds_per_tick = (stats->last > stats->start_ticks) ? elapsed / (double)(stats->last - stats->start_ticks) : 0;
+    if (0 != getrusage (RUSAGE_SELF, &usage)) {
+        usage.ru_maxrss = 0;
+    }
+
+    filep = fopen (filename, "w");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open report file %s\n", filename);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    fprintf (filep, "{\n");
+    fprintf (filep, "    \"seconds\": %.6f,\n", elapsed);
+    fprintf (filep, "    \"records_read\": %llu,\n", (unsigned long long)stats->records_read);
+    fprintf (filep, "    \"records_written\": %llu,\n", (unsigned long long)stats->records_written);
+    fprintf (filep, "    \"records_dropped\": %llu,\n", (unsigned long long)stats->dropped);
+    fprintf (filep, "    \"records_filtered\": %llu,\n", (unsigned long long)stats->filtered);
+    fprintf (filep, "    \"duplicates\": %llu,\n", (unsigned long long)stats->duplicates);
+    fprintf (filep, "    \"bytes_read\": %llu,\n", (unsigned long long)stats->bytes_read);
+    fprintf (filep, "    \"bytes_written\": %llu,\n", (unsigned long long)stats->bytes_written);
+    fprintf (filep, "    \"flushes\": %llu,\n", (unsigned long long)stats->flushes);
+    fprintf (filep, "    \"records_per_sec\": %.1f,\n", (elapsed > 0) ? (double)stats->records_read / elapsed : 0);
+    fprintf (filep, "    \"peak_rss_kib\": %ld,\n", (long)usage.ru_maxrss);
+    fprintf (filep, "    \"stages\": {\n");
+    for (s = 0, colsum = 0; s < RBA_STAGES; s++) {
+        fprintf (filep, "        \"%s\": %.6f%s\n", stage_names[s],
+                (double)stats->ticks[s] * seconds_per_tick,
+                (s + 1 < RBA_STAGES) ? "," : "");
+    }
+    fprintf (filep, "    }");
+
+    if (NULL != stats->colticks) {
+        for (c = 0; c < stats->cols; c++) {
+            colsum += (double)stats->colticks[c];
+        }
+        fprintf (filep, ",\n    \"tokenize\": %.6f,\n",
+                ((double)stats->ticks[RBA_STAGE_PARSE] - colsum) * seconds_per_tick);
+        fprintf (filep, "    \"columns\": [\n");
+        for (c = 0; c < stats->cols; c++) {
+            fprintf (filep, "        {\"name\": ");
+            json_string (filep, stats->spec[c].name);
+            fprintf (filep, ", \"type\": \"%s\", \"seconds\": %.6f}%s\n",
+                    stats->spec[c].type->specname,
+                    (double)stats->colticks[c] * seconds_per_tick,
+                    (c + 1 < stats->cols) ? "," : "");
+        }
+        fprintf (filep, "    ]");
+    }
+    fprintf (filep, "\n}\n");
+
+    if (0 != fclose (filep)) {
+        RBA_ERR("Failed to write report file %s\n", filename);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+void
+rba_stats_free (rba_stats_t *stats)
+{
+    free (stats->colticks);
+    memset (stats, 0, sizeof(rba_stats_t));
+}
@@ -62,6 +62,129 @@ strtouint64 (   const char  *str,
     return ret;
 }
 
+/*  Decimal digits are checked and converted 8 at a time on little endian
+    targets: a 64-bit word of ASCII digits minus '0' in every byte is folded
+    into a number in three multiplications. */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define RBA_SWAR_DIGITS (1)
+#endif
+
+#ifdef RBA_SWAR_DIGITS
+static inline int
+swar_all_digits (uint64_t v)
+{
+    return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+                (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+            0x3333333333333333ULL);
+}
+
+static inline uint64_t
+swar_8digits (uint64_t v)
+{
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+            (((v >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+    return v;
+}
+#endif
+
+/*  Parse the len decimal digits at str. Up to 19 digits can not overflow
+    a uint64_t, so the check is only done for the 20th. */
+static int
+parse_digits (  const char  *str,
+                size_t      len,
+                uint64_t    *out_p)
+{
+    uint64_t val = 0, d;
+    size_t i = 0;
+#ifdef RBA_SWAR_DIGITS
+    uint64_t word;
+#endif
+
+    for (; (len > 19) && ('0' == *str); str++, len--);
+    if ((0 == len) || (len > 20)) {
+        return (0 == len) ? -1 : 1;
+    }
+
+#ifdef RBA_SWAR_DIGITS
+    for (; i + 8 <= len; i += 8) {
+        memcpy (&word, str + i, sizeof(word));
+        if (!swar_all_digits (word)) {
+            return -1;
+        }
+        val = (val * 100000000) + swar_8digits (word);
+    }
+#endif
+    for (; i < len; i++) {
+        d = (uint64_t)(unsigned char)str[i] - '0';
+        if (d > 9) {
+            return -1;
+        }
+        if ((19 == i) && (val > (UINT64_MAX - d) / 10)) {
+            return 1;
+        }
+        val = (val * 10) + d;
+    }
+
+    *out_p = val;
+    return 0;
+}
+
+/*  Parse a plain decimal integer of at most max, with an optional '+', and
+    nothing else: no white space, base prefix or trailing characters. Sets
+    errno to EINVAL or ERANGE and returns -1 on failure, without printing. */
+int
+rba_parse_decimal_u64 (const char  *str,
+                        uint64_t    max,
+                        uint64_t    *out_p)
+{
+    int ret;
+    uint64_t val;
+
+    if ('+' == *str) {
+        str++;
+    }
+    ret = parse_digits (str, strlen (str), &val);
+    if ((0 != ret) || (val > max)) {
+        errno = (0 > ret) ? EINVAL : ERANGE;
+        ret = -1;
+    } else {
+        *out_p = val;
+    }
+
+    return ret;
+}
+
+/*  As rba_parse_decimal_u64, with an optional '-' and at least min. */
+int
+rba_parse_decimal_i64 (const char  *str,
+                        int64_t     min,
+                        int64_t     max,
+                        int64_t     *out_p)
+{
+    int ret;
+    uint64_t val;
+    int neg = 0;
+
+    if (('+' == *str) || ('-' == *str)) {
+        neg = ('-' == *str);
+        str++;
+    }
+    ret = parse_digits (str, strlen (str), &val);
+    if ((0 == ret) && neg && (val <= (uint64_t)INT64_MAX + 1) &&
+            ((0 == val) || ((int64_t)(val - 1) <= -(min + 1)))) {
+        *out_p = (0 == val) ? 0 : -(int64_t)(val - 1) - 1;
+    } else if ((0 == ret) && !neg && (val <= (uint64_t)max)) {
+        *out_p = (int64_t)val;
+    } else {
+        errno = (0 > ret) ? EINVAL : ERANGE;
+        ret = -1;
+    }
+
+    return ret;
+}
+
 int
 strtodouble (   const char  *str,
                 double      *out_p)
@@ -97,10 +220,12 @@ strtodouble (   const char  *str,
 int
 rba_type_ignore_initbuf (   rba_type_t  *type,
                             const char  *filename,
+                            uint32_t    flags,
                             rba_buf_t   *buf)
 {
     (void)type;
     (void)filename;
+    (void)flags;
     memset (buf, 0, sizeof(rba_buf_t));
     return 0;
 }
@@ -129,6 +254,52 @@ rba_type_ignore_parse ( rba_data_t  *data,
 /*  rba_type_..._parse functions                                              */
 /******************************************************************************/
 
+/*  Integer columns are plain decimal, RBA_DATA_LEGACYINT goes back to
+    strtoull/strtoll with base detection, which reads "010" as octal and
+    "0x10" as hexadecimal. Either way the value must fit max (and min). */
+static int
+parse_uint (uint32_t    flags,
+            const char  *string,
+            uint64_t    max,
+            uint64_t    *out_p)
+{
+    int ret;
+
+    if (flags & RBA_DATA_LEGACYINT) {
+        ret = strtouint64 (string, out_p);
+        if ((0 == ret) && (*out_p > max)) {
+            errno = ERANGE;
+            ret = -1;
+        }
+    } else {
+        ret = rba_parse_decimal_u64 (string, max, out_p);
+    }
+
+    return ret;
+}
+
+static int
+parse_int ( uint32_t    flags,
+            const char  *string,
+            int64_t     min,
+            int64_t     max,
+            int64_t     *out_p)
+{
+    int ret;
+
+    if (flags & RBA_DATA_LEGACYINT) {
+        ret = strtoint64 (string, out_p);
+        if ((0 == ret) && ((*out_p > max) || (*out_p < min))) {
+            errno = ERANGE;
+            ret = -1;
+        }
+    } else {
+        ret = rba_parse_decimal_i64 (string, min, max, out_p);
+    }
+
+    return ret;
+}
+
 int
 rba_type_u8_parse ( rba_data_t  *data,
                     uint32_t    col,
@@ -137,33 +308,27 @@ rba_type_u8_parse ( rba_data_t  *data,
     int ret;
     uint64_t val64;
 
-    ret = strtouint64 (string, &val64);
+    ret = parse_uint (data->flags, string, UINT8_MAX, &val64);
     if (-1 == ret) {
-        RBA_ERR("failed to convert %s to uint64\n", string);
+        RBA_ERR("failed to convert %s to uint8\n", string);
     } else {
-        if (val64 > UINT8_MAX) {
-            RBA_ERR("integer %s is out of range for uint8\n", string);
-            errno = ERANGE;
-            ret = -1;
-        } else {
-            uint32_t    r, p;
-            rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
-
-            for (r=0, ret=0; \
-                    (r < data->repetitions) && (0 == ret) ;
-                        r++) {
-
-                p = data->partidxbuf[r];
-                
-                ((uint8_t*)(bufs[p].arr))[bufs[p].idx] = (uint8_t)val64;
-                bufs[p].idx++;
-                if (bufs[p].idx == bufs[p].len) {
-
-                    ret = rba_buf_simple_flush (&(bufs[p]));
-                    if (0 != ret) {
-                        RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
-                        ret = -1;
-                    }
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+            
+            ((uint8_t*)(bufs[p].arr))[bufs[p].idx] = (uint8_t)val64;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
                 }
             }
         }
@@ -180,33 +345,27 @@ rba_type_i8_parse ( rba_data_t  *data,
     int ret;
     int64_t val64;
 
-    ret = strtoint64 (string, &val64);
+    ret = parse_int (data->flags, string, INT8_MIN, INT8_MAX, &val64);
     if (-1 == ret) {
-        RBA_ERR("failed to convert %s to int64\n", string);
+        RBA_ERR("failed to convert %s to int8\n", string);
     } else {
-        if ((val64 > INT8_MAX) || (val64 < INT8_MIN)) {
-            RBA_ERR("integer %s is out of range for int8\n", string);
-            errno = ERANGE;
-            ret = -1;
-        } else {
-            uint32_t    r, p;
-            rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
-
-            for (r=0, ret=0; \
-                    (r < data->repetitions) && (0 == ret) ;
-                        r++) {
-
-                p = data->partidxbuf[r];
-                
-                ((int8_t*)(bufs[p].arr))[bufs[p].idx] = (int8_t)val64;
-                bufs[p].idx++;
-                if (bufs[p].idx == bufs[p].len) {
-
-                    ret = rba_buf_simple_flush (&(bufs[p]));
-                    if (0 != ret) {
-                        RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
-                        ret = -1;
-                    }
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+            
+            ((int8_t*)(bufs[p].arr))[bufs[p].idx] = (int8_t)val64;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
                 }
             }
         }
@@ -223,33 +382,27 @@ rba_type_u16_parse (rba_data_t  *data,
     int ret;
     uint64_t val64;
 
-    ret = strtouint64 (string, &val64);
+    ret = parse_uint (data->flags, string, UINT16_MAX, &val64);
     if (-1 == ret) {
-        RBA_ERR("failed to convert %s to uint64\n", string);
+        RBA_ERR("failed to convert %s to uint16\n", string);
     } else {
-        if (val64 > UINT16_MAX) {
-            RBA_ERR("integer %s is out of range for uint16\n", string);
-            errno = ERANGE;
-            ret = -1;
-        } else {
-            uint32_t    r, p;
-            rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
-
-            for (r=0, ret=0; \
-                    (r < data->repetitions) && (0 == ret) ;
-                        r++) {
-
-                p = data->partidxbuf[r];
-                
-                ((uint16_t*)(bufs[p].arr))[bufs[p].idx] = (uint16_t)val64;
-                bufs[p].idx++;
-                if (bufs[p].idx == bufs[p].len) {
-
-                    ret = rba_buf_simple_flush (&(bufs[p]));
-                    if (0 != ret) {
-                        RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
-                        ret = -1;
-                    }
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+            
+            ((uint16_t*)(bufs[p].arr))[bufs[p].idx] = (uint16_t)val64;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
                 }
             }
         }
@@ -266,33 +419,27 @@ rba_type_i16_parse (rba_data_t  *data,
     int ret;
     int64_t val64;
 
-    ret = strtoint64 (string, &val64);
+    ret = parse_int (data->flags, string, INT16_MIN, INT16_MAX, &val64);
     if (-1 == ret) {
-        RBA_ERR("failed to convert %s to int64\n", string);
+        RBA_ERR("failed to convert %s to int16\n", string);
     } else {
-        if ((val64 > INT16_MAX) || (val64 < INT16_MIN)) {
-            RBA_ERR("integer %s is out of range for int16\n", string);
-            errno = ERANGE;
-            ret = -1;
-        } else {
-            uint32_t    r, p;
-            rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
-
-            for (r=0, ret=0; \
-                    (r < data->repetitions) && (0 == ret) ;
-                        r++) {
-
-                p = data->partidxbuf[r];
-                
-                ((int16_t*)(bufs[p].arr))[bufs[p].idx] = (int16_t)val64;
-                bufs[p].idx++;
-                if (bufs[p].idx == bufs[p].len) {
-
-                    ret = rba_buf_simple_flush (&(bufs[p]));
-                    if (0 != ret) {
-                        RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
-                        ret = -1;
-                    }
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+            
+            ((int16_t*)(bufs[p].arr))[bufs[p].idx] = (int16_t)val64;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
                 }
             }
         }
@@ -309,33 +456,27 @@ rba_type_u32_parse (rba_data_t  *data,
     int ret;
     uint64_t val64;
 
-    ret = strtouint64 (string, &val64);
+    ret = parse_uint (data->flags, string, UINT32_MAX, &val64);
     if (-1 == ret) {
-        RBA_ERR("failed to convert %s to uint64\n", string);
+        RBA_ERR("failed to convert %s to uint32\n", string);
     } else {
-        if (val64 > UINT32_MAX) {
-            RBA_ERR("integer %s is out of range for uint32\n", string);
-            errno = ERANGE;
-            ret = -1;
-        } else {
-            uint32_t    r, p;
-            rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
-
-            for (r=0, ret=0; \
-                    (r < data->repetitions) && (0 == ret) ;
-                        r++) {
-
-                p = data->partidxbuf[r];
-                
-                ((uint32_t*)(bufs[p].arr))[bufs[p].idx] = (uint32_t)val64;
-                bufs[p].idx++;
-                if (bufs[p].idx == bufs[p].len) {
-
-                    ret = rba_buf_simple_flush (&(bufs[p]));
-                    if (0 != ret) {
-                        RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
-                        ret = -1;
-                    }
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+            
+            ((uint32_t*)(bufs[p].arr))[bufs[p].idx] = (uint32_t)val64;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
                 }
             }
         }
@@ -352,33 +493,27 @@ rba_type_i32_parse (rba_data_t  *data,
     int ret;
     int64_t val64;
 
-    ret = strtoint64 (string, &val64);
+    ret = parse_int (data->flags, string, INT32_MIN, INT32_MAX, &val64);
     if (-1 == ret) {
-        RBA_ERR("failed to convert %s to int64\n", string);
+        RBA_ERR("failed to convert %s to int32\n", string);
     } else {
-        if ((val64 > INT32_MAX) || (val64 < INT32_MIN)) {
-            RBA_ERR("integer %s is out of range for int32\n", string);
-            errno = ERANGE;
-            ret = -1;
-        } else {
-            uint32_t    r, p;
-            rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
-
-            for (r=0, ret=0; \
-                    (r < data->repetitions) && (0 == ret) ;
-                        r++) {
-
-                p = data->partidxbuf[r];
-                
-                ((int32_t*)(bufs[p].arr))[bufs[p].idx] = (int32_t)val64;
-                bufs[p].idx++;
-                if (bufs[p].idx == bufs[p].len) {
-
-                    ret = rba_buf_simple_flush (&(bufs[p]));
-                    if (0 != ret) {
-                        RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
-                        ret = -1;
-                    }
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+            
+            ((int32_t*)(bufs[p].arr))[bufs[p].idx] = (int32_t)val64;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
                 }
             }
         }
@@ -395,7 +530,7 @@ rba_type_u64_parse (rba_data_t  *data,
     int ret;
     uint64_t val64;
 
-    ret = strtouint64 (string, &val64);
+    ret = parse_uint (data->flags, string, UINT64_MAX, &val64);
     if (-1 == ret) {
         RBA_ERR("failed to convert %s to uint64\n", string);
     } else {
@@ -432,7 +567,7 @@ rba_type_i64_parse (rba_data_t  *data,
     int ret;
     int64_t val64;
 
-    ret = strtoint64 (string, &val64);
+    ret = parse_int (data->flags, string, INT64_MIN, INT64_MAX, &val64);
     if (-1 == ret) {
         RBA_ERR("failed to convert %s to int64\n", string);
     } else {
@@ -542,6 +677,495 @@ rba_type_double_parse ( rba_data_t  *data,
     return ret;
 }
 
+/******************************************************************************/
+/*  rba_type_ip... functions                                                  */
+/******************************************************************************/
+
+/*  Parse a dotted quad into an address in host byte order, so that a.b.c.d is
+    (a << 24) | (b << 16) | (c << 8) | d. */
+int
+rba_parse_ipv4 (const char  *str,
+                uint32_t    *addr_p)
+{
+    int ret = 0;
+
+    const char *cp = str;
+    uint32_t addr = 0, octet;
+    int i, digits;
+
+    for (i = 0; (i < 4) && (0 == ret); i++) {
+        for (octet = 0, digits = 0; ((uint8_t)(cp[0] - '0') < 10) && (digits < 4); cp++, digits++) {
+            octet = octet * 10 + (uint32_t)(cp[0] - '0');
+        }
+        if ((0 == digits) || (digits > 3) || (octet > 255)) {
+            ret = -1;
+        } else {
+            addr = (addr << 8) | octet;
+            if (i < 3) {
+                ret = ('.' == cp[0]) ? 0 : -1;
+                cp++;
+            }
+        }
+    }
+
+    if ((0 != ret) || ('\0' != cp[0])) {
+        RBA_ERR("failed to convert %s to an IPv4 address\n", str);
+        errno = EINVAL;
+        ret = -1;
+    } else {
+        *addr_p = addr;
+    }
+
+    return ret;
+}
+
+static inline int
+hexdigit (char c)
+{
+    int ret;
+
+    if ((uint8_t)(c - '0') < 10) {
+        ret = c - '0';
+    } else if ((uint8_t)((c | 0x20) - 'a') < 6) {
+        ret = (c | 0x20) - 'a' + 10;
+    } else {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/*  Parse IPv6 text (RFC 4291 2.2, including "::" and a trailing dotted quad)
+    into the upper and lower 64 bits of the address. A dotted quad on its own
+    is parsed as the IPv4-mapped address ::ffff:a.b.c.d. */
+int
+rba_parse_ipv6 (const char  *str,
+                uint64_t    *hi_p,
+                uint64_t    *lo_p)
+{
+    int ret = 0;
+
+    const char *cp = str;
+    const char *start;
+    uint16_t groups[8], addr[8];
+    uint32_t v4, val;
+    int ngroups = 0, gap = -1, digits, d, i;
+
+    if ((NULL == strchr (str, ':')) && (0 == rba_parse_ipv4 (str, &v4))) {
+        groups[0] = 0xffff;
+        groups[1] = (uint16_t)(v4 >> 16);
+        groups[2] = (uint16_t)v4;
+        ngroups = 3;
+        gap = 0;
+        cp = "";
+    } else if (':' == cp[0]) {
+        if (':' != cp[1]) {
+            ret = -1;
+        }
+        gap = 0;
+        cp += 2;
+    }
+
+    while ((0 == ret) && ('\0' != cp[0])) {
+        start = cp;
+        for (val = 0, digits = 0; (digits < 5) && ((d = hexdigit (cp[0])) >= 0); cp++, digits++) {
+            val = (val << 4) | (uint32_t)d;
+        }
+        if ('.' == cp[0]) {
+            /*  trailing dotted quad */
+            if ((ngroups > 6) || (0 != rba_parse_ipv4 (start, &v4))) {
+                ret = -1;
+            } else {
+                groups[ngroups++] = (uint16_t)(v4 >> 16);
+                groups[ngroups++] = (uint16_t)v4;
+            }
+            break;
+        } else if ((0 == digits) || (digits > 4) || (8 == ngroups)) {
+            ret = -1;
+        } else {
+            groups[ngroups++] = (uint16_t)val;
+            if (':' == cp[0]) {
+                cp++;
+                if (':' == cp[0]) {
+                    ret = (gap >= 0) ? -1 : 0;
+                    gap = ngroups;
+                    cp++;
+                } else if ('\0' == cp[0]) {
+                    ret = -1;
+                }
+            } else if ('\0' != cp[0]) {
+                ret = -1;
+            }
+        }
+    }
+
+    if ((0 == ret) && (((gap < 0) && (8 != ngroups)) || ((gap >= 0) && (ngroups > 7)))) {
+        ret = -1;
+    }
+
+    if (0 != ret) {
+        RBA_ERR("failed to convert %s to an IPv6 address\n", str);
+        errno = EINVAL;
+        ret = -1;
+    } else {
+        memset (addr, 0, sizeof(addr));
+        if (gap < 0) {
+            gap = ngroups;
+        }
+        for (i = 0; i < gap; i++) {
+            addr[i] = groups[i];
+        }
+        for (i = gap; i < ngroups; i++) {
+            addr[8 - ngroups + i] = groups[i];
+        }
+        *hi_p = ((uint64_t)addr[0] << 48) | ((uint64_t)addr[1] << 32) |
+                ((uint64_t)addr[2] << 16) | (uint64_t)addr[3];
+        *lo_p = ((uint64_t)addr[4] << 48) | ((uint64_t)addr[5] << 32) |
+                ((uint64_t)addr[6] << 16) | (uint64_t)addr[7];
+    }
+
+    return ret;
+}
+
+static int
+rba_type_ipv4_store (   rba_data_t  *data,
+                        uint32_t    col,
+                        uint32_t    addr)
+{
+    int ret;
+    uint32_t    r, p;
+    rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+    for (r=0, ret=0; \
+            (r < data->repetitions) && (0 == ret) ;
+                r++) {
+
+        p = data->partidxbuf[r];
+
+        ((uint32_t*)(bufs[p].arr))[bufs[p].idx] = addr;
+        bufs[p].idx++;
+        if (bufs[p].idx == bufs[p].len) {
+
+            ret = rba_buf_simple_flush (&(bufs[p]));
+            if (0 != ret) {
+                RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int
+rba_type_ipv4_parse (   rba_data_t  *data,
+                        uint32_t    col,
+                        const char  *string)
+{
+    int ret;
+    uint32_t addr;
+
+    ret = rba_parse_ipv4 (string, &addr);
+    if (0 == ret) {
+        ret = rba_type_ipv4_store (data, col, addr);
+    }
+
+    return ret;
+}
+
+int
+rba_type_ipv4_prefix24_parse (  rba_data_t  *data,
+                                uint32_t    col,
+                                const char  *string)
+{
+    int ret;
+    uint32_t addr;
+
+    ret = rba_parse_ipv4 (string, &addr);
+    if (0 == ret) {
+        ret = rba_type_ipv4_store (data, col, addr & 0xFFFFFF00);
+    }
+
+    return ret;
+}
+
+int
+rba_type_ipv6_parse (   rba_data_t  *data,
+                        uint32_t    col,
+                        const char  *string)
+{
+    int ret;
+    uint64_t hi, lo;
+
+    ret = rba_parse_ipv6 (string, &hi, &lo);
+    if (0 == ret) {
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+
+            ((uint64_t*)(bufs[p].arr))[2 * bufs[p].idx] = hi;
+            ((uint64_t*)(bufs[p].arr))[2 * bufs[p].idx + 1] = lo;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/******************************************************************************/
+/*  rba_type_timestamp functions                                              */
+/******************************************************************************/
+
+/*  days since 1970-01-01 of a date of the proleptic Gregorian calendar */
+static inline int64_t
+days_from_civil (   int64_t     y,
+                    uint32_t    m,
+                    uint32_t    d)
+{
+    int64_t era;
+    uint32_t yoe, doy, doe;
+
+    y -= (m <= 2);
+    era = ((y >= 0) ? y : (y - 399)) / 400;
+    yoe = (uint32_t)(y - era * 400);
+    doy = (153 * ((m > 2) ? (m - 3) : (m + 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+/*  Parse "YYYY-MM-DD HH:MM:SS[.ffffff]", the CICFM timestamp layout, into
+    microseconds since the epoch, taking the time as UTC. The date and time
+    are at fixed offsets, so every digit is checked and converted without
+    branching on the input. Fractions with more than 6 digits are
+    truncated. */
+int
+rba_parse_timestamp (   const char  *str,
+                        int64_t     *usec_p)
+{
+    int ret;
+
+    static const char layout[] = "0000-00-00 00:00:00";
+    static const uint8_t mdays[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    uint32_t dig[sizeof(layout) - 1];
+    uint32_t bad = 0;
+    uint32_t year, month, day, hour, minute, second, frac, scale;
+    size_t i;
+    const char *cp;
+
+    for (i = 0; (i < sizeof(layout) - 1) && ('\0' != str[i]); i++) {
+        dig[i] = (uint32_t)(uint8_t)str[i] - '0';
+        if ('0' == layout[i]) {
+            bad |= (dig[i] > 9);
+        } else {
+            bad |= (str[i] != layout[i]) & ((10 != i) | ('T' != str[i]));
+        }
+    }
+    bad |= (i < sizeof(layout) - 1);
+
+    if (!bad) {
+        year = dig[0] * 1000 + dig[1] * 100 + dig[2] * 10 + dig[3];
+        month = dig[5] * 10 + dig[6];
+        day = dig[8] * 10 + dig[9];
+        hour = dig[11] * 10 + dig[12];
+        minute = dig[14] * 10 + dig[15];
+        second = dig[17] * 10 + dig[18];
+        bad |= (month - 1 > 11);
+        bad |= (day - 1 >= (bad ? 0 : mdays[month - 1])) |
+                ((2 == month) & (29 == day) & ((0 != year % 4) | ((0 == year % 100) & (0 != year % 400))));
+        bad |= (hour > 23) | (minute > 59) | (second > 59);
+    }
+
+    frac = 0;
+    cp = str + sizeof(layout) - 1;
+    if (!bad && ('.' == cp[0])) {
+        for (cp++, scale = 100000, i = 0; (uint8_t)(cp[0] - '0') < 10; cp++, i++) {
+            frac += (uint32_t)(cp[0] - '0') * scale;
+            scale /= 10;
+        }
+        bad |= (0 == i);
+    }
+    bad |= !bad && ('\0' != cp[0]);
+
+    if (bad) {
+        RBA_ERR("failed to convert %s to a timestamp\n", str);
+        errno = EINVAL;
+        ret = -1;
+    } else {
+        *usec_p = ((days_from_civil (year, month, day) * 86400 +
+                    (int64_t)(hour * 3600 + minute * 60 + second)) * 1000000) + frac;
+        ret = 0;
+    }
+
+    return ret;
+}
+
+int
+rba_type_timestamp_parse (  rba_data_t  *data,
+                            uint32_t    col,
+                            const char  *string)
+{
+    int ret;
+    int64_t usec;
+
+    ret = rba_parse_timestamp (string, &usec);
+    if (0 == ret) {
+        uint32_t    r, p;
+        rba_buf_t   *bufs = rba_data_getcolbufs(data, col);
+
+        for (r=0, ret=0; \
+                (r < data->repetitions) && (0 == ret) ;
+                    r++) {
+
+            p = data->partidxbuf[r];
+
+            ((int64_t*)(bufs[p].arr))[bufs[p].idx] = usec;
+            bufs[p].idx++;
+            if (bufs[p].idx == bufs[p].len) {
+
+                ret = rba_buf_simple_flush (&(bufs[p]));
+                if (0 != ret) {
+                    RBA_ERR("rba_buf_simple_flush_if_full failed for col: %u, part: %u\n", (unsigned)col, (unsigned)p);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/******************************************************************************/
+/*  rba_type_..._value functions                                              */
+/******************************************************************************/
+
+/*  The integer types take their range from their size */
+int
+rba_type_uint_value (   rba_type_t          *type,
+                        const char          *string,
+                        uint32_t            flags,
+                        rba_zone_value_t    *value_p)
+{
+    int ret;
+    uint64_t max;
+
+    max = (type->size < sizeof(uint64_t)) ? ((UINT64_C(1) << (8 * type->size)) - 1) : UINT64_MAX;
+    ret = parse_uint (flags, string, max, &(value_p->u));
+    if (-1 == ret) {
+        RBA_ERR("failed to convert %s to %s\n", string, type->specname);
+    }
+
+    return ret;
+}
+
+int
+rba_type_int_value (rba_type_t          *type,
+                    const char          *string,
+                    uint32_t            flags,
+                    rba_zone_value_t    *value_p)
+{
+    int ret;
+    int64_t max;
+
+    max = (type->size < sizeof(int64_t)) ? ((INT64_C(1) << (8 * type->size - 1)) - 1) : INT64_MAX;
+    ret = parse_int (flags, string, -max - 1, max, &(value_p->i));
+    if (-1 == ret) {
+        RBA_ERR("failed to convert %s to %s\n", string, type->specname);
+    }
+
+    return ret;
+}
+
+/*  missing float values are stored as 0, as rba_type_float_parse does */
+int
+rba_type_float_value (  rba_type_t          *type,
+                        const char          *string,
+                        uint32_t            flags,
+                        rba_zone_value_t    *value_p)
+{
+    int ret;
+    double valdbl;
+
+    (void)flags;
+
+    ret = strtodouble (string, &valdbl);
+    if (sizeof(float) == type->size) {
+        value_p->f = (-1 == ret) ? 0 : (double)(float)valdbl;
+        ret = 0;
+    } else if (-1 == ret) {
+        RBA_ERR("failed to convert %s to double\n", string);
+    } else {
+        value_p->f = valdbl;
+    }
+
+    return ret;
+}
+
+int
+rba_type_ipv4_value (   rba_type_t          *type,
+                        const char          *string,
+                        uint32_t            flags,
+                        rba_zone_value_t    *value_p)
+{
+    int ret;
+    uint32_t addr;
+
+    (void)type;
+    (void)flags;
+
+    ret = rba_parse_ipv4 (string, &addr);
+    if (0 == ret) {
+        value_p->u = addr;
+    }
+
+    return ret;
+}
+
+int
+rba_type_ipv4_prefix24_value (  rba_type_t          *type,
+                                const char          *string,
+                                uint32_t            flags,
+                                rba_zone_value_t    *value_p)
+{
+    int ret;
+    uint32_t addr;
+
+    (void)type;
+    (void)flags;
+
+    ret = rba_parse_ipv4 (string, &addr);
+    if (0 == ret) {
+        value_p->u = addr & 0xFFFFFF00;
+    }
+
+    return ret;
+}
+
+int
+rba_type_timestamp_value (  rba_type_t          *type,
+                            const char          *string,
+                            uint32_t            flags,
+                            rba_zone_value_t    *value_p)
+{
+    (void)type;
+    (void)flags;
+
+    return rba_parse_timestamp (string, &(value_p->i));
+}
+
 /*
 magic numbers:
 
@@ -556,6 +1180,10 @@ RBUINT64    52 42 55 49 4e 54 36 34     0x3436544E49554252
 RBINT64     52 42 49 4e 54 36 34 00     0x003436544E554252
 RBFLOAT     52 42 46 4c 4f 41 54 00     0x0054414F4C464252
 RBDOUBLE    52 42 44 4f 55 42 4c 45     0x454C42554F444252
+RBIPV4      52 42 49 50 56 34 00 00     0x0000345650494252
+RBIPV6      52 42 49 50 56 36 00 00     0x0000365650494252
+RBIP4P24    52 42 49 50 34 50 32 34     0x3432503450494252
+RBTIMEUS    52 42 54 49 4d 45 55 53     0x5355454D49544252
 
 */
 
@@ -571,70 +1199,129 @@ rba_type_t rba_type_u8 =    {   .specname   = "uint8",
                                 .size       = sizeof(uint8_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_u8_parse};
+                                .parse      = rba_type_u8_parse,
+                                .zone       = RBA_ZONE_UINT,
+                                .value      = rba_type_uint_value};
 
 rba_type_t rba_type_i8 =    {   .specname   = "int8",
                                 .magic      = 0x000038544E554252,
                                 .size       = sizeof(int8_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_i8_parse};
+                                .parse      = rba_type_i8_parse,
+                                .zone       = RBA_ZONE_INT,
+                                .value      = rba_type_int_value};
 
 rba_type_t rba_type_u16 =   {   .specname   = "uint16",
                                 .magic      = 0x3631544E49554252,
                                 .size       = sizeof(uint16_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_u16_parse};
+                                .parse      = rba_type_u16_parse,
+                                .zone       = RBA_ZONE_UINT,
+                                .value      = rba_type_uint_value};
 
 rba_type_t rba_type_i16 =   {   .specname   = "int16",
                                 .magic      = 0x003631544E554252,
                                 .size       = sizeof(int16_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_i16_parse};
+                                .parse      = rba_type_i16_parse,
+                                .zone       = RBA_ZONE_INT,
+                                .value      = rba_type_int_value};
 
 rba_type_t rba_type_u32 =   {   .specname   = "uint32",
                                 .magic      = 0x3233544E49554252,
                                 .size       = sizeof(uint32_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_u32_parse};
+                                .parse      = rba_type_u32_parse,
+                                .zone       = RBA_ZONE_UINT,
+                                .value      = rba_type_uint_value};
 
 rba_type_t rba_type_i32 =   {   .specname   = "int32",
                                 .magic      = 0x003233544E554252,
                                 .size       = sizeof(int32_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_i32_parse};
+                                .parse      = rba_type_i32_parse,
+                                .zone       = RBA_ZONE_INT,
+                                .value      = rba_type_int_value};
 
 rba_type_t rba_type_u64 =   {   .specname   = "uint64",
                                 .magic      = 0x3436544E49554252,
                                 .size       = sizeof(uint64_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_u64_parse};
+                                .parse      = rba_type_u64_parse,
+                                .zone       = RBA_ZONE_UINT,
+                                .value      = rba_type_uint_value};
 
 rba_type_t rba_type_i64 =   {   .specname   = "int64",
                                 .magic      = 0x003436544E554252,
                                 .size       = sizeof(int64_t),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_i64_parse};
+                                .parse      = rba_type_i64_parse,
+                                .zone       = RBA_ZONE_INT,
+                                .value      = rba_type_int_value};
 
 rba_type_t rba_type_float = {   .specname   = "float",
                                 .magic      = 0x0054414F4C464252,
                                 .size       = sizeof(float),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_float_parse};
+                                .parse      = rba_type_float_parse,
+                                .zone       = RBA_ZONE_FLOAT,
+                                .value      = rba_type_float_value};
 
 rba_type_t rba_type_double ={   .specname   = "double",
                                 .magic      = 0x454C42554F444252,
                                 .size       = sizeof(double),
                                 .initbuf    = rba_buf_alloc,
                                 .freebuf    = rba_buf_simple_free,
-                                .parse      = rba_type_double_parse};
+                                .parse      = rba_type_double_parse,
+                                .zone       = RBA_ZONE_FLOAT,
+                                .value      = rba_type_float_value};
+
+/*  addresses as uint32_t in host byte order, a.b.c.d is 0xaabbccdd */
+rba_type_t rba_type_ipv4 =  {   .specname   = "ipv4",
+                                .magic      = 0x0000345650494252,
+                                .size       = sizeof(uint32_t),
+                                .initbuf    = rba_buf_alloc,
+                                .freebuf    = rba_buf_simple_free,
+                                .parse      = rba_type_ipv4_parse,
+                                .zone       = RBA_ZONE_UINT,
+                                .value      = rba_type_ipv4_value};
+
+/*  the /24 prefix of IPv4 addresses, a.b.c.0 */
+rba_type_t rba_type_ipv4_prefix24 = {   .specname   = "ipv4_prefix24",
+                                        .magic      = 0x3432503450494252,
+                                        .size       = sizeof(uint32_t),
+                                        .initbuf    = rba_buf_alloc,
+                                        .freebuf    = rba_buf_simple_free,
+                                        .parse      = rba_type_ipv4_prefix24_parse,
+                                        .zone       = RBA_ZONE_UINT,
+                                        .value      = rba_type_ipv4_prefix24_value};
+
+/*  addresses as two uint64_t, the upper 64 bits first, IPv4 addresses are
+    stored IPv4-mapped */
+rba_type_t rba_type_ipv6 =  {   .specname   = "ipv6",
+                                .magic      = 0x0000365650494252,
+                                .size       = 2 * sizeof(uint64_t),
+                                .initbuf    = rba_buf_alloc,
+                                .freebuf    = rba_buf_simple_free,
+                                .parse      = rba_type_ipv6_parse};
+
+/*  int64_t microseconds since the epoch */
+rba_type_t rba_type_timestamp = {   .specname   = "timestamp",
+                                    .magic      = 0x5355454D49544252,
+                                    .size       = sizeof(int64_t),
+                                    .initbuf    = rba_buf_alloc,
+                                    .freebuf    = rba_buf_simple_free,
+                                    .parse      = rba_type_timestamp_parse,
+                                    .zone       = RBA_ZONE_INT,
+                                    .value      = rba_type_timestamp_value};
 
 /*
 rba_type_t rba_type_string =    {   .specname   = "uint8",
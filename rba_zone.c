@@ -0,0 +1,459 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <rba.h>
+
+#define ZONE_MINMAX(ctype, field)                                           \
+    do {                                                                    \
+        const ctype *v = (const ctype*)arr;                                 \
+        ctype lo = v[0], hi = v[0];                                         \
+        for (i = 1; i < count; i++) {                                       \
+            lo = (v[i] < lo) ? v[i] : lo;                                   \
+            hi = (v[i] > hi) ? v[i] : hi;                                   \
+        }                                                                   \
+        entry->min.field = lo;                                              \
+        entry->max.field = hi;                                              \
+    } while (0)
+
+/*  NaNs are counted and left out, no NaN leaves min > max */
+#define ZONE_MINMAX_FLOAT(ctype)                                            \
+    do {                                                                    \
+        const ctype *v = (const ctype*)arr;                                 \
+        double lo = INFINITY, hi = -INFINITY;                               \
+        for (i = 0; i < count; i++) {                                       \
+            if (isnan (v[i])) {                                             \
+                entry->nulls++;                                             \
+            } else {                                                        \
+                lo = ((double)v[i] < lo) ? (double)v[i] : lo;               \
+                hi = ((double)v[i] > hi) ? (double)v[i] : hi;               \
+            }                                                               \
+        }                                                                   \
+        entry->min.f = lo;                                                  \
+        entry->max.f = hi;                                                  \
+    } while (0)
+
+/*  Fill in the zone of the count elements at arr, the records from first
+    on, compared as kind. */
+int
+rba_zone_add (  uint32_t            kind,
+                size_t              elm_sz,
+                const void          *arr,
+                size_t              count,
+                uint64_t            first,
+                rba_zone_entry_t    *entry)
+{
+    int ret = 0;
+
+    size_t i;
+
+    memset (entry, 0, sizeof(rba_zone_entry_t));
+    entry->first = first;
+    entry->records = (uint32_t)count;
+    if (0 == count) {
+        return 0;
+    }
+
+    switch ((kind << 8) | elm_sz) {
+        case ((RBA_ZONE_UINT << 8) | sizeof(uint8_t)):
+            ZONE_MINMAX(uint8_t, u);
+            break;
+        case ((RBA_ZONE_UINT << 8) | sizeof(uint16_t)):
+            ZONE_MINMAX(uint16_t, u);
+            break;
+        case ((RBA_ZONE_UINT << 8) | sizeof(uint32_t)):
+            ZONE_MINMAX(uint32_t, u);
+            break;
+        case ((RBA_ZONE_UINT << 8) | sizeof(uint64_t)):
+            ZONE_MINMAX(uint64_t, u);
+            break;
+        case ((RBA_ZONE_INT << 8) | sizeof(int8_t)):
+            ZONE_MINMAX(int8_t, i);
+            break;
+        case ((RBA_ZONE_INT << 8) | sizeof(int16_t)):
+            ZONE_MINMAX(int16_t, i);
+            break;
+        case ((RBA_ZONE_INT << 8) | sizeof(int32_t)):
+            ZONE_MINMAX(int32_t, i);
+            break;
+        case ((RBA_ZONE_INT << 8) | sizeof(int64_t)):
+            ZONE_MINMAX(int64_t, i);
+            break;
+        case ((RBA_ZONE_FLOAT << 8) | sizeof(float)):
+            ZONE_MINMAX_FLOAT(float);
+            break;
+        case ((RBA_ZONE_FLOAT << 8) | sizeof(double)):
+            ZONE_MINMAX_FLOAT(double);
+            break;
+        default:
+            RBA_ERR("No zone map for kind %u of %lu byte values\n", (unsigned)kind, (unsigned long)elm_sz);
+            ret = -1;
+            break;
+    }
+
+    return ret;
+}
+
+/*  Write the zone map of filename, for typesize byte values of kind */
+int
+rba_zone_write (const char              *filename,
+                uint32_t                kind,
+                uint32_t                typesize,
+                const rba_zone_entry_t  *entries,
+                uint64_t                count)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+    rba_zone_desc_t desc;
+    char *zonename;
+
+    zonename = (char*)malloc (strlen (filename) + sizeof(RBA_ZONE_SUFFIX));
+    if (NULL == zonename) {
+        return -1;
+    }
+    sprintf (zonename, "%s" RBA_ZONE_SUFFIX, filename);
+
+    hdr.rba_header_magic   = RBA_HEADER_MAGIC;
+    hdr.rba_type_magic     = RBA_ZONE_MAGIC;
+    hdr.records            = count;
+    hdr.data_offset        = sizeof(rba_header_t) + sizeof(rba_zone_desc_t);
+    hdr.typesize           = sizeof(rba_zone_entry_t);
+    hdr.rba_header_version = RBA_HEADER_VERSION;
+
+    desc.records = (count > 0) ? entries[count - 1].first + entries[count - 1].records : 0;
+    desc.kind = kind;
+    desc.typesize = typesize;
+
+    filep = fopen (zonename, "wb");
+    if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", zonename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        if ((1 != fwrite (&hdr, sizeof(hdr), 1, filep)) ||
+                (1 != fwrite (&desc, sizeof(desc), 1, filep)) ||
+                ((count > 0) && (count != fwrite (entries, sizeof(rba_zone_entry_t), count, filep)))) {
+            RBA_ERR("Failed to write %llu zones to %s\n", (unsigned long long)count, zonename);
+            ret = -1;
+        } else {
+            ret = 0;
+        }
+        if (0 != fclose (filep)) {
+            ret = -1;
+        }
+    }
+    free (zonename);
+
+    return ret;
+}
+
+/*  Read the zone map of filename into a new array. Returns 1 when there is
+    none. */
+int
+rba_zone_read ( const char          *filename,
+                rba_zone_desc_t     *desc,
+                rba_zone_entry_t    **entries_p,
+                uint64_t            *count_p)
+{
+    int ret;
+
+    FILE *filep;
+    rba_header_t hdr;
+    rba_zone_entry_t *entries = NULL;
+    struct stat st;
+    char *zonename;
+
+    zonename = (char*)malloc (strlen (filename) + sizeof(RBA_ZONE_SUFFIX));
+    if (NULL == zonename) {
+        return -1;
+    }
+    sprintf (zonename, "%s" RBA_ZONE_SUFFIX, filename);
+
+    filep = fopen (zonename, "rb");
+    if ((NULL == filep) && (ENOENT == errno)) {
+        ret = 1;
+    } else if (NULL == filep) {
+        RBA_ERR("Failed to open file %s\n", zonename);
+        RBA_ERRNO();
+        ret = -1;
+    } else {
+        if ((0 != fstat (fileno (filep), &st)) ||
+                (1 != fread (&hdr, sizeof(hdr), 1, filep)) ||
+                (RBA_HEADER_MAGIC != hdr.rba_header_magic) ||
+                (RBA_ZONE_MAGIC != hdr.rba_type_magic) ||
+                (sizeof(rba_zone_entry_t) != hdr.typesize) ||
+                (sizeof(rba_header_t) + sizeof(rba_zone_desc_t) != hdr.data_offset) ||
+                ((uint64_t)st.st_size != hdr.data_offset + hdr.records * sizeof(rba_zone_entry_t)) ||
+                (1 != fread (desc, sizeof(rba_zone_desc_t), 1, filep))) {
+            RBA_ERR("File %s is not a zone map\n", zonename);
+            ret = -1;
+        } else {
+            entries = (rba_zone_entry_t*)malloc ((hdr.records > 0) ? hdr.records * sizeof(rba_zone_entry_t) : 1);
+            if ((NULL == entries) ||
+                    ((hdr.records > 0) && (hdr.records != fread (entries, sizeof(rba_zone_entry_t), hdr.records, filep)))) {
+                RBA_ERR("Failed to read %llu zones from %s\n", (unsigned long long)hdr.records, zonename);
+                free (entries);
+                entries = NULL;
+                ret = -1;
+            } else {
+                ret = 0;
+            }
+        }
+        fclose (filep);
+    }
+    free (zonename);
+
+    *entries_p = entries;
+    *count_p = (0 == ret) ? hdr.records : 0;
+
+    return ret;
+}
+
+/*  Build the zone map of an existing RBA file: one zone per chunk of a
+    packed file, one per RBA_BUF_DEFAULTLEN records of an unpacked one. */
+int
+rba_zone_file ( const char  *filename,
+                uint32_t    kind)
+{
+    int ret;
+
+    rba_packed_file_t pf;
+    rba_zone_entry_t *entries = NULL;
+    uint64_t count = 0, first, n, c;
+    void *arr = NULL;
+    int fd = -1;
+
+    memset (&pf, 0, sizeof(pf));
+    pf.fd = -1;
+    fd = open (filename, O_RDONLY);
+    if ((fd < 0) || (sizeof(rba_header_t) != pread (fd, &(pf.hdr), sizeof(rba_header_t), 0))) {
+        RBA_ERR("Failed to read the header of %s\n", filename);
+        ret = -1;
+    } else if (RBA_HEADER_VERSION_PACKED == pf.hdr.rba_header_version) {
+        ret = rba_packed_open (&pf, filename);
+        if (0 == ret) {
+            arr = malloc (pf.maxchunk * pf.hdr.typesize + 1);
+            entries = (rba_zone_entry_t*)malloc (pf.chunk_count * sizeof(rba_zone_entry_t) + 1);
+            ret = ((NULL == arr) || (NULL == entries)) ? -1 : 0;
+        }
+        for (c = 0; (c < pf.chunk_count) && (0 == ret); c++) {
+            ret = rba_packed_read (&pf, pf.chunks[c].first_record, pf.chunks[c].records, arr);
+            if (0 == ret) {
+                ret = rba_zone_add (kind, pf.hdr.typesize, arr, pf.chunks[c].records,
+                                    pf.chunks[c].first_record, &(entries[count++]));
+            }
+        }
+    } else {
+        count = (pf.hdr.records + RBA_BUF_DEFAULTLEN - 1) / RBA_BUF_DEFAULTLEN;
+        arr = malloc (RBA_BUF_DEFAULTLEN * pf.hdr.typesize + 1);
+        entries = (rba_zone_entry_t*)malloc (count * sizeof(rba_zone_entry_t) + 1);
+        ret = ((NULL == arr) || (NULL == entries)) ? -1 : 0;
+        for (c = 0; (c < count) && (0 == ret); c++) {
+            first = c * RBA_BUF_DEFAULTLEN;
+            n = (pf.hdr.records - first < RBA_BUF_DEFAULTLEN) ? pf.hdr.records - first : RBA_BUF_DEFAULTLEN;
+            if ((ssize_t)(n * pf.hdr.typesize) != pread (fd, arr, n * pf.hdr.typesize, pf.hdr.data_offset + first * pf.hdr.typesize)) {
+                RBA_ERR("Failed to read %llu records of %s\n", (unsigned long long)n, filename);
+                ret = -1;
+            } else {
+                ret = rba_zone_add (kind, pf.hdr.typesize, arr, n, first, &(entries[c]));
+            }
+        }
+    }
+
+    if (0 == ret) {
+        ret = rba_zone_write (filename, kind, pf.hdr.typesize, entries, count);
+    }
+
+    if (pf.fd >= 0) {
+        rba_packed_close (&pf);
+    }
+    if (fd >= 0) {
+        close (fd);
+    }
+    free (arr);
+    free (entries);
+
+    return ret;
+}
+
+/*  Rebuild the zone map of a rewritten file, if it has one */
+int
+rba_zone_refresh (const char *filename)
+{
+    int ret;
+
+    rba_zone_desc_t desc;
+    rba_zone_entry_t *entries;
+    uint64_t count;
+
+    ret = rba_zone_read (filename, &desc, &entries, &count);
+    free (entries);
+    if (0 == ret) {
+        ret = rba_zone_file (filename, desc.kind);
+    } else if (1 == ret) {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*  whether a zone may hold values in [pred->min, pred->max] */
+static int
+zone_match (const rba_zone_entry_t  *zone,
+            uint32_t                kind,
+            const rba_predicate_t   *pred)
+{
+    switch (kind) {
+        case RBA_ZONE_UINT:
+            return (zone->max.u >= pred->min.u) && (zone->min.u <= pred->max.u);
+        case RBA_ZONE_INT:
+            return (zone->max.i >= pred->min.i) && (zone->min.i <= pred->max.i);
+        default:
+            return (zone->max.f >= pred->min.f) && (zone->min.f <= pred->max.f);
+    }
+}
+
+/*  intersect the sorted, disjoint ranges a and b into out */
+static uint64_t
+intersect_ranges (  const rba_range_t   *a,
+                    uint64_t            na,
+                    const rba_range_t   *b,
+                    uint64_t            nb,
+                    rba_range_t         *out)
+{
+    uint64_t ia = 0, ib = 0, n = 0, lo, hi;
+
+    while ((ia < na) && (ib < nb)) {
+        lo = (a[ia].first > b[ib].first) ? a[ia].first : b[ib].first;
+        hi = (a[ia].first + a[ia].records < b[ib].first + b[ib].records) ?
+                a[ia].first + a[ia].records : b[ib].first + b[ib].records;
+        if (lo < hi) {
+            out[n].first = lo;
+            out[n].records = hi - lo;
+            n++;
+        }
+        if (a[ia].first + a[ia].records == hi) {
+            ia++;
+        } else {
+            ib++;
+        }
+    }
+
+    return n;
+}
+
+/*  The record ranges of the partition of reader that may hold rows matching
+    all n predicates, sorted and merged where they touch, in a buffer for the
+    caller to free. Every predicate column needs a zone map. Only the zone
+    maps are read, the candidate ranges can then be read with
+    rba_column_view, rba_packed_read or rba_gather. */
+int
+rba_zone_ranges (   rba_reader_t            *reader,
+                    const rba_predicate_t   *preds,
+                    uint32_t                n,
+                    rba_range_t             **ranges_p,
+                    uint64_t                *count_p)
+{
+    int ret = 0;
+
+    rba_zone_desc_t desc;
+    rba_zone_entry_t *zones;
+    rba_range_t *ranges = NULL, *cand, *both;
+    uint64_t count = 0, zcount, z, c;
+    uint32_t p;
+    char filename[strlen(reader->partpath) + sizeof("/c00000000.bin")];
+
+    for (p = 0; (p < n) && (0 == ret); p++) {
+
+        if (preds[p].col >= reader->cols) {
+            RBA_ERR("Predicate on column %u of %u\n", (unsigned)preds[p].col, (unsigned)reader->cols);
+            ret = -1;
+            break;
+        }
+        snprintf (filename, sizeof(filename), "%s/c%08X.bin", reader->partpath, preds[p].col);
+        ret = rba_zone_read (filename, &desc, &zones, &zcount);
+        if (1 == ret) {
+            RBA_ERR("Column file %s has no zone map\n", filename);
+            ret = -1;
+        }
+        if (0 != ret) {
+            break;
+        }
+
+        /*  the zones that may match, merged where they touch */
+        cand = (rba_range_t*)malloc (zcount * sizeof(rba_range_t) + 1);
+        if (NULL == cand) {
+            ret = -1;
+        }
+        for (z = 0, c = 0; (z < zcount) && (0 == ret); z++) {
+            if ((zones[z].records == zones[z].nulls) || !zone_match (&(zones[z]), desc.kind, &(preds[p]))) {
+                continue;
+            }
+            if ((c > 0) && (cand[c - 1].first + cand[c - 1].records == zones[z].first)) {
+                cand[c - 1].records += zones[z].records;
+            } else {
+                cand[c].first = zones[z].first;
+                cand[c].records = zones[z].records;
+                c++;
+            }
+        }
+        free (zones);
+
+        if ((0 == ret) && (0 == p)) {
+            ranges = cand;
+            count = c;
+        } else if (0 == ret) {
+            both = (rba_range_t*)malloc ((count + c) * sizeof(rba_range_t) + 1);
+            if (NULL == both) {
+                ret = -1;
+            } else {
+                count = intersect_ranges (ranges, count, cand, c, both);
+                free (ranges);
+                ranges = both;
+            }
+            free (cand);
+        }
+    }
+
+    if (0 == ret) {
+        *ranges_p = ranges;
+        *count_p = count;
+    } else {
+        free (ranges);
+    }
+
+    return ret;
+}
@@ -0,0 +1,120 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*  Concatenate RBA data sets, or single RBA files, of the same spec, for
+    data sets converted on different days.
+
+    rbamerge <dst> <src1> <src2> [...]
+
+    With directories, every partition p%08X of dst gets the records of the
+    same partition of src1, src2 and so on, in that order. The sources must
+    have the same number of partitions and the same files in each. The data
+    is moved with copy_file_range and FICLONERANGE, so on XFS or btrfs the
+    merge shares the blocks of the sources instead of copying them. */
+
+#include <time.h>
+#include <sys/stat.h>
+
+#include <rba.h>
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*  the number of partition directories p00000000, p00000001, ... */
+static uint32_t
+count_partitions (const char *dirpath)
+{
+    struct stat st;
+    char path[4096];
+    uint32_t p;
+
+    for (p = 0; p < UINT32_MAX; p++) {
+        snprintf (path, sizeof(path), "%s/p%08X", dirpath, p);
+        if ((0 != stat (path, &st)) || !S_ISDIR(st.st_mode)) {
+            break;
+        }
+    }
+
+    return p;
+}
+
+int main (int argc, char **argv)
+{
+    int ret = 0;
+
+    struct stat st;
+    uint32_t partitions;
+    int i;
+    double start;
+
+    if (argc < 4) {
+        fprintf (stderr, "%s <dst> <src1> <src2> [...]\n", argv[0]);
+        return -1;
+    }
+
+    start = now ();
+    if (0 != stat (argv[2], &st)) {
+        RBA_ERR("Failed to stat %s\n", argv[2]);
+        RBA_ERRNO();
+        ret = -1;
+    } else if (S_ISDIR(st.st_mode)) {
+        partitions = count_partitions (argv[2]);
+        for (i = 3; (i < argc) && (0 == ret); i++) {
+            if (partitions != count_partitions (argv[i])) {
+                RBA_ERR("%s and %s have different numbers of partitions\n", argv[2], argv[i]);
+                ret = -1;
+            }
+        }
+        if ((0 == ret) && (0 == partitions)) {
+            RBA_ERR("No partitions in %s\n", argv[2]);
+            ret = -1;
+        }
+        if (0 == ret) {
+            ret = rba_merge_dataset (argv[1], (const char**)(argv + 2), (uint32_t)(argc - 2), partitions);
+        }
+    } else {
+        ret = rba_merge_file (argv[1], (const char**)(argv + 2), (uint32_t)(argc - 2));
+    }
+
+    if (0 == ret) {
+        printf ("Merged %d sources into %s in %.2f s\n", argc - 2, argv[1], now () - start);
+    } else {
+        fprintf (stderr, "ERROR: failed to merge into %s\n", argv[1]);
+    }
+
+    return ret;
+}
@@ -0,0 +1,262 @@
+/*
+    Copyright 2023 Safayet N Ahmed
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1.  Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+    2.  Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+    3.  Neither the name of the copyright holder nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*  Verify an RBA data set after copying it: the header of every file
+    against its size or chunk index and, for files written with -K, the
+    CRC32C of every byte range in its .crc sidecar.
+
+    rbaverify [-j <threads>] [-c] [-w] <dirpath>
+
+    Files are verified by <threads> threads (default: online CPUs). -c fails
+    files without a sidecar, -w writes the missing sidecars instead, for data
+    sets converted without -K. */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <rba.h>
+
+typedef struct {
+    char                **files;
+    uint64_t            count;
+    uint64_t            next;
+    uint64_t            bytes;
+    uint64_t            unchecked;
+    uint64_t            failed;
+    int                 require;
+    int                 write;
+    pthread_mutex_t     lock;
+} verify_work_t;
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static int
+add_file (  verify_work_t   *work,
+            const char      *path,
+            uint64_t        *cap_p)
+{
+    char **files;
+
+    if (work->count == *cap_p) {
+        *cap_p = (*cap_p > 0) ? 2 * *cap_p : 1024;
+        files = (char**)realloc (work->files, *cap_p * sizeof(char*));
+        if (NULL == files) {
+            return -1;
+        }
+        work->files = files;
+    }
+    work->files[work->count] = strdup (path);
+    return (NULL == work->files[work->count++]) ? -1 : 0;
+}
+
+/*  collect the .bin files of the partition directories p%08X */
+static int
+list_files (const char      *dirpath,
+            verify_work_t   *work)
+{
+    int ret = 0;
+
+    DIR *dir, *partdir;
+    struct dirent *part, *entry;
+    char path[4096];
+    size_t len;
+    uint64_t cap = 0;
+
+    dir = opendir (dirpath);
+    if (NULL == dir) {
+        RBA_ERR("Failed to open directory %s\n", dirpath);
+        RBA_ERRNO();
+        return -1;
+    }
+
+    while ((0 == ret) && (NULL != (part = readdir (dir)))) {
+        if (('p' != part->d_name[0]) || (9 != strlen (part->d_name))) {
+            continue;
+        }
+        snprintf (path, sizeof(path), "%s/%s", dirpath, part->d_name);
+        partdir = opendir (path);
+        if (NULL == partdir) {
+            continue;
+        }
+        while ((0 == ret) && (NULL != (entry = readdir (partdir)))) {
+            len = strlen (entry->d_name);
+            if ((len > 4) && (0 == strcmp (entry->d_name + len - 4, ".bin"))) {
+                snprintf (path, sizeof(path), "%s/%s/%s", dirpath, part->d_name, entry->d_name);
+                ret = add_file (work, path, &cap);
+            }
+        }
+        closedir (partdir);
+    }
+    closedir (dir);
+
+    return ret;
+}
+
+static void*
+verify_worker (void *arg)
+{
+    verify_work_t *work = (verify_work_t*)arg;
+    struct stat st;
+    const char *filename;
+    uint64_t i;
+    int ret, checked;
+
+    for (;;) {
+        pthread_mutex_lock (&(work->lock));
+        i = work->next++;
+        pthread_mutex_unlock (&(work->lock));
+        if (i >= work->count) {
+            break;
+        }
+
+        /*  columns that are not stored leave an empty file */
+        filename = work->files[i];
+        if (0 != stat (filename, &st)) {
+            RBA_ERR("Failed to stat %s\n", filename);
+            ret = -1;
+        } else if (0 == st.st_size) {
+            continue;
+        } else {
+            ret = rba_verify_file (filename, &checked);
+        }
+        if ((0 == ret) && !checked && work->write) {
+            ret = rba_crc_file (filename);
+            checked = (0 == ret);
+        }
+        if ((0 == ret) && !checked && work->require) {
+            RBA_ERR("File %s has no checksums\n", filename);
+            ret = -1;
+        }
+
+        pthread_mutex_lock (&(work->lock));
+        if (0 != ret) {
+            work->failed++;
+        } else if (!checked) {
+            work->unchecked++;
+        }
+        work->bytes += (uint64_t)st.st_size;
+        pthread_mutex_unlock (&(work->lock));
+    }
+
+    return NULL;
+}
+
+int main (int argc, char **argv)
+{
+    int ret = 0;
+
+    verify_work_t work;
+    pthread_t *workers;
+    uint64_t threads, t, started;
+    double start, elapsed;
+    int opt;
+
+    memset (&work, 0, sizeof(work));
+    threads = (uint64_t)sysconf (_SC_NPROCESSORS_ONLN);
+    while ((0 == ret) && (-1 != (opt = getopt (argc, argv, "j:cw")))) {
+        switch (opt) {
+            case 'j':
+                ret = strtouint64 (optarg, &threads);
+                if ((0 == ret) && ((0 == threads) || (threads > 1024))) {
+                    ret = -1;
+                }
+                break;
+            case 'c':
+                work.require = 1;
+                break;
+            case 'w':
+                work.write = 1;
+                break;
+            default:
+                ret = -1;
+                break;
+        }
+    }
+
+    if ((0 != ret) || (argc - optind != 1)) {
+        fprintf (stderr, "%s [-j <threads>] [-c] [-w] <dirpath>\n", argv[0]);
+        return -1;
+    }
+
+    start = now ();
+    ret = list_files (argv[optind], &work);
+    if ((0 == ret) && (0 == work.count)) {
+        fprintf (stderr, "ERROR: no RBA files under %s\n", argv[optind]);
+        ret = -1;
+    }
+
+    if (0 == ret) {
+        pthread_mutex_init (&(work.lock), NULL);
+        threads = (threads > work.count) ? work.count : threads;
+        workers = (pthread_t*)malloc (threads * sizeof(pthread_t));
+        started = 0;
+        for (t = 0; (NULL != workers) && (t < threads); t++) {
+            if (0 == pthread_create (&(workers[t]), NULL, verify_worker, &work)) {
+                started++;
+            }
+        }
+        if (0 == started) {
+            verify_worker (&work);
+        }
+        for (t = 0; t < started; t++) {
+            pthread_join (workers[t], NULL);
+        }
+        free (workers);
+        pthread_mutex_destroy (&(work.lock));
+
+        elapsed = now () - start;
+        printf ("%llu files, %.1f MB in %.2f s (%.0f MB/s), %llu without checksums, %llu failed\n",
+                (unsigned long long)work.count,
+                (double)work.bytes / 1e6,
+                elapsed,
+                (double)work.bytes / 1e6 / elapsed,
+                (unsigned long long)work.unchecked,
+                (unsigned long long)work.failed);
+        ret = (0 == work.failed) ? 0 : -1;
+    }
+
+    for (t = 0; t < work.count; t++) {
+        free (work.files[t]);
+    }
+    free (work.files);
+
+    return ret;
+}